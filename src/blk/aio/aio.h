@@ -17,6 +17,7 @@
 
 #include "include/buffer.h"
 #include "include/types.h"
+#include "common/ceph_time.h"
 
 struct aio_t {
 #if defined(HAVE_LIBAIO)
@@ -35,6 +36,7 @@ struct aio_t {
   uint64_t offset, length;
   long rval;
   ceph::buffer::list bl;  ///< write payload (so that it remains stable for duration)
+  ceph::mono_time submit_stamp;  ///< when handed to the io queue
 
   boost::intrusive::list_member_hook<> queue_item;
 
@@ -103,6 +105,18 @@ struct io_queue_t {
   virtual int submit_batch(aio_iter begin, aio_iter end, uint16_t aios_size,
 			   void *priv, int *retries) = 0;
   virtual int get_next_completed(int timeout_ms, aio_t **paio, int max) = 0;
+
+  /// allocate an io buffer registered with the queue, if it has any left.
+  /// ios whose single iovec lies in such a buffer skip per-io page pinning.
+  virtual ceph::unique_leakable_ptr<ceph::buffer::raw>
+  create_fixed_buffer(size_t len) {
+    return nullptr;
+  }
+  /// register the buffers create_fixed_buffer() hands out, after init().
+  /// on failure the queue still works, just without them.
+  virtual int init_fixed_buffers() {
+    return -EOPNOTSUPP;
+  }
 };
 
 struct aio_queue_t final : public io_queue_t {
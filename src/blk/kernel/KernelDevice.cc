@@ -80,7 +80,11 @@ KernelDevice::KernelDevice(CephContext* cct, aio_callback_t cb, void *cbpriv, ai
   if (use_ioring && ioring_queue_t::supported()) {
     bool use_ioring_hipri = cct->_conf.get_val<bool>("bdev_ioring_hipri");
     bool use_ioring_sqthread_poll = cct->_conf.get_val<bool>("bdev_ioring_sqthread_poll");
-    io_queue = std::make_unique<ioring_queue_t>(iodepth, use_ioring_hipri, use_ioring_sqthread_poll);
+    auto fixed_buffers = cct->_conf.get_val<uint64_t>("bdev_ioring_fixed_buffers");
+    auto fixed_buffer_size = cct->_conf.get_val<Option::size_t>("bdev_ioring_fixed_buffer_size");
+    io_queue = std::make_unique<ioring_queue_t>(iodepth, use_ioring_hipri,
+      use_ioring_sqthread_poll, fixed_buffers, fixed_buffer_size);
+    use_fixed_buffers = fixed_buffers > 0;
   } else {
     static bool once;
     if (use_ioring && !once) {
@@ -514,6 +518,19 @@ int KernelDevice::_aio_start()
       }
       return r;
     }
+    if (use_fixed_buffers) {
+      r = io_queue->init_fixed_buffers();
+      if (r < 0) {
+	// not fatal: reads simply go through regular buffers
+	derr << __func__ << " registering io_uring fixed buffers failed: "
+	     << cpp_strerror(r)
+	     << (r == -ENOMEM ? "; check RLIMIT_MEMLOCK" : "") << dendl;
+	use_fixed_buffers = false;
+      } else {
+	dout(1) << __func__ << " registered io_uring fixed buffers" << dendl;
+      }
+    }
+    _init_logger();
     aio_thread.create("bstore_aio");
   }
   return 0;
@@ -527,9 +544,40 @@ void KernelDevice::_aio_stop()
     aio_thread.join();
     aio_stop = false;
     io_queue->shutdown();
+    _shutdown_logger();
   }
 }
 
+void KernelDevice::_init_logger()
+{
+  auto name = path.substr(path.find_last_of('/') + 1);
+  PerfCountersBuilder b(cct, "bdev-" + name, l_bdev_first, l_bdev_last);
+  b.add_u64_counter(l_bdev_aio_submitted, "aio_submitted",
+		    "Aios submitted to the io queue");
+  b.add_u64_avg(l_bdev_aio_submit_batch, "aio_submit_batch",
+		"Average number of aios per submission");
+  b.add_u64(l_bdev_aio_inflight, "aio_inflight",
+	    "Aios submitted but not yet reaped (queue depth)");
+  b.add_u64_avg(l_bdev_aio_reap_batch, "aio_reap_batch",
+		"Average number of aios reaped per completion poll");
+  b.add_time_avg(l_bdev_aio_lat, "aio_lat",
+		 "Average aio latency from submission to reaping");
+  b.add_u64_counter(l_bdev_read_fixed_buffers, "read_fixed_buffers",
+		    "Aio reads into io_uring registered buffers");
+  b.add_u64_counter(l_bdev_read_fixed_buffer_misses,
+		    "read_fixed_buffer_misses",
+		    "Aio reads that found no registered buffer available");
+  logger = b.create_perf_counters();
+  cct->get_perfcounters_collection()->add(logger);
+}
+
+void KernelDevice::_shutdown_logger()
+{
+  cct->get_perfcounters_collection()->remove(logger);
+  delete logger;
+  logger = nullptr;
+}
+
 void KernelDevice::_discard_start()
 {
     discard_thread.create("bstore_discard");
@@ -593,8 +641,12 @@ void KernelDevice::_aio_thread()
     }
     if (r > 0) {
       dout(30) << __func__ << " got " << r << " completed aios" << dendl;
+      auto now = mono_clock::now();
+      logger->inc(l_bdev_aio_reap_batch, r);
+      logger->dec(l_bdev_aio_inflight, r);
       for (int i = 0; i < r; ++i) {
 	IOContext *ioc = static_cast<IOContext*>(aio[i]->priv);
+	logger->tinc(l_bdev_aio_lat, now - aio[i]->submit_stamp);
 	_aio_log_finish(ioc, aio[i]->offset, aio[i]->length);
 	if (aio[i]->queue_item.is_linked()) {
 	  std::lock_guard l(debug_queue_lock);
@@ -855,6 +907,10 @@ void KernelDevice::aio_submit(IOContext *ioc)
   ceph_assert(ioc->num_pending.load() == 0);  // we should be only thread doing this
   ceph_assert(ioc->pending_aios.size() == 0);
 
+  auto now = mono_clock::now();
+  for (auto p = ioc->running_aios.begin(); p != e; ++p) {
+    p->submit_stamp = now;
+  }
   if (cct->_conf->bdev_debug_aio) {
     list<aio_t>::iterator p = ioc->running_aios.begin();
     while (p != e) {
@@ -863,6 +919,9 @@ void KernelDevice::aio_submit(IOContext *ioc)
       debug_aio_link(*p++);
     }
   }
+  logger->inc(l_bdev_aio_submitted, pending);
+  logger->inc(l_bdev_aio_submit_batch, pending);
+  logger->inc(l_bdev_aio_inflight, pending);
 
   void *priv = static_cast<void*>(ioc);
   int r, retries = 0;
@@ -1306,8 +1365,18 @@ int KernelDevice::aio_read(
     ioc->pending_aios.push_back(aio_t(ioc, fd_directs[WRITE_LIFE_NOT_SET]));
     ++ioc->num_pending;
     aio_t& aio = ioc->pending_aios.back();
-    aio.bl.push_back(
-      ceph::buffer::ptr_node::create(create_custom_aligned(len, ioc)));
+    auto raw = use_fixed_buffers ? io_queue->create_fixed_buffer(len) : nullptr;
+    if (raw) {
+      // registered buffers are few; don't let the cache pin them
+      ioc->flags |= IOContext::FLAG_DONT_CACHE;
+      logger->inc(l_bdev_read_fixed_buffers);
+    } else {
+      if (use_fixed_buffers) {
+	logger->inc(l_bdev_read_fixed_buffer_misses);
+      }
+      raw = create_custom_aligned(len, ioc);
+    }
+    aio.bl.push_back(ceph::buffer::ptr_node::create(std::move(raw)));
     aio.bl.prepare_iov(&aio.iov);
     aio.preadv(off, len);
     dout(30) << aio << dendl;
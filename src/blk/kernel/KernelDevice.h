@@ -20,6 +20,7 @@
 #include "include/types.h"
 #include "include/interval_set.h"
 #include "common/Thread.h"
+#include "common/perf_counters.h"
 #include "include/utime.h"
 
 #include "aio/aio.h"
@@ -28,6 +29,18 @@
 
 #define RW_IO_MAX (INT_MAX & CEPH_PAGE_MASK)
 
+enum {
+  l_bdev_first = 733000,
+  l_bdev_aio_submitted,
+  l_bdev_aio_submit_batch,
+  l_bdev_aio_inflight,
+  l_bdev_aio_reap_batch,
+  l_bdev_aio_lat,
+  l_bdev_read_fixed_buffers,
+  l_bdev_read_fixed_buffer_misses,
+  l_bdev_last
+};
+
 class KernelDevice : public BlockDevice {
 protected:
   std::string path;
@@ -47,6 +60,8 @@ private:
   ceph::mutex flush_mutex = ceph::make_mutex("KernelDevice::flush_mutex");
 
   std::unique_ptr<io_queue_t> io_queue;
+  bool use_fixed_buffers = false; ///< io_queue has registered read buffers
+  PerfCounters *logger = nullptr; ///< io queue stats, while aio is running
   aio_callback_t discard_callback;
   void *discard_callback_priv;
   bool aio_stop;
@@ -90,6 +105,9 @@ private:
   int _aio_start();
   void _aio_stop();
 
+  void _init_logger();
+  void _shutdown_logger();
+
   void _discard_start();
   void _discard_stop();
 
@@ -7,16 +7,89 @@
 
 #include "liburing.h"
 #include <sys/epoll.h>
+#include <sys/mman.h>
+
+#include "include/buffer_raw.h"
+#include "include/intarith.h"
+#include "include/page.h"
+#include "common/ceph_mutex.h"
 
 using std::list;
 using std::make_unique;
 
+/*
+ * Equally sized buffers carved out of one arena, which is registered with
+ * the ring as a single iovec (buf_index 0).  The arena is unmapped only
+ * after the ring is gone and the last buffer handed out is released.
+ */
+struct ioring_fixed_pool {
+  char *arena = nullptr;
+  size_t arena_len = 0;
+  size_t buffer_size = 0;
+  ceph::mutex lock = ceph::make_mutex("ioring_fixed_pool::lock");
+  std::vector<unsigned> free_bufs;
+
+  ioring_fixed_pool(unsigned count, size_t size)
+    : arena_len(count * size), buffer_size(size) {
+    void *p = ::mmap(nullptr, arena_len, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (p == MAP_FAILED) {
+      arena_len = 0;
+      return;
+    }
+    arena = static_cast<char*>(p);
+    free_bufs.reserve(count);
+    for (unsigned i = count; i > 0; --i) {
+      free_bufs.push_back(i - 1);
+    }
+  }
+  ~ioring_fixed_pool() {
+    if (arena) {
+      ::munmap(arena, arena_len);
+    }
+  }
+
+  bool contains(const void *p, size_t len) const {
+    auto c = static_cast<const char*>(p);
+    return c >= arena && c + len <= arena + arena_len;
+  }
+  int get() {
+    std::lock_guard l(lock);
+    if (free_bufs.empty()) {
+      return -1;
+    }
+    int idx = free_bufs.back();
+    free_bufs.pop_back();
+    return idx;
+  }
+  void put(unsigned idx) {
+    std::lock_guard l(lock);
+    free_bufs.push_back(idx);
+  }
+};
+
+struct ioring_fixed_raw : public ceph::buffer::raw {
+  std::shared_ptr<ioring_fixed_pool> pool;
+  const unsigned idx;
+
+  ioring_fixed_raw(std::shared_ptr<ioring_fixed_pool> p, unsigned i,
+		   unsigned len)
+    : raw(p->arena + i * p->buffer_size, len),
+      pool(std::move(p)),
+      idx(i) {
+  }
+  ~ioring_fixed_raw() override {
+    pool->put(idx);
+  }
+};
+
 struct ioring_data {
   struct io_uring io_uring;
   pthread_mutex_t cq_mutex;
   pthread_mutex_t sq_mutex;
   int epoll_fd = -1;
   std::map<int, int> fixed_fds_map;
+  std::shared_ptr<ioring_fixed_pool> fixed_pool; ///< registered, if any
 };
 
 static int ioring_get_cqe(struct ioring_data *d, unsigned int max,
@@ -57,13 +130,25 @@ static void init_sqe(struct ioring_data *d, struct io_uring_sqe *sqe,
 
   ceph_assert(fixed_fd != -1);
 
-  if (io->iocb.aio_lio_opcode == IO_CMD_PWRITEV)
-    io_uring_prep_writev(sqe, fixed_fd, &io->iov[0],
-			 io->iov.size(), io->offset);
-  else if (io->iocb.aio_lio_opcode == IO_CMD_PREADV)
-    io_uring_prep_readv(sqe, fixed_fd, &io->iov[0],
-			io->iov.size(), io->offset);
-  else
+  // a single segment in the registered arena needs no page pinning
+  bool fixed_buf = d->fixed_pool && io->iov.size() == 1 &&
+    d->fixed_pool->contains(io->iov[0].iov_base, io->iov[0].iov_len);
+
+  if (io->iocb.aio_lio_opcode == IO_CMD_PWRITEV) {
+    if (fixed_buf)
+      io_uring_prep_write_fixed(sqe, fixed_fd, io->iov[0].iov_base,
+				io->iov[0].iov_len, io->offset, 0);
+    else
+      io_uring_prep_writev(sqe, fixed_fd, &io->iov[0],
+			   io->iov.size(), io->offset);
+  } else if (io->iocb.aio_lio_opcode == IO_CMD_PREADV) {
+    if (fixed_buf)
+      io_uring_prep_read_fixed(sqe, fixed_fd, io->iov[0].iov_base,
+			       io->iov[0].iov_len, io->offset, 0);
+    else
+      io_uring_prep_readv(sqe, fixed_fd, &io->iov[0],
+			  io->iov.size(), io->offset);
+  } else
     ceph_assert(0);
 
   io_uring_sqe_set_data(sqe, io);
@@ -106,11 +191,34 @@ static void build_fixed_fds_map(struct ioring_data *d,
   }
 }
 
-ioring_queue_t::ioring_queue_t(unsigned iodepth_, bool hipri_, bool sq_thread_) :
+static int register_fixed_pool(struct ioring_data *d, unsigned count,
+			       size_t size)
+{
+  // a registered buffer (the whole arena here) is limited to 1 GiB
+  count = std::min<size_t>(count, (1ull << 30) / size);
+  auto pool = std::make_shared<ioring_fixed_pool>(count, size);
+  if (!pool->arena)
+    return -ENOMEM;
+
+  struct iovec iov = { pool->arena, pool->arena_len };
+  int ret = io_uring_register_buffers(&d->io_uring, &iov, 1);
+  if (ret < 0)
+    return ret;
+
+  d->fixed_pool = std::move(pool);
+  return 0;
+}
+
+ioring_queue_t::ioring_queue_t(unsigned iodepth_, bool hipri_, bool sq_thread_,
+			       unsigned fixed_buffers_,
+			       size_t fixed_buffer_size_) :
   d(make_unique<ioring_data>()),
   iodepth(iodepth_),
   hipri(hipri_),
-  sq_thread(sq_thread_)
+  sq_thread(sq_thread_),
+  fixed_buffers(fixed_buffers_),
+  // every buffer in the arena must stay aligned for O_DIRECT
+  fixed_buffer_size(p2roundup<size_t>(fixed_buffer_size_, CEPH_PAGE_SIZE))
 {
 }
 
@@ -170,6 +278,8 @@ close_ring_fd:
 void ioring_queue_t::shutdown()
 {
   d->fixed_fds_map.clear();
+  // buffers still referenced keep the arena itself alive
+  d->fixed_pool.reset();
   close(d->epoll_fd);
   d->epoll_fd = -1;
   io_uring_queue_exit(&d->io_uring);
@@ -189,8 +299,36 @@ int ioring_queue_t::submit_batch(aio_iter beg, aio_iter end,
   return rc;
 }
 
+static int ioring_poll_cqe(struct ioring_data *d, int timeout_ms,
+			   struct aio_t **paio, int max)
+{
+  // IOPOLL rings never signal the ring fd; completions are found by
+  // polling the device from io_uring_enter(GETEVENTS), which is what
+  // io_uring_peek_cqe() does when the cq is empty.
+  auto deadline = ceph::mono_clock::now() +
+    std::chrono::milliseconds(timeout_ms);
+  do {
+    struct io_uring_cqe *cqe;
+    pthread_mutex_lock(&d->cq_mutex);
+    int events = 0;
+    int ret = io_uring_peek_cqe(&d->io_uring, &cqe);
+    if (ret == 0)
+      events = ioring_get_cqe(d, max, paio);
+    else if (ret != -EAGAIN)
+      events = ret;
+    pthread_mutex_unlock(&d->cq_mutex);
+    if (events)
+      return events;
+  } while (ceph::mono_clock::now() < deadline);
+
+  return 0;
+}
+
 int ioring_queue_t::get_next_completed(int timeout_ms, aio_t **paio, int max)
 {
+  if (hipri)
+    return ioring_poll_cqe(d.get(), timeout_ms, paio, max);
+
 get_cqe:
   pthread_mutex_lock(&d->cq_mutex);
   int events = ioring_get_cqe(d.get(), max, paio);
@@ -209,6 +347,28 @@ get_cqe:
   return events;
 }
 
+ceph::unique_leakable_ptr<ceph::buffer::raw>
+ioring_queue_t::create_fixed_buffer(size_t len)
+{
+  auto& pool = d->fixed_pool;
+  if (!pool || len == 0 || len > pool->buffer_size)
+    return nullptr;
+
+  int idx = pool->get();
+  if (idx < 0)
+    return nullptr;
+
+  return ceph::unique_leakable_ptr<ceph::buffer::raw>(
+    new ioring_fixed_raw(pool, idx, len));
+}
+
+int ioring_queue_t::init_fixed_buffers()
+{
+  if (!fixed_buffers || !fixed_buffer_size)
+    return 0;
+  return register_fixed_pool(d.get(), fixed_buffers, fixed_buffer_size);
+}
+
 bool ioring_queue_t::supported()
 {
   struct io_uring ring;
@@ -224,7 +384,9 @@ bool ioring_queue_t::supported()
 
 struct ioring_data {};
 
-ioring_queue_t::ioring_queue_t(unsigned iodepth_, bool hipri_, bool sq_thread_)
+ioring_queue_t::ioring_queue_t(unsigned iodepth_, bool hipri_, bool sq_thread_,
+			       unsigned fixed_buffers_,
+			       size_t fixed_buffer_size_)
 {
   ceph_assert(0);
 }
@@ -256,6 +418,17 @@ int ioring_queue_t::get_next_completed(int timeout_ms, aio_t **paio, int max)
   ceph_assert(0);
 }
 
+ceph::unique_leakable_ptr<ceph::buffer::raw>
+ioring_queue_t::create_fixed_buffer(size_t len)
+{
+  ceph_assert(0);
+}
+
+int ioring_queue_t::init_fixed_buffers()
+{
+  ceph_assert(0);
+}
+
 bool ioring_queue_t::supported()
 {
   return false;
@@ -23,10 +23,12 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <chrono>
 #include <fstream>
 #include <functional>
 #include <map>
+#include <memory>
 #include <thread>
 #include <boost/intrusive/slist.hpp>
 
@@ -73,6 +75,7 @@ struct data_cache_buf : public bi::slist_base_hook<bi::link_mode<bi::normal_link
 {};
 
 struct Task;
+class SharedDriverQueueData;
 
 class SharedDriverData {
   unsigned id;
@@ -83,6 +86,20 @@ class SharedDriverData {
   uint64_t size = 0;
   std::thread admin_thread;
 
+  /*
+   * I/O queue pairs. A thread submitting I/O claims one of them on first
+   * use and keeps it until it exits, so that submission and completion
+   * polling from e.g. an OSD shard thread don't need any locking. Threads
+   * that come after all bluestore_spdk_max_io_queues queues are claimed
+   * share a single queue under shared_queue_lock.
+   */
+  ceph::mutex queue_lock = ceph::make_mutex("SharedDriverData::queue_lock");
+  std::vector<std::unique_ptr<SharedDriverQueueData>> queues;
+  std::vector<SharedDriverQueueData*> free_queues;
+  ceph::mutex shared_queue_lock =
+    ceph::make_mutex("SharedDriverData::shared_queue_lock");
+  std::unique_ptr<SharedDriverQueueData> shared_queue;
+
   public:
   std::vector<NVMEDevice*> registered_devices;
   friend class SharedDriverQueueData;
@@ -114,11 +131,7 @@ class SharedDriverData {
   bool is_equal(const spdk_nvme_transport_id& trid2) const {
     return spdk_nvme_transport_id_compare(&trid, &trid2) == 0;
   }
-  ~SharedDriverData() {
-    if (admin_thread.joinable()) {
-      admin_thread.join();
-    }
-  }
+  ~SharedDriverData();
 
   void register_device(NVMEDevice *device) {
     registered_devices.push_back(device);
@@ -139,6 +152,10 @@ class SharedDriverData {
   uint64_t get_size() {
     return size;
   }
+
+  SharedDriverQueueData *get_queue(NVMEDevice *device);
+  void put_queue(SharedDriverQueueData *queue);
+  void submit(NVMEDevice *device, Task *t, IOContext *ioc);
 };
 
 class SharedDriverQueueData {
@@ -193,6 +210,13 @@ class SharedDriverQueueData {
   }
 };
 
+SharedDriverData::~SharedDriverData()
+{
+  if (admin_thread.joinable()) {
+    admin_thread.join();
+  }
+}
+
 struct Task {
   NVMEDevice *device;
   IOContext *ctx = nullptr;
@@ -440,6 +464,67 @@ void SharedDriverQueueData::_aio_handle(Task *t, IOContext *ioc)
 #undef dout_prefix
 #define dout_prefix *_dout << "bdev "
 
+// queues claimed by the current thread, returned to their driver on exit
+struct ThreadQueues {
+  std::vector<std::pair<SharedDriverData*, SharedDriverQueueData*>> queues;
+  ~ThreadQueues() {
+    for (auto& [driver, queue] : queues) {
+      if (queue) {
+        driver->put_queue(queue);
+      }
+    }
+  }
+};
+static thread_local ThreadQueues thread_queues;
+
+SharedDriverQueueData *SharedDriverData::get_queue(NVMEDevice *device)
+{
+  std::lock_guard l(queue_lock);
+  if (!free_queues.empty()) {
+    auto queue = free_queues.back();
+    free_queues.pop_back();
+    return queue;
+  }
+  auto max_queues = g_conf().get_val<uint64_t>("bluestore_spdk_max_io_queues");
+  if (max_queues && queues.size() >= max_queues) {
+    dout(10) << __func__ << " all " << queues.size()
+             << " io queues in use, sharing one" << dendl;
+    return nullptr;
+  }
+  queues.emplace_back(std::make_unique<SharedDriverQueueData>(device, this));
+  dout(10) << __func__ << " allocated io queue " << queues.size() << dendl;
+  return queues.back().get();
+}
+
+void SharedDriverData::put_queue(SharedDriverQueueData *queue)
+{
+  std::lock_guard l(queue_lock);
+  free_queues.push_back(queue);
+}
+
+void SharedDriverData::submit(NVMEDevice *device, Task *t, IOContext *ioc)
+{
+  SharedDriverQueueData *queue = nullptr;
+  auto p = std::find_if(
+    thread_queues.queues.begin(), thread_queues.queues.end(),
+    [this](auto& i) { return i.first == this; });
+  if (p != thread_queues.queues.end()) {
+    queue = p->second;
+  } else {
+    queue = get_queue(device);
+    thread_queues.queues.emplace_back(this, queue);
+  }
+  if (queue) {
+    queue->_aio_handle(t, ioc);
+    return;
+  }
+  std::lock_guard l(shared_queue_lock);
+  if (!shared_queue) {
+    shared_queue = std::make_unique<SharedDriverQueueData>(device, this);
+  }
+  shared_queue->_aio_handle(t, ioc);
+}
+
 class NVMEManager {
  public:
   struct ProbeContext {
@@ -810,8 +895,7 @@ void NVMEDevice::aio_submit(IOContext *ioc)
     // Only need to push the first entry
     ioc->nvme_task_first = ioc->nvme_task_last = nullptr;
 
-    thread_local SharedDriverQueueData queue_t = SharedDriverQueueData(this, driver);
-    queue_t._aio_handle(t, ioc);
+    driver->submit(this, t, ioc);
   }
 }
 
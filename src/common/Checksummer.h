@@ -7,6 +7,7 @@
 #include "include/buffer.h"
 #include "include/byteorder.h"
 #include "include/ceph_assert.h"
+#include "include/crc32c.h"
 
 #include "xxHash/xxhash.h"
 
@@ -90,6 +91,15 @@ public:
       ) {
       return p.crc32c(len, init_value);
     }
+    static init_value_t calc(
+      init_value_t init_value,
+      size_t len,
+      const char *data
+      ) {
+      return ceph_crc32c(init_value,
+			 reinterpret_cast<const unsigned char*>(data),
+			 len);
+    }
   };
 
   struct crc32c_16 {
@@ -111,6 +121,15 @@ public:
       ) {
       return p.crc32c(len, init_value) & 0xffff;
     }
+    static init_value_t calc(
+      init_value_t init_value,
+      size_t len,
+      const char *data
+      ) {
+      return ceph_crc32c(init_value,
+			 reinterpret_cast<const unsigned char*>(data),
+			 len) & 0xffff;
+    }
   };
 
   struct crc32c_8 {
@@ -132,6 +151,15 @@ public:
       ) {
       return p.crc32c(len, init_value) & 0xff;
     }
+    static init_value_t calc(
+      init_value_t init_value,
+      size_t len,
+      const char *data
+      ) {
+      return ceph_crc32c(init_value,
+			 reinterpret_cast<const unsigned char*>(data),
+			 len) & 0xff;
+    }
   };
 
   struct xxhash32 {
@@ -161,6 +189,13 @@ public:
       }
       return XXH32_digest(state);
     }
+    static init_value_t calc(
+      init_value_t init_value,
+      size_t len,
+      const char *data
+      ) {
+      return XXH32(data, len, init_value);
+    }
   };
 
   struct xxhash64 {
@@ -190,8 +225,53 @@ public:
       }
       return XXH64_digest(state);
     }
+    static init_value_t calc(
+      init_value_t init_value,
+      size_t len,
+      const char *data
+      ) {
+      return XXH64(data, len, init_value);
+    }
   };
 
+  /// max number of csum blocks calculated in one go by calc_blocks()
+  static constexpr size_t BATCH_BLOCKS = 16;
+
+  /*
+   * Calculate csums of 'blocks' (at most BATCH_BLOCKS) consecutive csum
+   * blocks starting at 'p'. Blocks lying within a single buffer are hashed
+   * straight from memory with no iterator or streaming state in between, so
+   * the per-block overhead is gone and independent blocks can overlap in
+   * the CPU pipeline. Only a block crossing a buffer boundary goes through
+   * the iterator based calc().
+   */
+  template<class Alg>
+  static void calc_blocks(
+    typename Alg::state_t state,
+    typename Alg::init_value_t init_value,
+    size_t csum_block_size,
+    size_t blocks,
+    ceph::buffer::list::const_iterator& p,
+    typename Alg::init_value_t *out) {
+    while (blocks > 0) {
+      ceph::buffer::ptr cur = p.get_current_ptr();
+      size_t n = std::min(blocks, cur.length() / csum_block_size);
+      if (n == 0) {
+	*out++ = Alg::calc(state, init_value, csum_block_size, p);
+	--blocks;
+	continue;
+      }
+      const char *data = cur.c_str();
+      for (size_t i = 0; i < n; ++i) {
+	out[i] = Alg::calc(init_value, csum_block_size,
+			   data + i * csum_block_size);
+      }
+      p += n * csum_block_size;
+      out += n;
+      blocks -= n;
+    }
+  }
+
   template<class Alg>
   static int calculate(
     size_t csum_block_size,
@@ -225,9 +305,14 @@ public:
     typename Alg::value_t *pv =
       reinterpret_cast<typename Alg::value_t*>(csum_data->c_str());
     pv += offset / csum_block_size;
-    while (blocks--) {
-      *pv = Alg::calc(state, init_value, csum_block_size, p);
-      ++pv;
+    typename Alg::init_value_t v[BATCH_BLOCKS];
+    while (blocks > 0) {
+      size_t n = std::min(blocks, BATCH_BLOCKS);
+      calc_blocks<Alg>(state, init_value, csum_block_size, n, p, v);
+      for (size_t i = 0; i < n; ++i) {
+	*pv++ = v[i];
+      }
+      blocks -= n;
     }
     Alg::fini(&state);
     return 0;
@@ -253,18 +338,23 @@ public:
       reinterpret_cast<const typename Alg::value_t*>(csum_data.c_str());
     pv += offset / csum_block_size;
     size_t pos = offset;
-    while (length > 0) {
-      typename Alg::init_value_t v = Alg::calc(state, -1, csum_block_size, p);
-      if (*pv != v) {
-	if (bad_csum) {
-	  *bad_csum = v;
+    size_t blocks = length / csum_block_size;
+    typename Alg::init_value_t v[BATCH_BLOCKS];
+    while (blocks > 0) {
+      size_t n = std::min(blocks, BATCH_BLOCKS);
+      calc_blocks<Alg>(state, -1, csum_block_size, n, p, v);
+      for (size_t i = 0; i < n; ++i) {
+	if (*pv != v[i]) {
+	  if (bad_csum) {
+	    *bad_csum = v[i];
+	  }
+	  Alg::fini(&state);
+	  return pos;
 	}
-	Alg::fini(&state);
-	return pos;
+	++pv;
+	pos += csum_block_size;
       }
-      ++pv;
-      pos += csum_block_size;
-      length -= csum_block_size;
+      blocks -= n;
     }
     Alg::fini(&state);
     return -1;  // no errors
@@ -572,6 +572,14 @@ static ceph::spinlock debug_lock;
     memset(c_str(), 0, _len);
   }
 
+  void buffer::ptr::set_crc32c(uint32_t crc, uint32_t result) const
+  {
+    if (_raw && _len) {
+      _raw->set_crc(std::make_pair(_off, _off + _len),
+		    std::make_pair(crc, result));
+    }
+  }
+
   void buffer::ptr::zero(unsigned o, unsigned l, bool crc_reset)
   {
     ceph_assert(o+l <= _len);
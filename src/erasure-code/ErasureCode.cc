@@ -365,4 +365,80 @@ int ErasureCode::decode_concat(const map<int, bufferlist> &chunks,
   }
   return r;
 }
+
+int ErasureCode::encode_delta(const bufferlist &old_data,
+                              const bufferlist &new_data,
+                              bufferlist *delta)
+{
+  unsigned length = old_data.length();
+  if (new_data.length() != length)
+    return -EINVAL;
+  bufferptr buf(buffer::create_aligned(length, SIMD_ALIGN));
+  old_data.begin().copy(length, buf.c_str());
+  char *out = buf.c_str();
+  for (auto &p : new_data.buffers()) {
+    const char *in = p.c_str();
+    for (unsigned i = 0; i < p.length(); i++)
+      *out++ ^= in[i];
+  }
+  delta->clear();
+  delta->push_back(std::move(buf));
+  return 0;
+}
+
+int ErasureCode::apply_delta(const map<int, bufferlist> &deltas,
+                             map<int, bufferlist> *parity)
+{
+  unsigned int k = get_data_chunk_count();
+  unsigned int m = get_chunk_count() - k;
+  if (deltas.empty() || parity->empty())
+    return -EINVAL;
+  unsigned blocksize = deltas.begin()->second.length();
+
+  // The codes are linear: encoding the deltas with all other data
+  // chunks zeroed gives what has to be added to the coding chunks.
+  map<int, bufferlist> encoded;
+  set<int> want_to_encode;
+  unsigned found = 0;
+  for (unsigned int i = 0; i < k + m; i++) {
+    int chunk = chunk_index(i);
+    want_to_encode.insert(chunk);
+    bufferptr buf(buffer::create_aligned(blocksize, SIMD_ALIGN));
+    auto p = deltas.find(chunk);
+    if (i < k && p != deltas.end()) {
+      if (p->second.length() != blocksize)
+        return -EINVAL;
+      p->second.begin().copy(blocksize, buf.c_str());
+      found++;
+    } else {
+      buf.zero();
+    }
+    encoded[chunk].push_back(std::move(buf));
+  }
+  if (found != deltas.size())
+    return -EINVAL;
+  found = 0;
+  for (unsigned int i = k; i < k + m; i++) {
+    auto p = parity->find(chunk_index(i));
+    if (p != parity->end()) {
+      if (p->second.length() != blocksize)
+        return -EINVAL;
+      found++;
+    }
+  }
+  if (found != parity->size())
+    return -EINVAL;
+
+  int r = encode_chunks(want_to_encode, &encoded);
+  if (r)
+    return r;
+  for (auto &[chunk, bl] : *parity) {
+    bufferlist updated;
+    r = encode_delta(bl, encoded[chunk], &updated);
+    if (r)
+      return r;
+    bl.swap(updated);
+  }
+  return 0;
+}
 }
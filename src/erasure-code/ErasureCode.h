@@ -115,6 +115,17 @@ namespace ceph {
     int decode_concat(const std::map<int, bufferlist> &chunks,
 			      bufferlist *decoded) override;
 
+    uint64_t get_supported_optimizations() const override {
+      return 0;
+    }
+
+    int encode_delta(const bufferlist &old_data,
+                     const bufferlist &new_data,
+                     bufferlist *delta) override;
+
+    int apply_delta(const std::map<int, bufferlist> &deltas,
+                    std::map<int, bufferlist> *parity) override;
+
   protected:
     int parse(const ErasureCodeProfile &profile,
 	      std::ostream *ss);
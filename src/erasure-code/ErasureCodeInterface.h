@@ -140,6 +140,7 @@
     chunks with cost 6 + 6 = 12. 
  */ 
 
+#include <cstdint>
 #include <map>
 #include <set>
 #include <vector>
@@ -459,6 +460,62 @@ namespace ceph {
      */
     virtual int decode_concat(const std::map<int, bufferlist> &chunks,
 			      bufferlist *decoded) = 0;
+
+    /**
+     * Optional features a plugin may support, as returned by
+     * **get_supported_optimizations**.
+     *
+     * FLAG_EC_PLUGIN_PARITY_DELTA_OPTIMIZATION: **encode_delta** and
+     * **apply_delta** can be used to update the coding chunks after
+     * some of the data chunks are overwritten, without reading the
+     * other data chunks.
+     */
+    enum {
+      FLAG_EC_PLUGIN_PARITY_DELTA_OPTIMIZATION = 1 << 0,
+    };
+
+    /**
+     * Return a bitmask of the FLAG_EC_PLUGIN_* optimizations
+     * supported by the instance.
+     *
+     * @return bitmask of supported optimizations
+     */
+    virtual uint64_t get_supported_optimizations() const = 0;
+
+    /**
+     * Compute the **delta** between the **old_data** and the
+     * **new_data** content of a data chunk. Both buffers must have
+     * the same length, which is also the length of **delta**.
+     *
+     * Returns 0 on success.
+     *
+     * @param [in] old_data content of the chunk before the overwrite
+     * @param [in] new_data content of the chunk after the overwrite
+     * @param [out] delta difference to be given to **apply_delta**
+     * @return **0** on success or a negative errno on error.
+     */
+    virtual int encode_delta(const bufferlist &old_data,
+                             const bufferlist &new_data,
+                             bufferlist *delta) = 0;
+
+    /**
+     * Update the coding chunks found in **parity** with the
+     * **deltas** of the data chunks, as computed by **encode_delta**.
+     * The **deltas** and **parity** maps are keyed by chunk index
+     * and all buffers must have the same size. Data chunks missing
+     * from **deltas** are assumed not to have changed.
+     *
+     * After the call, **parity** contains the coding chunks that
+     * **encode** would have produced for the updated data chunks.
+     *
+     * Returns 0 on success.
+     *
+     * @param [in] deltas map data chunk indexes to their delta
+     * @param [in,out] parity map coding chunk indexes to chunk data
+     * @return **0** on success or a negative errno on error.
+     */
+    virtual int apply_delta(const std::map<int, bufferlist> &deltas,
+                            std::map<int, bufferlist> *parity) = 0;
   };
 
   typedef std::shared_ptr<ErasureCodeInterface> ErasureCodeInterfaceRef;
@@ -132,6 +132,58 @@ ErasureCodeIsaDefault::isa_encode(char **data,
 
 // -----------------------------------------------------------------------------
 
+uint64_t
+ErasureCodeIsaDefault::get_supported_optimizations() const
+{
+  return FLAG_EC_PLUGIN_PARITY_DELTA_OPTIMIZATION;
+}
+
+// -----------------------------------------------------------------------------
+
+int
+ErasureCodeIsaDefault::apply_delta(const map<int, bufferlist> &deltas,
+                                   map<int, bufferlist> *parity)
+{
+  // ec_encode_data_update always updates all coding chunks
+  if (m == 1 || (int) parity->size() != m || !chunk_mapping.empty())
+    return ErasureCode::apply_delta(deltas, parity);
+  if (deltas.empty())
+    return -EINVAL;
+  unsigned blocksize = deltas.begin()->second.length();
+  for (auto &[chunk, bl] : deltas) {
+    if (chunk < 0 || chunk >= k || bl.length() != blocksize)
+      return -EINVAL;
+  }
+  for (auto &[chunk, bl] : *parity) {
+    if (chunk < k || chunk >= k + m || bl.length() != blocksize)
+      return -EINVAL;
+  }
+
+  unsigned char *coding[m];
+  vector<bufferptr> updated;
+  updated.reserve(m);
+  for (auto &[chunk, bl] : *parity) {
+    bufferptr buf(buffer::create_aligned(blocksize, EC_ISA_ADDRESS_ALIGNMENT));
+    bl.begin().copy(blocksize, buf.c_str());
+    coding[chunk - k] = (unsigned char*) buf.c_str();
+    updated.push_back(std::move(buf));
+  }
+  for (auto &[chunk, bl] : deltas) {
+    bufferlist delta = bl;
+    delta.rebuild_aligned(EC_ISA_ADDRESS_ALIGNMENT);
+    ec_encode_data_update(blocksize, k, m, chunk, encode_tbls,
+                          (unsigned char*) delta.c_str(), coding);
+  }
+  auto p = updated.begin();
+  for (auto &[chunk, bl] : *parity) {
+    bl.clear();
+    bl.push_back(std::move(*p++));
+  }
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+
 bool
 ErasureCodeIsaDefault::erasure_contains(int *erasures, int i)
 {
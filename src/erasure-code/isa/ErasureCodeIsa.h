@@ -134,6 +134,11 @@ public:
                           char **coding,
                           int blocksize) override;
 
+  uint64_t get_supported_optimizations() const override;
+
+  int apply_delta(const std::map<int, ceph::buffer::list> &deltas,
+                  std::map<int, ceph::buffer::list> *parity) override;
+
   virtual bool erasure_contains(int *erasures, int i);
 
   int isa_decode(int *erasures,
@@ -39,6 +39,7 @@ using std::map;
 using std::set;
 
 using ceph::bufferlist;
+using ceph::bufferptr;
 using ceph::ErasureCodeProfile;
 
 static ostream& _prefix(std::ostream* _dout)
@@ -137,6 +138,60 @@ int ErasureCodeJerasure::decode_chunks(const set<int> &want_to_read,
   return jerasure_decode(erasures, data, coding, blocksize);
 }
 
+uint64_t ErasureCodeJerasure::get_supported_optimizations() const
+{
+  if (get_coding_matrix())
+    return FLAG_EC_PLUGIN_PARITY_DELTA_OPTIMIZATION;
+  return 0;
+}
+
+int ErasureCodeJerasure::apply_delta(const map<int, bufferlist> &deltas,
+				     map<int, bufferlist> *parity)
+{
+  const int *matrix = get_coding_matrix();
+  if (!matrix || !chunk_mapping.empty())
+    return ErasureCode::apply_delta(deltas, parity);
+  if (deltas.empty() || parity->empty())
+    return -EINVAL;
+  unsigned blocksize = deltas.begin()->second.length();
+  map<int, bufferlist> in;
+  for (auto &[chunk, bl] : deltas) {
+    if (chunk < 0 || chunk >= k || bl.length() != blocksize)
+      return -EINVAL;
+    in[chunk] = bl;
+    in[chunk].rebuild_aligned(SIMD_ALIGN);
+  }
+  for (auto &[chunk, bl] : *parity) {
+    if (chunk < k || chunk >= k + m || bl.length() != blocksize)
+      return -EINVAL;
+  }
+
+  // only the columns of the coding matrix matching the changed data
+  // chunks contribute, see jerasure_matrix_dotprod
+  for (auto &[chunk, bl] : *parity) {
+    bufferptr buf(ceph::buffer::create_aligned(blocksize, SIMD_ALIGN));
+    bl.begin().copy(blocksize, buf.c_str());
+    const int *row = &matrix[(chunk - k) * k];
+    for (auto &[i, delta] : in) {
+      char *src = delta.c_str();
+      if (row[i] == 0) {
+	continue;
+      } else if (row[i] == 1) {
+	galois_region_xor(src, buf.c_str(), blocksize);
+      } else if (w == 8) {
+	galois_w08_region_multiply(src, row[i], blocksize, buf.c_str(), 1);
+      } else if (w == 16) {
+	galois_w16_region_multiply(src, row[i], blocksize, buf.c_str(), 1);
+      } else {
+	galois_w32_region_multiply(src, row[i], blocksize, buf.c_str(), 1);
+      }
+    }
+    bl.clear();
+    bl.push_back(std::move(buf));
+  }
+  return 0;
+}
+
 bool ErasureCodeJerasure::is_prime(int value)
 {
   int prime55[] = {
@@ -65,6 +65,16 @@ public:
 
   int init(ceph::ErasureCodeProfile &profile, std::ostream *ss) override;
 
+  uint64_t get_supported_optimizations() const override;
+
+  int apply_delta(const std::map<int, ceph::buffer::list> &deltas,
+		  std::map<int, ceph::buffer::list> *parity) override;
+
+  /// m x k coding matrix, nullptr if the technique uses a bitmatrix
+  virtual const int *get_coding_matrix() const {
+    return nullptr;
+  }
+
   virtual void jerasure_encode(char **data,
                                char **coding,
                                int blocksize) = 0;
@@ -102,6 +112,9 @@ public:
                                char **data,
                                char **coding,
                                int blocksize) override;
+  const int *get_coding_matrix() const override {
+    return matrix;
+  }
   unsigned get_alignment() const override;
   void prepare() override;
 private:
@@ -132,6 +145,9 @@ public:
                                char **data,
                                char **coding,
                                int blocksize) override;
+  const int *get_coding_matrix() const override {
+    return matrix;
+  }
   unsigned get_alignment() const override;
   void prepare() override;
 private:
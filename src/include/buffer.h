@@ -335,6 +335,9 @@ struct error_code;
     void zero(bool crc_reset = true);
     void zero(unsigned o, unsigned l, bool crc_reset = true);
     unsigned append_zeros(unsigned l);
+    /// record that crc32c(crc, contents) == result, e.g. derived from
+    /// checksums of the same data, for list::crc32c() to reuse
+    void set_crc32c(uint32_t crc, uint32_t result) const;
 
 #ifdef HAVE_SEASTAR
     /// create a temporary_buffer, copying the ptr as its deleter
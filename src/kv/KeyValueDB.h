@@ -4,11 +4,14 @@
 #define KEY_VALUE_DB_H
 
 #include "include/buffer.h"
+#include "include/Context.h"
 #include <ostream>
 #include <set>
 #include <map>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <vector>
 #include <boost/scoped_ptr.hpp>
 #include "include/encoding.h"
 #include "common/Formatter.h"
@@ -190,6 +193,42 @@ public:
     return get(prefix, std::string(key, keylen), value);
   }
 
+  /**
+   * Retrieve a batch of keys, in as few round trips to the backend as it
+   * allows.
+   *
+   * (*values)[i] and (*rs)[i] (0 or -ENOENT) hold the result for keys[i].
+   */
+  virtual int get_many(
+    const std::string &prefix,                 ///< [in] Prefix/CF for keys
+    const std::vector<std::string> &keys,      ///< [in] Keys to retrieve
+    std::vector<ceph::buffer::list> *values,   ///< [out] Values retrieved
+    std::vector<int> *rs) {                    ///< [out] Per key result
+    values->resize(keys.size());
+    rs->resize(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+      (*values)[i].clear();
+      (*rs)[i] = get(prefix, keys[i], &(*values)[i]);
+    }
+    return 0;
+  }
+  /**
+   * Non-blocking variant of get_many().
+   *
+   * on_finish is completed with the get_many() result once values and rs
+   * are filled in; keys, values and rs must stay valid until then.  It may
+   * be completed in the calling thread, with -ESHUTDOWN if the store is
+   * closed.
+   */
+  virtual void async_get(
+    const std::string &prefix,
+    const std::vector<std::string> &keys,
+    std::vector<ceph::buffer::list> *values,
+    std::vector<int> *rs,
+    Context *on_finish) {
+    on_finish->complete(get_many(prefix, keys, values, rs));
+  }
+
   // This superclass is used both by kv iterators *and* by the ObjectMap
   // omap iterator.  The class hierarchies are unfortunately tied together
   // by the legacy DBOjectMap implementation :(.
@@ -215,6 +254,9 @@ public:
     virtual int seek_to_last() = 0;
     virtual int prev() = 0;
     virtual std::pair<std::string, std::string> raw_key() = 0;
+    /// views of the current key and value, valid until the iterator moves
+    virtual std::string_view key_as_sv() = 0;
+    virtual std::string_view value_as_sv() = 0;
     virtual ceph::buffer::ptr value_as_ptr() {
       ceph::buffer::list bl = value();
       if (bl.length() == 1) {
@@ -244,6 +286,10 @@ public:
     virtual std::pair<std::string,std::string> raw_key() = 0;
     virtual bool raw_key_is_prefixed(const std::string &prefix) = 0;
     virtual ceph::buffer::list value() = 0;
+    /// views of the current key (without prefix) and value, valid until
+    /// the iterator moves
+    virtual std::string_view key_as_sv() = 0;
+    virtual std::string_view value_as_sv() = 0;
     virtual ceph::buffer::ptr value_as_ptr() {
       ceph::buffer::list bl = value();
       if (bl.length()) {
@@ -315,6 +361,12 @@ private:
     ceph::buffer::list value() override {
       return generic_iter->value();
     }
+    std::string_view key_as_sv() override {
+      return generic_iter->key_as_sv();
+    }
+    std::string_view value_as_sv() override {
+      return generic_iter->value_as_sv();
+    }
     ceph::buffer::ptr value_as_ptr() override {
       return generic_iter->value_as_ptr();
     }
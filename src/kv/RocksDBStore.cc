@@ -1240,6 +1240,9 @@ int RocksDBStore::do_open(ostream &out,
   
   PerfCountersBuilder plb(cct, "rocksdb", l_rocksdb_first, l_rocksdb_last);
   plb.add_time_avg(l_rocksdb_get_latency, "get_latency", "Get latency");
+  plb.add_u64_counter(l_rocksdb_multiget_keys, "multiget_keys", "Keys looked up by MultiGet");
+  plb.add_time_avg(l_rocksdb_async_get_lat, "async_get_lat", "Async get latency, queueing included");
+  plb.add_u64(l_rocksdb_async_get_queue_len, "async_get_queue_len", "Length of async get queue");
   plb.add_time_avg(l_rocksdb_submit_latency, "submit_latency", "Submit Latency");
   plb.add_time_avg(l_rocksdb_submit_sync_latency, "submit_sync_latency", "Submit Sync Latency");
   plb.add_u64_counter(l_rocksdb_compact, "compact", "Compactions");
@@ -1259,6 +1262,10 @@ int RocksDBStore::do_open(ostream &out,
     compact();
     derr << "Finished compacting rocksdb store" << dendl;
   }
+  {
+    std::lock_guard l(async_get_lock);
+    async_get_stop = false;
+  }
   return 0;
 }
 
@@ -1295,6 +1302,8 @@ void RocksDBStore::close()
   } else {
     compact_queue_lock.unlock();
   }
+  // complete pending async gets while the db is still around
+  stop_async_get_threads();
 
   if (logger) {
     cct->get_perfcounters_collection()->remove(logger);
@@ -1853,40 +1862,89 @@ void RocksDBStore::RocksDBTransactionImpl::merge(
   }
 }
 
+void RocksDBStore::multi_get(
+  const string &prefix,
+  const std::vector<rocksdb::Slice> &keys,
+  std::vector<rocksdb::PinnableSlice> *values,
+  std::vector<rocksdb::Status> *statuses)
+{
+  // look all keys up with a single MultiGet, which batches the memtable and
+  // block cache probes and reads the data blocks it misses in parallel
+  size_t n = keys.size();
+  std::vector<rocksdb::ColumnFamilyHandle*> cfs;
+  std::vector<string> combined;
+  std::vector<rocksdb::Slice> slices;
+  cfs.reserve(n);
+  if (cf_handles.count(prefix) > 0) {
+    for (auto& key : keys) {
+      cfs.push_back(get_cf_handle(prefix, key.data(), key.size()));
+    }
+  } else {
+    combined.reserve(n);
+    slices.reserve(n);
+    for (auto& key : keys) {
+      combined.emplace_back();
+      combine_strings(prefix, key.data(), key.size(), &combined.back());
+      cfs.push_back(default_cf);
+      slices.emplace_back(combined.back());
+    }
+  }
+  *values = std::vector<rocksdb::PinnableSlice>(n);
+  statuses->resize(n);
+  if (n > 0) {
+    db->MultiGet(rocksdb::ReadOptions(), n, cfs.data(),
+		 combined.empty() ? keys.data() : slices.data(),
+		 values->data(), statuses->data());
+  }
+  logger->inc(l_rocksdb_multiget_keys, n);
+}
+
 int RocksDBStore::get(
     const string &prefix,
     const std::set<string> &keys,
     std::map<string, bufferlist> *out)
 {
-  rocksdb::PinnableSlice value;
   utime_t start = ceph_clock_now();
-  if (cf_handles.count(prefix) > 0) {
-    for (auto& key : keys) {
-      auto cf_handle = get_cf_handle(prefix, key);
-      auto status = db->Get(rocksdb::ReadOptions(),
-			    cf_handle,
-			    rocksdb::Slice(key),
-			    &value);
-      if (status.ok()) {
-	(*out)[key].append(value.data(), value.size());
-      } else if (status.IsIOError()) {
-	ceph_abort_msg(status.getState());
-      }
-      value.Reset();
-    }
-  } else {
-    for (auto& key : keys) {
-      string k = combine_strings(prefix, key);
-      auto status = db->Get(rocksdb::ReadOptions(),
-			    default_cf,
-			    rocksdb::Slice(k),
-			    &value);
-      if (status.ok()) {
-	(*out)[key].append(value.data(), value.size());
-      } else if (status.IsIOError()) {
-	ceph_abort_msg(status.getState());
-      }
-      value.Reset();
+  std::vector<rocksdb::Slice> slices(keys.begin(), keys.end());
+  std::vector<rocksdb::PinnableSlice> values;
+  std::vector<rocksdb::Status> statuses;
+  multi_get(prefix, slices, &values, &statuses);
+  size_t i = 0;
+  for (auto& key : keys) {
+    if (statuses[i].ok()) {
+      (*out)[key].append(values[i].data(), values[i].size());
+    } else if (statuses[i].IsIOError()) {
+      ceph_abort_msg(statuses[i].getState());
+    }
+    ++i;
+  }
+  utime_t lat = ceph_clock_now() - start;
+  logger->tinc(l_rocksdb_get_latency, lat);
+  return 0;
+}
+
+int RocksDBStore::get_many(
+  const string &prefix,
+  const std::vector<string> &keys,
+  std::vector<bufferlist> *out,
+  std::vector<int> *rs)
+{
+  utime_t start = ceph_clock_now();
+  std::vector<rocksdb::Slice> slices(keys.begin(), keys.end());
+  std::vector<rocksdb::PinnableSlice> values;
+  std::vector<rocksdb::Status> statuses;
+  multi_get(prefix, slices, &values, &statuses);
+  out->resize(keys.size());
+  rs->resize(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    (*out)[i].clear();
+    if (statuses[i].ok()) {
+      (*out)[i].append(values[i].data(), values[i].size());
+      (*rs)[i] = 0;
+    } else if (statuses[i].IsNotFound()) {
+      (*rs)[i] = -ENOENT;
+    } else {
+      ceph_abort_msg(statuses[i].getState());
     }
   }
   utime_t lat = ceph_clock_now() - start;
@@ -1894,6 +1952,71 @@ int RocksDBStore::get(
   return 0;
 }
 
+void RocksDBStore::async_get(
+  const string &prefix,
+  const std::vector<string> &keys,
+  std::vector<bufferlist> *values,
+  std::vector<int> *rs,
+  Context *on_finish)
+{
+  std::unique_lock l(async_get_lock);
+  if (async_get_stop) {
+    l.unlock();
+    on_finish->complete(-ESHUTDOWN);
+    return;
+  }
+  if (cct->_conf->rocksdb_async_get_threads == 0) {
+    l.unlock();
+    on_finish->complete(get_many(prefix, keys, values, rs));
+    return;
+  }
+  async_get_queue.push_back(
+    AsyncGet{prefix, &keys, values, rs, on_finish, ceph::mono_clock::now()});
+  logger->set(l_rocksdb_async_get_queue_len, async_get_queue.size());
+  async_get_cond.notify_one();
+  if (async_get_threads.empty()) {
+    for (uint64_t i = 0; i < cct->_conf->rocksdb_async_get_threads; ++i) {
+      async_get_threads.emplace_back(std::make_unique<AsyncGetThread>(this));
+      async_get_threads.back()->create("rstore_get");
+    }
+  }
+}
+
+void RocksDBStore::async_get_thread_entry()
+{
+  std::unique_lock l{async_get_lock};
+  dout(10) << __func__ << " enter" << dendl;
+  // drain the queue even when stopping, every request must be completed
+  while (!async_get_stop || !async_get_queue.empty()) {
+    if (!async_get_queue.empty()) {
+      auto req = std::move(async_get_queue.front());
+      async_get_queue.pop_front();
+      logger->set(l_rocksdb_async_get_queue_len, async_get_queue.size());
+      l.unlock();
+      int r = get_many(req.prefix, *req.keys, req.values, req.rs);
+      logger->tinc(l_rocksdb_async_get_lat,
+		   ceph::mono_clock::now() - req.start);
+      req.on_finish->complete(r);
+      l.lock();
+      continue;
+    }
+    async_get_cond.wait(l);
+  }
+  dout(10) << __func__ << " exit" << dendl;
+}
+
+void RocksDBStore::stop_async_get_threads()
+{
+  std::unique_lock l(async_get_lock);
+  async_get_stop = true;
+  async_get_cond.notify_all();
+  l.unlock();
+  for (auto& t : async_get_threads) {
+    t->join();
+  }
+  async_get_threads.clear();
+}
+
 int RocksDBStore::get(
     const string &prefix,
     const string &key,
@@ -2234,6 +2357,22 @@ size_t RocksDBStore::RocksDBWholeSpaceIteratorImpl::value_size()
   return dbiter->value().size();
 }
 
+std::string_view RocksDBStore::RocksDBWholeSpaceIteratorImpl::key_as_sv()
+{
+  rocksdb::Slice key = dbiter->key();
+  // skip "prefix\0"
+  const char* separator = (const char*)memchr(key.data(), 0, key.size());
+  ceph_assert(separator);
+  size_t prefix_len = separator - key.data() + 1;
+  return std::string_view(key.data() + prefix_len, key.size() - prefix_len);
+}
+
+std::string_view RocksDBStore::RocksDBWholeSpaceIteratorImpl::value_as_sv()
+{
+  rocksdb::Slice val = dbiter->value();
+  return std::string_view(val.data(), val.size());
+}
+
 bufferptr RocksDBStore::RocksDBWholeSpaceIteratorImpl::value_as_ptr()
 {
   rocksdb::Slice val = dbiter->value();
@@ -2327,6 +2466,14 @@ public:
   bufferlist value() override {
     return to_bufferlist(dbiter->value());
   }
+  std::string_view key_as_sv() override {
+    rocksdb::Slice key = dbiter->key();
+    return std::string_view(key.data(), key.size());
+  }
+  std::string_view value_as_sv() override {
+    rocksdb::Slice val = dbiter->value();
+    return std::string_view(val.data(), val.size());
+  }
   bufferptr value_as_ptr() override {
     rocksdb::Slice val = dbiter->value();
     return bufferptr(val.data(), val.size());
@@ -2668,6 +2815,24 @@ public:
     }
   }
 
+  std::string_view key_as_sv() override
+  {
+    if (smaller == on_main) {
+      return main->key_as_sv();
+    } else {
+      return current_shard->second->key_as_sv();
+    }
+  }
+
+  std::string_view value_as_sv() override
+  {
+    if (smaller == on_main) {
+      return main->value_as_sv();
+    } else {
+      return current_shard->second->value_as_sv();
+    }
+  }
+
   int status() override
   {
     //because we already had to inspect key, it must be ok
@@ -2996,6 +3161,14 @@ public:
   bufferlist value() override {
     return to_bufferlist(iters[0]->value());
   }
+  std::string_view key_as_sv() override {
+    rocksdb::Slice key = iters[0]->key();
+    return std::string_view(key.data(), key.size());
+  }
+  std::string_view value_as_sv() override {
+    rocksdb::Slice val = iters[0]->value();
+    return std::string_view(val.data(), val.size());
+  }
   bufferptr value_as_ptr() override {
     rocksdb::Slice val = iters[0]->value();
     return bufferptr(val.data(), val.size());
@@ -32,6 +32,9 @@
 enum {
   l_rocksdb_first = 34300,
   l_rocksdb_get_latency,
+  l_rocksdb_multiget_keys,
+  l_rocksdb_async_get_lat,
+  l_rocksdb_async_get_queue_len,
   l_rocksdb_submit_latency,
   l_rocksdb_submit_sync_latency,
   l_rocksdb_compact,
@@ -191,6 +194,40 @@ private:
 
   void compact_thread_entry();
 
+  // serve async_get() requests
+  struct AsyncGet {
+    std::string prefix;
+    const std::vector<std::string> *keys;
+    std::vector<ceph::bufferlist> *values;
+    std::vector<int> *rs;
+    Context *on_finish;
+    ceph::mono_time start;
+  };
+  ceph::mutex async_get_lock =
+    ceph::make_mutex("RocksDBStore::async_get_lock");
+  ceph::condition_variable async_get_cond;
+  std::list<AsyncGet> async_get_queue;
+  bool async_get_stop = true;  ///< not open, or closing
+  class AsyncGetThread : public Thread {
+    RocksDBStore *db;
+  public:
+    explicit AsyncGetThread(RocksDBStore *d) : db(d) {}
+    void *entry() override {
+      db->async_get_thread_entry();
+      return NULL;
+    }
+  };
+  std::vector<std::unique_ptr<AsyncGetThread>> async_get_threads;
+
+  void async_get_thread_entry();
+  void stop_async_get_threads();
+
+  /// look up user keys of a prefix with a single MultiGet
+  void multi_get(const std::string &prefix,
+		 const std::vector<rocksdb::Slice> &keys,
+		 std::vector<rocksdb::PinnableSlice> *values,
+		 std::vector<rocksdb::Status> *statuses);
+
   void compact_range(const std::string& start, const std::string& end);
   void compact_range_async(const std::string& start, const std::string& end);
   int tryInterpret(const std::string& key, const std::string& val,
@@ -350,6 +387,17 @@ public:
     const char *key,
     size_t keylen,
     ceph::bufferlist *out) override;
+  int get_many(
+    const std::string &prefix,
+    const std::vector<std::string> &keys,
+    std::vector<ceph::bufferlist> *values,
+    std::vector<int> *rs) override;
+  void async_get(
+    const std::string &prefix,
+    const std::vector<std::string> &keys,
+    std::vector<ceph::bufferlist> *values,
+    std::vector<int> *rs,
+    Context *on_finish) override;
 
 
   class RocksDBWholeSpaceIteratorImpl :
@@ -381,6 +429,8 @@ public:
     std::pair<std::string,std::string> raw_key() override;
     bool raw_key_is_prefixed(const std::string &prefix) override;
     ceph::bufferlist value() override;
+    std::string_view key_as_sv() override;
+    std::string_view value_as_sv() override;
     ceph::bufferptr value_as_ptr() override;
     int status() override;
     size_t key_size() override;
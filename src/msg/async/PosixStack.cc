@@ -21,6 +21,12 @@
 #include <errno.h>
 
 #include <algorithm>
+#include <deque>
+
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#include <linux/errqueue.h>
+#define HAVE_MSG_ZEROCOPY
+#endif
 
 #include "PosixStack.h"
 
@@ -37,16 +43,35 @@
 #undef dout_prefix
 #define dout_prefix *_dout << "PosixStack "
 
+#ifdef HAVE_MSG_ZEROCOPY
+// how often closed sockets with zero-copy sends in flight are checked
+static constexpr uint64_t ZEROCOPY_LINGER_POLL_US = 100 * 1000;
+// after this long without an ack the kernel aborts such a socket, which
+// completes its sends
+static constexpr unsigned ZEROCOPY_LINGER_TIMEOUT_MS = 30 * 1000;
+#endif
+
 class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
   ceph::NetHandler &handler;
   int _fd;
   entity_addr_t sa;
   bool connected;
+  PosixWorker *worker;
+  CephContext *cct;
+  PerfCounters *logger;
+#ifdef HAVE_MSG_ZEROCOPY
+  int zerocopy = 0;   ///< SO_ZEROCOPY: 0 not tried yet, 1 on, -1 unsupported
+  /// number of MSG_ZEROCOPY sendmsg calls so far, the kernel reports
+  /// their completion by the same sequence numbers
+  uint32_t zerocopy_seq = 0;
+  ZeroCopyPending zerocopy_pending;
+#endif
 
  public:
   explicit PosixConnectedSocketImpl(ceph::NetHandler &h, const entity_addr_t &sa,
-				    int f, bool connected)
-      : handler(h), _fd(f), sa(sa), connected(connected) {}
+				    int f, bool connected, PosixWorker *w)
+      : handler(h), _fd(f), sa(sa), connected(connected),
+	worker(w), cct(w->cct), logger(w->perf_logger) {}
 
   int is_connected() override {
     if (connected)
@@ -64,6 +89,13 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
   }
 
   ssize_t read(char *buf, size_t len) override {
+#ifdef HAVE_MSG_ZEROCOPY
+    // completions are queued on the error queue, which wakes us up
+    // as readable
+    if (!zerocopy_pending.empty()) {
+      reap_zerocopy(_fd, zerocopy_pending, logger);
+    }
+#endif
     #ifdef _WIN32
     ssize_t r = ::recv(_fd, buf, len, 0);
     #else
@@ -77,13 +109,17 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
   // return the sent length
   // < 0 means error occurred
   #ifndef _WIN32
-  static ssize_t do_sendmsg(int fd, struct msghdr &msg, unsigned len, bool more)
+  static ssize_t do_sendmsg(int fd, struct msghdr &msg, unsigned len, bool more,
+			    int flags = 0, unsigned *calls = nullptr)
   {
     size_t sent = 0;
     while (1) {
       MSGR_SIGPIPE_STOPPER;
       ssize_t r;
-      r = ::sendmsg(fd, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+      r = ::sendmsg(fd, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0) | flags);
+      if (r >= 0 && calls) {
+	++*calls;
+      }
       if (r < 0) {
         int err = ceph_sock_errno();
         if (err == EINTR) {
@@ -113,8 +149,67 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
     return (ssize_t)sent;
   }
 
+#ifdef HAVE_MSG_ZEROCOPY
+  bool enable_zerocopy() {
+    if (zerocopy == 0) {
+      int one = 1;
+      if (::setsockopt(_fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0) {
+	zerocopy = 1;
+      } else {
+	int r = -ceph_sock_errno();
+	ldout(cct, 5) << __func__ << " SO_ZEROCOPY not supported: "
+		      << cpp_strerror(r) << dendl;
+	zerocopy = -1;
+      }
+    }
+    return zerocopy > 0;
+  }
+
+  // release the data of MSG_ZEROCOPY sends the kernel is done with
+  static void reap_zerocopy(int fd, ZeroCopyPending &pending,
+			    PerfCounters *logger) {
+    while (!pending.empty()) {
+      char control[128];
+      struct msghdr msg;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      if (::recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+	break;
+      }
+      for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm;
+	   cm = CMSG_NXTHDR(&msg, cm)) {
+	auto serr = reinterpret_cast<struct sock_extended_err*>(CMSG_DATA(cm));
+	if (serr->ee_errno != 0 ||
+	    serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+	  continue;
+	}
+	if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+	  // e.g. loopback, or a device without scatter-gather
+	  logger->inc(l_msgr_send_zerocopy_copied);
+	}
+	// sendmsg calls [ee_info, ee_data] are complete
+	uint32_t last = serr->ee_data;
+	while (!pending.empty() &&
+	       (int32_t)(pending.front().first - last) <= 0) {
+	  pending.pop_front();
+	}
+      }
+    }
+  }
+#endif
+
   ssize_t send(ceph::buffer::list &bl, bool more) override {
     size_t sent_bytes = 0;
+    int flags = 0;
+    unsigned zerocopy_calls = 0;
+#ifdef HAVE_MSG_ZEROCOPY
+    uint64_t zerocopy_min = cct->_conf->ms_tcp_zerocopy_min_bytes;
+    if (zerocopy_min && bl.length() >= zerocopy_min && enable_zerocopy()) {
+      flags = MSG_ZEROCOPY;
+      reap_zerocopy(_fd, zerocopy_pending, logger);
+    }
+#endif
     auto pb = std::cbegin(bl.buffers());
     uint64_t left_pbrs = bl.get_num_buffers();
     while (left_pbrs) {
@@ -133,9 +228,18 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
 	msglen += pb->length();
 	++pb;
       }
-      ssize_t r = do_sendmsg(_fd, msg, msglen, left_pbrs || more);
-      if (r < 0)
+      ssize_t r = do_sendmsg(_fd, msg, msglen, left_pbrs || more,
+			     flags, &zerocopy_calls);
+      if (r < 0) {
+#ifdef HAVE_MSG_ZEROCOPY
+	if (zerocopy_calls) {
+	  // earlier sendmsg calls may have passed (part of) bl to the kernel
+	  zerocopy_seq += zerocopy_calls;
+	  zerocopy_pending.emplace_back(zerocopy_seq - 1, bl);
+	}
+#endif
         return r;
+      }
 
       // "r" is the remaining length
       sent_bytes += r;
@@ -150,8 +254,16 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
         bl.splice(sent_bytes, bl.length()-sent_bytes, &swapped);
         bl.swap(swapped);
       } else {
-        bl.clear();
+        swapped.swap(bl);
       }
+#ifdef HAVE_MSG_ZEROCOPY
+      if (zerocopy_calls) {
+        // the kernel references the sent pages until it reports completion
+        zerocopy_seq += zerocopy_calls;
+        zerocopy_pending.emplace_back(zerocopy_seq - 1, std::move(swapped));
+        logger->inc(l_msgr_send_zerocopy_bytes, sent_bytes);
+      }
+#endif
     }
 
     return static_cast<ssize_t>(sent_bytes);
@@ -204,6 +316,19 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
     ::shutdown(_fd, SHUT_RDWR);
   }
   void close() override {
+#ifdef HAVE_MSG_ZEROCOPY
+    if (!zerocopy_pending.empty()) {
+      reap_zerocopy(_fd, zerocopy_pending, logger);
+    }
+    if (!zerocopy_pending.empty()) {
+      // the kernel may still transmit from the pending buffers, and it
+      // only reports that through this fd
+      worker->linger_zerocopy(_fd, std::move(zerocopy_pending));
+      zerocopy_pending.clear();
+      _fd = -1;
+      return;
+    }
+#endif
     compat_closesocket(_fd);
   }
   void set_priority(int sd, int prio, int domain) override {
@@ -262,15 +387,109 @@ int PosixServerSocketImpl::accept(ConnectedSocket *sock, const SocketOptions &op
   out->set_sockaddr((sockaddr*)&ss);
   handler.set_priority(sd, opt.priority, out->get_family());
 
-  std::unique_ptr<PosixConnectedSocketImpl> csi(new PosixConnectedSocketImpl(handler, *out, sd, true));
+  std::unique_ptr<PosixConnectedSocketImpl> csi(
+    new PosixConnectedSocketImpl(handler, *out, sd, true,
+				 static_cast<PosixWorker*>(w)));
   *sock = ConnectedSocket(std::move(csi));
   return 0;
 }
 
+class C_reap_lingering : public EventCallback {
+  PosixWorker *worker;
+ public:
+  explicit C_reap_lingering(PosixWorker *w) : worker(w) {}
+  void do_request(uint64_t id) override {
+    worker->reap_lingering();
+  }
+};
+
+PosixWorker::PosixWorker(CephContext *c, unsigned i)
+  : Worker(c, i), net(c), linger_cb(new C_reap_lingering(this))
+{
+}
+
+PosixWorker::~PosixWorker()
+{
+  delete linger_cb;
+}
+
 void PosixWorker::initialize()
 {
 }
 
+void PosixWorker::destroy()
+{
+#ifdef HAVE_MSG_ZEROCOPY
+  if (linger_timer) {
+    center.delete_time_event(linger_timer);
+    linger_timer = 0;
+  }
+  // give the sends of lingering sockets a moment to complete
+  for (int i = 0; i < 100 && !lingering.empty(); ++i) {
+    if (i) {
+      usleep(10 * 1000);
+    }
+    reap_lingering();
+    if (linger_timer) {
+      center.delete_time_event(linger_timer);
+      linger_timer = 0;
+    }
+  }
+  for (auto &l : lingering) {
+    ldout(cct, 1) << __func__ << " fd " << l.fd << " still has "
+		  << l.pending.size() << " zero-copy sends in flight" << dendl;
+    ::close(l.fd);
+    // the kernel may still read from these pages, never let them be reused
+    auto leaked = new ZeroCopyPending(std::move(l.pending));
+    (void)leaked;
+  }
+  lingering.clear();
+#endif
+}
+
+void PosixWorker::linger_zerocopy(int fd, ZeroCopyPending &&pending)
+{
+#ifdef HAVE_MSG_ZEROCOPY
+  ldout(cct, 10) << __func__ << " fd " << fd << " " << pending.size()
+		 << " zero-copy sends in flight" << dendl;
+  ::shutdown(fd, SHUT_RDWR);
+  // don't wait for an unresponsive peer forever
+  unsigned timeout = ZEROCOPY_LINGER_TIMEOUT_MS;
+  ::setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout, sizeof(timeout));
+  center.submit_to(
+    center.get_id(),
+    [this, fd, pending = std::move(pending)]() mutable {
+      lingering.push_back(Lingering{fd, std::move(pending)});
+      if (!linger_timer) {
+	linger_timer = center.create_time_event(ZEROCOPY_LINGER_POLL_US,
+						linger_cb);
+      }
+    },
+    true);
+#endif
+}
+
+void PosixWorker::reap_lingering()
+{
+#ifdef HAVE_MSG_ZEROCOPY
+  linger_timer = 0;
+  for (auto p = lingering.begin(); p != lingering.end(); ) {
+    PosixConnectedSocketImpl::reap_zerocopy(p->fd, p->pending, perf_logger);
+    if (p->pending.empty()) {
+      ldout(cct, 10) << __func__ << " closing fd " << p->fd << dendl;
+      ::close(p->fd);
+      p = lingering.erase(p);
+    } else {
+      ++p;
+    }
+  }
+  if (!lingering.empty()) {
+    linger_timer = center.create_time_event(ZEROCOPY_LINGER_POLL_US,
+					    linger_cb);
+  }
+#endif
+}
+
 int PosixWorker::listen(entity_addr_t &sa,
 			unsigned addr_slot,
 			const SocketOptions &opt,
@@ -331,7 +550,8 @@ int PosixWorker::connect(const entity_addr_t &addr, const SocketOptions &opts, C
 
   net.set_priority(sd, opts.priority, addr.get_family());
   *socket = ConnectedSocket(
-      std::unique_ptr<PosixConnectedSocketImpl>(new PosixConnectedSocketImpl(net, addr, sd, !opts.nonblock)));
+      std::unique_ptr<PosixConnectedSocketImpl>(
+	new PosixConnectedSocketImpl(net, addr, sd, !opts.nonblock, this)));
   return 0;
 }
 
@@ -17,6 +17,8 @@
 #ifndef CEPH_MSG_ASYNC_POSIXSTACK_H
 #define CEPH_MSG_ASYNC_POSIXSTACK_H
 
+#include <deque>
+#include <list>
 #include <thread>
 
 #include "msg/msg_types.h"
@@ -24,17 +26,37 @@
 
 #include "Stack.h"
 
+/// data of MSG_ZEROCOPY sends the kernel may still read from, by the
+/// sequence number of the last sendmsg that covered it
+using ZeroCopyPending = std::deque<std::pair<uint32_t, ceph::buffer::list>>;
+
 class PosixWorker : public Worker {
   ceph::NetHandler net;
   void initialize() override;
+  void destroy() override;
+
+  /// closed sockets kept open until their zero-copy sends complete,
+  /// only touched from the center's thread
+  struct Lingering {
+    int fd;
+    ZeroCopyPending pending;
+  };
+  std::list<Lingering> lingering;
+  uint64_t linger_timer = 0;
+  EventCallbackRef linger_cb;
+  void reap_lingering();
+  friend class C_reap_lingering;
+
  public:
-  PosixWorker(CephContext *c, unsigned i)
-      : Worker(c, i), net(c) {}
+  PosixWorker(CephContext *c, unsigned i);
+  ~PosixWorker() override;
   int listen(entity_addr_t &sa,
 	     unsigned addr_slot,
 	     const SocketOptions &opt,
 	     ServerSocket *socks) override;
   int connect(const entity_addr_t &addr, const SocketOptions &opts, ConnectedSocket *socket) override;
+  /// take over a closed socket whose zero-copy sends are still in flight
+  void linger_zerocopy(int fd, ZeroCopyPending &&pending);
 };
 
 class PosixNetworkStack : public NetworkStack {
@@ -111,3 +111,33 @@ int ObjectStore::read_meta(const std::string& key,
   *value = string(buf, r);
   return 0;
 }
+
+int ObjectStore::omap_iterate(
+  CollectionHandle &c,
+  const ghobject_t &oid,
+  omap_iter_seek_t start_from,
+  std::function<omap_iter_ret_t(std::string_view, std::string_view)> f)
+{
+  auto iter = get_omap_iterator(c, oid);
+  if (!iter) {
+    return -ENOENT;
+  }
+  int r;
+  if (start_from.seek_type == omap_iter_seek_t::LOWER_BOUND) {
+    r = iter->lower_bound(start_from.seek_position);
+  } else {
+    r = iter->upper_bound(start_from.seek_position);
+  }
+  if (r < 0) {
+    return r;
+  }
+  for (; iter->valid(); iter->next()) {
+    string key = iter->key();
+    ceph::buffer::list value = iter->value();
+    if (f(key, std::string_view(value.c_str(), value.length())) ==
+	omap_iter_ret_t::STOP) {
+      return 1;
+    }
+  }
+  return iter->status();
+}
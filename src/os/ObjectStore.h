@@ -698,6 +698,19 @@ public:
     return collection_list(c, start, end, max, ls, next);
   }
 
+  /**
+   * hint that the given objects are about to be accessed
+   *
+   * Lets the backend load their metadata in one batch instead of one lookup
+   * per object, e.g. after listing a range of objects which is going to be
+   * stat'ed or read next. Purely advisory, the default does nothing.
+   *
+   * @param c collection
+   * @param oids objects to prefetch
+   */
+  virtual void prefetch_objects(CollectionHandle &c,
+				const std::vector<ghobject_t>& oids) {}
+
   /// OMAP
   /// Get omap contents
   virtual int omap_get(
@@ -761,6 +774,39 @@ public:
     const ghobject_t &oid  ///< [in] object
     ) = 0;
 
+  /// what omap_iterate() should do after visiting an entry
+  enum class omap_iter_ret_t {
+    STOP,
+    NEXT
+  };
+  /// where omap_iterate() starts
+  struct omap_iter_seek_t {
+    std::string seek_position;
+    enum {
+      LOWER_BOUND,  ///< first key >= seek_position
+      UPPER_BOUND   ///< first key > seek_position
+    } seek_type = LOWER_BOUND;
+
+    static omap_iter_seek_t min_lower_bound() {
+      return {};
+    }
+  };
+  /**
+   * Iterate over omap entries of an object without copying them
+   *
+   * f is called for each key and value in order until it returns STOP.
+   * The views passed to f are only valid for the duration of the call.
+   *
+   * @return 0 if the end was reached, 1 if f stopped the iteration,
+   *         negative error code otherwise
+   */
+  virtual int omap_iterate(
+    CollectionHandle &c,   ///< [in] collection
+    const ghobject_t &oid, ///< [in] object
+    omap_iter_seek_t start_from, ///< [in] where to start
+    std::function<omap_iter_ret_t(std::string_view, std::string_view)> f
+    );
+
   virtual int flush_journal() { return -EOPNOTSUPP; }
 
   virtual int dump_journal(std::ostream& out) { return -EOPNOTSUPP; }
@@ -342,6 +342,10 @@ void BlueFS::_init_logger()
 		    "Bytes read from prefetch buffer in random read mode",
 		    NULL,
 		    PerfCountersBuilder::PRIO_USEFUL, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluefs_read_random_batch_count, "read_random_batch_count",
+		    "random read batches issued to devices in parallel");
+  b.add_u64_counter(l_bluefs_read_random_batch_reqs, "read_random_batch_reqs",
+		    "random read requests served by parallel batches");
   b.add_time_avg   (l_bluefs_read_lat, "read_lat",
                     "Average bluefs read latency",
                     "rd_t",
@@ -452,6 +456,37 @@ void BlueFS::_init_logger()
              "asxt",
              PerfCountersBuilder::PRIO_INTERESTING);
 
+  PerfHistogramCommon::axis_config_d fsync_hist_x_axis_config{
+    "Latency (usec)",
+    PerfHistogramCommon::SCALE_LOG2, ///< Latency in logarithmic scale
+    0,                               ///< Start at 0
+    1000,                            ///< Quantization unit is 1usec
+    24,                              ///< Up to ~8 seconds
+  };
+  PerfHistogramCommon::axis_config_d fsync_hist_y_axis_config{
+    "Flushed size (bytes)",
+    PerfHistogramCommon::SCALE_LOG2, ///< Size in logarithmic scale
+    0,                               ///< Start at 0
+    4096,                            ///< Quantization unit is 4KiB
+    20,                              ///< Up to ~2GiB
+  };
+  b.add_u64_counter_histogram(
+    l_bluefs_fsync_lat_histogram, "fsync_lat_histogram",
+    fsync_hist_x_axis_config, fsync_hist_y_axis_config,
+    "Histogram of bluefs fsync latency vs. bytes flushed");
+  b.add_u64_counter(l_bluefs_compaction_bg, "compact_bg",
+		    "Log compactions performed by the background thread");
+  b.add_u64(l_bluefs_spilled_files, "spilled_files",
+	    "Files with extents on slow device that prefer a faster one");
+  b.add_u64(l_bluefs_spilled_bytes, "spilled_bytes",
+	    "Bytes spilled over to slow device by files that prefer a faster one",
+	    NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluefs_hot_migrated_files, "hot_migrated_files",
+		    "Frequently read files moved back from slow device");
+  b.add_u64_counter(l_bluefs_hot_migrated_bytes, "hot_migrated_bytes",
+		    "Bytes moved back from slow device for frequently read files",
+		    NULL, 0, unit_t(UNIT_BYTES));
+
   logger = b.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
 }
@@ -970,6 +1005,21 @@ int BlueFS::_bdev_read_random(uint8_t ndev, uint64_t off, uint64_t len,
   return bdev[ndev]->read_random(off, len, buf, buffered);
 }
 
+int BlueFS::_bdev_aio_read_random(uint8_t ndev, uint64_t off, uint64_t len,
+  ceph::buffer::list* pbl, IOContext* ioc)
+{
+  int cnt = 0;
+  switch (ndev) {
+    case BDEV_WAL: cnt = l_bluefs_read_random_disk_bytes_wal; break;
+    case BDEV_DB: cnt = l_bluefs_read_random_disk_bytes_db; break;
+    case BDEV_SLOW: cnt = l_bluefs_read_random_disk_bytes_slow; break;
+  }
+  if (cnt) {
+    logger->inc(cnt, len);
+  }
+  return bdev[ndev]->aio_read(off, len, pbl, ioc);
+}
+
 int BlueFS::mount()
 {
   dout(1) << __func__ << dendl;
@@ -1032,6 +1082,8 @@ int BlueFS::mount()
            << dendl;
   // update log size
   logger->set(l_bluefs_log_bytes, log.writer->file->fnode.size);
+  _start_log_compact_thread();
+  _start_hot_migrate_thread();
   return 0;
 
  out:
@@ -1060,6 +1112,8 @@ void BlueFS::umount(bool avoid_compact)
 {
   dout(1) << __func__ << dendl;
 
+  _stop_hot_migrate_thread();
+  _stop_log_compact_thread();
   sync_metadata(avoid_compact);
   if (cct->_conf->bluefs_check_volume_selector_on_umount) {
     _check_vselector_LNF();
@@ -2147,7 +2201,7 @@ int64_t BlueFS::_read_random(
            << " 0x" << std::hex << off << "~" << len << std::dec
 	   << " from " << lock_fnode_print(h->file) << dendl;
 
-  ++h->file->num_reading;
+  _start_reading(h->file.get());
 
   if (!h->ignore_eof &&
       off + len > h->file->fnode.size) {
@@ -2229,6 +2283,103 @@ int64_t BlueFS::_read_random(
   return ret;
 }
 
+void BlueFS::_read_random_batch(
+  FileReader *h,
+  std::vector<ReadRequest>& reqs)
+{
+  // aio reads bypass the page cache and the zero check rereads
+  // synchronously, so leave those setups to the plain path
+  if (reqs.size() < 2 ||
+      cct->_conf->bluefs_buffered_io ||
+      cct->_conf->bluefs_check_for_zeros) {
+    for (auto& req : reqs) {
+      req.result = _read_random(h, req.offset, req.len, req.out);
+    }
+    return;
+  }
+  auto t0 = mono_clock::now();
+  dout(10) << __func__ << " h " << h << " " << reqs.size() << " reads"
+	   << " from " << lock_fnode_print(h->file) << dendl;
+
+  // a device read covering (part of) one request
+  struct piece_t {
+    uint64_t skip;   ///< bytes to skip at the start of bl
+    uint64_t len;
+    char *out;
+    bufferlist bl;
+  };
+  std::list<piece_t> pieces;
+  std::array<std::unique_ptr<IOContext>, MAX_BDEV> iocs;
+  std::vector<ReadRequest*> buffered;
+
+  _start_reading(h->file.get());
+  for (auto& req : reqs) {
+    uint64_t off = req.offset;
+    uint64_t len = req.len;
+    if (!h->ignore_eof &&
+	off + len > h->file->fnode.size) {
+      len = off > h->file->fnode.size ? 0 : h->file->fnode.size - off;
+    }
+    req.result = len;
+    {
+      // the prefetch buffer is authoritative as long as it's there
+      std::shared_lock s_lock(h->lock);
+      if (off >= h->buf.bl_off && off < h->buf.get_buf_end()) {
+	buffered.push_back(&req);
+	continue;
+      }
+    }
+    logger->inc(l_bluefs_read_random_count, 1);
+    logger->inc(l_bluefs_read_random_bytes, len);
+    char *out = req.out;
+    while (len > 0) {
+      uint64_t x_off = 0;
+      auto p = h->file->fnode.seek(off, &x_off);
+      ceph_assert(p != h->file->fnode.extents.end());
+      uint64_t l = std::min(p->length - x_off, len);
+      uint64_t dev_off = p->offset + x_off;
+      uint64_t block_size = bdev[p->bdev]->get_block_size();
+      uint64_t aligned_off = p2align(dev_off, block_size);
+      uint64_t aligned_len = p2roundup(dev_off + l, block_size) - aligned_off;
+      if (!iocs[p->bdev]) {
+	iocs[p->bdev] = std::make_unique<IOContext>(cct, nullptr);
+      }
+      pieces.push_back(piece_t{dev_off - aligned_off, l, out, {}});
+      int r = _bdev_aio_read_random(p->bdev, aligned_off, aligned_len,
+				    &pieces.back().bl, iocs[p->bdev].get());
+      ceph_assert(r == 0);
+      logger->inc(l_bluefs_read_random_disk_count, 1);
+      logger->inc(l_bluefs_read_random_disk_bytes, l);
+      off += l;
+      len -= l;
+      out += l;
+    }
+  }
+  for (unsigned i = 0; i < MAX_BDEV; ++i) {
+    if (iocs[i] && iocs[i]->has_pending_aios()) {
+      bdev[i]->aio_submit(iocs[i].get());
+    }
+  }
+  for (auto& ioc : iocs) {
+    if (ioc) {
+      ioc->aio_wait();
+      ceph_assert(ioc->get_return_value() >= 0);
+    }
+  }
+  for (auto& piece : pieces) {
+    auto p = piece.bl.cbegin(piece.skip);
+    p.copy(piece.len, piece.out);
+  }
+  --h->file->num_reading;
+  logger->inc(l_bluefs_read_random_batch_count);
+  logger->inc(l_bluefs_read_random_batch_reqs, reqs.size() - buffered.size());
+  logger->tinc(l_bluefs_read_random_lat, mono_clock::now() - t0);
+
+  for (auto req : buffered) {
+    req->result = _read_random(h, req->offset, req->len, req->out);
+  }
+}
+
 int64_t BlueFS::_read(
   FileReader *h,         ///< [in] read from here
   uint64_t off,          ///< [in] offset
@@ -2246,7 +2397,7 @@ int64_t BlueFS::_read(
 	   << (prefetch ? " prefetch" : "")
 	   << dendl;
 
-  ++h->file->num_reading;
+  _start_reading(h->file.get());
 
   if (!h->ignore_eof &&
       off + len > h->file->fnode.size) {
@@ -3755,6 +3906,7 @@ int BlueFS::fsync(FileWriter *h)/*_WF_WD_WLD_WLNF_WNF*/
   _maybe_check_vselector_LNF();
   std::unique_lock hl(h->lock);
   uint64_t old_dirty_seq = 0;
+  uint64_t flushed = h->get_buffer_length();
   {
     dout(10) << __func__ << " " << h << " " << h->file->fnode
              << " dirty " << h->file->is_dirty << dendl;
@@ -3779,7 +3931,10 @@ int BlueFS::fsync(FileWriter *h)/*_WF_WD_WLD_WLNF_WNF*/
     _flush_and_sync_log_LD(old_dirty_seq);
   }
   _maybe_compact_log_LNF_NF_LD_D();
-  logger->tinc(l_bluefs_fsync_lat, mono_clock::now() - t0);
+  auto lat = mono_clock::now() - t0;
+  logger->tinc(l_bluefs_fsync_lat, lat);
+  logger->hinc(l_bluefs_fsync_lat_histogram,
+               std::chrono::nanoseconds(lat).count(), flushed);
   return 0;
 }
 
@@ -4054,6 +4209,14 @@ void BlueFS::_maybe_compact_log_LNF_NF_LD_D()
 {
   if (!cct->_conf->bluefs_replay_recovery_disable_compact &&
       _should_start_compact_log_L_N()) {
+    if (!cct->_conf->bluefs_compact_log_sync &&
+        log_compact_thread.is_started()) {
+      // let the background thread do it, don't hold up the caller
+      std::lock_guard l(log_compact_lock);
+      log_compact_requested = true;
+      log_compact_cond.notify_one();
+      return;
+    }
     auto t0 = mono_clock::now();
     if (cct->_conf->bluefs_compact_log_sync) {
       _compact_log_sync_LNF_LD();
@@ -4064,6 +4227,295 @@ void BlueFS::_maybe_compact_log_LNF_NF_LD_D()
   }
 }
 
+void BlueFS::_start_log_compact_thread()
+{
+  if (!cct->_conf->bluefs_compact_log_background) {
+    return;
+  }
+  ceph_assert(!log_compact_thread.is_started());
+  log_compact_stop = false;
+  log_compact_requested = false;
+  log_compact_thread.create("bfs_log_compact");
+}
+
+void BlueFS::_stop_log_compact_thread()
+{
+  if (!log_compact_thread.is_started()) {
+    return;
+  }
+  {
+    std::lock_guard l(log_compact_lock);
+    log_compact_stop = true;
+    log_compact_cond.notify_one();
+  }
+  log_compact_thread.join();
+}
+
+void BlueFS::_log_compact_thread()
+{
+  dout(10) << __func__ << " start" << dendl;
+  std::unique_lock l(log_compact_lock);
+  while (!log_compact_stop) {
+    if (!log_compact_requested) {
+      log_compact_cond.wait(l);
+      continue;
+    }
+    log_compact_requested = false;
+    l.unlock();
+    // conditions might have changed since the request was posted
+    if (!cct->_conf->bluefs_replay_recovery_disable_compact &&
+        _should_start_compact_log_L_N()) {
+      auto t0 = mono_clock::now();
+      _compact_log_async_LD_LNF_D();
+      logger->tinc(l_bluefs_compaction_lat, mono_clock::now() - t0);
+      logger->inc(l_bluefs_compaction_bg);
+    }
+    l.lock();
+  }
+  dout(10) << __func__ << " finish" << dendl;
+}
+
+void BlueFS::_start_reading(File *f)
+{
+  // pairs with _migrate_file_to_fast_LNF_D(): either the migration sees our
+  // num_reading and waits for it to drop, or we see migrating and wait until
+  // the new extents are in place
+  while (true) {
+    ++f->num_reading;
+    if (!f->migrating) {
+      break;
+    }
+    --f->num_reading;
+    std::unique_lock l(hot_migrate_lock);
+    hot_migrate_cond.wait(l, [f] { return !f->migrating; });
+  }
+  ++f->num_reads;
+}
+
+void BlueFS::_start_hot_migrate_thread()
+{
+  if (cct->_conf->bluefs_hot_migrate_interval <= 0 ||
+      !alloc[BDEV_DB] || !alloc[BDEV_SLOW]) {
+    return;
+  }
+  ceph_assert(!hot_migrate_thread.is_started());
+  hot_migrate_stop = false;
+  hot_migrate_thread.create("bfs_hot_migrate");
+}
+
+void BlueFS::_stop_hot_migrate_thread()
+{
+  if (!hot_migrate_thread.is_started()) {
+    return;
+  }
+  {
+    std::lock_guard l(hot_migrate_lock);
+    hot_migrate_stop = true;
+    hot_migrate_cond.notify_all();
+  }
+  hot_migrate_thread.join();
+}
+
+void BlueFS::_hot_migrate_thread()
+{
+  dout(10) << __func__ << " start" << dendl;
+  auto interval = make_timespan(cct->_conf->bluefs_hot_migrate_interval);
+  std::unique_lock l(hot_migrate_lock);
+  while (!hot_migrate_stop) {
+    hot_migrate_cond.wait_for(l, interval);
+    if (hot_migrate_stop) {
+      break;
+    }
+    l.unlock();
+    _hot_migrate_pass_LNF_LD_D();
+    l.lock();
+  }
+  dout(10) << __func__ << " finish" << dendl;
+}
+
+uint64_t BlueFS::_hot_migrate_pass_LNF_LD_D()
+{
+  uint64_t min_reads = cct->_conf->bluefs_hot_migrate_min_reads;
+  uint64_t budget = cct->_conf->bluefs_hot_migrate_max_bytes;
+  double min_free_ratio = cct->_conf->bluefs_hot_migrate_min_free_ratio;
+
+  // age the read counters and pick the candidates
+  std::vector<std::pair<uint64_t, FileRef>> hot;
+  uint64_t spilled_files = 0;
+  uint64_t spilled_bytes = 0;
+  {
+    std::lock_guard nl(nodes.lock);
+    for (auto& [ino, f] : nodes.file_map) {
+      if (ino <= 1) {
+	continue;
+      }
+      std::lock_guard fl(f->lock);
+      f->heat = f->heat / 2 + f->num_reads.exchange(0);
+      if (vselector->select_prefer_bdev(f->vselector_hint) == BDEV_SLOW) {
+	continue;
+      }
+      uint64_t slow = 0;
+      for (auto& e : f->fnode.extents) {
+	if (e.bdev == BDEV_SLOW) {
+	  slow += e.length;
+	}
+      }
+      if (!slow) {
+	continue;
+      }
+      ++spilled_files;
+      spilled_bytes += slow;
+      if (f->heat >= min_reads && f->num_writers == 0 && !f->deleted) {
+	hot.emplace_back(f->heat, f);
+      }
+    }
+  }
+  logger->set(l_bluefs_spilled_files, spilled_files);
+  logger->set(l_bluefs_spilled_bytes, spilled_bytes);
+  dout(10) << __func__ << " spilled files " << spilled_files
+	   << " bytes 0x" << std::hex << spilled_bytes << std::dec
+	   << ", " << hot.size() << " hot" << dendl;
+  if (hot.empty()) {
+    return 0;
+  }
+
+  std::sort(hot.begin(), hot.end(),
+	    [](const auto& a, const auto& b) { return a.first > b.first; });
+  uint64_t migrated = 0;
+  for (auto& [heat, f] : hot) {
+    if (migrated >= budget) {
+      break;
+    }
+    uint8_t target = vselector->select_prefer_bdev(f->vselector_hint);
+    if (target == BDEV_SLOW || !alloc[target]) {
+      continue;
+    }
+    uint64_t size = f->fnode.size;
+    uint64_t total = _get_total(target);
+    uint64_t free = alloc[target]->get_free();
+    if (free < size || free - size < total * min_free_ratio) {
+      dout(20) << __func__ << " not enough room on bdev " << (int)target
+	       << " for ino " << f->fnode.ino << dendl;
+      continue;
+    }
+    uint64_t moved = 0;
+    int r = _migrate_file_to_fast_LNF_D(f, target, &moved);
+    if (r < 0) {
+      dout(10) << __func__ << " failed to migrate ino " << f->fnode.ino
+	       << ": " << cpp_strerror(r) << dendl;
+      continue;
+    }
+    migrated += moved;
+  }
+  if (migrated) {
+    // persist new extent maps, old ones are released after log flush
+    _flush_and_sync_log_LD();
+  }
+  return migrated;
+}
+
+int BlueFS::_migrate_file_to_fast_LNF_D(FileRef f, uint8_t target,
+					uint64_t *moved)
+{
+  bluefs_fnode_t old;
+  {
+    std::lock_guard fl(f->lock);
+    old.size = f->fnode.size;
+    old.clone_extents(f->fnode);
+  }
+  dout(10) << __func__ << " ino " << f->fnode.ino << " size 0x" << std::hex
+	   << old.size << std::dec << " to bdev " << (int)target << dendl;
+
+  bluefs_fnode_t tmp;
+  int r = _allocate(target, std::max<uint64_t>(old.size, 1), 0, &tmp,
+		    nullptr, 0, false);
+  if (r < 0) {
+    return r;
+  }
+  auto release_extents = [this](const auto& extents) {
+    std::lock_guard dl(dirty.lock);
+    for (auto& p : extents) {
+      dirty.pending_release[p.bdev].insert(p.offset, p.length);
+    }
+  };
+
+  // copy data; file has no writers so it is stable as long as it
+  // stays that way, which is rechecked below
+  uint64_t pos = 0;
+  uint64_t end = std::min(old.allocated, tmp.allocated);
+  IOContext ioc(cct, nullptr);
+  for (auto& e : old.extents) {
+    if (pos >= end) {
+      break;
+    }
+    uint64_t len = std::min<uint64_t>(e.length, end - pos);
+    bufferlist bl;
+    r = _bdev_read(e.bdev, e.offset, len, &bl, &ioc, false);
+    if (r < 0) {
+      release_extents(tmp.extents);
+      return r;
+    }
+    uint64_t done = 0;
+    while (done < len) {
+      uint64_t x_off = 0;
+      auto p = tmp.seek(pos + done, &x_off);
+      uint64_t l = std::min<uint64_t>(p->length - x_off, len - done);
+      bufferlist t;
+      t.substr_of(bl, done, l);
+      bdev[p->bdev]->write(p->offset + x_off, t, false);
+      done += l;
+    }
+    pos += len;
+  }
+  bdev[target]->flush();
+
+  // keep readers away from the extent map while it is replaced
+  f->migrating = true;
+  while (f->num_reading.load() != 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  bool swapped = false;
+  {
+    std::lock_guard ll(log.lock);
+    std::lock_guard nl(nodes.lock);
+    std::lock_guard fl(f->lock);
+    auto same = [](const bluefs_extent_t& a, const bluefs_extent_t& b) {
+      return a.bdev == b.bdev && a.offset == b.offset && a.length == b.length;
+    };
+    if (!f->deleted && f->num_writers == 0 && f->fnode.size == old.size &&
+	std::equal(f->fnode.extents.begin(), f->fnode.extents.end(),
+		   old.extents.begin(), old.extents.end(), same)) {
+      for (auto& e : f->fnode.extents) {
+	vselector->sub_usage(f->vselector_hint, e);
+      }
+      f->fnode.swap_extents(tmp);
+      for (auto& e : f->fnode.extents) {
+	vselector->add_usage(f->vselector_hint, e);
+      }
+      log.t.op_file_update(f->fnode);
+      swapped = true;
+    }
+  }
+  {
+    std::lock_guard l(hot_migrate_lock);
+    f->migrating = false;
+    hot_migrate_cond.notify_all();
+  }
+  // tmp holds the extents that are no longer referenced
+  release_extents(tmp.extents);
+  if (!swapped) {
+    dout(10) << __func__ << " ino " << f->fnode.ino
+	     << " changed while copying, skipped" << dendl;
+    return -EAGAIN;
+  }
+  *moved = old.size;
+  logger->inc(l_bluefs_hot_migrated_files);
+  logger->inc(l_bluefs_hot_migrated_bytes, old.size);
+  dout(10) << __func__ << " ino " << f->fnode.ino << " now "
+	   << lock_fnode_print(f) << dendl;
+  return 0;
+}
+
 int BlueFS::open_for_write(
   std::string_view dirname,
   std::string_view filename,
@@ -11,6 +11,7 @@
 #include "blk/BlockDevice.h"
 
 #include "common/RefCountedObj.h"
+#include "common/Thread.h"
 #include "common/ceph_context.h"
 #include "global/global_context.h"
 #include "include/common_fwd.h"
@@ -56,6 +57,8 @@ enum {
   l_bluefs_read_random_disk_bytes_slow,
   l_bluefs_read_random_buffer_count,
   l_bluefs_read_random_buffer_bytes,
+  l_bluefs_read_random_batch_count,
+  l_bluefs_read_random_batch_reqs,
   l_bluefs_read_lat,
   l_bluefs_read_count,
   l_bluefs_read_bytes,
@@ -85,6 +88,12 @@ enum {
   l_bluefs_wal_alloc_max_lat,
   l_bluefs_db_alloc_max_lat,
   l_bluefs_slow_alloc_max_lat,
+  l_bluefs_fsync_lat_histogram,
+  l_bluefs_compaction_bg,
+  l_bluefs_spilled_files,
+  l_bluefs_spilled_bytes,
+  l_bluefs_hot_migrated_files,
+  l_bluefs_hot_migrated_bytes,
   l_bluefs_last,
 };
 
@@ -245,6 +254,9 @@ public:
 
     std::atomic_int num_readers, num_writers;
     std::atomic_int num_reading;
+    std::atomic<uint64_t> num_reads;  ///< reads since last hot migrate pass
+    uint64_t heat;                    ///< decayed num_reads, hot migrate thread only
+    std::atomic<bool> migrating;      ///< extents are being replaced, readers wait
 
     void* vselector_hint = nullptr;
     /* lock protects fnode and other the parts that can be modified during read & write operations.
@@ -265,6 +277,9 @@ public:
 	num_readers(0),
 	num_writers(0),
 	num_reading(0),
+	num_reads(0),
+	heat(0),
+	migrating(false),
         vselector_hint(nullptr)
       {}
     ~File() override {
@@ -427,6 +442,14 @@ public:
     }
   };
 
+  /// one range of read_random_batch()
+  struct ReadRequest {
+    uint64_t offset;
+    uint64_t len;
+    char *out;
+    int64_t result = 0;  ///< [out] bytes read
+  };
+
   struct FileLock {
     MEMPOOL_CLASS_HELPERS();
 
@@ -482,6 +505,53 @@ private:
   std::atomic<bool> log_is_compacting{false};                    ///< signals that bluefs log is already ongoing compaction
   std::atomic<bool> log_forbidden_to_expand{false};              ///< used to signal that async compaction is in state
                                                                  ///  that prohibits expansion of bluefs log
+
+  /*
+   * Log compaction requested from the write path (flush/fsync/sync_metadata)
+   * is handed over to this thread, so that the caller doesn't pay for
+   * writing out the compacted log. Only the short jump-to-new-extent step
+   * of async compaction takes log.lock.
+   */
+  struct LogCompactThread : public Thread {
+    BlueFS *fs;
+    explicit LogCompactThread(BlueFS *fs) : fs(fs) {}
+    void *entry() override {
+      fs->_log_compact_thread();
+      return nullptr;
+    }
+  } log_compact_thread{this};
+  ceph::mutex log_compact_lock = ceph::make_mutex("BlueFS::log_compact_lock");
+  ceph::condition_variable log_compact_cond;
+  bool log_compact_requested = false;
+  bool log_compact_stop = false;
+
+  void _log_compact_thread();
+  void _start_log_compact_thread();
+  void _stop_log_compact_thread();
+
+  /*
+   * Files that the volume selector prefers to keep on the fast device but
+   * which spilled over to BDEV_SLOW are moved back by this thread once they
+   * turn out to be read often and BDEV_DB has room again.
+   */
+  struct HotMigrateThread : public Thread {
+    BlueFS *fs;
+    explicit HotMigrateThread(BlueFS *fs) : fs(fs) {}
+    void *entry() override {
+      fs->_hot_migrate_thread();
+      return nullptr;
+    }
+  } hot_migrate_thread{this};
+  ceph::mutex hot_migrate_lock = ceph::make_mutex("BlueFS::hot_migrate_lock");
+  ceph::condition_variable hot_migrate_cond;
+  bool hot_migrate_stop = false;
+
+  void _hot_migrate_thread();
+  void _start_hot_migrate_thread();
+  void _stop_hot_migrate_thread();
+  uint64_t _hot_migrate_pass_LNF_LD_D();
+  int _migrate_file_to_fast_LNF_D(FileRef f, uint8_t target, uint64_t *moved);
+  void _start_reading(File *f);
   /*
    * There are up to 3 block devices:
    *
@@ -616,6 +686,9 @@ private:
     uint64_t offset, ///< [in] offset
     uint64_t len,    ///< [in] this many bytes
     char *out);      ///< [out] optional: or copy it here
+  void _read_random_batch(
+    FileReader *h,
+    std::vector<ReadRequest>& reqs);
 
   int _open_super();
   int _write_super(int dev);
@@ -766,6 +839,11 @@ public:
     // atomics and asserts).
     return _read_random(h, offset, len, out);
   }
+  /// read several ranges of a file, the device reads are issued in parallel
+  void read_random_batch(FileReader *h, std::vector<ReadRequest>& reqs) {
+    // same locking as read_random()
+    _read_random_batch(h, reqs);
+  }
   void invalidate_cache(FileRef f, uint64_t offset, uint64_t len);
   int preallocate(FileRef f, uint64_t offset, uint64_t len);
   int truncate(FileWriter *h, uint64_t offset);
@@ -778,6 +856,9 @@ public:
   }
   uint64_t debug_get_dirty_seq(FileWriter *h);
   bool debug_get_is_dev_dirty(FileWriter *h, uint8_t dev);
+  uint64_t debug_hot_migrate_pass() {
+    return _hot_migrate_pass_LNF_LD_D();
+  }
 
 private:
   // Wrappers for BlockDevice::read(...) and BlockDevice::read_random(...)
@@ -789,6 +870,8 @@ private:
   int _bdev_read(uint8_t ndev, uint64_t off, uint64_t len,
     ceph::buffer::list* pbl, IOContext* ioc, bool buffered);
   int _bdev_read_random(uint8_t ndev, uint64_t off, uint64_t len, char* buf, bool buffered);
+  int _bdev_aio_read_random(uint8_t ndev, uint64_t off, uint64_t len,
+    ceph::buffer::list* pbl, IOContext* ioc);
 
   /// test and compact log, if necessary
   void _maybe_compact_log_LNF_NF_LD_D();
@@ -121,6 +121,24 @@ class BlueRocksRandomAccessFile : public rocksdb::RandomAccessFile {
     return rocksdb::Status::OK();
   }
 
+  // Readers like MultiGet() use this to fetch several data blocks at once,
+  // BlueFS issues the device reads in parallel.
+  rocksdb::Status MultiRead(rocksdb::ReadRequest* reqs,
+			    size_t num_reqs) override {
+    std::vector<BlueFS::ReadRequest> bluefs_reqs;
+    bluefs_reqs.reserve(num_reqs);
+    for (size_t i = 0; i < num_reqs; ++i) {
+      bluefs_reqs.push_back({reqs[i].offset, reqs[i].len, reqs[i].scratch});
+    }
+    fs->read_random_batch(h, bluefs_reqs);
+    for (size_t i = 0; i < num_reqs; ++i) {
+      ceph_assert(bluefs_reqs[i].result >= 0);
+      reqs[i].result = rocksdb::Slice(reqs[i].scratch, bluefs_reqs[i].result);
+      reqs[i].status = rocksdb::Status::OK();
+    }
+    return rocksdb::Status::OK();
+  }
+
   // Tries to get an unique ID for this file that will be the same each time
   // the file is opened (and will stay the same while the file is open).
   // Furthermore, it tries to make this ID at most "max_size" bytes. If such an
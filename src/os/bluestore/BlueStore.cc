@@ -36,6 +36,7 @@
 #include "include/stringify.h"
 #include "include/str_map.h"
 #include "include/util.h"
+#include "common/admin_socket.h"
 #include "common/errno.h"
 #include "common/safe_io.h"
 #include "common/PriorityCache.h"
@@ -128,8 +129,11 @@ const string PREFIX_DEFERRED = "L";    // id -> deferred_transaction_t
 const string PREFIX_ALLOC = "B";       // u64 offset -> u64 length (freelist)
 const string PREFIX_ALLOC_BITMAP = "b";// (see BitmapFreelistManager)
 const string PREFIX_SHARED_BLOB = "X"; // u64 SB id -> shared_blob_t
+const string PREFIX_ALLOC_DELTA = "D"; // u64 seq -> allocated, released
 
 const string BLUESTORE_GLOBAL_STATFS_KEY = "bluestore_statfs";
+// PREFIX_SUPER key holding the deep fsck read position
+static const string FSCK_DEEP_DONE_KEY = "fsck_deep_done";
 
 #define OBJECT_MAX_SIZE 0xffffffff // 32 bits
 
@@ -543,6 +547,11 @@ static void get_deferred_key(uint64_t seq, string *out)
   _key_encode_u64(seq, out);
 }
 
+static void get_alloc_delta_key(uint64_t seq, string *out)
+{
+  _key_encode_u64(seq, out);
+}
+
 static void get_pool_stat_key(int64_t pool_id, string *key)
 {
   key->clear();
@@ -1143,6 +1152,17 @@ struct LruOnodeCacheShard : public BlueStore::OnodeCacheShard {
       dout(20) << __func__ << "  rm " << o->oid << " "
                << o->nref << " " << o->cached << dendl;
 
+      if (_maybe_unload_shards(o)) {
+        // keep it, in compact form, for another trip down the LRU
+        lru.push_front(*o);
+        if (o->cache_age_bin != age_bins.front()) {
+          *(o->cache_age_bin) -= 1;
+          o->cache_age_bin = age_bins.front();
+          *(o->cache_age_bin) += 1;
+        }
+        ++n;
+        continue;
+      }
       *(o->cache_age_bin) -= 1;
       if (o->pin_nref > 1) {
         dout(20) << __func__ << " " << this << " " << " " << " " << o->oid << dendl;
@@ -1176,15 +1196,175 @@ struct LruOnodeCacheShard : public BlueStore::OnodeCacheShard {
 #endif
 };
 
+// ClockOnodeCacheShard
+//
+// CLOCK (second chance) replacement.  Onodes stay on the ring while they
+// are pinned and the hand simply skips them, so unpinning an existing
+// onode only sets its reference bit and does not need the shard lock.
+struct ClockOnodeCacheShard : public BlueStore::OnodeCacheShard {
+  typedef boost::intrusive::list<
+    BlueStore::Onode,
+    boost::intrusive::member_hook<
+      BlueStore::Onode,
+      boost::intrusive::list_member_hook<>,
+      &BlueStore::Onode::lru_item> > list_t;
+
+  list_t ring;
+  list_t::iterator hand = ring.end();
+  uint64_t num_pinned = 0;  ///< pinned entries seen by the last sweep
+
+  explicit ClockOnodeCacheShard(CephContext *cct) : BlueStore::OnodeCacheShard(cct) {}
+
+  void _add(BlueStore::Onode* o, int level) override
+  {
+    o->set_cached();
+    o->cache_ref = false;
+    // just behind the hand is the last spot it visits; level 0 entries go
+    // right in front of it instead
+    if (level > 0) {
+      ring.insert(hand, *o);
+    } else if (hand == ring.end()) {
+      ring.push_front(*o);
+    } else {
+      hand = ring.insert(hand, *o);
+    }
+    o->cache_age_bin = age_bins.front();
+    *(o->cache_age_bin) += 1;
+    ++num;
+    dout(20) << __func__ << " " << this << " " << o->oid << " added, num="
+             << num << dendl;
+  }
+  void _rm(BlueStore::Onode* o) override
+  {
+    o->clear_cached();
+    if (o->lru_item.is_linked()) {
+      *(o->cache_age_bin) -= 1;
+      auto p = ring.iterator_to(*o);
+      if (p == hand) {
+        ++hand;
+      }
+      ring.erase(p);
+    }
+    ceph_assert(num);
+    --num;
+    dout(20) << __func__ << " " << this << " " << " " << o->oid << " removed, num=" << num << dendl;
+  }
+
+  void maybe_unpin(BlueStore::Onode* o) override
+  {
+    if (o->exists) {
+      // cache hit; the ring itself is left alone
+      o->cache_ref.store(true, std::memory_order_relaxed);
+      return;
+    }
+    OnodeCacheShard* ocs = this;
+    ocs->lock.lock();
+    // It is possible that during waiting split_cache moved us to different OnodeCacheShard.
+    while (ocs != o->c->get_onode_cache()) {
+      ocs->lock.unlock();
+      ocs = o->c->get_onode_cache();
+      ocs->lock.lock();
+    }
+    if (o->is_cached() && o->pin_nref == 1 && !o->exists) {
+      ocs->_rm(o);
+      dout(20) << __func__ << " " << this << " " << o->oid << " removed"
+               << dendl;
+      // remove will also decrement nref
+      o->c->onode_space._remove(o->oid);
+    }
+    ocs->lock.unlock();
+  }
+
+  void _trim_to(uint64_t new_size) override
+  {
+    if (new_size >= num) {
+      return;
+    }
+    uint64_t n = num - new_size;
+    // two turns of the hand clear every reference bit; whatever is left
+    // after that is pinned
+    uint64_t budget = 2 * ring.size();
+    num_pinned = 0;
+    while (n > 0 && budget-- > 0 && !ring.empty()) {
+      if (hand == ring.end()) {
+        hand = ring.begin();
+        num_pinned = 0;
+      }
+      BlueStore::Onode *o = &*hand;
+      if (o->pin_nref > 1) {
+        ++num_pinned;
+        ++hand;
+        continue;
+      }
+      if (o->cache_ref.exchange(false, std::memory_order_relaxed) ||
+          _maybe_unload_shards(o)) {
+        // second chance
+        if (o->cache_age_bin != age_bins.front()) {
+          *(o->cache_age_bin) -= 1;
+          o->cache_age_bin = age_bins.front();
+          *(o->cache_age_bin) += 1;
+        }
+        ++hand;
+        continue;
+      }
+      dout(20) << __func__ << "  rm " << o->oid << " "
+               << o->nref << " " << o->cached << dendl;
+      _rm(o);
+      o->c->onode_space._remove(o->oid);
+      --n;
+    }
+  }
+  void _move_pinned(OnodeCacheShard *to, BlueStore::Onode *o) override
+  {
+    if (to == this) {
+      return;
+    }
+    _rm(o);
+    ceph_assert(o->nref > 1);
+    to->_add(o, 0);
+  }
+  void add_stats(uint64_t *onodes, uint64_t *pinned_onodes) override
+  {
+    std::lock_guard l(lock);
+    *onodes += num;
+    *pinned_onodes += std::min<uint64_t>(num_pinned, num);
+  }
+#ifdef DEBUG_CACHE
+  void _audit(const char *when) override
+  {
+  }
+#endif
+};
+
 // OnodeCacheShard
+bool BlueStore::OnodeCacheShard::_maybe_unload_shards(BlueStore::Onode* o)
+{
+  if (!cct->_conf->bluestore_onode_cache_unload_shards ||
+      o->pin_nref > 1 || !o->exists) {
+    return false;
+  }
+  unsigned n = o->extent_map.unload_clean_shards();
+  if (!n) {
+    return false;
+  }
+  dout(20) << __func__ << " " << this << " " << o->oid << " unloaded " << n
+           << " shards" << dendl;
+  if (logger) {
+    logger->inc(l_bluestore_onode_shard_unloads, n);
+  }
+  return true;
+}
+
 BlueStore::OnodeCacheShard *BlueStore::OnodeCacheShard::create(
     CephContext* cct,
     string type,
     PerfCounters *logger)
 {
   BlueStore::OnodeCacheShard *c = nullptr;
-  // Currently we only implement an LRU cache for onodes
-  c = new LruOnodeCacheShard(cct);
+  if (type == "clock")
+    c = new ClockOnodeCacheShard(cct);
+  else
+    c = new LruOnodeCacheShard(cct);
   c->logger = logger;
   return c;
 }
@@ -1630,6 +1810,126 @@ public:
 #endif
 };
 
+// ClockBufferCacheShard
+//
+// CLOCK (second chance) replacement; a hit only sets the reference bit
+// (kept in cache_private) instead of relinking the buffer.
+struct ClockBufferCacheShard : public BlueStore::BufferCacheShard {
+  typedef boost::intrusive::list<
+    BlueStore::Buffer,
+    boost::intrusive::member_hook<
+      BlueStore::Buffer,
+      boost::intrusive::list_member_hook<>,
+      &BlueStore::Buffer::lru_item> > list_t;
+  list_t ring;
+  list_t::iterator hand = ring.end();
+
+  enum {
+    BUFFER_COLD = 0,
+    BUFFER_REFERENCED,
+  };
+
+  explicit ClockBufferCacheShard(CephContext *cct) : BlueStore::BufferCacheShard(cct) {}
+
+  void _add(BlueStore::Buffer *b, int level, BlueStore::Buffer *near) override {
+    // a non-zero cache_private here is a hint from discard
+    b->cache_private = b->cache_private ? BUFFER_REFERENCED : BUFFER_COLD;
+    if (near) {
+      ring.insert(ring.iterator_to(*near), *b);
+    } else if (level > 0) {
+      ring.insert(hand, *b);
+    } else if (hand == ring.end()) {
+      ring.push_front(*b);
+    } else {
+      hand = ring.insert(hand, *b);
+    }
+    buffer_bytes += b->length;
+    b->cache_age_bin = age_bins.front();
+    *(b->cache_age_bin) += b->length;
+    num = ring.size();
+  }
+  void _rm(BlueStore::Buffer *b) override {
+    ceph_assert(buffer_bytes >= b->length);
+    buffer_bytes -= b->length;
+    assert(*(b->cache_age_bin) >= b->length);
+    *(b->cache_age_bin) -= b->length;
+    auto q = ring.iterator_to(*b);
+    if (q == hand) {
+      ++hand;
+    }
+    ring.erase(q);
+    num = ring.size();
+  }
+  void _move(BlueStore::BufferCacheShard *src, BlueStore::Buffer *b) override {
+    src->_rm(b);
+    _add(b, 0, nullptr);
+  }
+  void _adjust_size(BlueStore::Buffer *b, int64_t delta) override {
+    ceph_assert((int64_t)buffer_bytes + delta >= 0);
+    buffer_bytes += delta;
+    assert(*(b->cache_age_bin) + delta >= 0);
+    *(b->cache_age_bin) += delta;
+  }
+  void _touch(BlueStore::Buffer *b) override {
+    b->cache_private = BUFFER_REFERENCED;
+  }
+
+  void _trim_to(uint64_t max) override
+  {
+    uint64_t budget = 2 * ring.size();
+    while (buffer_bytes > max && budget-- > 0 && !ring.empty()) {
+      if (hand == ring.end()) {
+        hand = ring.begin();
+      }
+      BlueStore::Buffer *b = &*hand;
+      if (b->cache_private == BUFFER_REFERENCED) {
+        // second chance
+        b->cache_private = BUFFER_COLD;
+        if (b->cache_age_bin != age_bins.front()) {
+          *(b->cache_age_bin) -= b->length;
+          b->cache_age_bin = age_bins.front();
+          *(b->cache_age_bin) += b->length;
+        }
+        ++hand;
+        continue;
+      }
+      ceph_assert(b->is_clean());
+      dout(20) << __func__ << " rm " << *b << dendl;
+      b->space->_rm_buffer(this, b);
+    }
+    num = ring.size();
+  }
+
+  void add_stats(uint64_t *extents,
+                 uint64_t *blobs,
+                 uint64_t *buffers,
+                 uint64_t *bytes) override {
+    std::lock_guard l(lock);
+    *extents += num_extents;
+    *blobs += num_blobs;
+    *buffers += num;
+    *bytes += buffer_bytes;
+  }
+#ifdef DEBUG_CACHE
+  void _audit(const char *when) override
+  {
+    dout(10) << __func__ << " " << when << " start" << dendl;
+    uint64_t s = 0;
+    for (auto i = ring.begin(); i != ring.end(); ++i) {
+      ceph_assert(i->cache_private <= BUFFER_REFERENCED);
+      s += i->length;
+    }
+    if (s != buffer_bytes) {
+      derr << __func__ << " buffer_size " << buffer_bytes << " actual " << s
+           << dendl;
+      ceph_assert(s == buffer_bytes);
+    }
+    dout(20) << __func__ << " " << when << " buffer_bytes " << buffer_bytes
+             << " ok" << dendl;
+  }
+#endif
+};
+
 // BuferCacheShard
 
 BlueStore::BufferCacheShard *BlueStore::BufferCacheShard::create(
@@ -1642,6 +1942,8 @@ BlueStore::BufferCacheShard *BlueStore::BufferCacheShard::create(
     c = new LruBufferCacheShard(cct);
   else if (type == "2q")
     c = new TwoQBufferCacheShard(cct);
+  else if (type == "clock")
+    c = new ClockBufferCacheShard(cct);
   else
     ceph_abort_msg("unrecognized cache type");
   c->logger = logger;
@@ -1987,6 +2289,17 @@ BlueStore::OnodeRef BlueStore::OnodeSpace::lookup(const ghobject_t& oid)
   return o;
 }
 
+void BlueStore::OnodeSpace::evict(const ghobject_t& oid)
+{
+  std::lock_guard l(cache->lock);
+  ldout(cache->cct, 20) << __func__ << " " << oid << dendl;
+  auto p = onode_map.find(oid);
+  if (p != onode_map.end()) {
+    cache->_rm(p->second.get());
+    onode_map.erase(p);
+  }
+}
+
 void BlueStore::OnodeSpace::clear()
 {
   std::lock_guard l(cache->lock);
@@ -4227,6 +4540,30 @@ void BlueStore::ExtentMap::fault_range(
   }
 }
 
+unsigned BlueStore::ExtentMap::unload_clean_shards()
+{
+  unsigned n = 0;
+  for (size_t i = 0; i < shards.size(); ++i) {
+    auto& s = shards[i];
+    if (!s.loaded || s.dirty) {
+      continue;
+    }
+    // extents never cross shard boundaries and non-spanning blobs stay
+    // within their shard, so this drops the shard's blobs as well while
+    // spanning blobs (and their persisted refs) are left alone
+    uint32_t end = i + 1 < shards.size() ?
+      shards[i + 1].shard_info->offset : OBJECT_MAX_SIZE;
+    auto p = seek_lextent(s.shard_info->offset);
+    while (p != extent_map.end() && p->logical_offset < end) {
+      rm(p++);
+    }
+    s.extents = 0;
+    s.loaded = false;
+    ++n;
+  }
+  return n;
+}
+
 void BlueStore::ExtentMap::dirty_range(
   uint32_t offset,
   uint32_t length)
@@ -4774,6 +5111,24 @@ void BlueStore::Onode::flush()
   ldout(c->store->cct, 20) << __func__ << " done" << dendl;
 }
 
+BlueStore::ReadaheadState* BlueStore::Onode::get_readahead()
+{
+  ReadaheadState* ras = readahead.load();
+  if (!ras) {
+    auto& conf = c->store->cct->_conf;
+    auto n = new ReadaheadState;
+    n->ra.set_trigger_requests(conf->bluestore_readahead_trigger_requests);
+    n->ra.set_min_readahead_size(conf->bluestore_readahead_min_bytes);
+    n->ra.set_max_readahead_size(conf->bluestore_readahead_max_bytes);
+    if (readahead.compare_exchange_strong(ras, n)) {
+      ras = n;
+    } else {
+      delete n;
+    }
+  }
+  return ras;
+}
+
 void BlueStore::Onode::dump(Formatter* f) const
 {
   onode.dump(f);
@@ -5106,6 +5461,57 @@ BlueStore::OnodeRef BlueStore::Collection::get_onode(
   return onode_space.add_onode(oid, o);
 }
 
+void BlueStore::Collection::get_onodes(
+  const std::vector<ghobject_t>& oids,
+  const std::vector<bool>& create,
+  std::vector<OnodeRef>* onodes)
+{
+  ceph_assert(oids.size() == create.size());
+  ceph_assert(ceph_mutex_is_locked(lock));
+
+  spg_t pgid;
+  bool is_pg = cid.is_pg(&pgid);
+  onodes->resize(oids.size());
+  std::set<string> keys;
+  std::vector<std::pair<size_t, string>> missing; ///< oids index, key
+  for (size_t i = 0; i < oids.size(); ++i) {
+    const ghobject_t& oid = oids[i];
+    ceph_assert(!create[i] || ceph_mutex_is_wlocked(lock));
+    if (is_pg && !oid.match(cnode.bits, pgid.ps())) {
+      lderr(store->cct) << __func__ << " oid " << oid << " not part of "
+			<< pgid << " bits " << cnode.bits << dendl;
+      ceph_abort();
+    }
+    (*onodes)[i] = onode_space.lookup(oid);
+    if (!(*onodes)[i]) {
+      string key;
+      get_object_key(store->cct, oid, &key);
+      keys.insert(key);
+      missing.emplace_back(i, std::move(key));
+    }
+  }
+  if (missing.empty()) {
+    return;
+  }
+  ldout(store->cct, 20) << __func__ << " reading " << keys.size()
+			<< " of " << oids.size() << " onodes" << dendl;
+
+  std::map<string, bufferlist> values;
+  store->db->get(PREFIX_OBJ, keys, &values);
+  store->logger->inc(l_bluestore_onode_batch_reads, keys.size());
+  for (auto& [i, key] : missing) {
+    bufferlist v;
+    auto p = values.find(key);
+    if (p != values.end()) {
+      v = p->second;
+    } else if (!create[i]) {
+      continue;
+    }
+    OnodeRef o(Onode::create_decode(this, oids[i], key, v, true));
+    (*onodes)[i] = onode_space.add_onode(oids[i], o);
+  }
+}
+
 void BlueStore::Collection::split_cache(
   Collection *dest)
 {
@@ -5644,7 +6050,9 @@ BlueStore::BlueStore(CephContext *cct,
     kv_finalize_thread(this),
     min_alloc_size(_min_alloc_size),
     min_alloc_size_order(std::countr_zero(_min_alloc_size)),
-    mempool_thread(this)
+    mempool_thread(this),
+    alloc_checkpoint_thread(this),
+    defrag_thread(this)
 {
   _init_logger();
   cct->_conf.add_observer(this);
@@ -5690,6 +6098,7 @@ const char **BlueStore::get_tracked_conf_keys() const
     "bluestore_deferred_batch_ops",
     "bluestore_deferred_batch_ops_hdd",
     "bluestore_deferred_batch_ops_ssd",
+    "bluestore_deferred_adaptive",
     "bluestore_throttle_bytes",
     "bluestore_throttle_deferred_bytes",
     "bluestore_throttle_cost_per_io_hdd",
@@ -5755,7 +6164,8 @@ void BlueStore::handle_conf_change(const ConfigProxy& conf,
       changed.count("bluestore_max_alloc_size") ||
       changed.count("bluestore_deferred_batch_ops") ||
       changed.count("bluestore_deferred_batch_ops_hdd") ||
-      changed.count("bluestore_deferred_batch_ops_ssd")) {
+      changed.count("bluestore_deferred_batch_ops_ssd") ||
+      changed.count("bluestore_deferred_adaptive")) {
     if (bdev) {
       // only after startup
       _set_alloc_sizes();
@@ -6152,6 +6562,17 @@ void BlueStore::_init_logger()
   b.add_time_avg(l_bluestore_read_lat, "read_lat",
 		 "Average read latency",
 		 "r_l", PerfCountersBuilder::PRIO_CRITICAL);
+  b.add_u64_counter(l_bluestore_readahead_count, "readahead_count",
+		    "Read-ahead requests issued");
+  b.add_u64_counter(l_bluestore_readahead_bytes, "readahead_bytes",
+		    "Bytes requested by read-ahead", NULL, 0,
+		    unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_readahead_hit_bytes, "readahead_hit_bytes",
+		    "Bytes of reads served from read-ahead data", NULL, 0,
+		    unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_readahead_wasted_bytes, "readahead_wasted_bytes",
+		    "Read-ahead bytes dropped or skipped over by the reader",
+		    NULL, 0, unit_t(UNIT_BYTES));
   //****************************************
 
   // kv_thread latencies
@@ -6168,6 +6589,9 @@ void BlueStore::_init_logger()
   b.add_time_avg(l_bluestore_kv_final_lat, "kv_final_lat",
 		 "Average kv_finalize thread latency",
 		 "kfll", PerfCountersBuilder::PRIO_INTERESTING);
+  b.add_u64_avg(l_bluestore_kv_sync_batch, "kv_sync_batch",
+		"Average number of transactions committed per kv_sync cycle",
+		"ksb", PerfCountersBuilder::PRIO_INTERESTING);
   //****************************************
 
   // write op stats
@@ -6228,6 +6652,17 @@ void BlueStore::_init_logger()
 		    NULL,
 		    PerfCountersBuilder::PRIO_DEBUGONLY,
 		    unit_t(UNIT_BYTES));
+  b.add_u64(l_bluestore_deferred_adaptive_size,
+	    "deferred_adaptive_size",
+	    "Effective prefer_deferred_size",
+	    NULL,
+	    PerfCountersBuilder::PRIO_DEBUGONLY,
+	    unit_t(UNIT_BYTES));
+  b.add_u64(l_bluestore_deferred_adaptive_batch_ops,
+	    "deferred_adaptive_batch_ops",
+	    "Effective deferred_batch_ops");
+  b.add_time_avg(l_bluestore_deferred_aio_lat, "deferred_aio_lat",
+		 "Average latency of deferred write batches on the main device");
 
   b.add_u64_counter(l_bluestore_write_big_skipped_blobs,
       "write_big_skipped_blobs",
@@ -6264,6 +6699,10 @@ void BlueStore::_init_logger()
 	    "Sum for beneficial compress ops");
   b.add_u64_counter(l_bluestore_compress_rejected_count, "compress_rejected_count",
 	    "Sum for compress ops rejected due to low net gain of space");
+  b.add_u64_counter(l_bluestore_compress_skipped_count, "compress_skipped_count",
+	    "Sum for compress ops skipped since a sample compressed poorly");
+  b.add_u64_counter(l_bluestore_compress_parallel_count, "compress_parallel_count",
+	    "Sum for blobs handed to the compression threads");
   //****************************************
 
   // onode cache stats
@@ -6278,11 +6717,16 @@ void BlueStore::_init_logger()
   b.add_u64_counter(l_bluestore_onode_misses, "onode_misses",
 		    "Count of onode cache lookup misses",
 		    "o_ms", PerfCountersBuilder::PRIO_USEFUL);
+  b.add_u64_counter(l_bluestore_onode_batch_reads, "onode_batch_reads",
+		    "Onodes read from the DB by batched lookups");
   b.add_u64_counter(l_bluestore_onode_shard_hits, "onode_shard_hits",
 		    "Count of onode shard cache lookups hits");
   b.add_u64_counter(l_bluestore_onode_shard_misses,
 		    "onode_shard_misses",
 		    "Count of onode shard cache lookups misses");
+  b.add_u64_counter(l_bluestore_onode_shard_unloads,
+		    "onode_shard_unloads",
+		    "Count of clean onode shards dropped from cache");
   b.add_u64(l_bluestore_extents, "onode_extents",
 	    "Number of extents in cache");
   b.add_u64(l_bluestore_blobs, "onode_blobs",
@@ -6351,6 +6795,8 @@ void BlueStore::_init_logger()
   b.add_time_avg(l_bluestore_omap_get_values_lat, "omap_get_values_lat",
     "Average omap get_values call latency",
     "ogvl", PerfCountersBuilder::PRIO_USEFUL);
+  b.add_time_avg(l_bluestore_omap_iterate_lat, "omap_iterate_lat",
+    "Average omap iterate call latency");
   b.add_time_avg(l_bluestore_omap_clear_lat, "omap_clear_lat",
     "Average omap clear call latency");
   b.add_time_avg(l_bluestore_clist_lat, "clist_lat",
@@ -6411,6 +6857,24 @@ void BlueStore::_init_logger()
     "Average bluestore allocator latency",
     "bsal",
     PerfCountersBuilder::PRIO_USEFUL);
+  b.add_u64_counter(l_bluestore_alloc_deltas, "alloc_deltas",
+    "Allocation changes logged for the next allocation checkpoint");
+  b.add_time_avg(l_bluestore_alloc_checkpoint_lat, "alloc_checkpoint_lat",
+    "Average allocation checkpoint latency");
+  b.add_u64_counter(l_bluestore_defrag_scanned_objects, "defrag_scanned_objects",
+    "Objects checked for fragmentation");
+  b.add_u64_counter(l_bluestore_defrag_objects, "defrag_objects",
+    "Objects rewritten by defragmentation");
+  b.add_u64_counter(l_bluestore_defrag_bytes, "defrag_bytes",
+    "Bytes rewritten by defragmentation", NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_defrag_removed_extents, "defrag_removed_extents",
+    "Physical extents eliminated by defragmentation");
+  b.add_time_avg(l_bluestore_defrag_lat, "defrag_lat",
+    "Average defragmentation pass duration");
+  b.add_u64_counter(l_bluestore_fsck_deep_objects, "fsck_deep_objects",
+    "Objects whose data was read by deep fsck");
+  b.add_u64_counter(l_bluestore_fsck_deep_bytes, "fsck_deep_bytes",
+    "Bytes read by deep fsck", NULL, 0, unit_t(UNIT_BYTES));
 
   logger = b.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
@@ -6582,25 +7046,32 @@ void BlueStore::_set_alloc_sizes(void)
   max_alloc_size = cct->_conf->bluestore_max_alloc_size;
 
   if (cct->_conf->bluestore_prefer_deferred_size) {
-    prefer_deferred_size = cct->_conf->bluestore_prefer_deferred_size;
+    prefer_deferred_size_conf = cct->_conf->bluestore_prefer_deferred_size;
   } else {
     if (_use_rotational_settings()) {
-      prefer_deferred_size = cct->_conf->bluestore_prefer_deferred_size_hdd;
+      prefer_deferred_size_conf = cct->_conf->bluestore_prefer_deferred_size_hdd;
     } else {
-      prefer_deferred_size = cct->_conf->bluestore_prefer_deferred_size_ssd;
+      prefer_deferred_size_conf = cct->_conf->bluestore_prefer_deferred_size_ssd;
     }
   }
 
   if (cct->_conf->bluestore_deferred_batch_ops) {
-    deferred_batch_ops = cct->_conf->bluestore_deferred_batch_ops;
+    deferred_batch_ops_conf = cct->_conf->bluestore_deferred_batch_ops;
   } else {
     if (_use_rotational_settings()) {
-      deferred_batch_ops = cct->_conf->bluestore_deferred_batch_ops_hdd;
+      deferred_batch_ops_conf = cct->_conf->bluestore_deferred_batch_ops_hdd;
     } else {
-      deferred_batch_ops = cct->_conf->bluestore_deferred_batch_ops_ssd;
+      deferred_batch_ops_conf = cct->_conf->bluestore_deferred_batch_ops_ssd;
     }
   }
 
+  // (re)start the adaptive policy, if any, from the configured values
+  prefer_deferred_size = prefer_deferred_size_conf.load();
+  deferred_batch_ops = deferred_batch_ops_conf.load();
+  deferred_adaptive.reset = true;
+  logger->set(l_bluestore_deferred_adaptive_size, prefer_deferred_size);
+  logger->set(l_bluestore_deferred_adaptive_batch_ops, deferred_batch_ops);
+
   dout(10) << __func__ << " min_alloc_size 0x" << std::hex << min_alloc_size
 	   << std::dec << " order " << (int)min_alloc_size_order
 	   << " max_alloc_size 0x" << std::hex << max_alloc_size
@@ -6876,6 +7347,11 @@ int BlueStore::_init_alloc(std::map<uint64_t, uint64_t> *zone_adjustments)
 
   uint64_t num = 0, bytes = 0;
   utime_t start_time = ceph_clock_now();
+  alloc_delta_log = false;
+  alloc_delta_log_empty = false;
+  alloc_file_restored = false;
+  alloc_file_delta_seq.reset();
+  alloc_delta_replayed_seq = 0;
   if (!fm->is_null_manager()) {
     // This is the original path - loading allocation map from RocksDB and feeding into the allocator
     dout(5) << __func__ << "::NCB::loading allocation from FM -> alloc" << dendl;
@@ -6931,30 +7407,139 @@ void BlueStore::_post_init_alloc(const std::map<uint64_t, uint64_t>& zone_adjust
 {
   int r = 0;
   if (fm->is_null_manager()) {
-    // Now that we load the allocation map we need to invalidate the file as new allocation won't be reflected
-    // Changes to the allocation map (alloc/release) are not updated inline and will only be stored on umount()
-    // This means that we should not use the existing file on failure case (unplanned shutdown) and must resort
-    //  to recovery from RocksDB::ONodes
-    r = invalidate_allocation_file_on_bluefs();
+    r = _start_alloc_delta_log();
+    if (!alloc_delta_log) {
+      // Now that we load the allocation map we need to invalidate the file as new allocation won't be reflected
+      // Changes to the allocation map (alloc/release) are not updated inline and will only be stored on umount()
+      // This means that we should not use the existing file on failure case (unplanned shutdown) and must resort
+      //  to recovery from RocksDB::ONodes
+      r = invalidate_allocation_file_on_bluefs();
+    }
   }
   ceph_assert(r >= 0);
 }
 
-void BlueStore::_close_alloc()
+// With a non-zero bluestore_allocation_checkpoint_interval every txc logs
+// the space it allocates and releases under PREFIX_ALLOC_DELTA, keyed by a
+// monotonic seq, in the same kv transaction as the rest of its metadata.
+// The allocation file records the last seq it covers, so it stays valid
+// while mounted: file + deltas past that seq is always the current map.
+// The log can only be trusted on top of a file that was written with it,
+// hence it's enabled on the next mount when the file predates it.
+int BlueStore::_start_alloc_delta_log()
 {
-  ceph_assert(bdev);
-  bdev->discard_drain();
-
-  ceph_assert(alloc);
-  alloc->shutdown();
-  delete alloc;
-
-  ceph_assert(shared_alloc.a);
-  if (alloc != shared_alloc.a) {
-    shared_alloc.a->shutdown();
-    delete shared_alloc.a;
+  if (cct->_conf.get_val<double>("bluestore_allocation_checkpoint_interval") <= 0) {
+    return 0;
   }
-
+  auto t = db->get_transaction();
+  if (alloc_file_restored && alloc_file_delta_seq) {
+    // deltas up to the file seq are already part of the file
+    string end;
+    get_alloc_delta_key(*alloc_file_delta_seq + 1, &end);
+    t->rm_range_keys(PREFIX_ALLOC_DELTA, string(), end);
+    alloc_checkpoint_seq = *alloc_file_delta_seq;
+    alloc_delta_seq = std::max(alloc_checkpoint_seq, alloc_delta_replayed_seq);
+    alloc_delta_log = true;
+  } else {
+    // whatever is left in the log is stale, the allocation file is either
+    // rebuilt or written from scratch on umount
+    t->rmkeys_by_prefix(PREFIX_ALLOC_DELTA);
+    alloc_checkpoint_seq = 0;
+    alloc_delta_seq = 0;
+    alloc_delta_replayed_seq = 0;
+    // the file written on umount can be used with the log next time
+    alloc_delta_log_empty = true;
+  }
+  int r = db->submit_transaction_sync(t);
+  if (r < 0) {
+    derr << __func__ << " failed to trim the allocation delta log: "
+	 << cpp_strerror(r) << dendl;
+    alloc_delta_log = false;
+    alloc_delta_log_empty = false;
+    return r;
+  }
+  if (alloc_delta_log) {
+    need_to_destage_allocation_file = true;
+    dout(1) << __func__ << " allocation delta log enabled, checkpoint seq "
+	    << alloc_checkpoint_seq << " last seq " << alloc_delta_seq << dendl;
+  }
+  return 0;
+}
+
+void BlueStore::_txc_log_alloc_delta(
+  TransContext *txc,
+  const interval_set<uint64_t>& allocated,
+  const interval_set<uint64_t>& released,
+  KeyValueDB::Transaction t)
+{
+  if (allocated.empty() && released.empty()) {
+    return;
+  }
+  // a txc reusing space released by another one is prepared only after the
+  // latter has committed, so seq order preserves causality for the replay
+  uint64_t seq = ++alloc_delta_seq;
+  bufferlist bl;
+  encode(allocated, bl);
+  encode(released, bl);
+  string key;
+  get_alloc_delta_key(seq, &key);
+  t->set(PREFIX_ALLOC_DELTA, key, bl);
+  logger->inc(l_bluestore_alloc_deltas);
+  dout(20) << __func__ << " txc " << txc << " seq " << seq << std::hex
+	   << " allocated 0x" << allocated
+	   << " released 0x" << released << std::dec << dendl;
+}
+
+int BlueStore::_replay_alloc_deltas(
+  uint64_t after_seq,
+  std::function<bool(uint64_t seq,
+		     const interval_set<uint64_t>& allocated,
+		     const interval_set<uint64_t>& released)> fn)
+{
+  string start;
+  get_alloc_delta_key(after_seq + 1, &start);
+  KeyValueDB::Iterator it =
+    db->get_iterator(PREFIX_ALLOC_DELTA, KeyValueDB::ITERATOR_NOCACHE);
+  for (it->lower_bound(start); it->valid(); it->next()) {
+    uint64_t seq;
+    string key = it->key();
+    if (key.length() != sizeof(uint64_t)) {
+      derr << __func__ << " invalid key " << pretty_binary_string(key) << dendl;
+      return -EIO;
+    }
+    _key_decode_u64(key.c_str(), &seq);
+    interval_set<uint64_t> allocated, released;
+    bufferlist bl = it->value();
+    auto p = bl.cbegin();
+    try {
+      decode(allocated, p);
+      decode(released, p);
+    } catch (ceph::buffer::error& e) {
+      derr << __func__ << " failed to decode delta " << seq << dendl;
+      return -EIO;
+    }
+    if (!fn(seq, allocated, released)) {
+      break;
+    }
+  }
+  return 0;
+}
+
+void BlueStore::_close_alloc()
+{
+  ceph_assert(bdev);
+  bdev->discard_drain();
+
+  ceph_assert(alloc);
+  alloc->shutdown();
+  delete alloc;
+
+  ceph_assert(shared_alloc.a);
+  if (alloc != shared_alloc.a) {
+    shared_alloc.a->shutdown();
+    delete shared_alloc.a;
+  }
+
   shared_alloc.reset();
   alloc = nullptr;
 }
@@ -7108,7 +7693,9 @@ bool BlueStore::_use_rotational_settings()
 bool BlueStore::is_statfs_recoverable() const
 {
   // abuse fm for now
-  return has_null_manager();
+  // no full recovery to rebuild statfs after a crash when the allocation
+  // delta log is on, so it's persisted per txc as with a real fm
+  return has_null_manager() && !alloc_delta_log;
 }
 
 bool BlueStore::test_mount_in_use()
@@ -7413,7 +8000,8 @@ int BlueStore::_open_db_and_around(bool read_only, bool to_repair)
 
   // when function is called in repair mode (to_repair=true) we skip db->open()/create()
   // we can't change bluestore allocation so no need to invlidate allocation-file
-  if (fm->is_null_manager() && !read_only && !to_repair) {
+  // with the allocation delta log the file is kept valid (see _start_alloc_delta_log)
+  if (fm->is_null_manager() && !read_only && !to_repair && !alloc_delta_log) {
     // Now that we load the allocation map we need to invalidate the file as new allocation won't be reflected
     // Changes to the allocation map (alloc/release) are not updated inline and will only be stored on umount()
     // This means that we should not use the existing file on failure case (unplanned shutdown) and must resort
@@ -8676,6 +9264,18 @@ int BlueStore::_mount()
     return r;
   }
 
+  {
+    // objects may change from now on, a deep fsck that was interrupted
+    // before must not skip them when it is run again
+    bufferlist bl;
+    if (db->get(PREFIX_SUPER, FSCK_DEEP_DONE_KEY, &bl) >= 0) {
+      dout(1) << __func__ << " dropping deep fsck position" << dendl;
+      KeyValueDB::Transaction t = db->get_transaction();
+      t->rmkey(PREFIX_SUPER, FSCK_DEEP_DONE_KEY);
+      db->submit_transaction_sync(t);
+    }
+  }
+
   // The recovery process for allocation-map needs to open collection early
   r = _open_collections();
   if (r < 0) {
@@ -8705,6 +9305,9 @@ int BlueStore::_mount()
   }
 
   mempool_thread.init();
+  if (alloc_delta_log) {
+    alloc_checkpoint_thread.init();
+  }
 
   if ((!per_pool_stat_collection || per_pool_omap != OMAP_PER_PG) &&
     cct->_conf->bluestore_fsck_quick_fix_on_mount == true) {
@@ -8720,6 +9323,7 @@ int BlueStore::_mount()
     }
   }
 
+  _defrag_start();
   mounted = true;
   return 0;
 }
@@ -8728,7 +9332,11 @@ int BlueStore::umount()
 {
   dout(5) << __func__ << dendl;
   ceph_assert(_kv_only || mounted);
+  if (!_kv_only) {
+    _defrag_stop();
+  }
   _osr_drain_all();
+  _readahead_drain();
 
   mounted = false;
 
@@ -8736,6 +9344,9 @@ int BlueStore::umount()
 
   if (!_kv_only) {
     mempool_thread.shutdown();
+    if (alloc_checkpoint_thread.is_started()) {
+      alloc_checkpoint_thread.shutdown();
+    }
     dout(20) << __func__ << " stopping kv thread" << dendl;
     _kv_stop();
     // skip cache cleanup step on fast shutdown
@@ -9734,6 +10345,204 @@ void BlueStore::_fsck_check_object_omap(FSCKDepth depth,
   }
 }
 
+int BlueStore::_fsck_read_object(Collection* c, OnodeRef& o)
+{
+  bufferlist bl;
+  uint64_t max_read_block = cct->_conf->bluestore_fsck_read_bytes_cap;
+  uint64_t offset = 0;
+  do {
+    uint64_t l = std::min(uint64_t(o->onode.size - offset), max_read_block);
+    int r = _do_read(c, o, offset, l, bl,
+      CEPH_OSD_OP_FLAG_FADVISE_NOCACHE);
+    if (r < 0) {
+      derr << "fsck error: " << o->oid << std::hex
+        << " error during read: "
+        << " " << offset << "~" << l
+        << " " << cpp_strerror(r) << std::dec
+        << dendl;
+      return r;
+    }
+    offset += l;
+    logger->inc(l_bluestore_fsck_deep_bytes, l);
+  } while (offset < o->onode.size);
+  logger->inc(l_bluestore_fsck_deep_objects);
+  return 0;
+}
+
+#undef dout_prefix
+#define dout_prefix *_dout << "bluestore.FSCKDeepReader(" << this << ") "
+
+/*
+ * Reads object data for deep fsck in a few threads while the caller keeps
+ * walking the onode keyspace. Objects are queued in key order and the number
+ * of objects in flight is bounded, so is the memory held by their decoded
+ * extent maps. The key of the last object for which it and all objects before
+ * it have been read is periodically saved, so that a deep fsck which gets
+ * interrupted can skip these objects the next time.
+ */
+class BlueStore::FSCKDeepReader {
+  struct Item {
+    CollectionRef c;
+    OnodeRef o;
+    std::string key;
+    bool done = false;
+  };
+
+  BlueStore* store;
+  CephContext* cct;
+  const size_t max_in_flight;
+  const double checkpoint_interval;
+
+  ceph::mutex lock = ceph::make_mutex("BlueStore::FSCKDeepReader::lock");
+  ceph::condition_variable cond;
+  std::list<Item> in_flight;   ///< queued or being read, in key order
+  std::deque<Item*> pending;   ///< not picked by a reader yet
+  bool stopping = false;
+  std::vector<std::thread> threads;
+
+  int64_t errors = 0;
+  uint64_t num_objects = 0;
+  uint64_t num_bytes = 0;
+  std::string done_key;        ///< this and all preceding objects are read
+  std::string resume_key;      ///< done_key saved by an interrupted run
+  ceph::mono_clock::time_point start;
+  ceph::mono_clock::time_point last_report;
+
+  void reader() {
+    std::unique_lock l(lock);
+    while (true) {
+      if (pending.empty()) {
+        if (stopping) {
+          break;
+        }
+        cond.wait(l);
+        continue;
+      }
+      Item* item = pending.front();
+      pending.pop_front();
+      l.unlock();
+
+      uint64_t size = item->o->onode.size;
+      int r = store->_fsck_read_object(item->c.get(), item->o);
+      item->o.reset();
+      item->c.reset();
+
+      l.lock();
+      if (r < 0) {
+        ++errors;
+      }
+      ++num_objects;
+      num_bytes += size;
+      item->done = true;
+      while (!in_flight.empty() && in_flight.front().done) {
+        done_key = std::move(in_flight.front().key);
+        in_flight.pop_front();
+      }
+      cond.notify_all();
+    }
+  }
+
+  void _report(std::unique_lock<ceph::mutex>& l, bool save) {
+    auto now = ceph::mono_clock::now();
+    last_report = now;
+    std::string key = done_key;
+    uint64_t objects = num_objects;
+    uint64_t bytes = num_bytes;
+    l.unlock();
+
+    if (save && !key.empty()) {
+      KeyValueDB::Transaction t = store->db->get_transaction();
+      bufferlist bl;
+      encode(key, bl);
+      t->set(PREFIX_SUPER, FSCK_DEEP_DONE_KEY, bl);
+      store->db->submit_transaction_sync(t);
+    }
+    double elapsed = std::max(1e-9, ceph::to_seconds<double>(now - start));
+    dout(1) << "deep fsck read " << objects << " objects, "
+            << byte_u_t(bytes) << " in " << elapsed << "s ("
+            << uint64_t(objects / elapsed) << " objects/s, "
+            << byte_u_t(bytes / elapsed) << "/s)"
+            << (save ? ", saved position " : ", position ")
+            << pretty_binary_string(key) << dendl;
+    l.lock();
+  }
+
+public:
+  FSCKDeepReader(BlueStore* _store,
+                 size_t num_threads,
+                 double _checkpoint_interval)
+    : store(_store),
+      cct(_store->cct),
+      max_in_flight(num_threads * 4),
+      checkpoint_interval(_checkpoint_interval) {
+    if (checkpoint_interval > 0) {
+      bufferlist bl;
+      if (store->db->get(PREFIX_SUPER, FSCK_DEEP_DONE_KEY, &bl) >= 0 &&
+          bl.length()) {
+        auto p = bl.cbegin();
+        decode(resume_key, p);
+        dout(1) << "resuming data reads after "
+                << pretty_binary_string(resume_key) << dendl;
+      }
+    }
+    start = last_report = ceph::mono_clock::now();
+    for (size_t i = 0; i < num_threads; ++i) {
+      threads.emplace_back(
+        make_named_thread("bstore_fsck_rd", &FSCKDeepReader::reader, this));
+    }
+  }
+  ~FSCKDeepReader() {
+    ceph_assert(threads.empty());
+  }
+
+  /// true if the object was read by a previous, interrupted, deep fsck
+  bool is_done(const std::string& key) const {
+    return !resume_key.empty() && key <= resume_key;
+  }
+
+  void queue(CollectionRef c, OnodeRef o, const std::string& key) {
+    std::unique_lock l(lock);
+    cond.wait(l, [this] { return in_flight.size() < max_in_flight; });
+    auto& item = in_flight.emplace_back(Item{std::move(c), std::move(o), key});
+    pending.push_back(&item);
+    cond.notify_all();
+
+    // report progress once a minute if no checkpoints are configured
+    auto interval = checkpoint_interval > 0 ?
+      make_timespan(checkpoint_interval) : make_timespan(60);
+    if (ceph::mono_clock::now() - last_report >= interval) {
+      _report(l, checkpoint_interval > 0);
+    }
+  }
+
+  /// waits for all queued objects to be read, returns number of errors
+  int64_t finish() {
+    {
+      std::lock_guard l(lock);
+      stopping = true;
+      cond.notify_all();
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    threads.clear();
+    ceph_assert(in_flight.empty());
+
+    if (checkpoint_interval > 0) {
+      // the pass is complete, the next deep fsck starts over
+      KeyValueDB::Transaction t = store->db->get_transaction();
+      t->rmkey(PREFIX_SUPER, FSCK_DEEP_DONE_KEY);
+      store->db->submit_transaction_sync(t);
+    }
+    std::unique_lock l(lock);
+    _report(l, false);
+    return errors;
+  }
+};
+
+#undef dout_prefix
+#define dout_prefix *_dout << "bluestore(" << path << ") "
+
 void BlueStore::_fsck_check_objects(
   FSCKDepth depth,
   BlueStore::FSCK_ObjectCtx& ctx)
@@ -9772,6 +10581,18 @@ void BlueStore::_fsck_check_objects(
       thread_pool.start();
     }
 
+    std::unique_ptr<FSCKDeepReader> deep_reader;
+    if (depth == FSCK_DEEP) {
+      auto deep_threads = cct->_conf.get_val<uint64_t>(
+        "bluestore_fsck_deep_threads");
+      if (deep_threads > 0) {
+        deep_reader = std::make_unique<FSCKDeepReader>(
+          this,
+          deep_threads,
+          cct->_conf.get_val<double>("bluestore_fsck_deep_checkpoint_interval"));
+      }
+    }
+
     // fill global if not overriden below
     CollectionRef c;
     int64_t pool_id = -1;
@@ -9957,27 +10778,19 @@ void BlueStore::_fsck_check_objects(
           }
         } // if (o->onode.has_omap())
         if (depth == FSCK_DEEP) {
-          bufferlist bl;
-          uint64_t max_read_block = cct->_conf->bluestore_fsck_read_bytes_cap;
-          uint64_t offset = 0;
-          do {
-            uint64_t l = std::min(uint64_t(o->onode.size - offset), max_read_block);
-            int r = _do_read(c.get(), o, offset, l, bl,
-              CEPH_OSD_OP_FLAG_FADVISE_NOCACHE);
-            if (r < 0) {
+          if (!deep_reader) {
+            if (_fsck_read_object(c.get(), o) < 0) {
               ++errors;
-              derr << "fsck error: " << oid << std::hex
-                << " error during read: "
-                << " " << offset << "~" << l
-                << " " << cpp_strerror(r) << std::dec
-                << dendl;
-              break;
             }
-            offset += l;
-          } while (offset < o->onode.size);
+          } else if (!deep_reader->is_done(it->key())) {
+            deep_reader->queue(c, std::move(o), it->key());
+          }
         } // deep
       } //if (depth != FSCK_SHALLOW)
     } // for (it->lower_bound(string()); it->valid(); it->next())
+    if (deep_reader) {
+      errors += deep_reader->finish();
+    }
     if (depth == FSCK_SHALLOW && thread_count > 0) {
       wq->finalize(thread_pool, ctx);
       if (processed_myself) {
@@ -11371,8 +12184,8 @@ BlueStore::CollectionRef BlueStore::_get_collection_by_oid(const ghobject_t& oid
 void BlueStore::_queue_reap_collection(CollectionRef& c)
 {
   dout(10) << __func__ << " " << c << " " << c->cid << dendl;
-  // _reap_collections and this in the same thread,
-  // so no need a lock.
+  // kv finalize threads of all kv sync shards queue and reap
+  std::lock_guard l(reap_lock);
   removed_collections.push_back(c);
 }
 
@@ -11381,8 +12194,7 @@ void BlueStore::_reap_collections()
 
   list<CollectionRef> removed_colls;
   {
-    // _queue_reap_collection and this in the same thread.
-    // So no need a lock.
+    std::lock_guard l(reap_lock);
     if (!removed_collections.empty())
       removed_colls.swap(removed_collections);
     else
@@ -11412,6 +12224,7 @@ void BlueStore::_reap_collections()
   if (removed_colls.empty()) {
     dout(10) << __func__ << " all reaped" << dendl;
   } else {
+    std::lock_guard l(reap_lock);
     removed_collections.splice(removed_collections.begin(), removed_colls);
   }
 }
@@ -11576,6 +12389,8 @@ int BlueStore::read(
     r = _do_read(c, o, offset, length, bl, op_flags);
     if (r == -EIO) {
       logger->inc(l_bluestore_read_eio);
+    } else if (r > 0) {
+      _maybe_readahead(c, o, offset, r, op_flags);
     }
   }
 
@@ -11979,6 +12794,116 @@ int BlueStore::_do_read(
   return r;
 }
 
+void BlueStore::_maybe_readahead(
+  Collection *c,
+  OnodeRef& o,
+  uint64_t offset,
+  size_t length,
+  uint32_t op_flags)
+{
+  if (cct->_conf->bluestore_readahead_max_bytes == 0 ||
+      (op_flags & (CEPH_OSD_OP_FLAG_FADVISE_RANDOM |
+		   CEPH_OSD_OP_FLAG_FADVISE_DONTNEED |
+		   CEPH_OSD_OP_FLAG_FADVISE_NOCACHE |
+		   CEPH_OSD_OP_FLAG_BYPASS_CLEAN_CACHE))) {
+    return;
+  }
+  ReadaheadState* ras = o->get_readahead();
+  {
+    std::lock_guard l(ras->lock);
+    uint64_t end = offset + length;
+    if (ras->start < ras->end) {
+      if (offset < ras->end && end > ras->start) {
+	logger->inc(l_bluestore_readahead_hit_bytes,
+		    std::min(end, ras->end) - std::max(offset, ras->start));
+	ras->start = std::max(ras->start, std::min(end, ras->end));
+      } else if (offset >= ras->end) {
+	// the reader went past what we read ahead for it
+	logger->inc(l_bluestore_readahead_wasted_bytes, ras->end - ras->start);
+	ras->start = ras->end = 0;
+      }
+    }
+  }
+  auto [ra_off, ra_len] = ras->ra.update(offset, length, o->onode.size);
+  if (ra_len == 0) {
+    return;
+  }
+  dout(20) << __func__ << " " << o->oid << " 0x" << std::hex
+	   << ra_off << "~" << ra_len << std::dec << dendl;
+
+  o->extent_map.fault_range(db, ra_off, ra_len);
+  auto rc = new ReadaheadContext(cct, c, o, ra_off, ra_len);
+  _read_cache(o, ra_off, ra_len, 0, rc->ready_regions, rc->blobs2read);
+  int r = _prepare_read_ioc(rc->blobs2read, &rc->compressed_blob_bls,
+			    &rc->ioc);
+  if (r < 0 || !rc->ioc.has_pending_aios()) {
+    // nothing to read, or it failed and the client will find out itself
+    delete rc;
+    return;
+  }
+  {
+    std::lock_guard l(readahead_lock);
+    ++readahead_in_flight;
+  }
+  logger->inc(l_bluestore_readahead_count);
+  logger->inc(l_bluestore_readahead_bytes, ra_len);
+  bdev->aio_submit(&rc->ioc);
+}
+
+void BlueStore::_readahead_finish(ReadaheadContext *rc)
+{
+  bool cached = false;
+  // Don't wait for the collection lock here, we're in the aio thread and the
+  // lock holder may be waiting for its own ios to complete.
+  if (rc->ioc.get_return_value() >= 0 &&
+      rc->c->lock.try_lock_shared()) {
+    // If the object was modified or moved to another collection while we
+    // were reading, the extents might not hold its data anymore.
+    if (rc->o->c == rc->c.get() &&
+	rc->o->modify_seq == rc->modify_seq && rc->o->exists) {
+      bool csum_error = false;
+      bufferlist bl;
+      int r = _generate_read_result_bl(rc->o, rc->offset, rc->length,
+				       rc->ready_regions,
+				       rc->compressed_blob_bls,
+				       rc->blobs2read, true, &csum_error, bl);
+      cached = r >= 0 && !csum_error;
+    }
+    rc->c->lock.unlock_shared();
+  }
+  dout(20) << __func__ << " " << rc->o->oid << " 0x" << std::hex
+	   << rc->offset << "~" << rc->length << std::dec
+	   << (cached ? " cached" : " dropped") << dendl;
+
+  ReadaheadState* ras = rc->o->get_readahead();
+  {
+    std::lock_guard l(ras->lock);
+    if (!cached) {
+      logger->inc(l_bluestore_readahead_wasted_bytes, rc->length);
+    } else if (ras->start < ras->end && rc->offset == ras->end) {
+      ras->end = rc->offset + rc->length;
+    } else {
+      if (ras->start < ras->end) {
+	logger->inc(l_bluestore_readahead_wasted_bytes, ras->end - ras->start);
+      }
+      ras->start = rc->offset;
+      ras->end = rc->offset + rc->length;
+    }
+  }
+  delete rc;
+
+  std::lock_guard l(readahead_lock);
+  if (--readahead_in_flight == 0) {
+    readahead_cond.notify_all();
+  }
+}
+
+void BlueStore::_readahead_drain()
+{
+  std::unique_lock l(readahead_lock);
+  readahead_cond.wait(l, [this] { return readahead_in_flight == 0; });
+}
+
 int BlueStore::_verify_csum(OnodeRef& o,
 			    const bluestore_blob_t* blob, uint64_t blob_xoffset,
 			    const bufferlist& bl,
@@ -11995,6 +12920,19 @@ int BlueStore::_verify_csum(OnodeRef& o,
     r = -1;
     bad_csum = 0xDEADBEEF;
   }
+  if (r == 0 && blob->csum_type == Checksummer::CSUM_CRC32C &&
+      bl.get_num_buffers() == 1) {
+    // derive crc32c(-1, data) from the chunk csums, so that a data crc
+    // taken later, e.g. by the messenger for a read reply, needn't scan
+    // the data again
+    uint64_t chunk_size = blob->get_csum_chunk_size();
+    uint32_t crc = -1;
+    for (uint64_t off = 0; off < bl.length(); off += chunk_size) {
+      crc = blob->get_csum_item((blob_xoffset + off) / chunk_size) ^
+	ceph_crc32c(~crc, NULL, chunk_size);
+    }
+    bl.front().set_crc32c(-1, crc);
+  }
   if (r < 0) {
     if (r == -1) {
       PExtentVector pex;
@@ -12535,6 +13473,21 @@ int BlueStore::collection_list_legacy(
   return r;
 }
 
+void BlueStore::prefetch_objects(
+  CollectionHandle &c_,
+  const vector<ghobject_t>& oids)
+{
+  Collection *c = static_cast<Collection *>(c_.get());
+  dout(15) << __func__ << " " << c->cid << " " << oids.size() << " objects"
+	   << dendl;
+  if (!c->exists || oids.empty())
+    return;
+  std::vector<bool> create(oids.size(), false);
+  std::vector<OnodeRef> onodes;
+  std::shared_lock l(c->lock);
+  c->get_onodes(oids, create, &onodes);
+}
+
 int BlueStore::_collection_list(
   Collection *c, const ghobject_t& start, const ghobject_t& end, int max,
   bool legacy, vector<ghobject_t> *ls, ghobject_t *pnext)
@@ -12857,14 +13810,23 @@ int BlueStore::omap_get_values(
     const string& prefix = o->get_omap_prefix();
     o->get_omap_key(string(), &final_key);
     size_t base_key_len = final_key.size();
-    for (set<string>::const_iterator p = keys.begin(); p != keys.end(); ++p) {
+    vector<string> db_keys;
+    db_keys.reserve(keys.size());
+    for (auto& key : keys) {
       final_key.resize(base_key_len); // keep prefix
-      final_key += *p;
-      bufferlist val;
-      if (db->get(prefix, final_key, &val) >= 0) {
-	dout(30) << __func__ << "  got " << pretty_binary_string(final_key)
+      final_key += key;
+      db_keys.push_back(final_key);
+    }
+    // look all keys up in one go
+    vector<bufferlist> vals;
+    vector<int> rs;
+    db->get_many(prefix, db_keys, &vals, &rs);
+    auto p = keys.begin();
+    for (size_t i = 0; i < db_keys.size(); ++i, ++p) {
+      if (rs[i] >= 0) {
+	dout(30) << __func__ << "  got " << pretty_binary_string(db_keys[i])
 		 << " -> " << *p << dendl;
-	out->insert(make_pair(*p, val));
+	out->emplace_hint(out->end(), *p, std::move(vals[i]));
       }
     }
   }
@@ -13003,6 +13965,65 @@ ObjectMap::ObjectMapIterator BlueStore::get_omap_iterator(
   return ObjectMap::ObjectMapIterator(new OmapIteratorImpl(logger,c, o, it));
 }
 
+int BlueStore::omap_iterate(
+  CollectionHandle &c_,   ///< [in] collection
+  const ghobject_t &oid, ///< [in] object
+  omap_iter_seek_t start_from, ///< [in] where to start
+  std::function<omap_iter_ret_t(std::string_view, std::string_view)> f)
+{
+  Collection *c = static_cast<Collection *>(c_.get());
+  dout(10) << __func__ << " " << c->get_cid() << " " << oid << dendl;
+  if (!c->exists) {
+    return -ENOENT;
+  }
+  std::shared_lock l(c->lock);
+  OnodeRef o = c->get_onode(oid, false);
+  if (!o || !o->exists) {
+    dout(10) << __func__ << " " << oid << " doesn't exist" << dendl;
+    return -ENOENT;
+  }
+  o->flush();
+  dout(10) << __func__ << " has_omap = " << (int)o->onode.has_omap() << dendl;
+  if (!o->onode.has_omap()) {
+    return 0;
+  }
+  auto start1 = mono_clock::now();
+  int r = 0;
+  {
+    string head, tail, seek_key;
+    o->get_omap_key(string(), &head);
+    o->get_omap_tail(&tail);
+    o->get_omap_key(start_from.seek_position, &seek_key);
+    KeyValueDB::Iterator it = db->get_iterator(
+      o->get_omap_prefix(), 0, KeyValueDB::IteratorBounds{head, tail});
+    if (start_from.seek_type == omap_iter_seek_t::LOWER_BOUND) {
+      it->lower_bound(seek_key);
+    } else {
+      it->upper_bound(seek_key);
+    }
+    // keys and values are handed out as views of the db iterator's
+    // buffers, they are only copied if f wants to keep them
+    for (; it->valid(); it->next()) {
+      std::string_view key = it->key_as_sv();
+      if (key >= tail) {
+	dout(30) << __func__ << "  reached tail" << dendl;
+	break;
+      }
+      key.remove_prefix(head.size());
+      if (f(key, it->value_as_sv()) == omap_iter_ret_t::STOP) {
+	r = 1;
+	break;
+      }
+    }
+  }
+  c->store->log_latency(
+    __func__,
+    l_bluestore_omap_iterate_lat,
+    mono_clock::now() - start1,
+    c->store->cct->_conf->bluestore_log_omap_iterator_age);
+  return r;
+}
+
 // -----------------
 // write helpers
 
@@ -13348,6 +14369,9 @@ void BlueStore::_txc_state_proc(TransContext *txc)
       {
 	mono_clock::duration lat = throttle.log_state_latency(
 	  *txc, logger, l_bluestore_state_aio_wait_lat);
+	if (txc->had_ios) {
+	  deferred_adaptive.direct.add(lat);
+	}
 	if (ceph::to_seconds<double>(lat) >= cct->_conf->bluestore_log_op_age) {
 	  logger->inc(l_bluestore_slow_aio_wait_count);
 	  dout(0) << __func__ << " slow aio_wait, txc = " << txc
@@ -13391,7 +14415,20 @@ void BlueStore::_txc_state_proc(TransContext *txc)
 	  _txc_apply_kv(txc, true);
 	}
       }
-      {
+      if (KVSyncShard *shard = _get_kv_sync_shard(txc->osr.get()); shard) {
+	std::lock_guard l(shard->lock);
+	shard->queue.push_back(txc);
+	if (!shard->in_progress) {
+	  shard->in_progress = true;
+	  shard->cond.notify_one();
+	}
+	if (txc->get_state() != TransContext::STATE_KV_SUBMITTED) {
+	  ++txc->osr->kv_committing_serially;
+	}
+	if (txc->had_ios)
+	  shard->ios++;
+	shard->throttle_costs += txc->cost;
+      } else {
 	std::lock_guard l(kv_lock);
 	kv_queue.push_back(txc);
 	if (!kv_sync_in_progress) {
@@ -13540,7 +14577,7 @@ void BlueStore::_txc_finalize_kv(TransContext *txc, KeyValueDB::Transaction t)
 	   << " released 0x" << txc->released
 	   << std::dec << dendl;
 
-  if (!fm->is_null_manager())
+  if (!fm->is_null_manager() || alloc_delta_log)
   {
     // We have to handle the case where we allocate *and* deallocate the
     // same region in this transaction.  The freelist doesn't like that.
@@ -13566,18 +14603,22 @@ void BlueStore::_txc_finalize_kv(TransContext *txc, KeyValueDB::Transaction t)
       }
     }
 
-    // update freelist with non-overlap sets
-    for (interval_set<uint64_t>::iterator p = pallocated->begin();
-	 p != pallocated->end();
-	 ++p) {
-      fm->allocate(p.get_start(), p.get_len(), t);
-    }
-    for (interval_set<uint64_t>::iterator p = preleased->begin();
-	 p != preleased->end();
-	 ++p) {
-      dout(20) << __func__ << " release 0x" << std::hex << p.get_start()
-	       << "~" << p.get_len() << std::dec << dendl;
-      fm->release(p.get_start(), p.get_len(), t);
+    if (fm->is_null_manager()) {
+      _txc_log_alloc_delta(txc, *pallocated, *preleased, t);
+    } else {
+      // update freelist with non-overlap sets
+      for (interval_set<uint64_t>::iterator p = pallocated->begin();
+	   p != pallocated->end();
+	   ++p) {
+	fm->allocate(p.get_start(), p.get_len(), t);
+      }
+      for (interval_set<uint64_t>::iterator p = preleased->begin();
+	   p != preleased->end();
+	   ++p) {
+	dout(20) << __func__ << " release 0x" << std::hex << p.get_start()
+		 << "~" << p.get_len() << std::dec << dendl;
+	fm->release(p.get_start(), p.get_len(), t);
+      }
     }
   }
 
@@ -13921,11 +14962,47 @@ void BlueStore::_kv_start()
   finisher.start();
   kv_sync_thread.create("bstore_kv_sync");
   kv_finalize_thread.create("bstore_kv_final");
+
+  auto shards = cct->_conf.get_val<uint64_t>("bluestore_kv_sync_shards");
+  for (uint32_t i = 1; i < shards; ++i) {
+    auto shard = std::make_unique<KVSyncShard>(this, i);
+    shard->sync_thread.create(
+      fmt::format("bstore_kvsync{}", i).c_str());
+    shard->finalize_thread.create(
+      fmt::format("bstore_kvfin{}", i).c_str());
+    kv_sync_shards.emplace_back(std::move(shard));
+  }
+  if (!kv_sync_shards.empty()) {
+    dout(1) << __func__ << " " << shards << " kv sync shards" << dendl;
+  }
+  _compress_start();
 }
 
 void BlueStore::_kv_stop()
 {
   dout(10) << __func__ << dendl;
+  _compress_stop();
+  for (auto& shard : kv_sync_shards) {
+    {
+      std::unique_lock l{shard->lock};
+      while (!shard->started) {
+	shard->cond.wait(l);
+      }
+      shard->stop = true;
+      shard->cond.notify_all();
+    }
+    shard->sync_thread.join();
+    {
+      std::unique_lock l{shard->finalize_lock};
+      while (!shard->finalize_started) {
+	shard->finalize_cond.wait(l);
+      }
+      shard->finalize_stop = true;
+      shard->finalize_cond.notify_all();
+    }
+    shard->finalize_thread.join();
+  }
+  kv_sync_shards.clear();
   {
     std::unique_lock l{kv_lock};
     while (!kv_sync_started) {
@@ -13959,23 +15036,73 @@ void BlueStore::_kv_stop()
   dout(10) << __func__ << " stopped" << dendl;
 }
 
-void BlueStore::_kv_sync_thread()
+void BlueStore::_compress_start()
 {
-  dout(10) << __func__ << " start" << dendl;
-  deque<DeferredBatch*> deferred_stable_queue; ///< deferred ios done + stable
-  std::unique_lock l{kv_lock};
-  ceph_assert(!kv_sync_started);
-  kv_sync_started = true;
-  kv_cond.notify_all();
-
-  auto t0 = mono_clock::now();
-  timespan twait = ceph::make_timespan(0);
-  size_t kv_submitted = 0;
+  auto n = cct->_conf.get_val<uint64_t>("bluestore_compression_threads");
+  compress_stop = false;
+  for (uint64_t i = 0; i < n; ++i) {
+    auto t = std::make_unique<CompressThread>(this);
+    t->create(fmt::format("bstore_cmp{}", i).c_str());
+    compress_threads.emplace_back(std::move(t));
+  }
+  if (n) {
+    dout(1) << __func__ << " " << n << " compression threads" << dendl;
+  }
+}
 
-  while (true) {
-    auto period = cct->_conf->bluestore_kv_sync_util_logging_s;
-    auto observation_period =
-      ceph::make_timespan(period);
+void BlueStore::_compress_stop()
+{
+  if (compress_threads.empty()) {
+    return;
+  }
+  {
+    std::lock_guard l{compress_lock};
+    compress_stop = true;
+    compress_cond.notify_all();
+  }
+  for (auto& t : compress_threads) {
+    t->join();
+  }
+  compress_threads.clear();
+  ceph_assert(compress_queue.empty());
+}
+
+void BlueStore::_compress_thread()
+{
+  std::unique_lock l{compress_lock};
+  while (true) {
+    if (compress_queue.empty()) {
+      if (compress_stop) {
+	break;
+      }
+      compress_cond.wait(l);
+      continue;
+    }
+    auto job = std::move(compress_queue.front());
+    compress_queue.pop_front();
+    l.unlock();
+    job();
+    l.lock();
+  }
+}
+
+void BlueStore::_kv_sync_thread()
+{
+  dout(10) << __func__ << " start" << dendl;
+  deque<DeferredBatch*> deferred_stable_queue; ///< deferred ios done + stable
+  std::unique_lock l{kv_lock};
+  ceph_assert(!kv_sync_started);
+  kv_sync_started = true;
+  kv_cond.notify_all();
+
+  auto t0 = mono_clock::now();
+  timespan twait = ceph::make_timespan(0);
+  size_t kv_submitted = 0;
+
+  while (true) {
+    auto period = cct->_conf->bluestore_kv_sync_util_logging_s;
+    auto observation_period =
+      ceph::make_timespan(period);
     auto elapsed = mono_clock::now() - t0;
     if (period && elapsed >= observation_period) {
       dout(5) << __func__ << " utilization: idle "
@@ -13988,6 +15115,7 @@ void BlueStore::_kv_sync_thread()
     }
     ceph_assert(kv_committing.empty());
     if (kv_queue.empty() &&
+	!kv_prealloc_requested &&
 	((deferred_done_queue.empty() && deferred_stable_queue.empty()) ||
 	 !deferred_aggressive)) {
       if (kv_stop)
@@ -14003,6 +15131,7 @@ void BlueStore::_kv_sync_thread()
       deque<TransContext*> kv_submitting;
       deque<DeferredBatch*> deferred_done, deferred_stable;
       uint64_t aios = 0, costs = 0;
+      bool prealloc_requested = kv_prealloc_requested;
 
       dout(20) << __func__ << " committing " << kv_queue.size()
 	       << " submitting " << kv_queue_unsubmitted.size()
@@ -14017,6 +15146,7 @@ void BlueStore::_kv_sync_thread()
       costs = kv_throttle_costs;
       kv_ios = 0;
       kv_throttle_costs = 0;
+      kv_prealloc_requested = false;
       l.unlock();
 
       dout(30) << __func__ << " committing " << kv_committing << dendl;
@@ -14071,9 +15201,11 @@ void BlueStore::_kv_sync_thread()
       // increase {nid,blobid}_max?  note that this covers both the
       // case where we are approaching the max and the case we passed
       // it.  in either case, we increase the max in the earlier txn
-      // we submit.
+      // we submit.  other kv sync shards never do this themselves; they
+      // ask us via kv_prealloc_requested and wait for the new max.
       uint64_t new_nid_max = 0, new_blobid_max = 0;
-      if (nid_last + cct->_conf->bluestore_nid_prealloc/2 > nid_max) {
+      if (prealloc_requested ||
+	  nid_last + cct->_conf->bluestore_nid_prealloc/2 > nid_max) {
 	KeyValueDB::Transaction t =
 	  kv_submitting.empty() ? synct : kv_submitting.front()->t;
 	new_nid_max = nid_last + cct->_conf->bluestore_nid_prealloc;
@@ -14082,7 +15214,8 @@ void BlueStore::_kv_sync_thread()
 	t->set(PREFIX_SUPER, "nid_max", bl);
 	dout(10) << __func__ << " new_nid_max " << new_nid_max << dendl;
       }
-      if (blobid_last + cct->_conf->bluestore_blobid_prealloc/2 > blobid_max) {
+      if (prealloc_requested ||
+	  blobid_last + cct->_conf->bluestore_blobid_prealloc/2 > blobid_max) {
 	KeyValueDB::Transaction t =
 	  kv_submitting.empty() ? synct : kv_submitting.front()->t;
 	new_blobid_max = blobid_last + cct->_conf->bluestore_blobid_prealloc;
@@ -14195,6 +15328,10 @@ void BlueStore::_kv_sync_thread()
 	blobid_max = new_blobid_max;
 	dout(10) << __func__ << " blobid_max now " << blobid_max << dendl;
       }
+      if (new_nid_max || new_blobid_max) {
+	std::lock_guard l(kv_lock);
+	kv_prealloc_cond.notify_all();
+      }
 
       {
 	auto finish = mono_clock::now();
@@ -14218,6 +15355,10 @@ void BlueStore::_kv_sync_thread()
 	  l_bluestore_kv_sync_lat,
 	  dur,
 	  cct->_conf->bluestore_log_op_age);
+	if (committing_size) {
+	  logger->inc(l_bluestore_kv_sync_batch, committing_size);
+	  deferred_adaptive.commit.add(dur_kv);
+	}
       }
 
       l.lock();
@@ -14277,6 +15418,8 @@ void BlueStore::_kv_finalize_thread()
       }
       deferred_stable.clear();
 
+      _deferred_adapt();
+
       if (!deferred_aggressive) {
 	if (deferred_queue_size >= deferred_batch_ops.load() ||
 	    throttle.should_submit_deferred()) {
@@ -14303,6 +15446,215 @@ void BlueStore::_kv_finalize_thread()
 }
 
 
+BlueStore::KVSyncShard::KVSyncShard(BlueStore *store, uint32_t shard_id)
+  : store(store),
+    shard_id(shard_id),
+    sync_thread(this),
+    finalize_thread(this)
+{
+  PerfCountersBuilder b(store->cct,
+			fmt::format("bluestore-kv-shard-{}", shard_id),
+			l_bluestore_kv_shard_first, l_bluestore_kv_shard_last);
+  b.add_u64_counter(l_bluestore_kv_shard_txc, "txc",
+		    "Transactions committed by this kv sync shard");
+  b.add_u64_avg(l_bluestore_kv_shard_batch, "batch",
+		"Average number of transactions committed per sync cycle");
+  b.add_time_avg(l_bluestore_kv_shard_flush_lat, "flush_lat",
+		 "Average block device flush latency");
+  b.add_time_avg(l_bluestore_kv_shard_commit_lat, "commit_lat",
+		 "Average kv submit and sync latency");
+  b.add_time_avg(l_bluestore_kv_shard_sync_lat, "sync_lat",
+		 "Average sync cycle latency");
+  b.add_time_avg(l_bluestore_kv_shard_final_lat, "final_lat",
+		 "Average finalize cycle latency");
+  logger = b.create_perf_counters();
+  store->cct->get_perfcounters_collection()->add(logger);
+}
+
+BlueStore::KVSyncShard::~KVSyncShard()
+{
+  ceph_assert(queue.empty());
+  ceph_assert(committing_to_finalize.empty());
+  store->cct->get_perfcounters_collection()->remove(logger);
+  delete logger;
+}
+
+void *BlueStore::KVShardSyncThread::entry()
+{
+  shard->store->_kv_shard_sync_thread(shard);
+  return NULL;
+}
+
+void *BlueStore::KVShardFinalizeThread::entry()
+{
+  shard->store->_kv_shard_finalize_thread(shard);
+  return NULL;
+}
+
+void BlueStore::_kv_wait_prealloc(uint64_t nid, uint64_t blobid)
+{
+  std::unique_lock l{kv_lock};
+  while (nid >= nid_max || blobid >= blobid_max) {
+    dout(20) << __func__ << " nid " << nid << " >= " << nid_max
+	     << " or blobid " << blobid << " >= " << blobid_max << dendl;
+    kv_prealloc_requested = true;
+    if (!kv_sync_in_progress) {
+      kv_sync_in_progress = true;
+      kv_cond.notify_one();
+    }
+    kv_prealloc_cond.wait(l);
+  }
+}
+
+void BlueStore::_kv_shard_sync_thread(KVSyncShard *shard)
+{
+  dout(10) << __func__ << " " << shard->shard_id << " start" << dendl;
+  std::unique_lock l{shard->lock};
+  ceph_assert(!shard->started);
+  shard->started = true;
+  shard->cond.notify_all();
+
+  while (true) {
+    if (shard->queue.empty()) {
+      if (shard->stop)
+	break;
+      dout(20) << __func__ << " " << shard->shard_id << " sleep" << dendl;
+      shard->in_progress = false;
+      shard->cond.wait(l);
+      dout(20) << __func__ << " " << shard->shard_id << " wake" << dendl;
+    } else {
+      deque<TransContext*> committing;
+      committing.swap(shard->queue);
+      uint64_t aios = shard->ios;
+      uint64_t costs = shard->throttle_costs;
+      shard->ios = 0;
+      shard->throttle_costs = 0;
+      l.unlock();
+
+      dout(20) << __func__ << " " << shard->shard_id
+	       << " committing " << committing.size() << dendl;
+      auto start = mono_clock::now();
+
+      // deferred ios are not ours to stabilize, so the only reason to
+      // flush is direct writes made by the txcs we are about to commit
+      if (aios) {
+	bdev->flush();
+      }
+      auto after_flush = mono_clock::now();
+
+      for (auto txc : committing) {
+	throttle.log_state_latency(*txc, logger, l_bluestore_state_kv_queued_lat);
+	if (txc->get_state() == TransContext::STATE_KV_QUEUED) {
+	  if (txc->last_nid >= nid_max || txc->last_blobid >= blobid_max) {
+	    // the new max must be persisted before any nid above it
+	    _kv_wait_prealloc(txc->last_nid, txc->last_blobid);
+	  }
+	  _txc_apply_kv(txc, false);
+	  --txc->osr->kv_committing_serially;
+	} else {
+	  ceph_assert(txc->get_state() == TransContext::STATE_KV_SUBMITTED);
+	}
+	if (txc->had_ios) {
+	  --txc->osr->txc_with_unstable_io;
+	}
+      }
+
+      // see _kv_sync_thread
+      throttle.release_kv_throttle(costs);
+
+      // an empty synchronous transaction makes everything submitted so
+      // far durable; rocksdb groups concurrent syncs from all shards.
+      KeyValueDB::Transaction synct = db->get_transaction();
+      int r = cct->_conf->bluestore_debug_omit_kv_commit ? 0 : db->submit_transaction_sync(synct);
+      ceph_assert(r == 0);
+
+      auto committing_size = committing.size();
+      {
+	std::unique_lock m{shard->finalize_lock};
+	if (shard->committing_to_finalize.empty()) {
+	  shard->committing_to_finalize.swap(committing);
+	} else {
+	  shard->committing_to_finalize.insert(
+	    shard->committing_to_finalize.end(),
+	    committing.begin(),
+	    committing.end());
+	  committing.clear();
+	}
+	if (!shard->finalize_in_progress) {
+	  shard->finalize_in_progress = true;
+	  shard->finalize_cond.notify_one();
+	}
+      }
+
+      auto finish = mono_clock::now();
+      dout(20) << __func__ << " " << shard->shard_id
+	       << " committed " << committing_size
+	       << " in " << (finish - start)
+	       << " (" << (after_flush - start) << " flush + "
+	       << (finish - after_flush) << " kv commit)" << dendl;
+      shard->logger->inc(l_bluestore_kv_shard_txc, committing_size);
+      shard->logger->inc(l_bluestore_kv_shard_batch, committing_size);
+      shard->logger->tinc(l_bluestore_kv_shard_flush_lat, after_flush - start);
+      shard->logger->tinc(l_bluestore_kv_shard_commit_lat, finish - after_flush);
+      shard->logger->tinc(l_bluestore_kv_shard_sync_lat, finish - start);
+      l.lock();
+    }
+  }
+  dout(10) << __func__ << " " << shard->shard_id << " finish" << dendl;
+  shard->started = false;
+}
+
+void BlueStore::_kv_shard_finalize_thread(KVSyncShard *shard)
+{
+  deque<TransContext*> kv_committed;
+  dout(10) << __func__ << " " << shard->shard_id << " start" << dendl;
+  std::unique_lock l(shard->finalize_lock);
+  ceph_assert(!shard->finalize_started);
+  shard->finalize_started = true;
+  shard->finalize_cond.notify_all();
+  while (true) {
+    ceph_assert(kv_committed.empty());
+    if (shard->committing_to_finalize.empty()) {
+      if (shard->finalize_stop)
+	break;
+      dout(20) << __func__ << " " << shard->shard_id << " sleep" << dendl;
+      shard->finalize_in_progress = false;
+      shard->finalize_cond.wait(l);
+      dout(20) << __func__ << " " << shard->shard_id << " wake" << dendl;
+    } else {
+      kv_committed.swap(shard->committing_to_finalize);
+      l.unlock();
+      dout(20) << __func__ << " " << shard->shard_id
+	       << " kv_committed " << kv_committed << dendl;
+
+      auto start = mono_clock::now();
+
+      while (!kv_committed.empty()) {
+	TransContext *txc = kv_committed.front();
+	ceph_assert(txc->get_state() == TransContext::STATE_KV_SUBMITTED);
+	_txc_state_proc(txc);
+	kv_committed.pop_front();
+      }
+
+      if (!deferred_aggressive) {
+	if (deferred_queue_size >= deferred_batch_ops.load() ||
+	    throttle.should_submit_deferred()) {
+	  deferred_try_submit();
+	}
+      }
+
+      _reap_collections();
+
+      shard->logger->tinc(l_bluestore_kv_shard_final_lat,
+			  mono_clock::now() - start);
+      l.lock();
+    }
+  }
+  dout(10) << __func__ << " " << shard->shard_id << " finish" << dendl;
+  shard->finalize_started = false;
+}
+
+
 bluestore_deferred_op_t *BlueStore::_get_deferred_op(
   TransContext *txc, uint64_t len)
 {
@@ -14450,6 +15802,7 @@ void BlueStore::_deferred_submit_unlock(OpSequencer *osr)
     ++i;
   }
 
+  b->submit_stamp = mono_clock::now();
   bdev->aio_submit(&b->ioc);
 }
 
@@ -14467,6 +15820,12 @@ void BlueStore::_deferred_aio_finish(OpSequencer *osr)
   ceph_assert(osr->deferred_running);
   DeferredBatch *b = osr->deferred_running;
 
+  {
+    auto lat = mono_clock::now() - b->submit_stamp;
+    logger->tinc(l_bluestore_deferred_aio_lat, lat);
+    deferred_adaptive.deferred.add(lat);
+  }
+
   {
     osr->deferred_lock.lock();
     ceph_assert(osr->deferred_running == b);
@@ -14517,6 +15876,89 @@ void BlueStore::_deferred_aio_finish(OpSequencer *osr)
   }
 }
 
+void BlueStore::_deferred_adapt()
+{
+  if (!cct->_conf.get_val<bool>("bluestore_deferred_adaptive")) {
+    return;
+  }
+  auto& a = deferred_adaptive;
+  if (a.reset.exchange(false)) {
+    a.trend = 0;
+  }
+  auto now = mono_clock::now();
+  if (now - a.last_update < make_timespan(
+	cct->_conf.get_val<double>("bluestore_deferred_adaptive_interval"))) {
+    return;
+  }
+  a.last_update = now;
+
+  const double alpha = 0.3;
+  a.direct.update(a.direct_lat, alpha);
+  a.deferred.update(a.deferred_lat, alpha);
+  a.commit.update(a.commit_lat, alpha);
+
+  // A deferred write pays a WAL commit up front and a batched write to the
+  // main device later, a direct write pays the main device up front.  Back
+  // off when the deferred backlog builds up or deferred batches get clearly
+  // slower than direct writes; lean on the WAL when it is clearly faster
+  // than the main device and the backlog has room.  The dead bands plus the
+  // two interval trend keep HDD + fast DB setups from flapping.
+  double usage = throttle.get_deferred_usage();
+  int vote = 0;
+  if (usage > 0.75 ||
+      (a.direct_lat > 0 && a.deferred_lat > a.direct_lat * 2)) {
+    vote = -1;
+  } else if (usage < 0.25 &&
+	     a.commit_lat > 0 && a.direct_lat > a.commit_lat * 2) {
+    vote = 1;
+  }
+  if (vote == 0 || (vote > 0) != (a.trend > 0)) {
+    a.trend = vote;
+  } else {
+    a.trend += vote;
+  }
+
+  uint64_t max_size =
+    cct->_conf.get_val<Option::size_t>("bluestore_deferred_adaptive_max_size");
+  if (!max_size) {
+    max_size = prefer_deferred_size_conf;
+  }
+  int batch_conf = deferred_batch_ops_conf;
+  uint64_t size = std::min<uint64_t>(prefer_deferred_size, max_size);
+  int batch = deferred_batch_ops;
+  if (a.trend <= -2) {
+    // below one allocation unit only the mandatory (overwrite) deferrals
+    // are left; flush the queue sooner to drain the backlog
+    size = size / 2 >= min_alloc_size ? size / 2 : 0;
+    batch = std::max(batch_conf / 4, batch / 2);
+    a.trend = 0;
+  } else if (a.trend >= 2) {
+    // larger batches merge better and interfere less with direct io
+    size = std::min<uint64_t>(size ? size * 2 : min_alloc_size, max_size);
+    batch = std::min(std::min(batch_conf * 4, 65535), std::max(batch * 2, 1));
+    a.trend = 0;
+  }
+  dout(20) << __func__ << " direct " << a.direct_lat
+	   << " deferred " << a.deferred_lat
+	   << " commit " << a.commit_lat
+	   << " usage " << usage
+	   << " trend " << a.trend << dendl;
+  if (a.reset) {
+    // reconfigured meanwhile, the values above are based on stale ones
+    return;
+  }
+  if (size != prefer_deferred_size || batch != deferred_batch_ops) {
+    dout(10) << __func__ << " prefer_deferred_size 0x" << std::hex
+	     << prefer_deferred_size << " -> 0x" << size << std::dec
+	     << " deferred_batch_ops " << deferred_batch_ops
+	     << " -> " << batch << dendl;
+    prefer_deferred_size = size;
+    deferred_batch_ops = batch;
+    logger->set(l_bluestore_deferred_adaptive_size, size);
+    logger->set(l_bluestore_deferred_adaptive_batch_ops, batch);
+  }
+}
+
 int BlueStore::_deferred_replay()
 {
   dout(10) << __func__ << " start" << dendl;
@@ -14668,6 +16110,7 @@ int BlueStore::queue_transactions(
   dout(10) << __func__ << " ch " << c << " " << c->cid << dendl;
 
   // prepare
+  ++c->submitting;
   TransContext *txc = _txc_create(static_cast<Collection*>(ch.get()), osr,
 				  &on_commit, op);
 
@@ -14675,6 +16118,44 @@ int BlueStore::queue_transactions(
     txc->bytes += (*p).get_num_bytes();
     _txc_add_transaction(txc, &(*p));
   }
+  --c->submitting;
+  auto throttle_lat = _txc_submit(txc, handle);
+
+  // we're immediately readable (unlike FileStore)
+  for (auto c : on_applied_sync) {
+    c->complete(0);
+  }
+  if (!on_applied.empty()) {
+    if (c->commit_queue) {
+      c->commit_queue->queue(on_applied);
+    } else {
+      finisher.queue(on_applied);
+    }
+  }
+
+#ifdef WITH_BLKIN
+  if (txc->trace) {
+    txc->trace.event("txc applied");
+  }
+#endif
+
+  log_latency("submit_transact",
+    l_bluestore_submit_lat,
+    mono_clock::now() - start,
+    cct->_conf->bluestore_log_op_age);
+  log_latency("throttle_transact",
+    l_bluestore_throttle_lat,
+    throttle_lat,
+    cct->_conf->bluestore_log_op_age);
+  return 0;
+}
+
+// Encode a txc whose ops have been applied and start executing it.
+// Returns the time spent waiting for the throttle.
+ceph::timespan BlueStore::_txc_submit(
+  TransContext *txc,
+  ThreadPool::TPHandle *handle)
+{
   _txc_calc_cost(txc);
 
   _txc_write_nodes(txc, txc->t);
@@ -14731,34 +16212,7 @@ int BlueStore::queue_transactions(
 
   // execute (start)
   _txc_state_proc(txc);
-
-  // we're immediately readable (unlike FileStore)
-  for (auto c : on_applied_sync) {
-    c->complete(0);
-  }
-  if (!on_applied.empty()) {
-    if (c->commit_queue) {
-      c->commit_queue->queue(on_applied);
-    } else {
-      finisher.queue(on_applied);
-    }
-  }
-
-#ifdef WITH_BLKIN
-  if (txc->trace) {
-    txc->trace.event("txc applied");
-  }
-#endif
-
-  log_latency("submit_transact",
-    l_bluestore_submit_lat,
-    mono_clock::now() - start,
-    cct->_conf->bluestore_log_op_age);
-  log_latency("throttle_transact",
-    l_bluestore_throttle_lat,
-    tend - tstart,
-    cct->_conf->bluestore_log_op_age);
-  return 0;
+  return tend - tstart;
 }
 
 void BlueStore::_txc_aio_submit(TransContext *txc)
@@ -14767,6 +16221,71 @@ void BlueStore::_txc_aio_submit(TransContext *txc)
   bdev->aio_submit(&txc->ioc);
 }
 
+// Look up the onodes of all objects a transaction touches before applying
+// it, with one batched DB read per collection rather than a point lookup
+// per object.
+void BlueStore::_txc_get_onodes(
+  Transaction *t,
+  vector<CollectionRef>& cvec,
+  vector<OnodeRef>& ovec)
+{
+  struct batch_t {
+    vector<uint32_t> idx;  ///< object index in the transaction
+    vector<ghobject_t> oids;
+    vector<bool> create;
+  };
+  map<uint32_t, batch_t> batches;  ///< by collection index
+  vector<bool> seen(ovec.size(), false);
+  Transaction::iterator i = t->begin();
+  while (i.have_op()) {
+    Transaction::Op *op = i.decode_op();
+    switch (op->op) {
+    case Transaction::OP_NOP:
+    case Transaction::OP_MKCOLL:
+    case Transaction::OP_COLL_HINT:
+    case Transaction::OP_COLL_SETATTR:
+    case Transaction::OP_COLL_RMATTR:
+      continue;
+    case Transaction::OP_RMCOLL:
+    case Transaction::OP_SPLIT_COLLECTION:
+    case Transaction::OP_SPLIT_COLLECTION2:
+    case Transaction::OP_MERGE_COLLECTION:
+    case Transaction::OP_COLL_RENAME:
+      // onodes may move between collections, leave it to the ops
+      return;
+    }
+    if (seen[op->oid] || !cvec[op->cid]) {
+      continue;
+    }
+    seen[op->oid] = true;
+    if (op->op == Transaction::OP_CREATE) {
+      // new object, get_onode() won't look it up anyway
+      continue;
+    }
+    auto& b = batches[op->cid];
+    b.idx.push_back(op->oid);
+    b.oids.push_back(i.get_oid(op->oid));
+    // same as what _txc_add_transaction passes to get_onode()
+    b.create.push_back(op->op == Transaction::OP_TOUCH ||
+		       op->op == Transaction::OP_WRITE ||
+		       op->op == Transaction::OP_ZERO);
+  }
+  for (auto& [cid, b] : batches) {
+    if (b.oids.size() < 2) {
+      continue;
+    }
+    CollectionRef& c = cvec[cid];
+    vector<OnodeRef> onodes;
+    {
+      std::unique_lock l(c->lock);
+      c->get_onodes(b.oids, b.create, &onodes);
+    }
+    for (size_t k = 0; k < onodes.size(); ++k) {
+      ovec[b.idx[k]] = onodes[k];
+    }
+  }
+}
+
 void BlueStore::_txc_add_transaction(TransContext *txc, Transaction *t)
 {
   Transaction::iterator i = t->begin();
@@ -14781,6 +16300,10 @@ void BlueStore::_txc_add_transaction(TransContext *txc, Transaction *t)
   }
   
   vector<OnodeRef> ovec(i.objects.size());
+  if (cct->_conf->bluestore_onode_batch_min_objects > 0 &&
+      ovec.size() >= cct->_conf->bluestore_onode_batch_min_objects) {
+    _txc_get_onodes(t, cvec, ovec);
+  }
 
   for (int pos = 0; i.have_op(); ++pos) {
     Transaction::Op *op = i.decode_op();
@@ -15953,6 +17476,95 @@ void BlueStore::_do_write_big(
   }
 }
 
+void BlueStore::_compress_blob(
+  const CompressorRef& c,
+  double crr,
+  const bufferlist& bl,
+  blob_compress_t *res)
+{
+  auto start = mono_clock::now();
+  // try a prefix first, data that doesn't compress usually doesn't
+  // compress anywhere
+  uint64_t sample = cct->_conf->bluestore_compression_sample_size;
+  if (sample && bl.length() >= 2 * sample) {
+    bufferlist in, out;
+    in.substr_of(bl, 0, sample);
+    std::optional<int32_t> msg;
+    if (c->compress(in, out, msg) == 0 && out.length() > sample * crr) {
+      res->skipped = true;
+      res->lat = mono_clock::now() - start;
+      return;
+    }
+  }
+  // FIXME: memory alignment here is bad
+  res->r = c->compress(bl, res->out, res->compressor_message);
+  res->lat = mono_clock::now() - start;
+}
+
+void BlueStore::_compress_blobs(
+  const CompressorRef& c,
+  double crr,
+  WriteContext *wctx,
+  std::vector<blob_compress_t>& res)
+{
+  res.resize(wctx->writes.size());
+  std::vector<size_t> todo;
+  for (size_t i = 0; i < wctx->writes.size(); ++i) {
+    auto& wi = wctx->writes[i];
+    if (wi.blob_length > min_alloc_size) {
+      ceph_assert(wi.b_off == 0);
+      ceph_assert(wi.blob_length == wi.bl.length());
+      todo.push_back(i);
+    }
+  }
+  if (compress_threads.empty() || todo.size() < 2) {
+    for (auto i : todo) {
+      _compress_blob(c, crr, wctx->writes[i].bl, &res[i]);
+    }
+    return;
+  }
+
+  // hand out all but the first blob, then work on the queue ourselves
+  // until everything we queued is done
+  ceph::mutex done_lock = ceph::make_mutex("BlueStore::_compress_blobs");
+  ceph::condition_variable done_cond;
+  size_t pending = todo.size() - 1;
+  {
+    std::lock_guard l{compress_lock};
+    for (size_t j = 1; j < todo.size(); ++j) {
+      auto i = todo[j];
+      compress_queue.emplace_back(
+	[this, &c, crr, &wi = wctx->writes[i], r = &res[i],
+	 &done_lock, &done_cond, &pending] {
+	  _compress_blob(c, crr, wi.bl, r);
+	  std::lock_guard l{done_lock};
+	  if (--pending == 0) {
+	    done_cond.notify_all();
+	  }
+	});
+    }
+    compress_cond.notify_all();
+  }
+  logger->inc(l_bluestore_compress_parallel_count, pending);
+  _compress_blob(c, crr, wctx->writes[todo[0]].bl, &res[todo[0]]);
+  while (true) {
+    std::function<void()> job;
+    {
+      std::lock_guard l{compress_lock};
+      if (!compress_queue.empty()) {
+	job = std::move(compress_queue.front());
+	compress_queue.pop_front();
+      }
+    }
+    if (!job) {
+      break;
+    }
+    job();
+  }
+  std::unique_lock l{done_lock};
+  done_cond.wait(l, [&pending] { return pending == 0; });
+}
+
 int BlueStore::_do_alloc_write(
   TransContext *txc,
   CollectionRef coll,
@@ -16032,19 +17644,18 @@ int BlueStore::_do_alloc_write(
   // We assume that allocator does its best to provide contiguous space,
   // and the condition is : (data_size < deferred).
 
+  std::vector<blob_compress_t> compressed;
+  if (c) {
+    _compress_blobs(c, crr, wctx, compressed);
+  }
   auto max_bsize = std::max(wctx->target_blob_size, min_alloc_size);
-  for (auto& wi : wctx->writes) {
+  for (size_t i = 0; i < wctx->writes.size(); ++i) {
+    auto& wi = wctx->writes[i];
     if (c && wi.blob_length > min_alloc_size) {
-      auto start = mono_clock::now();
-
-      // compress
-      ceph_assert(wi.b_off == 0);
-      ceph_assert(wi.blob_length == wi.bl.length());
-
-      // FIXME: memory alignment here is bad
-      bufferlist t;
-      std::optional<int32_t> compressor_message;
-      int r = c->compress(wi.bl, t, compressor_message);
+      auto& cres = compressed[i];
+      bufferlist& t = cres.out;
+      std::optional<int32_t>& compressor_message = cres.compressor_message;
+      int r = cres.r;
       uint64_t want_len_raw = wi.blob_length * crr;
       uint64_t want_len = p2roundup(want_len_raw, min_alloc_size);
       bool rejected = false;
@@ -16052,7 +17663,14 @@ int BlueStore::_do_alloc_write(
       // do an approximate (fast) estimation for resulting blob size
       // that doesn't take header overhead  into account
       uint64_t result_len = p2roundup(compressed_len, min_alloc_size);
-      if (r == 0 && result_len <= want_len && result_len < wi.blob_length) {
+      if (cres.skipped) {
+	dout(20) << __func__ << std::hex << "  0x" << wi.blob_length
+		 << " skipped, sample didn't compress well enough"
+		 << std::dec << dendl;
+	logger->inc(l_bluestore_compress_skipped_count);
+	need += wi.blob_length;
+	data_size += wi.bl.length();
+      } else if (r == 0 && result_len <= want_len && result_len < wi.blob_length) {
 	bluestore_compression_header_t chdr;
 	chdr.type = c->get_type();
 	chdr.length = t.length();
@@ -16110,7 +17728,7 @@ int BlueStore::_do_alloc_write(
       }
       log_latency("compress@_do_alloc_write",
 	l_bluestore_compress_lat,
-        mono_clock::now() - start,
+	cres.lat,
 	cct->_conf->bluestore_log_op_age );
     } else {
       need += wi.blob_length;
@@ -16592,6 +18210,7 @@ int BlueStore::_do_write(
   if (length == 0) {
     return 0;
   }
+  ++o->modify_seq;
 
   uint64_t end = offset + length;
 
@@ -16716,6 +18335,7 @@ int BlueStore::_do_zero(TransContext *txc,
 
   _dump_onode<30>(cct, *o);
 
+  ++o->modify_seq;
   WriteContext wctx;
   o->extent_map.fault_range(db, offset, length);
   o->extent_map.punch_hole(c, offset, length, &wctx.old_extents);
@@ -16747,6 +18367,7 @@ void BlueStore::_do_truncate(
   if (offset == o->onode.size)
     return;
 
+  ++o->modify_seq;
   WriteContext wctx;
   if (offset < o->onode.size) {
     uint64_t length = o->onode.size - offset;
@@ -16815,6 +18436,7 @@ int BlueStore::_do_remove(
 {
   set<SharedBlob*> maybe_unshared_blobs;
   bool is_gen = !o->oid.is_no_gen();
+  ++o->modify_seq;
   _do_truncate(txc, c, o, 0, is_gen ? &maybe_unshared_blobs : nullptr);
   if (o->onode.has_omap()) {
     o->flush();
@@ -17343,6 +18965,9 @@ int BlueStore::_do_clone_range(
   newo->extent_map.fault_range(db, dstoff, length);
   _dump_onode<30>(cct, *oldo);
   _dump_onode<30>(cct, *newo);
+  // sharing turns the source's blobs into shared ones as well
+  ++oldo->modify_seq;
+  ++newo->modify_seq;
 
   if (elastic_shared_blobs) {
     oldo->extent_map.dup_esb(this, txc, c, oldo, newo, srcoff, length, dstoff);
@@ -18644,6 +20269,8 @@ bool RocksDBBlueFSVolumeSelector::compare(BlueFSVolumeSelector* other) {
 static const std::string allocator_dir    = "ALLOCATOR_NCB_DIR";
 static const std::string allocator_file   = "ALLOCATOR_NCB_FILE";
 static uint32_t    s_format_version = 0x01; // support future changes to allocator-map file
+// the file covers the allocation delta log up to the seq kept in the header
+static uint32_t    s_format_version_delta_log = 0x02;
 static uint32_t    s_serial         = 0x01;
 
 #if 1
@@ -18661,12 +20288,14 @@ static uint32_t    s_serial         = 0x01;
 
 // 48 Bytes header for on-disk alloator image
 const uint64_t ALLOCATOR_IMAGE_VALID_SIGNATURE = 0x1FACE0FF;
+// pad[2] of a delta log image, makes older versions reject the file
+const uint32_t ALLOCATOR_IMAGE_DELTA_LOG_SIGNATURE = 0x0DE17A00;
 struct allocator_image_header {
   uint32_t format_version;	// 0x00
   uint32_t valid_signature;	// 0x04
   utime_t  timestamp;		// 0x08
   uint32_t serial;		// 0x10
-  uint32_t pad[0x7];		// 0x14
+  uint32_t pad[0x7];		// 0x14 (delta log seq in pad[0..2] for v2)
 
   allocator_image_header() {
     memset((char*)this, 0, sizeof(allocator_image_header));
@@ -18681,6 +20310,18 @@ struct allocator_image_header {
     memset(this->pad, 0, sizeof(this->pad));
   }
 
+  bool has_delta_seq() const {
+    return format_version >= s_format_version_delta_log;
+  }
+  uint64_t get_delta_seq() const {
+    return (uint64_t(pad[1]) << 32) | pad[0];
+  }
+  void set_delta_seq(uint64_t seq) {
+    pad[0] = uint32_t(seq);
+    pad[1] = uint32_t(seq >> 32);
+    pad[2] = ALLOCATOR_IMAGE_DELTA_LOG_SIGNATURE;
+  }
+
   friend std::ostream& operator<<(std::ostream& out, const allocator_image_header& header) {
     out << "format_version  = " << header.format_version << std::endl;
     out << "valid_signature = " << header.valid_signature << "/" << ALLOCATOR_IMAGE_VALID_SIGNATURE << std::endl;
@@ -18708,7 +20349,15 @@ struct allocator_image_header {
 
   int verify(CephContext* cct, const std::string &path) {
     if (valid_signature == ALLOCATOR_IMAGE_VALID_SIGNATURE) {
-      for (unsigned i = 0; i < (sizeof(pad) / sizeof(uint32_t)); i++) {
+      unsigned first_pad = 0;
+      if (has_delta_seq()) {
+	if (pad[2] != ALLOCATOR_IMAGE_DELTA_LOG_SIGNATURE) {
+	  derr << "Illegal Header - delta log signature=" << pad[2] << dendl;
+	  return -1;
+	}
+	first_pad = 3;
+      }
+      for (unsigned i = first_pad; i < (sizeof(pad) / sizeof(uint32_t)); i++) {
 	if (this->pad[i]) {
 	  derr << "Illegal Header - pad[" << i << "]="<< pad[i] << dendl;
 	  return -1;
@@ -18990,10 +20639,43 @@ int BlueStore::store_allocator(Allocator* src_allocator)
   }
 
   // store all extents (except for the bluefs extents we removed) in a single flat file
+  std::optional<uint64_t> delta_seq;
+  if (alloc_delta_log || alloc_delta_log_empty) {
+    delta_seq = alloc_delta_seq.load();
+  }
+  ret = __store_allocator(
+    p_handle,
+    [&](std::function<void(uint64_t, uint64_t)> notify) {
+      allocator->foreach(notify);
+    },
+    delta_seq);
+  bluefs->close_writer(p_handle);
+  if (ret != 0) {
+    return -1;
+  }
+
+  utime_t duration = ceph_clock_now() - start_time;
+  dout(5) <<"WRITE-duration=" << duration << " seconds" << dendl;
+  need_to_destage_allocation_file = false;
+  return 0;
+}
+
+//-----------------------------------------------------------------------------------
+int BlueStore::__store_allocator(
+  BlueFS::FileWriter *p_handle,
+  std::function<void(std::function<void(uint64_t, uint64_t)>)> for_each,
+  std::optional<uint64_t> delta_seq)
+{
+  int ret = 0;
   utime_t                 timestamp = ceph_clock_now();
   uint32_t                crc       = -1;
+  uint32_t                format_version =
+    delta_seq ? s_format_version_delta_log : s_format_version;
   {
-    allocator_image_header  header(timestamp, s_format_version, s_serial);
+    allocator_image_header  header(timestamp, format_version, s_serial);
+    if (delta_seq) {
+      header.set_delta_seq(*delta_seq);
+    }
     bufferlist              header_bl;
     encode(header, header_bl);
     crc = header_bl.crc32c(crc);
@@ -19024,13 +20706,12 @@ int BlueStore::store_allocator(Allocator* src_allocator)
       p_curr = buffer; // recycle the buffer
     }
   };
-  allocator->foreach(iterated_allocation);
+  for_each(iterated_allocation);
   // if got null extent -> fail the operation
   if (ret != 0) {
     derr << "Illegal extent, fail store operation" << dendl;
     derr << "invalidate using bluefs->truncate(p_handle, 0)" << dendl;
     bluefs->truncate(p_handle, 0);
-    bluefs->close_writer(p_handle);
     return -1;
   }
 
@@ -19040,7 +20721,7 @@ int BlueStore::store_allocator(Allocator* src_allocator)
   }
 
   {
-    allocator_image_trailer trailer(timestamp, s_format_version, s_serial, extent_count, allocation_size);
+    allocator_image_trailer trailer(timestamp, format_version, s_serial, extent_count, allocation_size);
     bufferlist trailer_bl;
     encode(trailer, trailer_bl);
     uint32_t crc = -1;
@@ -19053,12 +20734,9 @@ int BlueStore::store_allocator(Allocator* src_allocator)
   bluefs->truncate(p_handle, p_handle->pos);
   bluefs->fsync(p_handle);
 
-  utime_t duration = ceph_clock_now() - start_time;
   dout(5) <<"WRITE-extent_count=" << extent_count << ", allocation_size=" << allocation_size << ", serial=" << s_serial << dendl;
-  dout(5) <<"p_handle->pos=" << p_handle->pos << " WRITE-duration=" << duration << " seconds" << dendl;
-
-  bluefs->close_writer(p_handle);
-  need_to_destage_allocation_file = false;
+  dout(5) <<"p_handle->pos=" << p_handle->pos
+	  << " delta_seq=" << (delta_seq ? *delta_seq : 0) << dendl;
   return 0;
 }
 
@@ -19107,7 +20785,10 @@ int calc_allocator_image_trailer_size()
 }
 
 //-----------------------------------------------------------------------------------
-int BlueStore::__restore_allocator(Allocator* allocator, uint64_t *num, uint64_t *bytes)
+int BlueStore::__restore_allocator(
+  std::function<void(uint64_t, uint64_t)> add_free,
+  uint64_t *num, uint64_t *bytes,
+  std::optional<uint64_t> *delta_seq)
 {
   if (cct->_conf->bluestore_debug_inject_allocation_from_file_failure > 0) {
      boost::mt11213b rng(time(NULL));
@@ -19195,7 +20876,7 @@ int BlueStore::__restore_allocator(Allocator* allocator, uint64_t *num, uint64_t
       read_alloc_size += length;
 
       if (length > 0) {
-	allocator->init_add_free(offset, length);
+	add_free(offset, length);
 	extent_count ++;
       } else {
 	derr << "extent with zero length at idx=" << extent_count << dendl;
@@ -19260,6 +20941,10 @@ int BlueStore::__restore_allocator(Allocator* allocator, uint64_t *num, uint64_t
   dout(5) << "READ duration=" << duration << " seconds, s_serial=" << header.serial << dendl;
   *num   = extent_count;
   *bytes = read_alloc_size;
+  delta_seq->reset();
+  if (header.has_delta_seq()) {
+    *delta_seq = header.get_delta_seq();
+  }
   return 0;
 }
 
@@ -19268,11 +20953,43 @@ int BlueStore::restore_allocator(Allocator* dest_allocator, uint64_t *num, uint6
 {
   utime_t    start = ceph_clock_now();
   auto temp_allocator = unique_ptr<Allocator>(create_bitmap_allocator(bdev->get_size()));
-  int ret = __restore_allocator(temp_allocator.get(), num, bytes);
+  std::optional<uint64_t> delta_seq;
+  int ret = __restore_allocator(
+    [&](uint64_t offset, uint64_t length) {
+      temp_allocator->init_add_free(offset, length);
+    },
+    num, bytes, &delta_seq);
   if (ret != 0) {
     return ret;
   }
 
+  if (delta_seq) {
+    // bring the file up to date with the allocation delta log
+    uint64_t count = 0;
+    ret = _replay_alloc_deltas(
+      *delta_seq,
+      [&](uint64_t seq,
+	  const interval_set<uint64_t>& allocated,
+	  const interval_set<uint64_t>& released) {
+	for (auto p = allocated.begin(); p != allocated.end(); ++p) {
+	  temp_allocator->init_rm_free(p.get_start(), p.get_len());
+	}
+	for (auto p = released.begin(); p != released.end(); ++p) {
+	  temp_allocator->init_add_free(p.get_start(), p.get_len());
+	}
+	alloc_delta_replayed_seq = seq;
+	++count;
+	return true;
+      });
+    if (ret != 0) {
+      return ret;
+    }
+    dout(5) << "replayed " << count << " allocation deltas after seq "
+	    << *delta_seq << " up to " << alloc_delta_replayed_seq << dendl;
+  }
+  alloc_file_restored = true;
+  alloc_file_delta_seq = delta_seq;
+
   uint64_t num_entries = 0;
   dout(5) << " calling copy_allocator(bitmap_allocator -> shared_alloc.a)" << dendl;
   copy_allocator(temp_allocator.get(), dest_allocator, &num_entries);
@@ -19281,6 +20998,508 @@ int BlueStore::restore_allocator(Allocator* dest_allocator, uint64_t *num, uint6
   return ret;
 }
 
+//-----------------------------------------------------------------------------------
+// Rebuild the allocation file from its previous copy and the delta log. It
+// only depends on persisted state, so the live allocator and bluefs are never
+// touched and a crash at any point leaves either the old or the new file in
+// place, both of which are valid with the log.
+// Only the net effect of the deltas is kept in memory, the extents of the
+// previous file are streamed into the new one as they are read.
+int BlueStore::_checkpoint_allocator()
+{
+  uint64_t min_deltas =
+    cct->_conf.get_val<uint64_t>("bluestore_allocation_checkpoint_min_deltas");
+  if (alloc_delta_seq - alloc_checkpoint_seq < std::max<uint64_t>(min_deltas, 1)) {
+    return 0;
+  }
+  utime_t start = ceph_clock_now();
+
+  // extents allocated since the file was written and still in use, and
+  // extents released since
+  interval_set<uint64_t> used, freed;
+
+  // Deltas of txcs still in flight may be missing, so stop at the first gap.
+  // Gaps left by txcs lost in a crash are only possible up to the last seq
+  // replayed on mount.
+  const uint64_t file_seq = alloc_checkpoint_seq;
+  uint64_t last = file_seq;
+  uint64_t floor = std::max(last, alloc_delta_replayed_seq);
+  int ret = _replay_alloc_deltas(
+    last,
+    [&](uint64_t seq,
+	const interval_set<uint64_t>& allocated,
+	const interval_set<uint64_t>& released) {
+      if (seq > floor && seq != std::max(last, floor) + 1) {
+	return false;
+      }
+      interval_set<uint64_t> overlap;
+      overlap.intersection_of(freed, allocated);
+      freed.subtract(overlap);
+      used.union_of(allocated);
+      overlap.intersection_of(used, released);
+      used.subtract(overlap);
+      freed.union_of(released);
+      last = seq;
+      return true;
+    });
+  if (ret != 0) {
+    return ret;
+  }
+  last = std::max(last, floor);
+  if (last == file_seq) {
+    return 0;
+  }
+  interval_set<uint64_t> touched;
+  touched.union_of(used, freed);
+
+  const string tmp_file = allocator_file + ".tmp";
+  BlueFS::FileWriter *p_handle = nullptr;
+  bool overwrite_file =
+    bluefs->stat(allocator_dir, tmp_file, nullptr, nullptr) == 0;
+  ret = bluefs->open_for_write(allocator_dir, tmp_file, &p_handle, overwrite_file);
+  if (ret != 0) {
+    derr << "Failed open_for_write with error-code " << ret << dendl;
+    return ret;
+  }
+  uint64_t extent_count = 0;
+  int read_ret = 0;
+  std::optional<uint64_t> read_seq;
+  ret = __store_allocator(
+    p_handle,
+    [&](std::function<void(uint64_t, uint64_t)> notify) {
+      uint64_t num = 0, bytes = 0;
+      read_ret = __restore_allocator(
+	[&](uint64_t offset, uint64_t length) {
+	  if (!touched.intersects(offset, length)) {
+	    notify(offset, length);
+	    ++extent_count;
+	    return;
+	  }
+	  interval_set<uint64_t> rest, overlap;
+	  rest.insert(offset, length);
+	  overlap.intersection_of(rest, touched);
+	  rest.subtract(overlap);
+	  for (auto p = rest.begin(); p != rest.end(); ++p) {
+	    notify(p.get_start(), p.get_len());
+	    ++extent_count;
+	  }
+	},
+	&num, &bytes, &read_seq);
+      if (read_ret != 0) {
+	return;
+      }
+      for (auto p = freed.begin(); p != freed.end(); ++p) {
+	notify(p.get_start(), p.get_len());
+	++extent_count;
+      }
+    },
+    last);
+  bluefs->close_writer(p_handle);
+  if (ret != 0) {
+    return ret;
+  }
+  if (read_ret != 0 || read_seq != file_seq) {
+    derr << "failed to read allocation file, checkpoint skipped" << dendl;
+    return -EIO;
+  }
+  ret = bluefs->rename(allocator_dir, tmp_file, allocator_dir, allocator_file);
+  if (ret != 0) {
+    derr << "Failed rename with error-code " << ret << dendl;
+    return ret;
+  }
+  bluefs->sync_metadata(false);
+
+  // the deltas are in the file now
+  auto t = db->get_transaction();
+  string end;
+  get_alloc_delta_key(last + 1, &end);
+  t->rm_range_keys(PREFIX_ALLOC_DELTA, string(), end);
+  db->submit_transaction(t);
+  alloc_checkpoint_seq = last;
+
+  utime_t duration = ceph_clock_now() - start;
+  logger->tinc(l_bluestore_alloc_checkpoint_lat, duration);
+  dout(5) << "checkpoint seq " << file_seq << " -> " << last
+	  << ", extent_count=" << extent_count
+	  << " in " << duration << " seconds" << dendl;
+  return 0;
+}
+
+void *BlueStore::AllocCheckpointThread::entry()
+{
+  std::unique_lock l{lock};
+  while (!stop) {
+    double interval = store->cct->_conf.get_val<double>(
+      "bluestore_allocation_checkpoint_interval");
+    cond.wait_for(l, ceph::make_timespan(interval > 0 ? interval : 1.0));
+    if (stop || interval <= 0) {
+      continue;
+    }
+    l.unlock();
+    store->_checkpoint_allocator();
+    l.lock();
+  }
+  return NULL;
+}
+
+// ---------------
+// defragmentation
+
+class BlueStore::SocketHook : public AdminSocketHook {
+  BlueStore* store;
+public:
+  static BlueStore::SocketHook* create(BlueStore* store)
+  {
+    BlueStore::SocketHook* hook = nullptr;
+    AdminSocket* admin_socket = store->cct->get_admin_socket();
+    if (admin_socket) {
+      hook = new BlueStore::SocketHook(store);
+      int r = admin_socket->register_command("bluestore defrag start",
+					     hook,
+					     "Start a defragmentation pass now");
+      if (r != 0) {
+	ldout(store->cct, 1) << __func__ << " cannot register SocketHook" << dendl;
+	delete hook;
+	hook = nullptr;
+      } else {
+	r = admin_socket->register_command("bluestore defrag stop", hook,
+					   "Abort the defragmentation pass in "
+					   "progress and pause until started again");
+	ceph_assert(r == 0);
+	r = admin_socket->register_command("bluestore defrag status", hook,
+					   "Show defragmentation progress");
+	ceph_assert(r == 0);
+      }
+    }
+    return hook;
+  }
+
+  ~SocketHook() {
+    AdminSocket* admin_socket = store->cct->get_admin_socket();
+    admin_socket->unregister_commands(this);
+  }
+private:
+  SocketHook(BlueStore* store) :
+    store(store) {}
+  int call(std::string_view command, const cmdmap_t& cmdmap,
+	   const bufferlist&,
+	   Formatter *f,
+	   std::ostream& errss,
+	   bufferlist& out) override {
+    auto& t = store->defrag_thread;
+    std::lock_guard l(t.lock);
+    if (command == "bluestore defrag start") {
+      t.paused = false;
+      t.kick = true;
+      t.cond.notify_all();
+    } else if (command == "bluestore defrag stop") {
+      t.paused = true;
+      t.kick = false;
+      t.cond.notify_all();
+    } else if (command == "bluestore defrag status") {
+      f->open_object_section("defrag");
+      f->dump_string("state",
+		     t.paused ? "paused" : (t.running ? "running" : "idle"));
+      f->dump_stream("collection") << t.cur_coll;
+      f->dump_unsigned("scanned_objects", t.scanned);
+      f->dump_unsigned("rewritten_objects", t.rewritten);
+      f->dump_unsigned("rewritten_bytes", t.bytes);
+      f->dump_stream("last_pass") << t.last_pass;
+      f->close_section();
+    } else {
+      errss << "Invalid command" << std::endl;
+      return -ENOSYS;
+    }
+    return 0;
+  }
+};
+
+void BlueStore::_defrag_start()
+{
+  asok_hook = SocketHook::create(this);
+  defrag_thread.init();
+}
+
+void BlueStore::_defrag_stop()
+{
+  delete asok_hook;
+  asok_hook = nullptr;
+  if (defrag_thread.is_started()) {
+    defrag_thread.shutdown();
+  }
+}
+
+void *BlueStore::DefragThread::entry()
+{
+  std::unique_lock l{lock};
+  while (!stop) {
+    double interval = store->cct->_conf.get_val<double>(
+      "bluestore_defrag_interval");
+    if (!kick) {
+      cond.wait_for(l, ceph::make_timespan(interval > 0 ? interval : 1.0));
+    }
+    if (stop) {
+      break;
+    }
+    if (!kick && (paused || interval <= 0)) {
+      continue;
+    }
+    kick = false;
+    running = true;
+    scanned = rewritten = bytes = 0;
+    l.unlock();
+    auto start = mono_clock::now();
+    store->_defrag_pass();
+    store->logger->tinc(l_bluestore_defrag_lat, mono_clock::now() - start);
+    l.lock();
+    running = false;
+    last_pass = ceph_clock_now();
+  }
+  return NULL;
+}
+
+bool BlueStore::_defrag_should_stop()
+{
+  std::lock_guard l(defrag_thread.lock);
+  return defrag_thread.stop || defrag_thread.paused;
+}
+
+void BlueStore::_defrag_pass()
+{
+  dout(10) << __func__ << dendl;
+  vector<CollectionRef> colls;
+  {
+    std::shared_lock l(coll_lock);
+    for (auto& p : coll_map) {
+      colls.push_back(p.second);
+    }
+  }
+  for (auto& c : colls) {
+    {
+      std::lock_guard l(defrag_thread.lock);
+      defrag_thread.cur_coll = c->cid;
+    }
+    ghobject_t next;
+    while (!_defrag_should_stop()) {
+      vector<ghobject_t> ls;
+      {
+	std::shared_lock l(c->lock);
+	if (!c->exists ||
+	    _collection_list(c.get(), next, ghobject_t::get_max(), 64, false,
+			     &ls, &next) < 0) {
+	  break;
+	}
+      }
+      for (auto& oid : ls) {
+	if (_defrag_should_stop()) {
+	  return;
+	}
+	uint64_t bytes = 0, removed = 0;
+	int r = _defrag_object(c, oid, &bytes, &removed);
+	logger->inc(l_bluestore_defrag_scanned_objects);
+	std::unique_lock l(defrag_thread.lock);
+	++defrag_thread.scanned;
+	if (r <= 0) {
+	  continue;
+	}
+	++defrag_thread.rewritten;
+	defrag_thread.bytes += bytes;
+	logger->inc(l_bluestore_defrag_objects);
+	logger->inc(l_bluestore_defrag_bytes, bytes);
+	logger->inc(l_bluestore_defrag_removed_extents, removed);
+
+	// throttle
+	auto rate = cct->_conf.get_val<Option::size_t>(
+	  "bluestore_defrag_max_bytes_per_sec");
+	if (rate) {
+	  defrag_thread.cond.wait_for(
+	    l, ceph::make_timespan((double)bytes / rate),
+	    [this] { return defrag_thread.stop || defrag_thread.paused; });
+	}
+      }
+      if (ls.empty() || next.is_max()) {
+	break;
+      }
+    }
+  }
+}
+
+// Returns 1 if the object was rewritten, 0 if it doesn't need to be,
+// or a negative error.
+int BlueStore::_defrag_object(CollectionRef& c, const ghobject_t& oid,
+			      uint64_t *bytes, uint64_t *removed_extents)
+{
+  auto count_extents = [](OnodeRef& o, bool *shared) {
+    uint64_t n = 0;
+    std::set<Blob*> seen;
+    for (auto& e : o->extent_map.extent_map) {
+      if (!seen.insert(e.blob.get()).second) {
+	continue;
+      }
+      auto& b = e.blob->get_blob();
+      if (shared && b.is_shared()) {
+	*shared = true;
+      }
+      for (auto& p : b.get_extents()) {
+	n += p.is_valid();
+      }
+    }
+    return n;
+  };
+
+  // analyze and read under the shared lock like any reader, then
+  // revalidate before rewriting
+  OnodeRef o;
+  uint64_t modify_seq;
+  uint64_t before;
+  interval_set<uint64_t> data;
+  vector<bufferlist> bls;
+  {
+    std::shared_lock l{c->lock};
+    if (!c->exists) {
+      return 0;
+    }
+    o = c->get_onode(oid, false);
+    if (!o || !o->exists || !o->onode.size) {
+      return 0;
+    }
+    if (o->flushing_count.load()) {
+      // writes in flight, leave it for the next pass
+      return 0;
+    }
+    modify_seq = o->modify_seq;
+    o->extent_map.fault_range(db, 0, o->onode.size);
+
+    bool shared = false;
+    before = count_extents(o, &shared);
+    if (shared) {
+      // rewriting would unshare the data of clones
+      return 0;
+    }
+    for (auto& e : o->extent_map.extent_map) {
+      data.union_insert(e.logical_offset, e.length);
+    }
+    // number of extents the data would occupy if allocated contiguously
+    uint64_t ideal = data.num_intervals() +
+      data.size() / std::max<uint64_t>(max_blob_size, min_alloc_size);
+    uint64_t min_extents =
+      cct->_conf.get_val<uint64_t>("bluestore_defrag_min_extents");
+    double ratio = cct->_conf.get_val<double>("bluestore_defrag_extent_ratio");
+    dout(20) << __func__ << " " << c->cid << " " << oid
+	     << " extents " << before << " ideal " << ideal << dendl;
+    if (before < min_extents || before < ideal * ratio) {
+      return 0;
+    }
+
+    // the old extents are released only once the rewrite commits, so all
+    // of the new space has to be available on top of them; full ratios
+    // don't apply to this internal write, keep our own reserve instead
+    uint64_t need = 0;
+    for (auto p = data.begin(); p != data.end(); ++p) {
+      need += p2roundup(p.get_end(), min_alloc_size) -
+	p2align(p.get_start(), min_alloc_size);
+    }
+    uint64_t reserve = alloc->get_capacity() *
+      cct->_conf.get_val<double>("bluestore_defrag_min_free_ratio");
+    uint64_t free = alloc->get_free();
+    if (free < need + reserve) {
+      dout(10) << __func__ << " " << c->cid << " " << oid
+	       << " needs 0x" << std::hex << need << " + 0x" << reserve
+	       << " reserve, free 0x" << free << std::dec << ", skipping" << dendl;
+      return 0;
+    }
+
+    for (auto p = data.begin(); p != data.end(); ++p) {
+      bufferlist bl;
+      int r = _do_read(c.get(), o, p.get_start(), p.get_len(), bl,
+		       CEPH_OSD_OP_FLAG_FADVISE_NOCACHE);
+      if (r < 0) {
+	derr << __func__ << " " << c->cid << " " << oid
+	     << " read failed: " << cpp_strerror(r) << dendl;
+	return r;
+      }
+      bls.emplace_back(std::move(bl));
+    }
+  }
+
+  std::unique_lock l{c->lock};
+  if (!c->exists || !o->exists || o->c != c.get() || o->oid != oid ||
+      o->modify_seq != modify_seq || o->flushing_count.load()) {
+    dout(20) << __func__ << " " << c->cid << " " << oid
+	     << " changed while reading, skipping" << dendl;
+    return 0;
+  }
+  if (o->nref.load() > 2) {
+    // someone besides the onode cache and us holds the onode (readahead,
+    // omap iterators); it could not be dropped if the rewrite failed
+    dout(20) << __func__ << " " << c->cid << " " << oid
+	     << " nref " << o->nref.load() << ", skipping" << dendl;
+    return 0;
+  }
+
+  TransContext *txc = _txc_create(c.get(), c->osr.get(), nullptr);
+  if (c->submitting.load()) {
+    // a client txc may have been queued ahead of ours without having
+    // applied its ops yet, it would then commit our allocations
+    l.unlock();
+    _txc_submit(txc);
+    return 0;
+  }
+  spg_t pgid;
+  if (c->cid.is_pg(&pgid)) {
+    txc->osd_pool_id = pgid.pool();
+  }
+  ++o->modify_seq;
+  auto bl = bls.begin();
+  for (auto p = data.begin(); p != data.end(); ++p, ++bl) {
+    int r = _write(txc, c, o, p.get_start(), p.get_len(), *bl,
+		   CEPH_OSD_OP_FLAG_FADVISE_NOCACHE);
+    if (r < 0) {
+      // e.g. ENOSPC from a concurrent writer despite the check above.
+      // Nothing of the txc has been submitted, so the on-disk state is
+      // intact, but the cached onode already carries the partial rewrite:
+      // drop both and let the next access reload the object.
+      derr << __func__ << " " << c->cid << " " << oid
+	   << " rewrite failed: " << cpp_strerror(r) << dendl;
+      _defrag_discard(txc, c, o);
+      return r;
+    }
+  }
+  uint64_t after = count_extents(o, nullptr);
+  l.unlock();
+
+  txc->bytes = data.size();
+  _txc_submit(txc);
+  dout(10) << __func__ << " " << c->cid << " " << oid
+	   << " 0x" << std::hex << data.size() << std::dec
+	   << " bytes, extents " << before << " -> " << after << dendl;
+  *bytes = data.size();
+  *removed_extents = before > after ? before - after : 0;
+  return 1;
+}
+
+// Throw away a defrag txc that has not been submitted, together with the
+// cached state it modified. Caller holds c->lock exclusively and has made
+// sure the onode cache and itself are the only holders of o.
+void BlueStore::_defrag_discard(TransContext *txc, CollectionRef& c,
+				OnodeRef& o)
+{
+  dout(10) << __func__ << " " << txc << " " << o->oid << dendl;
+  for (auto& b : txc->blobs_written) {
+    b->finish_write(txc->seq);
+  }
+  txc->blobs_written.clear();
+  // the pending aios are never submitted, the space can be reused
+  alloc->release(txc->allocated);
+  txc->allocated.clear();
+  txc->released.clear();
+  txc->onodes.clear();
+  txc->osr->undo_queue(txc);
+  delete txc;
+  c->onode_space.evict(o->oid);
+  o.reset();
+}
+
 //-----------------------------------------------------------------------------------
 void BlueStore::set_allocation_in_simple_bmap(SimpleBitmap* sbmap, uint64_t offset, uint64_t length)
 {
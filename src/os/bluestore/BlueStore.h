@@ -48,6 +48,7 @@
 #include "common/Throttle.h"
 #include "common/perf_counters.h"
 #include "common/PriorityCache.h"
+#include "common/Readahead.h"
 #include "compressor/Compressor.h"
 #include "os/ObjectStore.h"
 
@@ -113,6 +114,10 @@ enum {
   l_bluestore_read_eio,
   l_bluestore_reads_with_retries,
   l_bluestore_read_lat,
+  l_bluestore_readahead_count,
+  l_bluestore_readahead_bytes,
+  l_bluestore_readahead_hit_bytes,
+  l_bluestore_readahead_wasted_bytes,
   //****************************************
 
   // kv_thread latencies
@@ -121,6 +126,7 @@ enum {
   l_bluestore_kv_commit_lat,
   l_bluestore_kv_sync_lat,
   l_bluestore_kv_final_lat,
+  l_bluestore_kv_sync_batch,
   //****************************************
 
   // write op stats
@@ -143,6 +149,9 @@ enum {
   l_bluestore_issued_deferred_write_bytes,
   l_bluestore_submitted_deferred_writes,
   l_bluestore_submitted_deferred_write_bytes,
+  l_bluestore_deferred_adaptive_size,
+  l_bluestore_deferred_adaptive_batch_ops,
+  l_bluestore_deferred_aio_lat,
 
   l_bluestore_write_big_skipped_blobs,
   l_bluestore_write_big_skipped_bytes,
@@ -159,6 +168,8 @@ enum {
   l_bluestore_decompress_lat,
   l_bluestore_compress_success_count,
   l_bluestore_compress_rejected_count,
+  l_bluestore_compress_skipped_count,
+  l_bluestore_compress_parallel_count,
   //****************************************
 
   // onode cache stats
@@ -167,8 +178,10 @@ enum {
   l_bluestore_pinned_onodes,
   l_bluestore_onode_hits,
   l_bluestore_onode_misses,
+  l_bluestore_onode_batch_reads,
   l_bluestore_onode_shard_hits,
   l_bluestore_onode_shard_misses,
+  l_bluestore_onode_shard_unloads,
   l_bluestore_extents,
   l_bluestore_blobs,
   //****************************************
@@ -204,6 +217,7 @@ enum {
   l_bluestore_omap_next_lat,
   l_bluestore_omap_get_keys_lat,
   l_bluestore_omap_get_values_lat,
+  l_bluestore_omap_iterate_lat,
   l_bluestore_omap_clear_lat,
   l_bluestore_clist_lat,
   l_bluestore_remove_lat,
@@ -214,6 +228,23 @@ enum {
   //****************************************
   l_bluestore_allocate_hist,
   l_bluestore_allocator_lat,
+  l_bluestore_alloc_deltas,
+  l_bluestore_alloc_checkpoint_lat,
+  //****************************************
+
+  // defragmentation stats
+  //****************************************
+  l_bluestore_defrag_scanned_objects,
+  l_bluestore_defrag_objects,
+  l_bluestore_defrag_bytes,
+  l_bluestore_defrag_removed_extents,
+  l_bluestore_defrag_lat,
+  //****************************************
+
+  // fsck stats
+  //****************************************
+  l_bluestore_fsck_deep_objects,
+  l_bluestore_fsck_deep_bytes,
   //****************************************
 
   // slow op counter
@@ -226,6 +257,18 @@ enum {
   l_bluestore_last
 };
 
+// per kv sync shard stats, see BlueStore::KVSyncShard
+enum {
+  l_bluestore_kv_shard_first = 732900,
+  l_bluestore_kv_shard_txc,
+  l_bluestore_kv_shard_batch,
+  l_bluestore_kv_shard_flush_lat,
+  l_bluestore_kv_shard_commit_lat,
+  l_bluestore_kv_shard_sync_lat,
+  l_bluestore_kv_shard_final_lat,
+  l_bluestore_kv_shard_last
+};
+
 #define META_POOL_ID ((uint64_t)-1ull)
 using bptr_c_it_t = buffer::ptr::const_iterator;
 
@@ -1135,6 +1178,10 @@ public:
     /// ensure a range of the map is marked dirty
     void dirty_range(uint32_t offset, uint32_t length);
 
+    /// drop the decoded extents of loaded, clean shards; fault_range()
+    /// brings them back.  returns the number of shards unloaded
+    unsigned unload_clean_shards();
+
     /// for seek_lextent test
     extent_map_t::iterator find(uint64_t offset);
 
@@ -1303,6 +1350,15 @@ public:
 
   struct OnodeSpace;
   struct OnodeCacheShard;
+  /// per onode sequential read detection and read-ahead accounting
+  struct ReadaheadState {
+    Readahead ra;
+    ceph::mutex lock = ceph::make_mutex("BlueStore::ReadaheadState::lock");
+    /// read ahead data which hasn't been read by the client yet
+    uint64_t start = 0;
+    uint64_t end = 0;
+  };
+
   /// an in-memory object
   struct Onode {
     MEMPOOL_CLASS_HELPERS();
@@ -1316,6 +1372,7 @@ public:
     mempool::bluestore_cache_meta::string key;
 
     boost::intrusive::list_member_hook<> lru_item;
+    std::atomic_bool cache_ref = {false}; ///< CLOCK reference bit
 
     bluestore_onode_t onode;  ///< metadata stored as value in kv store
     bool exists;              ///< true if object logically exists
@@ -1332,6 +1389,11 @@ public:
     ceph::mutex flush_lock = ceph::make_mutex("BlueStore::Onode::flush_lock");
     ceph::condition_variable flush_cond;   ///< wait here for uncommitted txns
     std::shared_ptr<int64_t> cache_age_bin;  ///< cache age bin
+    /// created on the first read which may trigger read-ahead
+    std::atomic<ReadaheadState*> readahead = {nullptr};
+    /// bumped under the collection's exclusive lock by every change to the
+    /// object's extents, lets in-flight read-ahead detect stale data
+    uint64_t modify_seq = 0;
 
     Onode(Collection *c, const ghobject_t& o,
 	  const mempool::bluestore_cache_meta::string& k)
@@ -1374,6 +1436,9 @@ public:
 	  cct->_conf->
 	    bluestore_extent_map_inline_shard_prealloc_size) {
     }
+    ~Onode() {
+      delete readahead.load();
+    }
     static void decode_raw(
       BlueStore::Onode* on,
       const bufferlist& v,
@@ -1392,6 +1457,8 @@ public:
     void get();
     void put();
 
+    ReadaheadState* get_readahead();
+
     inline bool is_cached() const {
       return cached;
     }
@@ -1532,6 +1599,10 @@ private:
     bool empty() {
       return _get_num() == 0;
     }
+
+    /// instead of evicting an unpinned onode, shrink it to its encoded
+    /// shards first (see bluestore_onode_cache_unload_shards)
+    bool _maybe_unload_shards(Onode* o);
   };
 
   /// A Generic buffer Cache Shard
@@ -1593,6 +1664,7 @@ private:
     friend struct Collection; // for split_cache()
     friend struct Onode; // for put()
     friend struct LruOnodeCacheShard;
+    friend struct ClockOnodeCacheShard;
     void _remove(const ghobject_t& oid);
   public:
     OnodeSpace(OnodeCacheShard *c) : cache(c) {}
@@ -1605,6 +1677,8 @@ private:
     void rename(OnodeRef& o, const ghobject_t& old_oid,
 		const ghobject_t& new_oid,
 		const mempool::bluestore_cache_meta::string& new_okey);
+    /// drop a possibly pinned onode, later lookups load it from disk
+    void evict(const ghobject_t& oid);
     void clear();
     bool empty();
 
@@ -1627,6 +1701,9 @@ private:
       ceph::make_shared_mutex("BlueStore::Collection::lock", true, false);
 
     bool exists;
+    /// queue_transactions() calls that created a txc but haven't applied
+    /// its ops yet, background rewrites must not be ordered among them
+    std::atomic<int> submitting = {0};
 
     SharedBlobSet shared_blob_set;      ///< open SharedBlobs
 
@@ -1642,6 +1719,11 @@ private:
       return onode_space.cache;
     }
     OnodeRef get_onode(const ghobject_t& oid, bool create, bool is_createop=false);
+    /// batched get_onode(): all uncached onodes are read with one kv lookup,
+    /// (*onodes)[i] stays null if oids[i] doesn't exist and !create[i]
+    void get_onodes(const std::vector<ghobject_t>& oids,
+		    const std::vector<bool>& create,
+		    std::vector<OnodeRef>* onodes);
 
     // the terminology is confusing here, sorry!
     //
@@ -2062,6 +2144,12 @@ private:
     bool should_submit_deferred() {
       return throttle_deferred_bytes.past_midpoint();
     }
+    /// fraction of the deferred throttle in use, in [0, 1]
+    double get_deferred_usage() const {
+      int64_t max = throttle_deferred_bytes.get_max();
+      return max > 0 ?
+	std::min(1.0, (double)throttle_deferred_bytes.get_current() / max) : 0;
+    }
     void reset_throttle(const ConfigProxy &conf) {
       throttle_bytes.reset_max(conf->bluestore_throttle_bytes);
       throttle_deferred_bytes.reset_max(
@@ -2092,6 +2180,7 @@ private:
     IOContext ioc;                   ///< our aios
     /// bytes of pending io for each deferred seq (may be 0)
     std::map<uint64_t,int> seq_bytes;
+    ceph::mono_clock::time_point submit_stamp; ///< when aios were submitted
 
     void _discard(CephContext *cct, uint64_t offset, uint64_t length);
     void _audit(CephContext *cct);
@@ -2154,9 +2243,14 @@ private:
     }
     void undo_queue(TransContext* txc) {
       std::lock_guard l(qlock);
-      ceph_assert(&q.back() == txc);
-      --last_seq;
-      q.pop_back();
+      if (&q.back() == txc) {
+	--last_seq;
+	q.pop_back();
+      } else {
+	// a later txc got queued meanwhile, leave a gap in the seqs
+	q.erase(q.iterator_to(*txc));
+	qcond.notify_all();
+      }
     }
 
     void drain() {
@@ -2268,6 +2362,59 @@ private:
     }
   };
 
+  struct CompressThread : public Thread {
+    BlueStore *store;
+    explicit CompressThread(BlueStore *s) : store(s) {}
+    void *entry() override {
+      store->_compress_thread();
+      return NULL;
+    }
+  };
+
+  struct KVSyncShard;
+  struct KVShardSyncThread : public Thread {
+    KVSyncShard *shard;
+    explicit KVShardSyncThread(KVSyncShard *s) : shard(s) {}
+    void *entry() override;
+  };
+  struct KVShardFinalizeThread : public Thread {
+    KVSyncShard *shard;
+    explicit KVShardFinalizeThread(KVSyncShard *s) : shard(s) {}
+    void *entry() override;
+  };
+
+  /// an additional kv commit pipeline (see bluestore_kv_sync_shards).
+  /// shard 0 is the kv_sync_thread/kv_finalize_thread pair, which also
+  /// owns deferred cleanup and {nid,blobid}_max preallocation; the others
+  /// only batch, submit and sync txcs of the OpSequencers bound to them.
+  struct KVSyncShard {
+    BlueStore *store;
+    const uint32_t shard_id;
+    PerfCounters *logger = nullptr;
+
+    KVShardSyncThread sync_thread;
+    ceph::mutex lock = ceph::make_mutex("BlueStore::KVSyncShard::lock");
+    ceph::condition_variable cond;
+    bool started = false;
+    bool stop = false;
+    bool in_progress = false;
+    std::deque<TransContext*> queue;  ///< ready, submitted or not
+    uint64_t ios = 0;
+    uint64_t throttle_costs = 0;
+
+    KVShardFinalizeThread finalize_thread;
+    ceph::mutex finalize_lock =
+      ceph::make_mutex("BlueStore::KVSyncShard::finalize_lock");
+    ceph::condition_variable finalize_cond;
+    bool finalize_started = false;
+    bool finalize_stop = false;
+    bool finalize_in_progress = false;
+    std::deque<TransContext*> committing_to_finalize; ///< pending finalization
+
+    KVSyncShard(BlueStore *store, uint32_t shard_id);
+    ~KVSyncShard();
+  };
+
   struct BigDeferredWriteContext {
     uint64_t off = 0;     // original logical offset
     uint32_t b_off = 0;   // blob relative offset
@@ -2314,6 +2461,15 @@ private:
   bool db_was_opened_read_only = true;
   bool need_to_destage_allocation_file = false;
 
+  // allocation delta log (see bluestore_allocation_checkpoint_interval)
+  bool alloc_delta_log = false;           ///< txcs log alloc/release deltas
+  bool alloc_delta_log_empty = false;     ///< log trimmed, unused till umount
+  bool alloc_file_restored = false;       ///< allocation file was usable
+  std::optional<uint64_t> alloc_file_delta_seq; ///< last delta in the file
+  std::atomic<uint64_t> alloc_delta_seq = {0}; ///< last assigned delta seq
+  uint64_t alloc_delta_replayed_seq = 0;  ///< last delta replayed on mount
+  uint64_t alloc_checkpoint_seq = 0;      ///< last delta in the checkpoint
+
   ///< rwlock to protect coll_map/new_coll_map
   ceph::shared_mutex coll_lock = ceph::make_shared_mutex("BlueStore::coll_lock");
   mempool::bluestore_cache_other::unordered_map<coll_t, CollectionRef> coll_map;
@@ -2364,9 +2520,22 @@ private:
   std::deque<DeferredBatch*> deferred_stable_to_finalize; ///< pending finalization
   bool kv_finalize_in_progress = false;
 
+  std::vector<std::unique_ptr<KVSyncShard>> kv_sync_shards; ///< shards 1..n-1
+  ceph::condition_variable kv_prealloc_cond; ///< {nid,blobid}_max raised
+  bool kv_prealloc_requested = false; ///< a shard waits for a new max
+
+  /// blobs of a write are compressed in parallel by these threads and the
+  /// submitting thread (see bluestore_compression_threads)
+  std::vector<std::unique_ptr<CompressThread>> compress_threads;
+  ceph::mutex compress_lock = ceph::make_mutex("BlueStore::compress_lock");
+  ceph::condition_variable compress_cond;
+  std::deque<std::function<void()>> compress_queue;
+  bool compress_stop = false;
+
   PerfCounters *logger = nullptr;
 
-  std::list<CollectionRef> removed_collections;
+  ceph::mutex reap_lock = ceph::make_mutex("BlueStore::reap_lock");
+  std::list<CollectionRef> removed_collections; ///< protected by reap_lock
 
   ceph::shared_mutex debug_read_error_lock =
     ceph::make_shared_mutex("BlueStore::debug_read_error_lock");
@@ -2404,6 +2573,43 @@ private:
   ///< size threshold for forced deferred writes
   std::atomic<uint64_t> prefer_deferred_size = {0};
 
+  ///< configured values of the two above; with bluestore_deferred_adaptive
+  ///< the effective ones are moved around these by _deferred_adapt()
+  std::atomic<int> deferred_batch_ops_conf = {0};
+  std::atomic<uint64_t> prefer_deferred_size_conf = {0};
+
+  /// latency samples and state for the adaptive deferred write policy
+  struct DeferredAdaptive {
+    struct Sample {
+      std::atomic<uint64_t> ns = {0};
+      std::atomic<uint64_t> count = {0};
+      void add(ceph::timespan t) {
+	ns += std::chrono::duration_cast<std::chrono::nanoseconds>(t).count();
+	++count;
+      }
+      /// fold samples since the last call into the ewma (seconds)
+      void update(double& ewma, double alpha) {
+	uint64_t c = count.exchange(0);
+	uint64_t n = ns.exchange(0);
+	if (c) {
+	  double avg = (double)n / c / 1000000000.0;
+	  ewma = ewma > 0 ? ewma + alpha * (avg - ewma) : avg;
+	}
+      }
+    };
+    Sample direct;   ///< aio wait of txcs writing to the main device
+    Sample deferred; ///< deferred batch aio on the main device
+    Sample commit;   ///< kv (WAL) commit
+    // below are only touched by the kv_finalize thread
+    double direct_lat = 0;
+    double deferred_lat = 0;
+    double commit_lat = 0;
+    int trend = 0;  ///< consecutive intervals voting the same way
+    ceph::mono_clock::time_point last_update;
+    /// set by _set_alloc_sizes() to have the kv_finalize thread start over
+    std::atomic<bool> reset = {false};
+  } deferred_adaptive;
+
   ///< approx cost per io, in bytes
   std::atomic<uint64_t> throttle_cost_per_io = {0};
 
@@ -2679,6 +2885,69 @@ private:
     void _resize_shards(bool interval_stats);
   } mempool_thread;
 
+  /// periodically folds the allocation delta log into the allocation file
+  struct AllocCheckpointThread : public Thread {
+    BlueStore *store;
+
+    ceph::condition_variable cond;
+    ceph::mutex lock = ceph::make_mutex("BlueStore::AllocCheckpointThread::lock");
+    bool stop = false;
+
+    explicit AllocCheckpointThread(BlueStore *s) : store(s) {}
+
+    void *entry() override;
+    void init() {
+      ceph_assert(stop == false);
+      create("bstore_alloc_cp");
+    }
+    void shutdown() {
+      lock.lock();
+      stop = true;
+      cond.notify_all();
+      lock.unlock();
+      join();
+      stop = false;
+    }
+  } alloc_checkpoint_thread;
+
+  /// rewrites fragmented objects into contiguous allocations
+  struct DefragThread : public Thread {
+    BlueStore *store;
+
+    ceph::condition_variable cond;
+    ceph::mutex lock = ceph::make_mutex("BlueStore::DefragThread::lock");
+    bool stop = false;
+    bool paused = false;   ///< stopped via admin socket until started again
+    bool kick = false;     ///< run a pass now, regardless of the interval
+    bool running = false;  ///< a pass is in progress
+
+    // progress of the current (or last) pass
+    coll_t cur_coll;
+    uint64_t scanned = 0;
+    uint64_t rewritten = 0;
+    uint64_t bytes = 0;
+    utime_t last_pass;
+
+    explicit DefragThread(BlueStore *s) : store(s) {}
+
+    void *entry() override;
+    void init() {
+      ceph_assert(stop == false);
+      create("bstore_defrag");
+    }
+    void shutdown() {
+      lock.lock();
+      stop = true;
+      cond.notify_all();
+      lock.unlock();
+      join();
+      stop = false;
+    }
+  } defrag_thread;
+
+  class SocketHook;
+  SocketHook* asok_hook = nullptr;
+
 #ifdef WITH_BLKIN
   ZTracer::Endpoint trace_endpoint {"0.0.0.0", 0, "BlueStore"};
 #endif
@@ -2745,6 +3014,24 @@ private:
   int _create_alloc();
   int _init_alloc(std::map<uint64_t, uint64_t> *zone_adjustments);
   void _post_init_alloc(const std::map<uint64_t, uint64_t>& zone_adjustments);
+  int _start_alloc_delta_log();
+  void _txc_log_alloc_delta(TransContext *txc,
+			    const interval_set<uint64_t>& allocated,
+			    const interval_set<uint64_t>& released,
+			    KeyValueDB::Transaction t);
+  int _replay_alloc_deltas(
+    uint64_t after_seq,
+    std::function<bool(uint64_t seq,
+		       const interval_set<uint64_t>& allocated,
+		       const interval_set<uint64_t>& released)> fn);
+  int _checkpoint_allocator();
+  void _defrag_start();
+  void _defrag_stop();
+  void _defrag_pass();
+  bool _defrag_should_stop();
+  int _defrag_object(CollectionRef& c, const ghobject_t& oid,
+		     uint64_t *bytes, uint64_t *removed_extents);
+  void _defrag_discard(TransContext *txc, CollectionRef& c, OnodeRef& o);
   void _close_alloc();
   int _open_collections();
   void _fsck_collections(int64_t* errors);
@@ -2795,8 +3082,13 @@ private:
 			    TrackedOpRef osd_op=TrackedOpRef());
   void _txc_update_store_statfs(TransContext *txc);
   void _txc_add_transaction(TransContext *txc, Transaction *t);
+  void _txc_get_onodes(Transaction *t,
+		       std::vector<CollectionRef>& cvec,
+		       std::vector<OnodeRef>& ovec);
   void _txc_calc_cost(TransContext *txc);
   void _txc_write_nodes(TransContext *txc, KeyValueDB::Transaction t);
+  ceph::timespan _txc_submit(TransContext *txc,
+			     ThreadPool::TPHandle *handle = nullptr);
   void _txc_state_proc(TransContext *txc);
   void _txc_aio_submit(TransContext *txc);
 public:
@@ -2821,6 +3113,19 @@ private:
   void _kv_stop();
   void _kv_sync_thread();
   void _kv_finalize_thread();
+  KVSyncShard *_get_kv_sync_shard(const OpSequencer *osr) {
+    if (kv_sync_shards.empty()) {
+      return nullptr;
+    }
+    auto n = osr->get_sequencer_id() % (kv_sync_shards.size() + 1);
+    return n ? kv_sync_shards[n - 1].get() : nullptr;
+  }
+  void _kv_shard_sync_thread(KVSyncShard *shard);
+  void _kv_shard_finalize_thread(KVSyncShard *shard);
+  void _kv_wait_prealloc(uint64_t nid, uint64_t blobid);
+  void _compress_start();
+  void _compress_stop();
+  void _compress_thread();
 
   bluestore_deferred_op_t *_get_deferred_op(TransContext *txc, uint64_t len);
   void _deferred_queue(TransContext *txc);
@@ -2829,6 +3134,7 @@ public:
 private:
   void _deferred_submit_unlock(OpSequencer *osr);
   void _deferred_aio_finish(OpSequencer *osr);
+  void _deferred_adapt();
   int _deferred_replay();
   bool _eliminate_outdated_deferred(bluestore_deferred_transaction_t* deferred_txn,
 				    interval_set<uint64_t>& bluefs_extents);
@@ -3175,6 +3481,40 @@ private:
     uint32_t op_flags = 0,
     uint64_t retry_count = 0);
 
+  /// asynchronous read-ahead into the blobs' buffer cache
+  struct ReadaheadContext final : public AioContext {
+    CollectionRef c;
+    OnodeRef o;
+    uint64_t offset;
+    uint64_t length;
+    uint64_t modify_seq;    ///< o->modify_seq when the read was issued
+    ready_regions_t ready_regions;
+    blobs2read_t blobs2read;
+    std::vector<ceph::buffer::list> compressed_blob_bls;
+    IOContext ioc;
+
+    ReadaheadContext(CephContext *cct, Collection *c, OnodeRef& o,
+		     uint64_t offset, uint64_t length)
+      : c(c), o(o), offset(offset), length(length),
+	modify_seq(o->modify_seq), ioc(cct, this, true) {}
+
+    void aio_finish(BlueStore *store) override {
+      store->_readahead_finish(this);
+    }
+  };
+  ceph::mutex readahead_lock = ceph::make_mutex("BlueStore::readahead_lock");
+  ceph::condition_variable readahead_cond;
+  unsigned readahead_in_flight = 0;
+
+  void _maybe_readahead(
+    Collection *c,
+    OnodeRef& o,
+    uint64_t offset,
+    size_t length,
+    uint32_t op_flags);
+  void _readahead_finish(ReadaheadContext *rc);
+  void _readahead_drain();
+
   int _fiemap(CollectionHandle &c_, const ghobject_t& oid,
 	      uint64_t offset, size_t len, interval_set<uint64_t>& destset);
 public:
@@ -3223,6 +3563,9 @@ public:
                              std::vector<ghobject_t> *ls,
                              ghobject_t *next) override;
 
+  void prefetch_objects(CollectionHandle &c,
+			const std::vector<ghobject_t>& oids) override;
+
   int omap_get(
     CollectionHandle &c,     ///< [in] Collection containing oid
     const ghobject_t &oid,   ///< [in] Object containing omap
@@ -3287,6 +3630,13 @@ public:
     const ghobject_t &oid  ///< [in] object
     ) override;
 
+  int omap_iterate(
+    CollectionHandle &c,   ///< [in] collection
+    const ghobject_t &oid, ///< [in] object
+    omap_iter_seek_t start_from, ///< [in] where to start
+    std::function<omap_iter_ret_t(std::string_view, std::string_view)> f
+    ) override;
+
   void set_fsid(uuid_d u) override {
     fsid = u;
   }
@@ -3352,8 +3702,16 @@ public:
 
   void inject_leaked(uint64_t len);
   void inject_false_free(coll_t cid, ghobject_t oid);
+  /// run a defragmentation pass synchronously
+  void debug_defrag_pass() {
+    _defrag_pass();
+  }
   void inject_statfs(const std::string& key, const store_statfs_t& new_statfs);
   void inject_global_statfs(const store_statfs_t& new_statfs);
+  /// skip the allocation file update on the next umount, as a crash would
+  void inject_skip_allocation_destage() {
+    need_to_destage_allocation_file = false;
+  }
   void inject_misreference(coll_t cid1, ghobject_t oid1,
 			   coll_t cid2, ghobject_t oid2,
 			   uint64_t offset);
@@ -3581,6 +3939,24 @@ private:
     uint64_t offset, uint64_t length,
     ceph::buffer::list::iterator& blp,
     WriteContext *wctx);
+  /// outcome of compressing a single write_item
+  struct blob_compress_t {
+    int r = 0;
+    bool skipped = false;   ///< sampled prefix compressed poorly, not tried
+    ceph::buffer::list out;
+    std::optional<int32_t> compressor_message;
+    ceph::timespan lat;
+  };
+  void _compress_blob(
+    const CompressorRef& c,
+    double crr,
+    const ceph::buffer::list& bl,
+    blob_compress_t *res);
+  void _compress_blobs(
+    const CompressorRef& c,
+    double crr,
+    WriteContext *wctx,
+    std::vector<blob_compress_t>& res);
   int _do_alloc_write(
     TransContext *txc,
     CollectionRef c,
@@ -3909,8 +4285,13 @@ private:
 
   int  copy_allocator(Allocator* src_alloc, Allocator *dest_alloc, uint64_t* p_num_entries);
   int  store_allocator(Allocator* allocator);
+  int  __store_allocator(BlueFS::FileWriter *p_handle,
+			 std::function<void(std::function<void(uint64_t, uint64_t)>)> for_each,
+			 std::optional<uint64_t> delta_seq);
   int  invalidate_allocation_file_on_bluefs();
-  int  __restore_allocator(Allocator* allocator, uint64_t *num, uint64_t *bytes);
+  int  __restore_allocator(std::function<void(uint64_t, uint64_t)> add_free,
+			   uint64_t *num, uint64_t *bytes,
+			   std::optional<uint64_t> *delta_seq);
   int  restore_allocator(Allocator* allocator, uint64_t *num, uint64_t *bytes);
   int  read_allocation_from_drive_on_startup();
   int  reconstruct_allocations(SimpleBitmap *smbmp, read_alloc_stats_t &stats);
@@ -3930,6 +4311,9 @@ private:
     OnodeRef& o,
     const BlueStore::FSCK_ObjectCtx& ctx);
 
+  class FSCKDeepReader;
+  int _fsck_read_object(Collection* c, OnodeRef& o);
+
   void _fsck_check_objects(FSCKDepth depth,
     FSCK_ObjectCtx& ctx);
 };
@@ -0,0 +1,457 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:nil -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "SegregatedAllocator.h"
+
+#include <bit>
+#include <limits>
+
+#include "common/config_proxy.h"
+#include "common/debug.h"
+
+#define dout_context cct
+#define dout_subsys ceph_subsys_bluestore
+#undef  dout_prefix
+#define dout_prefix *_dout << "SegregatedAllocator "
+
+void SegregatedAllocator::_class_insert(uint64_t start, uint64_t end)
+{
+  auto c = _get_class(end - start);
+  size_classes[c].emplace(start, end);
+  class_mask |= 1ull << c;
+}
+
+void SegregatedAllocator::_class_erase(uint64_t start, uint64_t end)
+{
+  auto c = _get_class(end - start);
+  auto& sc = size_classes[c];
+  auto n = sc.erase(start);
+  ceph_assert(n == 1);
+  if (sc.empty()) {
+    class_mask &= ~(1ull << c);
+  }
+}
+
+uint64_t SegregatedAllocator::_pick_at_hint(uint64_t hint,
+                                            uint64_t size,
+                                            uint64_t unit)
+{
+  auto rs = range_tree.upper_bound(hint);
+  if (rs == range_tree.begin()) {
+    return -1ULL;
+  }
+  --rs;
+  uint64_t offset = p2roundup(hint, unit);
+  if (offset >= rs->first && offset + size <= rs->second) {
+    return offset;
+  }
+  return -1ULL;
+}
+
+uint64_t SegregatedAllocator::_pick_segregated(uint64_t size,
+                                               uint64_t unit)
+{
+  // Class N extents are [2^N, 2^(N+1)) blocks long, hence the request's own
+  // class might have fitting extents and every larger class should have
+  // them, modulo alignment.
+  uint64_t mask = class_mask & (~0ull << _get_class(size));
+  while (mask) {
+    auto c = std::countr_zero(mask);
+    mask &= mask - 1;
+
+    auto& sc = size_classes[c];
+    uint64_t* cursor = &cursors[c];
+    uint64_t n = 0;
+    auto try_pick = [&](range_tree_t::const_iterator rs) -> uint64_t {
+      uint64_t offset = p2roundup(rs->first, unit);
+      if (offset + size <= rs->second) {
+        *cursor = offset + size;
+        return offset;
+      }
+      return -1ULL;
+    };
+    auto rs_start = sc.lower_bound(*cursor);
+    for (auto rs = rs_start;
+         rs != sc.end() && (!max_search_count || n < max_search_count);
+         ++rs, ++n) {
+      if (auto offset = try_pick(rs); offset != -1ULL) {
+        return offset;
+      }
+    }
+    // wrap around and continue from the beginning of the class
+    for (auto rs = sc.begin();
+         rs != rs_start && (!max_search_count || n < max_search_count);
+         ++rs, ++n) {
+      if (auto offset = try_pick(rs); offset != -1ULL) {
+        return offset;
+      }
+    }
+  }
+  return -1ULL;
+}
+
+uint64_t SegregatedAllocator::_pick_whole(uint64_t size,
+                                          uint64_t min_size,
+                                          uint64_t unit,
+                                          uint64_t* length)
+{
+  int cmin = _get_class(min_size);
+  for (int c = _get_class(size); c >= cmin; --c) {
+    if (!(class_mask & (1ull << c))) {
+      continue;
+    }
+    uint64_t n = 0;
+    for (auto& [start, end] : size_classes[c]) {
+      if (max_search_count && n++ >= max_search_count) {
+        break;
+      }
+      auto len = end - start;
+      // only extents which are consumed entirely, i.e. leave nothing behind
+      if (len < size && len >= min_size &&
+          p2phase(start, unit) == 0 && p2phase(len, unit) == 0) {
+        *length = len;
+        return start;
+      }
+    }
+  }
+  return -1ULL;
+}
+
+uint64_t SegregatedAllocator::_pick_longest(uint64_t size,
+                                            uint64_t unit,
+                                            uint64_t* length)
+{
+  uint64_t best = -1ULL;
+  uint64_t best_len = 0;
+  for (int c = std::bit_width(class_mask) - 1; c >= 0; --c) {
+    if (!(class_mask & (1ull << c))) {
+      continue;
+    }
+    // nothing in this or any lower class can beat what we already have
+    if (c < 63 && best_len >= (uint64_t(block_size) << (c + 1))) {
+      break;
+    }
+    uint64_t n = 0;
+    for (auto& [start, end] : size_classes[c]) {
+      if (max_search_count && n++ >= max_search_count) {
+        break;
+      }
+      uint64_t offset = p2roundup(start, unit);
+      if (offset >= end) {
+        continue;
+      }
+      uint64_t len = p2align(std::min(end - offset, size), unit);
+      if (len > best_len) {
+        best = offset;
+        best_len = len;
+      }
+    }
+  }
+  if (best_len == 0) {
+    return -1ULL;
+  }
+  *length = best_len;
+  return best;
+}
+
+void SegregatedAllocator::_add_to_tree(uint64_t start, uint64_t size)
+{
+  ceph_assert(size != 0);
+
+  uint64_t end = start + size;
+
+  auto rs_after = range_tree.upper_bound(start);
+  auto rs_before = range_tree.end();
+  if (rs_after != range_tree.begin()) {
+    rs_before = std::prev(rs_after);
+  }
+  /* Make sure we don't overlap with either of our neighbors */
+  ceph_assert(rs_before == range_tree.end() || rs_before->second <= start);
+  ceph_assert(rs_after == range_tree.end() || rs_after->first >= end);
+
+  bool merge_before = (rs_before != range_tree.end() && rs_before->second == start);
+  bool merge_after = (rs_after != range_tree.end() && rs_after->first == end);
+
+  uint64_t new_start = start;
+  uint64_t new_end = end;
+  if (merge_after) {
+    new_end = rs_after->second;
+    _class_erase(rs_after->first, rs_after->second);
+  }
+  if (merge_before) {
+    // | before   |//////| after? |
+    new_start = rs_before->first;
+    _class_erase(rs_before->first, rs_before->second);
+    // expand the head seg before rs_after is erased and iterators
+    // get invalidated
+    rs_before->second = new_end;
+    if (merge_after) {
+      range_tree.erase(rs_after);
+    }
+  } else if (merge_after) {
+    // |//////| after |
+    range_tree.erase(rs_after);
+    range_tree.emplace(start, new_end);
+  } else {
+    // no neighbours
+    range_tree.emplace_hint(rs_after, start, end);
+  }
+  _class_insert(new_start, new_end);
+  num_free += size;
+}
+
+void SegregatedAllocator::_remove_from_tree(uint64_t start, uint64_t size)
+{
+  uint64_t end = start + size;
+
+  ceph_assert(size != 0);
+  ceph_assert(size <= num_free);
+
+  // Make sure we completely overlap with someone
+  auto rs = range_tree.upper_bound(start);
+  ceph_assert(rs != range_tree.begin());
+  --rs;
+  ceph_assert(rs->first <= start);
+  ceph_assert(rs->second >= end);
+
+  uint64_t rs_start = rs->first;
+  uint64_t rs_end = rs->second;
+  _class_erase(rs_start, rs_end);
+
+  // | left <|////|  right |
+  if (rs_start != start) {
+    // shrink the left seg in the offset tree
+    rs->second = start;
+    _class_insert(rs_start, start);
+  } else {
+    range_tree.erase(rs);
+  }
+  if (rs_end != end) {
+    // add the spin-off right seg
+    range_tree.emplace(end, rs_end);
+    _class_insert(end, rs_end);
+  }
+  num_free -= size;
+}
+
+int SegregatedAllocator::_allocate_chunk(
+  uint64_t size,
+  uint64_t unit,
+  int64_t hint,
+  uint64_t *offset,
+  uint64_t *length)
+{
+  uint64_t start = -1ULL;
+  uint64_t len = size;
+  if (hint > 0) {
+    start = _pick_at_hint(hint, size, unit);
+    dout(20) << __func__ << " at hint=" << start << " size=" << size << dendl;
+  }
+  if (start == -1ULL &&
+      defrag_threshold > 0 &&
+      size > unit &&
+      _get_fragmentation() > defrag_threshold) {
+    // Fill holes which are at least 1/8 of the request, so that the
+    // allocation isn't scattered over too many tiny extents.
+    start = _pick_whole(size, std::max(unit, p2align(size >> 3, unit)),
+                        unit, &len);
+    dout(20) << __func__ << " whole=" << start << " size=" << len << dendl;
+  }
+  if (start == -1ULL) {
+    len = size;
+    start = _pick_segregated(size, unit);
+    dout(20) << __func__ << " segregated fit=" << start
+             << " size=" << size << dendl;
+  }
+  if (start == -1ULL) {
+    start = _pick_longest(size, unit, &len);
+    dout(20) << __func__ << " longest=" << start << " size=" << len << dendl;
+  }
+  if (start == -1ULL) {
+    return -ENOSPC;
+  }
+
+  _remove_from_tree(start, len);
+
+  *offset = start;
+  *length = len;
+  return 0;
+}
+
+int64_t SegregatedAllocator::_allocate(
+  uint64_t want,
+  uint64_t unit,
+  uint64_t max_alloc_size,
+  int64_t  hint,
+  PExtentVector* extents)
+{
+  uint64_t allocated = 0;
+  while (allocated < want) {
+    uint64_t offset, length;
+    uint64_t size = std::max(unit,
+      p2align(std::min(max_alloc_size, want - allocated), unit));
+    int r = _allocate_chunk(size, unit, hint, &offset, &length);
+    if (r < 0) {
+      // Allocation failed.
+      break;
+    }
+    extents->emplace_back(offset, length);
+    allocated += length;
+    // try to keep the rest of the request contiguous
+    hint = offset + length;
+  }
+  return allocated ? allocated : -ENOSPC;
+}
+
+void SegregatedAllocator::_release(const interval_set<uint64_t>& release_set)
+{
+  for (auto p = release_set.begin(); p != release_set.end(); ++p) {
+    const auto offset = p.get_start();
+    const auto length = p.get_len();
+    ceph_assert(offset + length <= uint64_t(device_size));
+    ldout(cct, 10) << __func__ << std::hex
+      << " offset 0x" << offset
+      << " length 0x" << length
+      << std::dec << dendl;
+    _add_to_tree(offset, length);
+  }
+}
+
+void SegregatedAllocator::_shutdown()
+{
+  for (auto& sc : size_classes) {
+    sc.clear();
+  }
+  class_mask = 0;
+  range_tree.clear();
+  num_free = 0;
+}
+
+SegregatedAllocator::SegregatedAllocator(CephContext* cct,
+                                         int64_t device_size,
+                                         int64_t block_size,
+                                         std::string_view name) :
+  Allocator(name, device_size, block_size),
+  max_search_count(
+    cct->_conf.get_val<uint64_t>("bluestore_segregated_alloc_search_count")),
+  defrag_threshold(
+    cct->_conf.get_val<double>("bluestore_segregated_alloc_defrag_threshold")),
+  cct(cct)
+{}
+
+SegregatedAllocator::~SegregatedAllocator()
+{
+  shutdown();
+}
+
+int64_t SegregatedAllocator::allocate(
+  uint64_t want,
+  uint64_t unit,
+  uint64_t max_alloc_size,
+  int64_t  hint,
+  PExtentVector* extents)
+{
+  ldout(cct, 10) << __func__ << std::hex
+                 << " want 0x" << want
+                 << " unit 0x" << unit
+                 << " max_alloc_size 0x" << max_alloc_size
+                 << " hint 0x" << hint
+                 << std::dec << dendl;
+  ceph_assert(std::has_single_bit(unit));
+  ceph_assert(want % unit == 0);
+
+  if (max_alloc_size == 0) {
+    max_alloc_size = want;
+  }
+  if (constexpr auto cap = std::numeric_limits<decltype(bluestore_pextent_t::length)>::max();
+      max_alloc_size >= cap) {
+    max_alloc_size = p2align(uint64_t(cap), (uint64_t)block_size);
+  }
+  std::lock_guard l(lock);
+  return _allocate(want, unit, max_alloc_size, hint, extents);
+}
+
+void SegregatedAllocator::release(const interval_set<uint64_t>& release_set) {
+  std::lock_guard l(lock);
+  _release(release_set);
+}
+
+uint64_t SegregatedAllocator::get_free()
+{
+  std::lock_guard l(lock);
+  return num_free;
+}
+
+double SegregatedAllocator::get_fragmentation()
+{
+  std::lock_guard l(lock);
+  return _get_fragmentation();
+}
+
+void SegregatedAllocator::dump()
+{
+  std::lock_guard l(lock);
+  _dump();
+}
+
+void SegregatedAllocator::_dump() const
+{
+  ldout(cct, 0) << __func__ << " range_tree: " << dendl;
+  for (auto& rs : range_tree) {
+    ldout(cct, 0) << std::hex
+      << "0x" << rs.first << "~" << rs.second
+      << std::dec
+      << dendl;
+  }
+
+  ldout(cct, 0) << __func__ << " size classes: " << dendl;
+  for (unsigned c = 0; c < NUM_CLASSES; ++c) {
+    if (size_classes[c].empty()) {
+      continue;
+    }
+    ldout(cct, 0) << "class " << c
+      << std::hex << " (0x" << (uint64_t(block_size) << c) << "+)"
+      << std::dec << ": " << size_classes[c].size() << " extents"
+      << dendl;
+  }
+}
+
+void SegregatedAllocator::foreach(std::function<void(uint64_t offset, uint64_t length)> notify)
+{
+  std::lock_guard l(lock);
+  for (auto& rs : range_tree) {
+    notify(rs.first, rs.second - rs.first);
+  }
+}
+
+void SegregatedAllocator::init_add_free(uint64_t offset, uint64_t length)
+{
+  if (!length)
+    return;
+  std::lock_guard l(lock);
+  ceph_assert(offset + length <= uint64_t(device_size));
+  ldout(cct, 10) << __func__ << std::hex
+                 << " offset 0x" << offset
+                 << " length 0x" << length
+                 << std::dec << dendl;
+  _add_to_tree(offset, length);
+}
+
+void SegregatedAllocator::init_rm_free(uint64_t offset, uint64_t length)
+{
+  if (!length)
+    return;
+  std::lock_guard l(lock);
+  ceph_assert(offset + length <= uint64_t(device_size));
+  ldout(cct, 10) << __func__ << std::hex
+                 << " offset 0x" << offset
+                 << " length 0x" << length
+                 << std::dec << dendl;
+  _remove_from_tree(offset, length);
+}
+
+void SegregatedAllocator::shutdown()
+{
+  std::lock_guard l(lock);
+  _shutdown();
+}
@@ -0,0 +1,131 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:nil -*-
+// vim: ts=8 sw=2 smarttab
+
+#pragma once
+
+#include <array>
+#include <bit>
+#include <mutex>
+#include "include/cpp-btree/btree_map.h"
+#include "Allocator.h"
+#include "os/bluestore/bluestore_types.h"
+#include "include/mempool.h"
+
+/*
+ * Segregated fit allocator.
+ *
+ * Free extents are tracked twice: in an offset ordered tree used for
+ * merging/splitting and in one of the size classes, where class N holds
+ * extents of [2^N, 2^(N+1)) blocks. A request is served from the smallest
+ * non-empty class that may contain a fitting extent, so large extents are
+ * only carved when nothing smaller fits. Within a class extents are picked
+ * in address order starting at a per-class cursor, which keeps allocations
+ * of similar size close to each other.
+ *
+ * When fragmentation exceeds bluestore_segregated_alloc_defrag_threshold,
+ * requests that may be split first consume whole free extents which are
+ * slightly smaller than the request, reducing the number of free extents.
+ */
+class SegregatedAllocator : public Allocator {
+public:
+  SegregatedAllocator(CephContext* cct, int64_t device_size, int64_t block_size,
+                      std::string_view name);
+  ~SegregatedAllocator();
+  const char* get_type() const override
+  {
+    return "segregated";
+  }
+  int64_t allocate(
+    uint64_t want,
+    uint64_t unit,
+    uint64_t max_alloc_size,
+    int64_t  hint,
+    PExtentVector *extents) override;
+  void release(const interval_set<uint64_t>& release_set) override;
+  uint64_t get_free() override;
+  double get_fragmentation() override;
+
+  void dump() override;
+  void foreach(
+    std::function<void(uint64_t offset, uint64_t length)> notify) override;
+  void init_add_free(uint64_t offset, uint64_t length) override;
+  void init_rm_free(uint64_t offset, uint64_t length) override;
+  void shutdown() override;
+
+private:
+  template<class T>
+  using pool_allocator = mempool::bluestore_alloc::pool_allocator<T>;
+  using range_tree_t =
+    btree::btree_map<
+      uint64_t /* start */,
+      uint64_t /* end */,
+      std::less<uint64_t>,
+      pool_allocator<std::pair<uint64_t, uint64_t>>>;
+  range_tree_t range_tree;    ///< all free extents ordered by offset
+
+  /*
+   * Each size class holds a copy of the range_tree entries whose length
+   * falls into the class, so that picking an extent doesn't need a lookup
+   * in the main tree.
+   */
+  static constexpr unsigned NUM_CLASSES = 64;
+  std::array<range_tree_t, NUM_CLASSES> size_classes;
+  /// per class position to continue address ordered search from
+  std::array<uint64_t, NUM_CLASSES> cursors = {0};
+  /// bit N is set when size_classes[N] is not empty
+  uint64_t class_mask = 0;
+
+  uint64_t num_free = 0;     ///< total bytes in freelist
+
+  const uint64_t max_search_count;
+  const double defrag_threshold;
+
+  CephContext* cct;
+  std::mutex lock;
+
+  unsigned _get_class(uint64_t length) const {
+    uint64_t blocks = std::max<uint64_t>(length / block_size, 1);
+    return std::bit_width(blocks) - 1;
+  }
+  void _class_insert(uint64_t start, uint64_t end);
+  void _class_erase(uint64_t start, uint64_t end);
+
+  double _get_fragmentation() const {
+    auto free_blocks = p2align(num_free, (uint64_t)block_size) / block_size;
+    if (free_blocks <= 1) {
+      return .0;
+    }
+    return (static_cast<double>(range_tree.size() - 1) / (free_blocks - 1));
+  }
+  void _dump() const;
+
+  // pick an extent of exactly 'size' bytes at or right after 'hint'
+  uint64_t _pick_at_hint(uint64_t hint, uint64_t size, uint64_t unit);
+  // pick an extent of 'size' bytes from the smallest suitable class
+  uint64_t _pick_segregated(uint64_t size, uint64_t unit);
+  // pick a whole free extent shorter than 'size' but not shorter than
+  // 'min_size', returns its length via 'length'
+  uint64_t _pick_whole(uint64_t size, uint64_t min_size, uint64_t unit,
+                       uint64_t* length);
+  // pick the longest 'unit' aligned piece available, up to 'size'
+  uint64_t _pick_longest(uint64_t size, uint64_t unit, uint64_t* length);
+
+  int _allocate_chunk(
+    uint64_t size,
+    uint64_t unit,
+    int64_t hint,
+    uint64_t *offset,
+    uint64_t *length);
+  int64_t _allocate(
+    uint64_t want,
+    uint64_t unit,
+    uint64_t max_alloc_size,
+    int64_t  hint,
+    PExtentVector *extents);
+
+  void _release(const interval_set<uint64_t>& release_set);
+  void _shutdown();
+
+  void _add_to_tree(uint64_t start, uint64_t size);
+  void _remove_from_tree(uint64_t start, uint64_t size);
+};
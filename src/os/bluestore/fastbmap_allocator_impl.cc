@@ -8,6 +8,17 @@
 
 #include "fastbmap_allocator_impl.h"
 
+#ifndef NON_CEPH_BUILD
+#include "arch/probe.h"
+#include "arch/intel.h"
+#include "arch/arm.h"
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 uint64_t AllocatorLevel::l0_dives = 0;
 uint64_t AllocatorLevel::l0_iterations = 0;
 uint64_t AllocatorLevel::l0_inner_iterations = 0;
@@ -15,6 +26,76 @@ uint64_t AllocatorLevel::alloc_fragments = 0;
 uint64_t AllocatorLevel::alloc_fragments_fast = 0;
 uint64_t AllocatorLevel::l2_allocs = 0;
 
+static size_t find_slot_not_equal_scalar(const slot_t* slots, size_t pos,
+  size_t end, slot_t val)
+{
+  while (pos < end && slots[pos] == val) {
+    ++pos;
+  }
+  return pos;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("avx2")))
+static size_t find_slot_not_equal_avx2(const slot_t* slots, size_t pos,
+  size_t end, slot_t val)
+{
+  const __m256i v = _mm256_set1_epi64x(val);
+  for (; pos + 4 <= end; pos += 4) {
+    __m256i s = _mm256_loadu_si256((const __m256i*)(slots + pos));
+    unsigned eq = _mm256_movemask_pd(
+      _mm256_castsi256_pd(_mm256_cmpeq_epi64(s, v)));
+    if (eq != 0xf) {
+      return pos + std::countr_one(eq);
+    }
+  }
+  return find_slot_not_equal_scalar(slots, pos, end, val);
+}
+#endif
+
+#if defined(__aarch64__)
+static size_t find_slot_not_equal_neon(const slot_t* slots, size_t pos,
+  size_t end, slot_t val)
+{
+  const uint64x2_t v = vdupq_n_u64(val);
+  for (; pos + 4 <= end; pos += 4) {
+    uint64x2_t eq = vandq_u64(vceqq_u64(vld1q_u64(slots + pos), v),
+                              vceqq_u64(vld1q_u64(slots + pos + 2), v));
+    if ((vgetq_lane_u64(eq, 0) & vgetq_lane_u64(eq, 1)) != all_slot_set) {
+      return find_slot_not_equal_scalar(slots, pos, pos + 4, val);
+    }
+  }
+  return find_slot_not_equal_scalar(slots, pos, end, val);
+}
+#endif
+
+typedef size_t (*find_slot_not_equal_func_t)(const slot_t*, size_t, size_t,
+  slot_t);
+
+static find_slot_not_equal_func_t choose_find_slot_not_equal()
+{
+#ifndef NON_CEPH_BUILD
+  ceph_arch_probe();
+#if defined(__x86_64__) && defined(__GNUC__)
+  if (ceph_arch_intel_avx2) {
+    return find_slot_not_equal_avx2;
+  }
+#elif defined(__aarch64__)
+  if (ceph_arch_neon) {
+    return find_slot_not_equal_neon;
+  }
+#endif
+#endif
+  return find_slot_not_equal_scalar;
+}
+
+size_t find_slot_not_equal(const slot_t* slots, size_t pos, size_t end,
+  slot_t val)
+{
+  static const find_slot_not_equal_func_t func = choose_find_slot_not_equal();
+  return func(slots, pos, end, val);
+}
+
 inline interval_t _align2units(uint64_t offset, uint64_t len, uint64_t min_length)
 {
   return len >= min_length ?
@@ -41,73 +122,58 @@ interval_t AllocatorLevel01Loose::_get_longest_from_l0(uint64_t pos0,
   *tail = interval_t();
 
   auto d = bits_per_slot;
-  slot_t bits = l0[pos / d];
-  bits >>= pos % d;
-  bool end_loop = false;
   auto min_granules = min_length / l0_granularity;
-
-  do {
-    if ((pos % d) == 0) {
-      bits = l0[pos / d];
-      if (pos1 - pos >= d) {
-        switch(bits) {
-	  case all_slot_set:
-	    // slot is totally free
-	    if (!res_candidate.length) {
-	      res_candidate.offset = pos;
-	    }
-	    res_candidate.length += d;
-	    pos += d;
-	    end_loop = pos >= pos1;
-	    if (end_loop) {
-	      *tail = res_candidate;
-	      res_candidate = _align2units(res_candidate.offset,
-		res_candidate.length, min_granules);
-	      if(res.length < res_candidate.length) {
-		res = res_candidate;
-	      }
-	    }
-	    continue;
-	  case all_slot_clear:
-	    // slot is totally allocated
-	    res_candidate = _align2units(res_candidate.offset,
-	      res_candidate.length, min_granules);
-	    if (res.length < res_candidate.length) {
-	      res = res_candidate;
-	    }
-	    res_candidate = interval_t();
-	    pos += d;
-	    end_loop = pos >= pos1;
-	    continue;
+  auto close_candidate = [&]() {
+    res_candidate = _align2units(res_candidate.offset,
+      res_candidate.length, min_granules);
+    if (res.length < res_candidate.length) {
+      res = res_candidate;
+    }
+    res_candidate = interval_t();
+  };
+
+  while (pos < pos1) {
+    slot_t bits = l0[pos / d];
+    if ((pos % d) == 0 && pos1 - pos >= d &&
+	(bits == all_slot_set || bits == all_slot_clear)) {
+      // consume the whole run of totally free/allocated slots
+      auto idx_end = find_slot_not_equal(l0.data(), pos / d + 1, pos1 / d,
+	bits);
+      auto len = idx_end * d - pos;
+      if (bits == all_slot_set) {
+	if (!res_candidate.length) {
+	  res_candidate.offset = pos;
 	}
+	res_candidate.length += len;
+      } else {
+	close_candidate();
       }
-    } //if ((pos % d) == 0)
-
-    end_loop = ++pos >= pos1;
-    if (bits & 1) {
-      // item is free
-      if (!res_candidate.length) {
-	res_candidate.offset = pos - 1;
-      }
-      ++res_candidate.length;
-      if (end_loop) {
-	*tail = res_candidate;
-	res_candidate = _align2units(res_candidate.offset,
-	  res_candidate.length, min_granules);
-	if (res.length < res_candidate.length) {
-	  res = res_candidate;
+      pos += len;
+      continue;
+    }
+    // walk the runs of a partial slot
+    bits >>= pos % d;
+    auto left = std::min<uint64_t>(d - pos % d, pos1 - pos);
+    while (left) {
+      uint64_t run;
+      if (bits & 1) {
+	run = std::min<uint64_t>(std::countr_one(bits), left);
+	if (!res_candidate.length) {
+	  res_candidate.offset = pos;
 	}
+	res_candidate.length += run;
+      } else {
+	run = std::min<uint64_t>(std::countr_zero(bits), left);
+	close_candidate();
       }
-    } else {
-      res_candidate = _align2units(res_candidate.offset,
-	res_candidate.length, min_granules);
-      if (res.length < res_candidate.length) {
-	res = res_candidate;
-      }
-      res_candidate = interval_t();
+      bits = run < d ? bits >> run : 0;
+      pos += run;
+      left -= run;
     }
-    bits >>= 1;
-  } while (!end_loop);
+  }
+  // a free run reaching pos1 may continue in the next slotset
+  *tail = res_candidate;
+  close_candidate();
   res.offset *= l0_granularity;
   res.length *= l0_granularity;
   tail->offset *= l0_granularity;
@@ -69,6 +69,11 @@ inline size_t find_next_set_bit(slot_t slot_val, size_t start_pos)
   return start_pos;
 }
 
+// Returns the index of the first slot in [pos, end) which isn't equal to val,
+// or end if there is none. Uses AVX2/NEON when the CPU supports them.
+size_t find_slot_not_equal(const slot_t* slots, size_t pos, size_t end,
+  slot_t val);
+
 
 class AllocatorLevel
 {
@@ -210,6 +215,9 @@ class AllocatorLevel01Loose : public AllocatorLevel01
       slot_t& slot_val = l0[idx];
       auto base = idx * d0;
       if (slot_val == all_slot_clear) {
+        // skip the whole run of allocated slots at once
+        idx = find_slot_not_equal(l0.data(), idx + 1, l0_pos1 / d0,
+          all_slot_clear) - 1;
         continue;
       } else if (slot_val == all_slot_set) {
         uint64_t to_alloc = std::min(need_entries, d0);
@@ -228,35 +236,21 @@ class AllocatorLevel01Loose : public AllocatorLevel01
         continue;
       }
 
-      auto free_pos = find_next_set_bit(slot_val, 0);
-      ceph_assert(free_pos < bits_per_slot);
-      auto next_pos = free_pos + 1;
-      while (next_pos < bits_per_slot &&
-        (next_pos - free_pos) < need_entries) {
+      // take free runs one at a time rather than bit by bit
+      slot_t bits = slot_val;
+      while (need_entries && bits) {
 	++l0_inner_iterations;
-
-        if (0 == (slot_val & (slot_t(1) << next_pos))) {
-          auto to_alloc = (next_pos - free_pos);
-          *allocated += to_alloc * l0_granularity;
-	  ++alloc_fragments;
-          need_entries -= to_alloc;
-	  _fragment_and_emplace(max_length, (base + free_pos) * l0_granularity,
-	    to_alloc * l0_granularity, res);
-          _mark_alloc_l0(base + free_pos, base + next_pos);
-          free_pos = find_next_set_bit(slot_val, next_pos + 1);
-          next_pos = free_pos + 1;
-        } else {
-          ++next_pos;
-        }
-      }
-      if (need_entries && free_pos < bits_per_slot) {
-        auto to_alloc = std::min(need_entries, d0 - free_pos);
+        uint64_t free_pos = std::countr_zero(bits);
+        uint64_t run = std::countr_one(bits >> free_pos);
+        auto to_alloc = std::min(need_entries, run);
         *allocated += to_alloc * l0_granularity;
 	++alloc_fragments;
-	need_entries -= to_alloc;
+        need_entries -= to_alloc;
 	_fragment_and_emplace(max_length, (base + free_pos) * l0_granularity,
 	  to_alloc * l0_granularity, res);
         _mark_alloc_l0(base + free_pos, base + free_pos + to_alloc);
+        bits &= run < bits_per_slot ?
+          ~(((slot_t(1) << run) - 1) << free_pos) : all_slot_clear;
       }
     }
     return _is_empty_l0(l0_pos0, l0_pos1);
@@ -21,6 +21,8 @@
 #include <sys/param.h>
 #endif
 
+#include <dirent.h>
+
 #include "include/types.h"
 #include "include/stringify.h"
 #include "include/unordered_map.h"
@@ -46,6 +48,7 @@ bool operator>(const MemStore::CollectionRef& l,
 
 int MemStore::mount()
 {
+  _init_page_tier();
   int r = _load();
   if (r < 0)
     return r;
@@ -60,6 +63,36 @@ int MemStore::umount()
   return _save();
 }
 
+void MemStore::_init_page_tier()
+{
+  if (!cct->_conf->memstore_page_set) {
+    return;
+  }
+  memory_limit = cct->_conf->memstore_memory_limit;
+  if (cct->_conf->memstore_page_arena || memory_limit) {
+    page_arena = std::make_unique<PageArena>(
+      Page::get_alloc_size(cct->_conf->memstore_page_size));
+  }
+  if (!memory_limit) {
+    return;
+  }
+  // spilled data doesn't outlive the process, drop leftovers
+  spill_dir = path + "/spill";
+  if (DIR *dir = ::opendir(spill_dir.c_str()); dir) {
+    while (struct dirent *de = ::readdir(dir)) {
+      if (de->d_name[0] != '.') {
+	::unlink((spill_dir + "/" + de->d_name).c_str());
+      }
+    }
+    ::closedir(dir);
+  } else {
+    int r = ::mkdir(spill_dir.c_str(), 0755);
+    ceph_assert(r == 0);
+  }
+  dout(1) << __func__ << " spilling object data to " << spill_dir
+	  << " above " << byte_u_t(memory_limit) << dendl;
+}
+
 int MemStore::_save()
 {
   dout(10) << __func__ << dendl;
@@ -156,7 +189,7 @@ int MemStore::_load()
     int r = cbl.read_file(fn.c_str(), &err);
     if (r < 0)
       return r;
-    auto c = ceph::make_ref<Collection>(cct, *q);
+    auto c = ceph::make_ref<Collection>(cct, this, *q);
     auto p = cbl.cbegin();
     c->decode(p);
     coll_map[*q] = c;
@@ -257,7 +290,7 @@ MemStore::CollectionRef MemStore::get_collection(const coll_t& cid)
 ObjectStore::CollectionHandle MemStore::create_new_collection(const coll_t& cid)
 {
   std::lock_guard l{coll_lock};
-  auto c = ceph::make_ref<Collection>(cct, cid);
+  auto c = ceph::make_ref<Collection>(cct, this, cid);
   new_coll_map[cid] = c;
   return c;
 }
@@ -672,6 +705,11 @@ int MemStore::queue_transactions(
     finisher.queue(on_apply);
   if (on_commit)
     finisher.queue(on_commit);
+  lock.unlock();
+
+  if (memory_limit) {
+    _maybe_spill();
+  }
   return 0;
 }
 
@@ -1594,6 +1632,37 @@ int BufferlistObject::truncate(uint64_t size)
 struct MemStore::PageSetObject : public Object {
   PageSet data;
   uint64_t data_len;
+
+  // spill tier state, only used if store->memory_limit is set
+  MemStore *store;
+  ceph::mutex spill_mutex = ceph::make_mutex("MemStore::PageSetObject::spill_mutex");
+  std::atomic<int> pins = {0};           ///< ops using data right now
+  std::atomic<bool> referenced = {false}; ///< accessed since last clock scan
+  std::string spill_file;                ///< data lives here if not empty
+  std::list<PageSetObject*>::iterator spill_item;
+
+  // keeps data in memory for the duration of an op
+  struct Pin {
+    PageSetObject *o;
+    explicit Pin(const PageSetObject *obj)
+      : o(obj->store ? const_cast<PageSetObject*>(obj) : nullptr) {
+      if (o) {
+	std::lock_guard l{o->spill_mutex};
+	o->_load();
+	++o->pins;
+	o->referenced = true;
+      }
+    }
+    ~Pin() {
+      if (o) {
+	--o->pins;
+      }
+    }
+  };
+  void _load();
+  uint64_t _spill();
+  void encode_data(ceph::buffer::list& bl) const;
+
 #if defined(__GLIBCXX__)
   // use a thread-local vector for the pages returned by PageSet, so we
   // can avoid allocations in read/write()
@@ -1611,11 +1680,12 @@ struct MemStore::PageSetObject : public Object {
   void encode(ceph::buffer::list& bl) const override {
     ENCODE_START(1, 1, bl);
     encode(data_len, bl);
-    data.encode(bl);
+    encode_data(bl);
     encode_base(bl);
     ENCODE_FINISH(bl);
   }
   void decode(ceph::buffer::list::const_iterator& p) override {
+    Pin pin(this);
     DECODE_START(1, p);
     decode(data_len, p);
     data.decode(p);
@@ -1625,7 +1695,23 @@ struct MemStore::PageSetObject : public Object {
 
 private:
   FRIEND_MAKE_REF(PageSetObject);
-  explicit PageSetObject(size_t page_size) : data(page_size), data_len(0) {}
+  PageSetObject(size_t page_size, MemStore *s)
+    : data(page_size, s->page_arena.get()), data_len(0),
+      store(s->memory_limit ? s : nullptr) {
+    if (store) {
+      std::lock_guard l{store->spill_lock};
+      spill_item = store->spill_clock.insert(store->spill_clock.end(), this);
+    }
+  }
+  ~PageSetObject() override {
+    if (store) {
+      std::lock_guard l{store->spill_lock};
+      store->spill_clock.erase(spill_item);
+      if (!spill_file.empty()) {
+	::unlink(spill_file.c_str());
+      }
+    }
+  }
 };
 
 #if defined(__GLIBCXX__)
@@ -1637,12 +1723,107 @@ thread_local PageSet::page_vector MemStore::PageSetObject::tls_pages;
 #define DEFINE_PAGE_VECTOR(name) PageSet::page_vector name;
 #endif
 
+void MemStore::PageSetObject::_load()
+{
+  ceph_assert(ceph_mutex_is_locked(spill_mutex));
+  if (spill_file.empty()) {
+    return;
+  }
+  ceph::buffer::list bl;
+  std::string err;
+  int r = bl.read_file(spill_file.c_str(), &err);
+  if (r < 0) {
+    ceph_abort_msg("failed to read " + spill_file + ": " + err);
+  }
+  auto p = bl.cbegin();
+  data.decode(p);
+  ::unlink(spill_file.c_str());
+  spill_file.clear();
+}
+
+// returns the number of bytes freed
+uint64_t MemStore::PageSetObject::_spill()
+{
+  ceph_assert(ceph_mutex_is_locked(spill_mutex));
+  if (!spill_file.empty() || pins || data.empty()) {
+    return 0;
+  }
+  ceph::buffer::list bl;
+  data.encode(bl);
+  auto fn = store->spill_dir + "/" + stringify(++store->spill_seq);
+  int r = bl.write_file(fn.c_str());
+  if (r < 0) {
+    ::unlink(fn.c_str());
+    return 0;
+  }
+  uint64_t freed = data.size() * data.get_page_size();
+  data.clear();
+  spill_file = fn;
+  return freed;
+}
+
+// spilled data is copied from its file, which holds the very same
+// encoding, instead of being paged back in
+void MemStore::PageSetObject::encode_data(ceph::buffer::list& bl) const
+{
+  if (!store) {
+    data.encode(bl);
+    return;
+  }
+  auto o = const_cast<PageSetObject*>(this);
+  std::lock_guard l{o->spill_mutex};
+  if (spill_file.empty()) {
+    data.encode(bl);
+    return;
+  }
+  ceph::buffer::list spilled;
+  std::string err;
+  int r = spilled.read_file(spill_file.c_str(), &err);
+  if (r < 0) {
+    ceph_abort_msg("failed to read " + spill_file + ": " + err);
+  }
+  bl.claim_append(spilled);
+}
+
+void MemStore::_maybe_spill()
+{
+  ceph_assert(page_arena);
+  if (page_arena->get_used() <= memory_limit) {
+    return;
+  }
+  std::unique_lock l{spill_lock, std::try_to_lock};
+  if (!l.owns_lock()) {
+    return;  // somebody else is on it
+  }
+  // go down to 90% of the limit so that we don't spill on every write
+  const uint64_t target = memory_limit - memory_limit / 10;
+  uint64_t spilled = 0, count = 0;
+  for (size_t n = spill_clock.size() * 2;
+       n > 0 && page_arena->get_used() > target;
+       --n) {
+    auto o = spill_clock.front();
+    spill_clock.splice(spill_clock.end(), spill_clock, spill_clock.begin());
+    if (o->referenced.exchange(false)) {
+      continue;  // second chance
+    }
+    std::lock_guard ol{o->spill_mutex};
+    if (uint64_t freed = o->_spill(); freed) {
+      spilled += freed;
+      ++count;
+    }
+  }
+  dout(10) << __func__ << " spilled " << count << " objects, "
+	   << byte_u_t(spilled) << ", in memory "
+	   << byte_u_t(page_arena->get_used()) << dendl;
+}
+
 int MemStore::PageSetObject::read(uint64_t offset, uint64_t len, ceph::buffer::list& bl)
 {
   const auto start = offset;
   const auto end = offset + len;
   auto remaining = len;
 
+  Pin pin(this);
   DEFINE_PAGE_VECTOR(tls_pages);
   data.get_range(offset, len, tls_pages);
 
@@ -1690,6 +1871,7 @@ int MemStore::PageSetObject::write(uint64_t offset, const ceph::buffer::list &sr
 {
   unsigned len = src.length();
 
+  Pin pin(this);
   DEFINE_PAGE_VECTOR(tls_pages);
   // make sure the page range is allocated
   data.alloc_range(offset, src.length(), tls_pages);
@@ -1718,7 +1900,10 @@ int MemStore::PageSetObject::clone(Object *src, uint64_t srcoff,
 {
   const int64_t delta = dstoff - srcoff;
 
-  auto &src_data = static_cast<PageSetObject*>(src)->data;
+  auto src_obj = static_cast<PageSetObject*>(src);
+  Pin src_pin(src_obj);
+  Pin pin(this);
+  auto &src_data = src_obj->data;
   const uint64_t src_page_size = src_data.get_page_size();
 
   auto &dst_data = data;
@@ -1805,6 +1990,7 @@ int MemStore::PageSetObject::clone(Object *src, uint64_t srcoff,
 
 int MemStore::PageSetObject::truncate(uint64_t size)
 {
+  Pin pin(this);
   data.free_pages_after(size);
   data_len = size;
 
@@ -1829,6 +2015,6 @@ int MemStore::PageSetObject::truncate(uint64_t size)
 
 MemStore::ObjectRef MemStore::Collection::create_object() const {
   if (use_page_set)
-    return ceph::make_ref<PageSetObject>(cct->_conf->memstore_page_size);
+    return ceph::make_ref<PageSetObject>(cct->_conf->memstore_page_size, store);
   return make_ref<BufferlistObject>();
 }
@@ -17,6 +17,8 @@
 #define CEPH_MEMSTORE_H
 
 #include <atomic>
+#include <list>
+#include <memory>
 #include <mutex>
 #include <boost/intrusive_ptr.hpp>
 
@@ -92,6 +94,7 @@ public:
   struct Collection : public CollectionImpl {
     int bits = 0;
     CephContext *cct;
+    MemStore *store;
     bool use_page_set;
     ceph::unordered_map<ghobject_t, ObjectRef> object_hash;  ///< for lookup
     std::map<ghobject_t, ObjectRef> object_map;        ///< for iteration
@@ -175,9 +178,10 @@ public:
 
   private:
     FRIEND_MAKE_REF(Collection);
-    explicit Collection(CephContext *cct, coll_t c)
+    explicit Collection(CephContext *cct, MemStore *store, coll_t c)
       : CollectionImpl(cct, c),
 	cct(cct),
+	store(store),
 	use_page_set(cct->_conf->memstore_page_set) {}
   };
   typedef Collection::Ref CollectionRef;
@@ -185,6 +189,23 @@ public:
 private:
   class OmapIteratorImpl;
 
+  /// pages of PageSetObjects come from here if memstore_page_arena is set
+  std::unique_ptr<PageArena> page_arena;
+
+  /*
+   * With memstore_memory_limit set, data of PageSetObjects that weren't
+   * accessed recently is written to files under spill_dir when the page
+   * arena grows past the limit, and read back on next access. Objects are
+   * kept on spill_clock, which is scanned in CLOCK order.
+   */
+  uint64_t memory_limit = 0;
+  std::string spill_dir;
+  ceph::mutex spill_lock = ceph::make_mutex("MemStore::spill_lock");
+  std::list<PageSetObject*> spill_clock;
+  std::atomic<uint64_t> spill_seq = {0};
+
+  void _init_page_tier();
+  void _maybe_spill();
 
   ceph::unordered_map<coll_t, CollectionRef> coll_map;
   /// rwlock to protect coll_map
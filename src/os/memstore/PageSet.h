@@ -16,17 +16,136 @@
 #define CEPH_PAGESET_H
 
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <cassert>
+#include <functional>
 #include <mutex>
+#include <thread>
 #include <vector>
+#include <sys/mman.h>
 #include <boost/intrusive/avl_set.hpp>
 #include <boost/intrusive_ptr.hpp>
 
 #include "include/encoding.h"
 
+/*
+ * Fixed size slots for Pages carved out of large mmap()ed chunks, which are
+ * backed by huge pages where the system allows it. Freed slots are kept on
+ * a number of free lists picked by thread, so that threads working on
+ * different objects don't contend on a single allocator lock. Chunks are
+ * only returned to the system when the arena is destroyed.
+ */
+class PageArena {
+  static constexpr size_t huge_page_size = 2 << 20;
+  static constexpr unsigned num_shards = 16;
+
+  struct Shard {
+    std::mutex lock;
+    std::vector<char*> free;
+  };
+  std::array<Shard, num_shards> shards;
+
+  std::mutex chunk_lock;
+  std::vector<std::pair<void*, size_t>> chunks;
+
+  const size_t slot_size;
+  const size_t chunk_size;
+  std::atomic<uint64_t> used{0};
+  bool hugetlb = true;
+
+  Shard& get_shard() {
+    auto h = std::hash<std::thread::id>{}(std::this_thread::get_id());
+    return shards[h % num_shards];
+  }
+
+  // map a new chunk and put its slots on the free list of 'shard'
+  void add_chunk(Shard& shard) {
+    void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (hugetlb) {
+      p = ::mmap(nullptr, chunk_size, PROT_READ|PROT_WRITE,
+                 MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+      // no reserved huge pages, don't try again
+      hugetlb = p != MAP_FAILED;
+    }
+#endif
+    if (p == MAP_FAILED) {
+      p = ::mmap(nullptr, chunk_size, PROT_READ|PROT_WRITE,
+                 MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+      ceph_assert(p != MAP_FAILED);
+#ifdef MADV_HUGEPAGE
+      ::madvise(p, chunk_size, MADV_HUGEPAGE);
+#endif
+    }
+    chunks.emplace_back(p, chunk_size);
+    for (size_t off = 0; off + slot_size <= chunk_size; off += slot_size) {
+      shard.free.push_back(static_cast<char*>(p) + off);
+    }
+  }
+
+ public:
+  explicit PageArena(size_t slot_size)
+    : slot_size((slot_size + 63) & ~size_t(63)),
+      chunk_size((std::max(this->slot_size * 16, huge_page_size) +
+                  huge_page_size - 1) & ~(huge_page_size - 1)) {}
+  ~PageArena() {
+    for (auto& [p, len] : chunks) {
+      ::munmap(p, len);
+    }
+  }
+
+  // disable copy
+  PageArena(const PageArena&) = delete;
+  const PageArena& operator=(const PageArena&) = delete;
+
+  size_t get_slot_size() const { return slot_size; }
+  uint64_t get_used() const { return used; }
+  uint64_t get_mapped() {
+    std::lock_guard<std::mutex> lock(chunk_lock);
+    return chunks.size() * chunk_size;
+  }
+
+  char *allocate() {
+    used += slot_size;
+    auto& shard = get_shard();
+    {
+      std::lock_guard<std::mutex> lock(shard.lock);
+      if (!shard.free.empty()) {
+        auto p = shard.free.back();
+        shard.free.pop_back();
+        return p;
+      }
+    }
+    // steal from another shard before mapping more memory
+    for (auto& other : shards) {
+      std::unique_lock<std::mutex> lock(other.lock, std::try_to_lock);
+      if (lock.owns_lock() && !other.free.empty()) {
+        auto p = other.free.back();
+        other.free.pop_back();
+        return p;
+      }
+    }
+    std::lock_guard<std::mutex> l(chunk_lock);
+    std::lock_guard<std::mutex> lock(shard.lock);
+    if (shard.free.empty()) {
+      add_chunk(shard);
+    }
+    auto p = shard.free.back();
+    shard.free.pop_back();
+    return p;
+  }
+  void free(char *p) {
+    used -= slot_size;
+    auto& shard = get_shard();
+    std::lock_guard<std::mutex> lock(shard.lock);
+    shard.free.push_back(p);
+  }
+};
+
 struct Page {
   char *const data;
+  PageArena *const arena;
   boost::intrusive::avl_set_member_hook<> hook;
   uint64_t offset;
 
@@ -62,14 +181,26 @@ struct Page {
     decode(offset, p);
   }
 
-  static Ref create(size_t page_size, uint64_t offset = 0) {
+  static size_t get_alloc_size(size_t page_size) {
     // ensure proper alignment of the Page
     const auto align = alignof(Page);
     page_size = (page_size + align - 1) & ~(align - 1);
+    return page_size + sizeof(Page);
+  }
+  static Ref create(size_t page_size, uint64_t offset = 0,
+                    PageArena *arena = nullptr) {
+    const auto alloc_size = get_alloc_size(page_size);
+    page_size = alloc_size - sizeof(Page);
     // allocate the Page and its data in a single buffer
-    auto buffer = new char[page_size + sizeof(Page)];
+    char *buffer;
+    if (arena) {
+      ceph_assert(alloc_size <= arena->get_slot_size());
+      buffer = arena->allocate();
+    } else {
+      buffer = new char[alloc_size];
+    }
     // place the Page structure at the end of the buffer
-    return new (buffer + page_size) Page(buffer, offset);
+    return new (buffer + page_size) Page(buffer, arena, offset);
   }
 
   // copy disabled
@@ -77,10 +208,15 @@ struct Page {
   const Page& operator=(const Page&) = delete;
 
  private: // private constructor, use create() instead
-  Page(char *data, uint64_t offset) : data(data), offset(offset), nrefs(1) {}
+  Page(char *data, PageArena *arena, uint64_t offset)
+    : data(data), arena(arena), offset(offset), nrefs(1) {}
 
   static void operator delete(void *p) {
-    delete[] reinterpret_cast<Page*>(p)->data;
+    auto page = reinterpret_cast<Page*>(p);
+    if (page->arena)
+      page->arena->free(page->data);
+    else
+      delete[] page->data;
   }
 };
 
@@ -102,6 +238,7 @@ class PageSet {
 
   page_set pages;
   uint64_t page_size;
+  PageArena *arena;
 
   typedef std::mutex lock_type;
   lock_type mutex;
@@ -129,9 +266,11 @@ class PageSet {
   }
 
  public:
-  explicit PageSet(size_t page_size) : page_size(page_size) {}
+  explicit PageSet(size_t page_size, PageArena *arena = nullptr)
+    : page_size(page_size), arena(arena) {}
   PageSet(PageSet &&rhs)
-    : pages(std::move(rhs.pages)), page_size(rhs.page_size) {}
+    : pages(std::move(rhs.pages)), page_size(rhs.page_size),
+      arena(rhs.arena) {}
   ~PageSet() {
     free_pages(pages.begin(), pages.end());
   }
@@ -161,7 +300,7 @@ class PageSet {
       typename page_set::insert_commit_data commit;
       auto insert = pages.insert_check(cur, page_offset, page_cmp(), commit);
       if (insert.second) {
-        auto page = Page::create(page_size, page_offset);
+        auto page = Page::create(page_size, page_offset, arena);
         cur = pages.insert_commit(*page, commit);
 
         // assume that the caller will write to the range [offset,length),
@@ -206,6 +345,11 @@ class PageSet {
     free_pages(cur, pages.end());
   }
 
+  void clear() {
+    std::lock_guard<lock_type> lock(mutex);
+    free_pages(pages.begin(), pages.end());
+  }
+
   void encode(ceph::buffer::list &bl) const {
     using ceph::encode;
     encode(page_size, bl);
@@ -222,7 +366,7 @@ class PageSet {
     decode(count, p);
     auto cur = pages.end();
     for (unsigned i = 0; i < count; i++) {
-      auto page = Page::create(page_size);
+      auto page = Page::create(page_size, 0, arena);
       page->decode(p, page_size);
       cur = pages.insert_before(cur, *page);
     }
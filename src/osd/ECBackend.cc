@@ -1523,6 +1523,12 @@ void ECBackend::submit_transaction(
       return ref;
     },
     get_parent()->get_dpp());
+  if (cct->_conf->osd_ec_parity_delta_writes &&
+      (ec_impl->get_supported_optimizations() &
+       ceph::ErasureCodeInterface::FLAG_EC_PLUGIN_PARITY_DELTA_OPTIMIZATION)) {
+    ECTransaction::plan_parity_delta(
+      sinfo, ec_impl, *(op->t), op->plan, get_parent()->get_dpp());
+  }
   dout(10) << __func__ << ": op " << *op << " starting" << dendl;
   rmw_pipeline.start_rmw(std::move(op));
 }
@@ -1668,6 +1674,17 @@ void ECBackend::objects_read_and_reconstruct(
     reads, fast_read, std::move(func));
 }
 
+bool ECBackend::objects_read_shards(
+  const hobject_t &hoid,
+  const set<int> &shards,
+  uint64_t off,
+  uint64_t len,
+  GenContextURef<pair<int, map<int, bufferlist>> &&> &&func)
+{
+  return read_pipeline.objects_read_shards(
+    hoid, shards, off, len, std::move(func));
+}
+
 void ECBackend::kick_reads() {
   read_pipeline.kick_reads();
 }
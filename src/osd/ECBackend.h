@@ -146,6 +146,13 @@ public:
     bool fast_read,
     GenContextURef<std::map<hobject_t,std::pair<int, extent_map> > &&> &&func) override;
 
+  bool objects_read_shards(
+    const hobject_t &hoid,
+    const std::set<int> &shards,
+    uint64_t off,
+    uint64_t len,
+    GenContextURef<std::pair<int, std::map<int, ceph::buffer::list>> &&> &&func) override;
+
   void objects_read_async(
     const hobject_t &hoid,
     const std::list<std::pair<boost::tuple<uint64_t, uint64_t, uint32_t>,
@@ -151,8 +151,11 @@ ostream &operator<<(ostream &lhs, const ECCommon::RMWPipeline::Op &rhs)
       << " pending_apply=" << rhs.pending_apply
       << " pending_commit=" << rhs.pending_commit
       << " plan.to_read=" << rhs.plan.to_read
-      << " plan.will_write=" << rhs.plan.will_write
-      << ")";
+      << " plan.will_write=" << rhs.plan.will_write;
+  for (auto &&[hoid, pd] : rhs.plan.parity_delta) {
+    lhs << " plan.parity_delta=" << pd.stripe_off << ":" << pd.data_chunks;
+  }
+  lhs << ")";
   return lhs;
 }
 
@@ -573,6 +576,95 @@ void ECCommon::ReadPipeline::objects_read_and_reconstruct(
     std::make_unique<ClientReadCompleter>(*this, &(in_progress_client_reads.back())));
 }
 
+struct ShardReadCompleter : ECCommon::ReadCompleter {
+  ShardReadCompleter(
+    ECCommon::ReadPipeline &read_pipeline,
+    const set<int> &want,
+    GenContextURef<pair<int, map<int, bufferlist>> &&> &&func)
+    : read_pipeline(read_pipeline),
+      want(want),
+      func(std::move(func)) {}
+
+  void finish_single_request(
+    const hobject_t &hoid,
+    ECCommon::read_result_t &res,
+    list<boost::tuple<uint64_t, uint64_t, uint32_t> > to_read) override
+  {
+    result.first = res.r;
+    if (res.r != 0)
+      return;
+    ceph_assert(res.returned.size() == 1);
+    map<int, bufferlist> chunks;
+    for (auto &&[shard, bl] : res.returned.front().get<2>()) {
+      chunks[shard.shard] = std::move(bl);
+    }
+    if (chunks.empty()) {
+      result.first = -EIO;
+      return;
+    }
+    // if one of the wanted shards failed others were read instead
+    map<int, bufferlist> decoded;
+    result.first = read_pipeline.ec_impl->decode(
+      want, chunks, &decoded, chunks.begin()->second.length());
+    if (result.first == 0) {
+      for (int i : want) {
+	result.second[i] = std::move(decoded[i]);
+      }
+    }
+  }
+
+  void finish(int priority) && override
+  {
+    func.release()->complete(std::move(result));
+  }
+
+  ECCommon::ReadPipeline &read_pipeline;
+  set<int> want;
+  GenContextURef<pair<int, map<int, bufferlist>> &&> func;
+  pair<int, map<int, bufferlist>> result{-EIO, {}};
+};
+
+bool ECCommon::ReadPipeline::objects_read_shards(
+  const hobject_t &hoid,
+  const set<int> &want,
+  uint64_t off,
+  uint64_t len,
+  GenContextURef<pair<int, map<int, bufferlist>> &&> &&func)
+{
+  set<int> have;
+  map<shard_id_t, pg_shard_t> shards;
+  get_all_avail_shards(hoid, set<pg_shard_t>(), have, shards, false);
+
+  map<pg_shard_t, vector<pair<int, int>>> need;
+  for (int i : want) {
+    auto iter = shards.find(shard_id_t(i));
+    if (iter == shards.end()) {
+      dout(10) << __func__ << ": " << hoid << " shard " << i
+	       << " not available" << dendl;
+      return false;
+    }
+    need[iter->second].push_back(make_pair(0, ec_impl->get_sub_chunk_count()));
+  }
+
+  map<hobject_t, set<int>> obj_want_to_read;
+  obj_want_to_read.emplace(hoid, want);
+  map<hobject_t, read_request_t> for_read_op;
+  for_read_op.emplace(
+    hoid,
+    read_request_t(
+      {boost::make_tuple(off, len, 0)},
+      need,
+      false));
+  start_read_op(
+    CEPH_MSG_PRIO_DEFAULT,
+    obj_want_to_read,
+    for_read_op,
+    OpRequestRef(),
+    false,
+    false,
+    std::make_unique<ShardReadCompleter>(*this, want, std::move(func)));
+  return true;
+}
 
 int ECCommon::ReadPipeline::send_all_remaining_reads(
   const hobject_t &hoid,
@@ -646,6 +738,19 @@ bool ECCommon::RMWPipeline::try_state_to_reads()
     return false;
   }
 
+  if (parity_delta_in_flight(*op)) {
+    dout(20) << __func__ << ": blocking " << *op
+	     << " because a parity delta update of the same object is"
+	     << " in progress" << dendl;
+    return false;
+  }
+
+  if (!op->plan.parity_delta.empty() &&
+      object_in_flight(op->plan.parity_delta.begin()->first)) {
+    // the coding chunks on disk are not up to date
+    op->plan.parity_delta.clear();
+  }
+
   if (!pipeline_state.caching_enabled()) {
     op->using_cache = false;
   } else if (op->invalidates_cache()) {
@@ -657,6 +762,16 @@ bool ECCommon::RMWPipeline::try_state_to_reads()
   waiting_state.pop_front();
   waiting_reads.push_back(*op);
 
+  if (!op->plan.parity_delta.empty()) {
+    if (start_parity_delta_read(op)) {
+      // the cache only holds whole stripes
+      op->using_cache = false;
+      dout(10) << __func__ << ": " << *op << dendl;
+      return true;
+    }
+    op->plan.parity_delta.clear();
+  }
+
   if (op->using_cache) {
     cache.open_write_pin(op->pin);
 
@@ -705,6 +820,81 @@ bool ECCommon::RMWPipeline::try_state_to_reads()
   return true;
 }
 
+bool ECCommon::RMWPipeline::object_in_flight(const hobject_t &hoid) const
+{
+  for (auto &&l : {&waiting_reads, &waiting_commit}) {
+    for (auto &&op : *l) {
+      if (op.plan.hash_infos.count(hoid)) {
+	return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool ECCommon::RMWPipeline::parity_delta_in_flight(const Op &op) const
+{
+  for (auto &&l : {&waiting_reads, &waiting_commit}) {
+    for (auto &&i : *l) {
+      for (auto &&[hoid, pd] : i.plan.parity_delta) {
+	if (op.plan.hash_infos.count(hoid)) {
+	  return true;
+	}
+      }
+    }
+  }
+  return false;
+}
+
+bool ECCommon::RMWPipeline::start_parity_delta_read(Op *op)
+{
+  ceph_assert(op->plan.parity_delta.size() == 1);
+  auto &[hoid, pd] = *op->plan.parity_delta.begin();
+  set<int> want = pd.data_chunks;
+  for (unsigned i = ec_impl->get_data_chunk_count();
+       i < ec_impl->get_chunk_count();
+       ++i) {
+    want.insert(i);
+  }
+  op->parity_delta_read = true;
+  bool started = ec_backend.objects_read_shards(
+    hoid,
+    want,
+    pd.stripe_off,
+    sinfo.get_stripe_width(),
+    make_gen_lambda_context<pair<int, map<int, bufferlist>> &&>(
+      [op, this](pair<int, map<int, bufferlist>> &&result) {
+	op->parity_delta_read = false;
+	auto &[hoid, pd] = *op->plan.parity_delta.begin();
+	if (result.first == 0) {
+	  pd.old_chunks = std::move(result.second);
+	  op->plan.will_write[hoid] = pd.get_will_write(sinfo);
+	} else {
+	  dout(10) << __func__ << ": " << hoid << " parity delta read failed "
+		   << result.first << ", reading the whole stripe" << dendl;
+	  // later rmws of the object were only held back by the parity delta
+	  // and this op bypasses the cache, so they must wait for the
+	  // pipeline to drain instead
+	  pipeline_state.invalidate();
+	  op->plan.parity_delta.clear();
+	  op->remote_read = op->plan.to_read;
+	  objects_read_async_no_cache(
+	    op->remote_read,
+	    [op, this](map<hobject_t,pair<int, extent_map> > &&results) {
+	      for (auto &&i: results) {
+		op->remote_read_result.emplace(i.first, i.second.second);
+	      }
+	      check_ops();
+	    });
+	}
+	check_ops();
+      }));
+  if (!started) {
+    op->parity_delta_read = false;
+  }
+  return started;
+}
+
 bool ECCommon::RMWPipeline::try_reads_to_commit()
 {
   if (waiting_reads.empty())
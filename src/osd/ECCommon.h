@@ -225,6 +225,15 @@ struct ECCommon {
     bool fast_read,
     GenContextURef<std::map<hobject_t,std::pair<int, extent_map> > &&> &&func) = 0;
 
+  /// read the given shards of a stripe aligned extent, false if some
+  /// of them are not available
+  virtual bool objects_read_shards(
+    const hobject_t &hoid,
+    const std::set<int> &shards,
+    uint64_t off,
+    uint64_t len,
+    GenContextURef<std::pair<int, std::map<int, ceph::buffer::list>> &&> &&func) = 0;
+
   struct read_request_t {
     const std::list<boost::tuple<uint64_t, uint64_t, uint32_t> > to_read;
     std::map<pg_shard_t, std::vector<std::pair<int, int>>> need;
@@ -370,6 +379,13 @@ struct ECCommon {
       bool fast_read,
       GenContextURef<std::map<hobject_t,std::pair<int, extent_map> > &&> &&func);
 
+    bool objects_read_shards(
+      const hobject_t &hoid,
+      const std::set<int> &shards,
+      uint64_t off,
+      uint64_t len,
+      GenContextURef<std::pair<int, std::map<int, ceph::buffer::list>> &&> &&func);
+
     template <class F, class G>
     void filter_read_op(
       const OSDMapRef& osdmap,
@@ -511,8 +527,10 @@ struct ECCommon {
       std::map<hobject_t,extent_set> pending_read; // subset already being read
       std::map<hobject_t,extent_set> remote_read;  // subset we must read
       std::map<hobject_t,extent_map> remote_read_result;
+      bool parity_delta_read = false; // reading plan.parity_delta chunks
       bool read_in_progress() const {
-        return !remote_read.empty() && remote_read_result.empty();
+        return (!remote_read.empty() && remote_read_result.empty()) ||
+          parity_delta_read;
       }
 
       /// In progress write state.
@@ -603,6 +621,9 @@ struct ECCommon {
     bool try_reads_to_commit();
     bool try_finish_rmw();
     void check_ops();
+    bool object_in_flight(const hobject_t &hoid) const;
+    bool parity_delta_in_flight(const Op &op) const;
+    bool start_parity_delta_read(Op *op);
 
     void on_change();
     void call_write_ordered(std::function<void(void)> &&cb);
@@ -94,6 +94,146 @@ static void encode_and_write(
   }
 }
 
+static void overwrite_with_parity_delta(
+  pg_t pgid,
+  const hobject_t &oid,
+  const ECUtil::stripe_info_t &sinfo,
+  ErasureCodeInterfaceRef &ecimpl,
+  ECTransaction::ParityDelta &pd,
+  const extent_map &to_overwrite,
+  uint32_t flags,
+  pg_log_entry_t *entry,
+  vector<pair<uint64_t, uint64_t> > &rollback_extents,
+  extent_map &written,
+  map<shard_id_t, ObjectStore::Transaction> *transactions,
+  DoutPrefixProvider *dpp)
+{
+  const uint64_t chunk_size = sinfo.get_chunk_size();
+  const uint64_t chunk_off =
+    sinfo.aligned_logical_offset_to_chunk_offset(pd.stripe_off);
+  const int k = ecimpl->get_data_chunk_count();
+
+  map<int, bufferlist> deltas;
+  map<int, bufferlist> to_store;
+  for (int i : pd.data_chunks) {
+    uint64_t logical = pd.stripe_off + i * chunk_size;
+    extent_map chunk;
+    chunk.insert(logical, chunk_size, pd.old_chunks.at(i));
+    chunk.insert(to_overwrite.intersect(logical, chunk_size));
+    ceph_assert(chunk.ext_count() == 1);
+    bufferlist new_data = chunk.begin().get_val();
+    int r = ecimpl->encode_delta(pd.old_chunks.at(i), new_data, &deltas[i]);
+    ceph_assert(r == 0);
+    written.insert(logical, chunk_size, new_data);
+    to_store[i] = std::move(new_data);
+  }
+  map<int, bufferlist> parity;
+  for (unsigned i = k; i < ecimpl->get_chunk_count(); ++i) {
+    parity[i] = pd.old_chunks.at(i);
+  }
+  int r = ecimpl->apply_delta(deltas, &parity);
+  ceph_assert(r == 0);
+  to_store.merge(parity);
+
+  ldpp_dout(dpp, 20) << __func__ << ": " << oid
+		     << " stripe " << pd.stripe_off
+		     << " data chunks " << pd.data_chunks
+		     << dendl;
+
+  // Every shard stashes the stripe so that rolling back the log entry
+  // works the same way on all of them, even if only some are written.
+  if (entry) {
+    if (rollback_extents.empty()) {
+      for (auto &&st : *transactions) {
+	st.second.touch(
+	  coll_t(spg_t(pgid, st.first)),
+	  ghobject_t(oid, entry->version.version, st.first));
+      }
+    }
+    rollback_extents.emplace_back(make_pair(chunk_off, chunk_size));
+    for (auto &&st : *transactions) {
+      st.second.clone_range(
+	coll_t(spg_t(pgid, st.first)),
+	ghobject_t(oid, ghobject_t::NO_GEN, st.first),
+	ghobject_t(oid, entry->version.version, st.first),
+	chunk_off,
+	chunk_size,
+	chunk_off);
+    }
+  }
+  for (auto &&st : *transactions) {
+    auto iter = to_store.find(st.first);
+    if (iter == to_store.end()) {
+      continue;
+    }
+    st.second.write(
+      coll_t(spg_t(pgid, st.first)),
+      ghobject_t(oid, ghobject_t::NO_GEN, st.first),
+      chunk_off,
+      iter->second.length(),
+      iter->second,
+      flags);
+  }
+}
+
+void ECTransaction::plan_parity_delta(
+  const ECUtil::stripe_info_t &sinfo,
+  const ErasureCodeInterfaceRef &ecimpl,
+  PGTransaction &t,
+  WritePlan &plan,
+  DoutPrefixProvider *dpp)
+{
+  if (plan.invalidates_cache ||
+      plan.to_read.size() != 1 ||
+      plan.will_write.size() != 1 ||
+      !ecimpl->get_chunk_mapping().empty()) {
+    return;
+  }
+  const auto &[oid, to_read] = *plan.to_read.begin();
+  if (oid.is_temp() ||
+      to_read.num_intervals() != 1 ||
+      to_read.size() != sinfo.get_stripe_width() ||
+      !(plan.will_write.begin()->second == to_read)) {
+    return;
+  }
+  auto opiter = t.op_map.find(oid);
+  if (opiter == t.op_map.end()) {
+    return;
+  }
+  const auto &op = opiter->second;
+  if (!op.is_none() || op.truncate || op.buffer_updates.empty()) {
+    return;
+  }
+
+  const uint64_t stripe_off = to_read.range_start();
+  const uint64_t stripe_end = stripe_off + sinfo.get_stripe_width();
+  const uint64_t chunk_size = sinfo.get_chunk_size();
+  ParityDelta pd;
+  pd.stripe_off = stripe_off;
+  for (auto &&extent : op.buffer_updates) {
+    uint64_t off = extent.get_off();
+    uint64_t end = off + extent.get_len();
+    if (off < stripe_off || end > stripe_end) {
+      return;
+    }
+    for (uint64_t i = (off - stripe_off) / chunk_size;
+	 i <= (end - 1 - stripe_off) / chunk_size;
+	 ++i) {
+      pd.data_chunks.insert(i);
+    }
+  }
+  // never read more chunks than the stripe read this replaces
+  if (pd.data_chunks.size() + ecimpl->get_coding_chunk_count() >
+      ecimpl->get_data_chunk_count()) {
+    return;
+  }
+  ldpp_dout(dpp, 20) << __func__ << ": " << oid
+		     << " stripe " << stripe_off
+		     << " data chunks " << pd.data_chunks
+		     << dendl;
+  plan.parity_delta.emplace(oid, std::move(pd));
+}
+
 void ECTransaction::generate_transactions(
   PGTransaction* _t,
   WritePlan &plan,
@@ -548,6 +688,23 @@ void ECTransaction::generate_transactions(
       ldpp_dout(dpp, 20) << "generate_transactions: to_overwrite: "
 			 << to_overwrite
 			 << dendl;
+      auto pditer = plan.parity_delta.find(oid);
+      if (pditer != plan.parity_delta.end()) {
+	overwrite_with_parity_delta(
+	  pgid,
+	  oid,
+	  sinfo,
+	  ecimpl,
+	  pditer->second,
+	  to_overwrite,
+	  fadvise_flags,
+	  entry,
+	  rollback_extents,
+	  written,
+	  transactions,
+	  dpp);
+	to_overwrite.clear();
+      }
       for (auto &&extent: to_overwrite) {
 	ceph_assert(extent.get_off() + extent.get_len() <= append_after);
 	ceph_assert(sinfo.logical_offset_is_stripe_aligned(extent.get_off()));
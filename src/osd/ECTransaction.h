@@ -22,12 +22,36 @@
 #include "PGTransaction.h"
 
 namespace ECTransaction {
+  /* A small overwrite within a single stripe can be applied by reading
+   * and writing only the data chunks it touches plus the coding chunks,
+   * which are updated with the delta of the data chunks instead of
+   * re-encoding the whole stripe. */
+  struct ParityDelta {
+    uint64_t stripe_off = 0;      ///< logical offset of the stripe
+    std::set<int> data_chunks;    ///< data chunks touched by the write
+    std::map<int, ceph::buffer::list> old_chunks; ///< touched data + coding
+
+    /// logical extents written instead of the whole stripe
+    extent_set get_will_write(const ECUtil::stripe_info_t &sinfo) const {
+      extent_set ret;
+      for (int i : data_chunks) {
+	ret.insert(stripe_off + i * sinfo.get_chunk_size(),
+		   sinfo.get_chunk_size());
+      }
+      return ret;
+    }
+  };
+
   struct WritePlan {
     bool invalidates_cache = false; // Yes, both are possible
     std::map<hobject_t,extent_set> to_read;
     std::map<hobject_t,extent_set> will_write; // superset of to_read
 
     std::map<hobject_t,ECUtil::HashInfoRef> hash_infos;
+
+    // set if the rmw pipeline may apply the write as a parity delta
+    // rather than reading to_read, see plan_parity_delta
+    std::map<hobject_t,ParityDelta> parity_delta;
   };
 
   template <typename F>
@@ -176,6 +200,13 @@ namespace ECTransaction {
     return plan;
   }
 
+  void plan_parity_delta(
+    const ECUtil::stripe_info_t &sinfo,
+    const ceph::ErasureCodeInterfaceRef &ecimpl,
+    PGTransaction &t,
+    WritePlan &plan,
+    DoutPrefixProvider *dpp);
+
   void generate_transactions(
     PGTransaction* _t,
     WritePlan &plan,
@@ -4756,6 +4756,10 @@ int OSD::shutdown()
     std::lock_guard l(s->osdmap_lock);
     s->shard_osdmap = OSDMapRef();
   }
+  for (auto s : shards) {
+    std::lock_guard l(s->shard_lock);
+    s->op_prefetch.clear();
+  }
   service.shutdown();
 
   std::lock_guard lock(osd_lock);
@@ -6352,6 +6356,25 @@ void OSD::tick_without_osd_lock()
   logger->set(l_osd_cached_crc, ceph::buffer::get_cached_crc());
   logger->set(l_osd_cached_crc_adjusted, ceph::buffer::get_cached_crc_adjusted());
   logger->set(l_osd_missed_crc, ceph::buffer::get_missed_crc());
+  {
+    unsigned queue_max = 0;
+    for (auto shard : shards) {
+      queue_max = std::max(queue_max, shard->queue_depth.load());
+    }
+    logger->set(l_osd_op_shard_queue_max, queue_max);
+  }
+  {
+    uint64_t entries = PGLog::IndexedLog::get_num_entries();
+    uint64_t dups = PGLog::IndexedLog::get_num_dups();
+    logger->set(l_osd_pglog_entries, entries);
+    logger->set(l_osd_pglog_dups, dups);
+    // the dups share the pool with the entries, a dup is just a list node
+    // as its op_returns are not charged to the pool
+    uint64_t bytes = mempool::osd_pglog::allocated_bytes();
+    uint64_t dup_bytes = dups * (sizeof(pg_log_dup_t) + 2 * sizeof(void*));
+    logger->set(l_osd_pglog_bytes_per_entry,
+		entries ? (bytes - std::min(bytes, dup_bytes)) / entries : 0);
+  }
 
   // refresh osd stats
   struct store_statfs_t stbuf;
@@ -10549,6 +10572,7 @@ void OSDShard::consume_map(
 	slot->waiting_for_split.empty() &&
 	!slot->pg) {
       dout(20) << __func__ << "  " << pgid << " empty, pruning" << dendl;
+      op_prefetch.erase(pgid);
       p = pg_slots.erase(p);
       continue;
     }
@@ -10600,6 +10624,7 @@ int OSDShard::_wake_pg_slot(
   }
   slot->waiting_peering.clear();
   ++slot->requeue_seq;
+  queue_depth += count;
   return count;
 }
 
@@ -10857,10 +10882,36 @@ void OSD::ShardedOpWQ::_add_slot_waiter(
 #undef dout_prefix
 #define dout_prefix *_dout << "osd." << osd->whoami << " op_wq(" << shard_index << ") "
 
+OSDShard *OSD::ShardedOpWQ::_pick_steal_victim(OSDShard *own)
+{
+  unsigned min_queue = osd->cct->_conf->osd_op_shard_steal_min_queue;
+  OSDShard *victim = nullptr;
+  unsigned max_depth = 0;
+  for (auto shard : osd->shards) {
+    unsigned depth = shard->queue_depth.load();
+    if (shard != own && depth >= min_queue && depth > max_depth) {
+      victim = shard;
+      max_depth = depth;
+    }
+  }
+  return victim;
+}
+
+void OSD::ShardedOpWQ::_wake_stealer(OSDShard *busy)
+{
+  for (auto shard : osd->shards) {
+    if (shard != busy && shard->queue_depth.load() == 0) {
+      std::lock_guard l{shard->sdata_wait_lock};
+      shard->sdata_cond.notify_all();
+      return;
+    }
+  }
+}
+
 void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
 {
   uint32_t shard_index = thread_index % osd->num_shards;
-  auto& sdata = osd->shards[shard_index];
+  OSDShard *sdata = osd->shards[shard_index];
   ceph_assert(sdata);
 
   // If all threads of shards do oncommits, there is a out-of-order
@@ -10869,10 +10920,29 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
   // callback.
   bool is_smallest_thread_index = thread_index < osd->num_shards;
 
+  // With nothing queued on our own shard, take the next item of an
+  // overloaded one.  We then act like one of that shard's own threads,
+  // so items of a pg stay ordered by its pg slot and the pg lock.
+  bool stealing = false;
+  if (!is_smallest_thread_index &&
+      osd->cct->_conf->osd_op_shard_steal_min_queue > 0 &&
+      sdata->queue_depth.load() == 0) {
+    if (auto victim = _pick_steal_victim(sdata); victim) {
+      dout(20) << __func__ << " stealing from " << victim->shard_name << dendl;
+      sdata = victim;
+      stealing = true;
+    }
+  }
+
   // peek at spg_t
   sdata->shard_lock.lock();
   if (sdata->scheduler->empty() &&
       (!is_smallest_thread_index || sdata->context_queue.empty())) {
+    if (stealing) {
+      // the shard's own threads were faster
+      sdata->shard_lock.unlock();
+      return;
+    }
     std::unique_lock wait_lock{sdata->sdata_wait_lock};
     if (is_smallest_thread_index && !sdata->context_queue.empty()) {
       // we raced with a context_queue addition, don't wait
@@ -10922,6 +10992,9 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
     }
 
     work_item = sdata->scheduler->dequeue();
+    if (std::get_if<OpSchedulerItem>(&work_item)) {
+      --sdata->queue_depth;
+    }
     if (osd->is_stopping()) {
       sdata->shard_lock.unlock();
       for (auto c : oncommits) {
@@ -10934,6 +11007,11 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
     // If the work item is scheduled in the future, wait until
     // the time returned in the dequeue response before retrying.
     if (auto when_ready = std::get_if<double>(&work_item)) {
+      if (stealing) {
+	// don't wait on behalf of another shard
+	sdata->shard_lock.unlock();
+	return;
+      }
       if (is_smallest_thread_index) {
         sdata->shard_lock.unlock();
         handle_oncommits(oncommits);
@@ -10971,6 +11049,10 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
     }
     return;    // OSD shutdown, discard.
   }
+  if (stealing) {
+    ++sdata->stolen;
+    osd->logger->inc(l_osd_op_shard_steals);
+  }
 
   const auto token = item.get_ordering_token();
   auto r = sdata->pg_slots.emplace(token, nullptr);
@@ -11148,6 +11230,13 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
       return;
     }
   }
+  // client ops of this pg queued so far, including this one
+  std::vector<OpRequestRef> prefetch_ops;
+  if (auto p = sdata->op_prefetch.find(token);
+      p != sdata->op_prefetch.end()) {
+    prefetch_ops.swap(p->second);
+    sdata->op_prefetch.erase(p);
+  }
   sdata->shard_lock.unlock();
 
   if (!new_children.empty()) {
@@ -11179,6 +11268,10 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
   delete f;
   *_dout << dendl;
 
+  if (prefetch_ops.size() > 1) {
+    pg->prefetch_object_contexts(prefetch_ops);
+  }
+
   qi.run(osd, sdata, pg, tp_handle);
 
   {
@@ -11210,10 +11303,22 @@ void OSD::ShardedOpWQ::_enqueue(OpSchedulerItem&& item) {
   dout(20) << fmt::format("{} {}", __func__, item) << dendl;
 
   bool empty = true;
+  unsigned depth;
+  unsigned prefetch_max = osd->cct->_conf->osd_op_prefetch_max_objects;
   {
     std::lock_guard l{sdata->shard_lock};
+    if (prefetch_max) {
+      if (std::optional<OpRequestRef> op = item.maybe_get_op();
+	  op && (*op)->get_req()->get_type() == CEPH_MSG_OSD_OP) {
+	auto& ops = sdata->op_prefetch[item.get_ordering_token()];
+	if (ops.size() < prefetch_max) {
+	  ops.push_back(std::move(*op));
+	}
+      }
+    }
     empty = sdata->scheduler->empty();
     sdata->scheduler->enqueue(std::move(item));
+    depth = ++sdata->queue_depth;
   }
 
   {
@@ -11224,6 +11329,12 @@ void OSD::ShardedOpWQ::_enqueue(OpSchedulerItem&& item) {
       sdata->sdata_cond.notify_one();
     }
   }
+
+  // get another shard to help out for every min_queue items backlog
+  unsigned min_queue = osd->cct->_conf->osd_op_shard_steal_min_queue;
+  if (min_queue > 0 && depth % min_queue == 0) {
+    _wake_stealer(sdata);
+  }
 }
 
 void OSD::ShardedOpWQ::_enqueue_front(OpSchedulerItem&& item)
@@ -11254,6 +11365,7 @@ void OSD::ShardedOpWQ::_enqueue_front(OpSchedulerItem&& item)
     dout(20) << __func__ << " " << item << dendl;
   }
   sdata->scheduler->enqueue_front(std::move(item));
+  ++sdata->queue_depth;
   sdata->shard_lock.unlock();
   std::lock_guard l{sdata->sdata_wait_lock};
   sdata->sdata_cond.notify_one();
@@ -11270,6 +11382,8 @@ void OSD::ShardedOpWQ::stop_for_fast_shutdown()
     while (!sdata->scheduler->empty()) {
       sdata->scheduler->dequeue();
     }
+    sdata->queue_depth = 0;
+    sdata->op_prefetch.clear();
   }
 }
 
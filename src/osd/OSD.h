@@ -1004,6 +1004,14 @@ struct OSDShard {
 
   /// priority queue
   ceph::osd::scheduler::OpSchedulerRef scheduler;
+  /// items in the scheduler; changed under shard_lock, but read without
+  /// it by idle threads of other shards looking for work to steal
+  std::atomic<unsigned> queue_depth = {0};
+  /// items of this shard processed by threads of other shards
+  std::atomic<uint64_t> stolen = {0};
+  /// client ops queued per pg, for the next thread to run an op of the
+  /// pg to prefetch their object contexts in one batch
+  std::unordered_map<spg_t,std::vector<OpRequestRef>> op_prefetch;
 
   bool stop_waiting = false;
 
@@ -1561,6 +1569,12 @@ protected:
     /// try to do some work
     void _process(uint32_t thread_index, ceph::heartbeat_handle_d *hb) override;
 
+    /// shard other than own with the deepest queue above
+    /// osd_op_shard_steal_min_queue, if any
+    OSDShard *_pick_steal_victim(OSDShard *own);
+    /// wake an idle shard's threads so that they help out busy
+    void _wake_stealer(OSDShard *busy);
+
     void stop_for_fast_shutdown();
 
     /// enqueue a new item
@@ -1598,6 +1612,8 @@ protected:
 
 	std::scoped_lock l{sdata->shard_lock};
 	f->open_object_section(queue_name);
+	f->dump_unsigned("queue_depth", sdata->queue_depth);
+	f->dump_unsigned("stolen", sdata->stolen);
 	sdata->scheduler->dump(*f);
 	f->close_section();
       }
@@ -756,6 +756,9 @@ public:
     OpRequestRef& op,
     ThreadPool::TPHandle &handle
   ) = 0;
+  /// load the object contexts of queued client ops in one batch
+  virtual void prefetch_object_contexts(
+    const std::vector<OpRequestRef>& ops) = 0;
   virtual void clear_cache() = 0;
   virtual int get_cache_obj_count() = 0;
 
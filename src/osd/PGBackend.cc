@@ -446,6 +446,17 @@ int PGBackend::objects_list_range(
   return r;
 }
 
+void PGBackend::objects_prefetch(const vector<hobject_t> &ls)
+{
+  vector<ghobject_t> oids;
+  oids.reserve(ls.size());
+  for (auto &hoid : ls) {
+    oids.emplace_back(
+      hoid, ghobject_t::NO_GEN, get_parent()->whoami_shard().shard);
+  }
+  store->prefetch_objects(ch, oids);
+}
+
 int PGBackend::objects_get_attr(
   const hobject_t &hoid,
   const string &attr,
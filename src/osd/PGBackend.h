@@ -534,6 +534,9 @@ typedef std::shared_ptr<const OSDMap> OSDMapRef;
      std::vector<hobject_t> *ls,
      std::vector<ghobject_t> *gen_obs=0);
 
+   /// hint the store that the metadata of these objects is about to be read
+   void objects_prefetch(const std::vector<hobject_t> &ls);
+
    int objects_get_attr(
      const hobject_t &hoid,
      const std::string &attr,
@@ -41,6 +41,9 @@ static ostream& _prefix(std::ostream *_dout, const PGLog *pglog)
 
 //////////////////// PGLog::IndexedLog ////////////////////
 
+std::atomic<uint64_t> PGLog::IndexedLog::num_entries = {0};
+std::atomic<uint64_t> PGLog::IndexedLog::num_dups = {0};
+
 void PGLog::IndexedLog::split_out_child(
   pg_t child_pgid,
   unsigned split_bits,
@@ -150,6 +153,7 @@ void PGLog::IndexedLog::trim(
     unindex(e);
     dups.pop_front();
   }
+  count_entries();
 
   // raise tail?
   if (tail < s)
@@ -413,6 +417,7 @@ void PGLog::merge_log(pg_info_t &oinfo, pg_log_t&& olog, pg_shard_t fromosd,
     // splice into our log.
     log.log.splice(log.log.begin(),
 		   std::move(olog.log), from, to);
+    log.count_entries();
 
     info.log_tail = log.tail = olog.tail;
     changed = true;
@@ -604,6 +609,7 @@ bool PGLog::merge_log_dups(const pg_log_t& olog) {
 	  << " log.dups.size()=" << log.dups.size()
 	  << " olog.dups.size()=" << olog.dups.size() << dendl;
 
+  log.count_entries();
   return changed;
 }
 
@@ -146,7 +146,15 @@ public:
    * plus some methods to manipulate it all.
    */
   struct IndexedLog : public pg_log_t {
-    mutable ceph::unordered_map<hobject_t,pg_log_entry_t*> objects;  // ptrs into log.  be careful!
+    /*
+     * The key of each object refers to the soid of the entry it maps to
+     * instead of holding a copy of the object name, so it must be re-keyed
+     * whenever the entry changes, see index_object().
+     */
+    using object_index_t = mempool::osd_pglog::unordered_map<
+      std::reference_wrapper<const hobject_t>, pg_log_entry_t*,
+      std::hash<hobject_t>, std::equal_to<hobject_t>>;
+    mutable object_index_t objects;  // ptrs into log.  be careful!
     mutable ceph::unordered_map<osd_reqid_t,pg_log_entry_t*> caller_ops;
     mutable ceph::unordered_multimap<osd_reqid_t,pg_log_entry_t*> extra_caller_ops;
     mutable ceph::unordered_map<osd_reqid_t,pg_log_dup_t*> dup_index;
@@ -158,6 +166,12 @@ public:
     //
   private:
     mutable __u16 indexed_data = 0;
+    /// our share of num_entries and num_dups
+    mutable size_t counted_entries = 0;
+    mutable size_t counted_dups = 0;
+    /// entries and dups held by all IndexedLogs of this process
+    static std::atomic<uint64_t> num_entries;
+    static std::atomic<uint64_t> num_dups;
     /**
      * rollback_info_trimmed_to_riter points to the first log entry <=
      * rollback_info_trimmed_to
@@ -231,6 +245,7 @@ public:
     {
       reset_rollback_info_trimmed_to_riter();
       index(rhs.indexed_data);
+      count_entries();
     }
 
     IndexedLog &operator=(const IndexedLog &rhs) {
@@ -239,6 +254,28 @@ public:
       return *this;
     }
 
+    ~IndexedLog() {
+      num_entries -= counted_entries;
+      num_dups -= counted_dups;
+    }
+
+    /// bring num_entries and num_dups up to date after entries or dups
+    /// were added or removed
+    void count_entries() const {
+      num_entries += log.size();
+      num_entries -= counted_entries;
+      counted_entries = log.size();
+      num_dups += dups.size();
+      num_dups -= counted_dups;
+      counted_dups = dups.size();
+    }
+    static uint64_t get_num_entries() {
+      return num_entries;
+    }
+    static uint64_t get_num_dups() {
+      return num_dups;
+    }
+
     void trim_rollback_info_to(eversion_t to, LogEntryHandler *h) {
       advance_can_rollback_to(
 	to,
@@ -304,6 +341,7 @@ public:
 
       unindex();
       pg_log_t::clear();
+      count_entries();
       rollback_info_trimmed_to_riter = log.rbegin();
       reset_recovery_pointers();
     }
@@ -472,7 +510,7 @@ public:
 	for (auto i = log.begin(); i != log.end(); ++i) {
 	  if (to_index & PGLOG_INDEXED_OBJECTS) {
 	    if (i->object_is_indexed()) {
-	      objects[i->soid] = const_cast<pg_log_entry_t*>(&(*i));
+	      index_object(*i);
 	    }
 	  }
 
@@ -494,6 +532,21 @@ public:
       }
 
       indexed_data |= to_index;
+      count_entries();
+    }
+
+    /// make e the latest entry of its object
+    void index_object(const pg_log_entry_t& e) const {
+      auto p = objects.find(e.soid);
+      if (p == objects.end()) {
+	objects.emplace(e.soid, const_cast<pg_log_entry_t*>(&e));
+      } else {
+	// the current key may belong to an entry that is trimmed before e
+	auto node = objects.extract(p);
+	node.key() = e.soid;
+	node.mapped() = const_cast<pg_log_entry_t*>(&e);
+	objects.insert(std::move(node));
+      }
     }
 
     void index_objects() const {
@@ -514,9 +567,9 @@ public:
 
     void index(pg_log_entry_t& e) {
       if ((indexed_data & PGLOG_INDEXED_OBJECTS) && e.object_is_indexed()) {
-        if (objects.count(e.soid) == 0 ||
-            objects[e.soid]->version < e.version)
-          objects[e.soid] = &e;
+	auto p = objects.find(e.soid);
+	if (p == objects.end() || p->second->version < e.version)
+	  index_object(e);
       }
       if (indexed_data & PGLOG_INDEXED_CALLER_OPS) {
 	// divergent merge_log indexes new before unindexing old
@@ -598,6 +651,8 @@ public:
 
       // add to log
       log.push_back(e);
+      ++num_entries;
+      ++counted_entries;
 
       // riter previously pointed to the previous entry
       if (rollback_info_trimmed_to_riter == log.rbegin())
@@ -609,7 +664,7 @@ public:
 
       // to our index
       if ((indexed_data & PGLOG_INDEXED_OBJECTS) && e.object_is_indexed()) {
-        objects[e.soid] = &(log.back());
+	index_object(log.back());
       }
       if (indexed_data & PGLOG_INDEXED_CALLER_OPS) {
         if (e.reqid_is_indexed()) {
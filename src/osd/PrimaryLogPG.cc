@@ -1969,6 +1969,66 @@ void PrimaryLogPG::do_request(
  * pg lock will be held (if multithreaded)
  * osd_lock NOT held.
  */
+/*
+ * Load the object contexts of the client ops queued on this pg before
+ * they run, fetching the metadata of all their cold objects from the
+ * store in one batch rather than with one lookup per op.  Objects do_op()
+ * wouldn't read locally right away (missing, misdirected, ...) are left
+ * alone; their ops take the usual path.
+ */
+void PrimaryLogPG::prefetch_object_contexts(const vector<OpRequestRef>& ops)
+{
+  if (!is_primary() || !is_active()) {
+    return;
+  }
+  const unsigned max = cct->_conf->osd_op_prefetch_max_objects;
+  const unsigned split_bits =
+    info.pgid.pgid.get_split_bits(pool.info.get_pg_num());
+  vector<hobject_t> heads;
+  for (auto& op : ops) {
+    if (heads.size() >= max) {
+      break;
+    }
+    MOSDOp *m = static_cast<MOSDOp*>(op->get_nonconst_req());
+    if (m->get_type() != CEPH_MSG_OSD_OP) {
+      continue;
+    }
+    if (m->finish_decode()) {
+      op->reset_desc();   // for TrackedOp
+      m->clear_payload();
+    }
+    if (m->get_hobj().oid.name.empty()) {
+      continue;  // pg op
+    }
+    const hobject_t head = m->get_hobj().get_head();
+    if (head.pool != (int64_t)info.pgid.pool() ||
+	!info.pgid.pgid.contains(split_bits, head) ||
+	osd->store->validate_hobject_key(head) ||
+	is_unreadable_object(head) ||
+	std::find(heads.begin(), heads.end(), head) != heads.end() ||
+	object_contexts.lookup(head)) {
+      continue;
+    }
+    heads.push_back(head);
+  }
+  if (heads.size() < 2) {
+    return;  // nothing to batch
+  }
+
+  dout(20) << __func__ << " " << heads << dendl;
+  pgbackend->objects_prefetch(heads);
+  for (auto& head : heads) {
+    map<string, bufferlist, less<>> attrs;
+    if (pgbackend->objects_get_attrs(head, &attrs) < 0 ||
+	!attrs.count(OI_ATTR)) {
+      continue;  // doesn't exist (yet)
+    }
+    if (get_object_context(head, false, &attrs)) {
+      osd->logger->inc(l_osd_object_ctx_prefetch);
+    }
+  }
+}
+
 void PrimaryLogPG::do_op(OpRequestRef& op)
 {
   FUNCTRACE(cct);
@@ -7736,27 +7796,35 @@ int PrimaryLogPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	bool truncated = false;
 	bufferlist bl;
 	if (oi.is_omap()) {
-	  ObjectMap::ObjectMapIterator iter = osd->store->get_omap_iterator(
-	    ch, ghobject_t(soid)
-	    );
-          if (!iter) {
-            result = -ENOENT;
-            goto fail;
-          }
-	  iter->upper_bound(start_after);
-	  if (filter_prefix > start_after) iter->lower_bound(filter_prefix);
-	  for (num = 0;
-	       iter->valid() &&
-		 iter->key().substr(0, filter_prefix.size()) == filter_prefix;
-	       ++num, iter->next()) {
-	    dout(20) << "Found key " << iter->key() << dendl;
-	    if (num >= max_return ||
-		bl.length() >= cct->_conf->osd_max_omap_bytes_per_request) {
-	      truncated = true;
-	      break;
-	    }
-	    encode(iter->key(), bl);
-	    encode(iter->value(), bl);
+	  ObjectStore::omap_iter_seek_t start_from;
+	  if (filter_prefix > start_after) {
+	    start_from.seek_position = filter_prefix;
+	    start_from.seek_type = ObjectStore::omap_iter_seek_t::LOWER_BOUND;
+	  } else {
+	    start_from.seek_position = start_after;
+	    start_from.seek_type = ObjectStore::omap_iter_seek_t::UPPER_BOUND;
+	  }
+	  // encode straight from the store's buffers into the reply
+	  const uint64_t max_bytes = cct->_conf->osd_max_omap_bytes_per_request;
+	  int r = osd->store->omap_iterate(
+	    ch, ghobject_t(soid), start_from,
+	    [&] (std::string_view key, std::string_view value) {
+	      if (key.substr(0, filter_prefix.size()) != filter_prefix) {
+		return ObjectStore::omap_iter_ret_t::STOP;
+	      }
+	      dout(20) << "Found key " << key << dendl;
+	      if (num >= max_return || bl.length() >= max_bytes) {
+		truncated = true;
+		return ObjectStore::omap_iter_ret_t::STOP;
+	      }
+	      encode(key, bl);
+	      encode(value, bl);
+	      ++num;
+	      return ObjectStore::omap_iter_ret_t::NEXT;
+	    });
+	  if (r < 0) {
+	    result = r;
+	    goto fail;
 	  }
 	} // else return empty out_set
 	encode(num, osd_op.outdata);
@@ -14332,6 +14400,7 @@ void PrimaryLogPG::scan_range(
   ceph_assert(r >= 0);
   dout(10) << " got " << ls.size() << " items, next " << bi->end << dendl;
   dout(20) << ls << dendl;
+  pgbackend->objects_prefetch(ls);
 
   for (vector<hobject_t>::iterator p = ls.begin(); p != ls.end(); ++p) {
     handle.reset_tp_timeout();
@@ -302,6 +302,9 @@ PerfCounters *build_osd_logger(CephContext *cct) {
     l_osd_object_ctx_cache_hit, "object_ctx_cache_hit", "Object context cache hits");
   osd_plb.add_u64_counter(
     l_osd_object_ctx_cache_total, "object_ctx_cache_total", "Object context cache lookups");
+  osd_plb.add_u64_counter(
+    l_osd_object_ctx_prefetch, "object_ctx_prefetch",
+    "Object contexts loaded ahead of their queued ops");
 
   osd_plb.add_u64_counter(l_osd_op_cache_hit, "op_cache_hit");
   osd_plb.add_time_avg(
@@ -319,6 +322,22 @@ PerfCounters *build_osd_logger(CephContext *cct) {
   osd_plb.add_u64_counter(
     l_osd_pg_biginfo, "osd_pg_biginfo", "PG updated its biginfo attr");
 
+  osd_plb.add_u64_counter(
+    l_osd_op_shard_steals, "op_shard_steals",
+    "Ops processed by a thread of another op shard");
+  osd_plb.add_u64(
+    l_osd_op_shard_queue_max, "op_shard_queue_max",
+    "Ops queued on the busiest op shard");
+
+  osd_plb.add_u64(
+    l_osd_pglog_entries, "pglog_entries", "PG log entries held in memory");
+  osd_plb.add_u64(
+    l_osd_pglog_dups, "pglog_dups", "PG log dups held in memory");
+  osd_plb.add_u64(
+    l_osd_pglog_bytes_per_entry, "pglog_bytes_per_entry",
+    "osd_pglog mempool bytes, less the dups, per in-memory PG log entry",
+    NULL, PerfCountersBuilder::PRIO_USEFUL, unit_t(UNIT_BYTES));
+
   /// scrub's replicas reservation time/#replicas histogram
   PerfHistogramCommon::axis_config_d rsrv_hist_x_axis_config{
       "number of replicas",
@@ -122,6 +122,7 @@ enum {
 
   l_osd_object_ctx_cache_hit,
   l_osd_object_ctx_cache_total,
+  l_osd_object_ctx_prefetch,
 
   l_osd_op_cache_hit,
   l_osd_tier_flush_lat,
@@ -132,6 +133,13 @@ enum {
   l_osd_pg_fastinfo,
   l_osd_pg_biginfo,
 
+  l_osd_op_shard_steals,
+  l_osd_op_shard_queue_max,
+
+  l_osd_pglog_entries,
+  l_osd_pglog_dups,
+  l_osd_pglog_bytes_per_entry,
+
   // scrubber related. Here, as the rest of the scrub counters
   // are labeled, and histograms do not fully support labels.
   l_osd_scrub_reservation_dur_hist,
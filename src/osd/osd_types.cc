@@ -4710,10 +4710,10 @@ void ObjectCleanRegions::set_max_num_intervals(uint32_t num)
 void ObjectCleanRegions::trim()
 {
   while(clean_offsets.num_intervals() > max_num_intervals) {
-    typename interval_set<uint64_t>::iterator shortest_interval = clean_offsets.begin();
+    offsets_t::iterator shortest_interval = clean_offsets.begin();
     if (shortest_interval == clean_offsets.end())
       break;
-    for (typename interval_set<uint64_t>::iterator it = clean_offsets.begin();
+    for (offsets_t::iterator it = clean_offsets.begin();
         it != clean_offsets.end();
         ++it) {
       if (it.get_len() < shortest_interval.get_len())
@@ -4732,7 +4732,7 @@ void ObjectCleanRegions::merge(const ObjectCleanRegions &other)
 
 void ObjectCleanRegions::mark_data_region_dirty(uint64_t offset, uint64_t len)
 {
-  interval_set<uint64_t> clean_region;
+  offsets_t clean_region;
   clean_region.insert(0, (uint64_t)-1);
   clean_region.erase(offset, len);
   clean_offsets.intersection_of(clean_region);
@@ -4765,7 +4765,9 @@ interval_set<uint64_t> ObjectCleanRegions::get_dirty_regions() const
 {
    interval_set<uint64_t> dirty_region;
    dirty_region.insert(0, (uint64_t)-1);
-   dirty_region.subtract(clean_offsets);
+   for (const auto& [start, len] : clean_offsets) {
+     dirty_region.erase(start, len);
+   }
    return dirty_region;
 }
 
@@ -4116,9 +4116,14 @@ WRITE_CLASS_ENCODER(ObjectModDesc)
 
 class ObjectCleanRegions {
 private:
+  // every pg log entry carries one of these, usually holding a single
+  // interval, so keep it in a flat map charged to the pglog mempool
+  // rather than in a tree node of its own
+  using offsets_t = interval_set<uint64_t, mempool::osd_pglog::flat_map>;
+
   bool new_object;
   bool clean_omap;
-  interval_set<uint64_t> clean_offsets;
+  offsets_t clean_offsets;
   static std::atomic<uint32_t> max_num_intervals;
 
   /**
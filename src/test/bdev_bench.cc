@@ -0,0 +1,194 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Measures how random I/O throughput of a BlockDevice scales with the
+ * number of submitting threads, each thread standing in for an OSD shard.
+ * Works with any backend BlockDevice::create() picks for the path, e.g. an
+ * spdk: device (backed by a real or emulated NVMe controller) or a plain
+ * file for the kernel device.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "blk/BlockDevice.h"
+
+#include "global/global_context.h"
+#include "global/global_init.h"
+
+#include "common/ceph_argparse.h"
+#include "common/debug.h"
+#include "common/errno.h"
+#include "common/strtol.h"
+
+#define dout_context g_ceph_context
+#define dout_subsys ceph_subsys_bdev
+
+using namespace std;
+
+static void usage()
+{
+  cout << "usage: ceph_bdev_bench [flags]\n"
+      "	 --path\n"
+      "	       device or file to run against (default bdev_bench.block)\n"
+      "	 --size\n"
+      "	       size of the file to create if path doesn't exist\n"
+      "	 --block-size\n"
+      "	       size of each I/O\n"
+      "	 --iodepth\n"
+      "	       I/Os submitted at once by each thread\n"
+      "	 --ops\n"
+      "	       number of I/Os per thread\n"
+      "	 --max-threads\n"
+      "	       run with 1, 2, 4, ... up to this many threads\n"
+      "	 --write\n"
+      "	       issue writes instead of reads\n" << std::endl;
+  generic_server_usage();
+}
+
+struct Config {
+  string path = "bdev_bench.block";
+  uint64_t size = 1ull << 30;
+  uint64_t block_size = 4096;
+  unsigned iodepth = 32;
+  uint64_t ops = 100000;
+  unsigned max_threads = 8;
+  bool write = false;
+};
+
+static void bench_worker(BlockDevice *bdev, const Config &cfg, unsigned seed)
+{
+  std::mt19937_64 rng(seed);
+  uint64_t blocks = bdev->get_size() / cfg.block_size;
+  bufferlist data;
+  data.append(buffer::create_small_page_aligned(cfg.block_size));
+  data.zero();
+
+  uint64_t done = 0;
+  while (done < cfg.ops) {
+    IOContext ioc(g_ceph_context, nullptr);
+    vector<bufferlist> out(cfg.iodepth);
+    unsigned n = std::min<uint64_t>(cfg.iodepth, cfg.ops - done);
+    for (unsigned i = 0; i < n; ++i) {
+      uint64_t off = (rng() % blocks) * cfg.block_size;
+      int r;
+      if (cfg.write) {
+	bufferlist bl = data;
+	r = bdev->aio_write(off, bl, &ioc, false);
+      } else {
+	r = bdev->aio_read(off, cfg.block_size, &out[i], &ioc);
+      }
+      ceph_assert(r == 0);
+    }
+    if (ioc.has_pending_aios()) {
+      bdev->aio_submit(&ioc);
+      ioc.aio_wait();
+    }
+    done += n;
+  }
+}
+
+int main(int argc, const char *argv[])
+{
+  auto args = argv_to_vec(argc, argv);
+  if (ceph_argparse_need_usage(args)) {
+    usage();
+    exit(0);
+  }
+
+  auto cct = global_init(nullptr, args, CEPH_ENTITY_TYPE_OSD,
+			 CODE_ENVIRONMENT_UTILITY,
+			 CINIT_FLAG_NO_DEFAULT_CONFIG_FILE);
+
+  Config cfg;
+  std::string val;
+  vector<const char*>::iterator i = args.begin();
+  while (i != args.end()) {
+    if (ceph_argparse_double_dash(args, i))
+      break;
+
+    std::string err;
+    if (ceph_argparse_witharg(args, i, &val, "--path", (char*)nullptr)) {
+      cfg.path = val;
+    } else if (ceph_argparse_witharg(args, i, &val, "--size", (char*)nullptr)) {
+      cfg.size = strict_iecstrtoll(val, &err);
+    } else if (ceph_argparse_witharg(args, i, &val, "--block-size", (char*)nullptr)) {
+      cfg.block_size = strict_iecstrtoll(val, &err);
+    } else if (ceph_argparse_witharg(args, i, &val, "--iodepth", (char*)nullptr)) {
+      cfg.iodepth = strict_strtol(val.c_str(), 10, &err);
+    } else if (ceph_argparse_witharg(args, i, &val, "--ops", (char*)nullptr)) {
+      cfg.ops = strict_strtoll(val.c_str(), 10, &err);
+    } else if (ceph_argparse_witharg(args, i, &val, "--max-threads", (char*)nullptr)) {
+      cfg.max_threads = strict_strtol(val.c_str(), 10, &err);
+    } else if (ceph_argparse_flag(args, i, "--write", (char*)nullptr)) {
+      cfg.write = true;
+    } else {
+      derr << "Error: can't understand argument: " << *i << "\n" << dendl;
+      exit(1);
+    }
+    if (!err.empty()) {
+      derr << "error parsing argument: " << err << dendl;
+      exit(1);
+    }
+  }
+  if (!cfg.block_size || !cfg.iodepth || !cfg.max_threads) {
+    derr << "block-size, iodepth and max-threads must be positive" << dendl;
+    exit(1);
+  }
+
+  common_init_finish(g_ceph_context);
+
+  // file backed stand-in for a real device
+  if (::access(cfg.path.c_str(), F_OK) != 0) {
+    int fd = ::open(cfg.path.c_str(), O_CREAT|O_RDWR, 0644);
+    if (fd < 0 || ::ftruncate(fd, cfg.size) < 0) {
+      derr << "failed to create " << cfg.path << dendl;
+      return 1;
+    }
+    ::close(fd);
+  }
+
+  std::unique_ptr<BlockDevice> bdev(
+    BlockDevice::create(g_ceph_context, cfg.path, nullptr, nullptr,
+			[](void* handle, void* aio) {}, nullptr));
+  int r = bdev->open(cfg.path);
+  if (r < 0) {
+    derr << "failed to open " << cfg.path << ": " << cpp_strerror(r) << dendl;
+    return 1;
+  }
+  cout << "device " << cfg.path << " size " << bdev->get_size()
+       << " block-size " << cfg.block_size << " iodepth " << cfg.iodepth
+       << (cfg.write ? " write" : " read") << std::endl;
+
+  using namespace std::chrono;
+  double base_iops = 0;
+  for (unsigned threads = 1; threads <= cfg.max_threads; threads *= 2) {
+    std::vector<std::thread> workers;
+    auto t1 = steady_clock::now();
+    for (unsigned t = 0; t < threads; t++) {
+      workers.emplace_back(bench_worker, bdev.get(), std::cref(cfg), t + 1);
+    }
+    for (auto &worker : workers)
+      worker.join();
+    auto us = duration_cast<microseconds>(steady_clock::now() - t1).count();
+    double iops = 1000000.0 * cfg.ops * threads / std::max<int64_t>(us, 1);
+    if (threads == 1) {
+      base_iops = iops;
+    }
+    cout << "threads " << threads
+	 << " iops " << (uint64_t)iops
+	 << " per-thread " << (uint64_t)(iops / threads)
+	 << " scaling " << iops / base_iops << std::endl;
+  }
+
+  bdev->close();
+  return 0;
+}
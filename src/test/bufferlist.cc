@@ -2580,6 +2580,29 @@ TEST(BufferList, crc32c_zeros) {
   }
 }
 
+TEST(BufferList, set_crc32c) {
+  bufferptr p(buffer::create_page_aligned(16384));
+  for (unsigned i = 0; i < p.length(); ++i) {
+    p.c_str()[i] = rand();
+  }
+  uint32_t expected = ceph_crc32c(-1, (unsigned char*)p.c_str(), p.length());
+  // combine crcs of 4k chunks like BlueStore does with its csums
+  uint32_t crc = -1;
+  for (unsigned off = 0; off < p.length(); off += 4096) {
+    uint32_t chunk = ceph_crc32c(-1, (unsigned char*)p.c_str() + off, 4096);
+    crc = chunk ^ ceph_crc32c(~crc, NULL, 4096);
+  }
+  ASSERT_EQ(expected, crc);
+
+  bufferlist bl;
+  bl.append(p);
+  p.set_crc32c(-1, crc);
+  buffer::track_cached_crc(true);
+  int base_cached = buffer::get_cached_crc();
+  ASSERT_EQ(expected, bl.crc32c(-1));
+  ASSERT_EQ(base_cached + 1, buffer::get_cached_crc());
+}
+
 TEST(BufferList, crc32c_append_perf) {
   int len = 256 * 1024 * 1024;
   bufferptr a(len);
@@ -368,6 +368,59 @@ TEST_F(IsaErasureCodeTest, encode)
   }
 }
 
+TEST_F(IsaErasureCodeTest, apply_delta)
+{
+  for (auto technique : { ErasureCodeIsaDefault::kVandermonde,
+                          ErasureCodeIsaDefault::kCauchy }) {
+    for (auto m : { "1", "2", "3" }) {
+      ErasureCodeIsaDefault Isa(tcache, technique);
+      ErasureCodeProfile profile;
+      profile["k"] = "4";
+      profile["m"] = m;
+      ASSERT_EQ(0, Isa.init(profile, &cerr));
+      EXPECT_TRUE(Isa.get_supported_optimizations() &
+                  ErasureCodeInterface::FLAG_EC_PLUGIN_PARITY_DELTA_OPTIMIZATION);
+
+      unsigned object_size = Isa.get_alignment() * 16;
+      unsigned length = Isa.get_chunk_size(object_size);
+      string payload;
+      for (unsigned i = 0; i < object_size; i++)
+        payload.push_back('A' + i % 26);
+      string updated = payload;
+      for (unsigned i = 0; i < length; i++) {
+        updated[i] = 'a' + i % 7;
+        updated[2 * length + i] = '0' + i % 10;
+      }
+
+      set<int> want_to_encode;
+      for (unsigned i = 0; i < Isa.get_chunk_count(); i++)
+        want_to_encode.insert(i);
+      map<int,bufferlist> encoded;
+      map<int,bufferlist> expected;
+      {
+        bufferlist in;
+        in.append(payload);
+        EXPECT_EQ(0, Isa.encode(want_to_encode, in, &encoded));
+      }
+      {
+        bufferlist in;
+        in.append(updated);
+        EXPECT_EQ(0, Isa.encode(want_to_encode, in, &expected));
+      }
+
+      map<int,bufferlist> deltas;
+      EXPECT_EQ(0, Isa.encode_delta(encoded[0], expected[0], &deltas[0]));
+      EXPECT_EQ(0, Isa.encode_delta(encoded[2], expected[2], &deltas[2]));
+      map<int,bufferlist> parity;
+      for (unsigned i = 4; i < Isa.get_chunk_count(); i++)
+        parity[i] = encoded[i];
+      EXPECT_EQ(0, Isa.apply_delta(deltas, &parity));
+      for (unsigned i = 4; i < Isa.get_chunk_count(); i++)
+        EXPECT_TRUE(parity[i].contents_equal(expected[i]));
+    }
+  }
+}
+
 TEST_F(IsaErasureCodeTest, sanity_check_k)
 {
   ErasureCodeIsaDefault Isa(tcache);
@@ -228,6 +228,65 @@ TYPED_TEST(ErasureCodeTest, minimum_to_decode)
   }
 }
 
+TYPED_TEST(ErasureCodeTest, apply_delta)
+{
+  TypeParam jerasure;
+  ErasureCodeProfile profile;
+  profile["k"] = "4";
+  profile["m"] = "2";
+  profile["packetsize"] = "8";
+  ASSERT_EQ(0, jerasure.init(profile, &cerr));
+
+  unsigned object_size = jerasure.get_alignment() * 4;
+  unsigned length = jerasure.get_chunk_size(object_size);
+  string payload;
+  for (unsigned i = 0; i < object_size; i++)
+    payload.push_back('A' + i % 26);
+  string updated = payload;
+  for (unsigned i = length + 3; i < 2 * length - 5; i++)
+    updated[i] = 'a' + i % 7;
+
+  set<int> want_to_encode = { 0, 1, 2, 3, 4, 5 };
+  map<int,bufferlist> encoded;
+  map<int,bufferlist> expected;
+  {
+    bufferlist in;
+    in.append(payload);
+    EXPECT_EQ(0, jerasure.encode(want_to_encode, in, &encoded));
+  }
+  {
+    bufferlist in;
+    in.append(updated);
+    EXPECT_EQ(0, jerasure.encode(want_to_encode, in, &expected));
+  }
+
+  bufferlist delta;
+  EXPECT_EQ(0, jerasure.encode_delta(encoded[1], expected[1], &delta));
+  EXPECT_EQ(length, delta.length());
+  map<int,bufferlist> deltas = { { 1, delta } };
+
+  // all coding chunks
+  {
+    map<int,bufferlist> parity = { { 4, encoded[4] }, { 5, encoded[5] } };
+    EXPECT_EQ(0, jerasure.apply_delta(deltas, &parity));
+    EXPECT_TRUE(parity[4].contents_equal(expected[4]));
+    EXPECT_TRUE(parity[5].contents_equal(expected[5]));
+  }
+  // a subset of the coding chunks
+  {
+    map<int,bufferlist> parity = { { 5, encoded[5] } };
+    EXPECT_EQ(0, jerasure.apply_delta(deltas, &parity));
+    EXPECT_EQ(1u, parity.size());
+    EXPECT_TRUE(parity[5].contents_equal(expected[5]));
+  }
+  // deltas must be for data chunks
+  {
+    map<int,bufferlist> parity = { { 4, encoded[4] } };
+    EXPECT_EQ(-EINVAL, jerasure.apply_delta({ { 4, delta } }, &parity));
+    EXPECT_TRUE(parity[4].contents_equal(encoded[4]));
+  }
+}
+
 TEST(ErasureCodeTest, encode)
 {
   ErasureCodeJerasureReedSolomonVandermonde jerasure;
@@ -59,7 +59,8 @@ int ErasureCodeBench::setup(int argc, char** argv) {
     ("plugin,p", po::value<string>()->default_value("jerasure"),
      "erasure code plugin name")
     ("workload,w", po::value<string>()->default_value("encode"),
-     "run either encode or decode")
+     "run encode, decode or delta (update the coding chunks after"
+     " overwriting the first data chunk)")
     ("erasures,e", po::value<int>()->default_value(1),
      "number of erasures when decoding")
     ("erased", po::value<vector<int> >(),
@@ -158,6 +159,8 @@ int ErasureCodeBench::run() {
 
   if (workload == "encode")
     return encode();
+  else if (workload == "delta")
+    return delta();
   else
     return decode();
 }
@@ -194,6 +197,67 @@ int ErasureCodeBench::encode()
   return 0;
 }
 
+int ErasureCodeBench::delta()
+{
+  ErasureCodePluginRegistry &instance = ErasureCodePluginRegistry::instance();
+  ErasureCodeInterfaceRef erasure_code;
+  stringstream messages;
+  int code = instance.factory(plugin,
+			      g_conf().get_val<std::string>("erasure_code_dir"),
+			      profile, &erasure_code, &messages);
+  if (code) {
+    cerr << messages.str() << endl;
+    return code;
+  }
+  if (!(erasure_code->get_supported_optimizations() &
+	ErasureCodeInterface::FLAG_EC_PLUGIN_PARITY_DELTA_OPTIMIZATION)) {
+    cerr << "plugin " << plugin << " does not support parity delta updates"
+	 << endl;
+    return -EOPNOTSUPP;
+  }
+
+  bufferlist in;
+  in.append(string(in_size, 'X'));
+  in.rebuild_aligned(ErasureCode::SIMD_ALIGN);
+  set<int> want_to_encode;
+  for (int i = 0; i < k + m; i++) {
+    want_to_encode.insert(i);
+  }
+  map<int,bufferlist> encoded;
+  code = erasure_code->encode(want_to_encode, in, &encoded);
+  if (code)
+    return code;
+
+  const vector<int> &mapping = erasure_code->get_chunk_mapping();
+  auto chunk_index = [&mapping](int i) {
+    return (int)mapping.size() > i ? mapping[i] : i;
+  };
+  bufferlist &old_data = encoded[chunk_index(0)];
+  bufferlist new_data;
+  new_data.append(string(old_data.length(), 'Y'));
+  new_data.rebuild_aligned(ErasureCode::SIMD_ALIGN);
+  map<int,bufferlist> parity;
+  for (int i = k; i < k + m; i++) {
+    parity[chunk_index(i)] = encoded[chunk_index(i)];
+  }
+
+  utime_t begin_time = ceph_clock_now();
+  for (int i = 0; i < max_iterations; i++) {
+    map<int,bufferlist> deltas;
+    code = erasure_code->encode_delta(old_data, new_data,
+				      &deltas[chunk_index(0)]);
+    if (code)
+      return code;
+    code = erasure_code->apply_delta(deltas, &parity);
+    if (code)
+      return code;
+  }
+  utime_t end_time = ceph_clock_now();
+  cout << (end_time - begin_time) << "\t"
+       << (max_iterations * (old_data.length() / 1024)) << endl;
+  return 0;
+}
+
 static void display_chunks(const map<int,bufferlist> &chunks,
 			   unsigned int chunk_count) {
   cout << "chunks ";
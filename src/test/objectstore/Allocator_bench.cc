@@ -328,6 +328,67 @@ TEST_P(AllocTest, test_alloc_bench_10_300)
   doOverwriteTest(capacity, prefill, overwrite);
 }
 
+// allocate/release throughput on a device fragmented up front
+TEST_P(AllocTest, test_alloc_bench_fragmented)
+{
+  uint64_t capacity = uint64_t(16) * 1024 * 1024 * 1024;
+  uint64_t alloc_unit = 4096;
+  const uint64_t units = capacity / alloc_unit;
+
+  struct profile_t {
+    const char* name;
+    // returns the length (in units) of the used run starting at unit u
+    std::function<uint64_t(gen_type&, uint64_t)> used_run;
+    uint64_t free_run;
+  };
+  const profile_t profiles[] = {
+    {"checkerboard", [](gen_type&, uint64_t) { return 1; }, 1},
+    {"sparse", [](gen_type&, uint64_t) { return 15; }, 1},
+    {"random", [](gen_type& rng, uint64_t) {
+      return boost::uniform_int<>(1, 64)(rng); }, 4},
+  };
+  for (auto& p : profiles) {
+    init_alloc(capacity, alloc_unit);
+    alloc->init_add_free(0, capacity);
+    gen_type rng(0);
+    for (uint64_t u = 0; u < units; ) {
+      uint64_t used = std::min(p.used_run(rng, u), units - u);
+      alloc->init_rm_free(u * alloc_unit, used * alloc_unit);
+      u += used + p.free_run;
+    }
+
+    boost::uniform_int<> u1(0, 4); // 4K-64K
+    const size_t ops = 100000;
+    std::vector<PExtentVector> allocated;
+    allocated.reserve(ops);
+    utime_t start = ceph_clock_now();
+    for (size_t i = 0; i < ops; ++i) {
+      PExtentVector tmp;
+      uint64_t want = alloc_unit << u1(rng);
+      auto r = alloc->allocate(want, alloc_unit, 0, 0, &tmp);
+      if (r < 0 || uint64_t(r) < want) {
+	break;
+      }
+      allocated.emplace_back(std::move(tmp));
+    }
+    utime_t alloc_time = ceph_clock_now() - start;
+    size_t done = allocated.size();
+    start = ceph_clock_now();
+    for (auto& a : allocated) {
+      alloc->release(a);
+    }
+    utime_t release_time = ceph_clock_now() - start;
+    std::cout << p.name << ": fragmentation " << alloc->get_fragmentation()
+	      << ", " << done << " allocations in " << alloc_time
+	      << " (" << done / std::max((double)alloc_time, 1e-9) << "/s), "
+	      << "releases in " << release_time
+	      << " (" << done / std::max((double)release_time, 1e-9) << "/s)"
+	      << std::endl;
+    EXPECT_GT(done, 0u);
+    init_close();
+  }
+}
+
 TEST_P(AllocTest, mempoolAccounting)
 {
   uint64_t bytes = mempool::bluestore_alloc::allocated_bytes();
@@ -365,4 +426,5 @@ TEST_P(AllocTest, mempoolAccounting)
 INSTANTIATE_TEST_SUITE_P(
   Allocator,
   AllocTest,
-  ::testing::Values("stupid", "bitmap", "avl", "hybrid", "btree"));
+  ::testing::Values("stupid", "bitmap", "avl", "hybrid", "btree",
+                    "segregated"));
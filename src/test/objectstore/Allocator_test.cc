@@ -652,7 +652,59 @@ TEST_P(AllocTest, test_init_rm_free_unbound)
   }
 }
 
+TEST_P(AllocTest, test_alloc_segregated_fit)
+{
+  if (string(GetParam()) != "segregated")
+    return;
+
+  int64_t block_size = 0x1000;
+  int64_t capacity = 1ull << 30;
+  init_alloc(capacity, block_size);
+
+  alloc->init_add_free(0, 0x10000);
+  alloc->init_add_free(0x100000, 0x1000000);
+  alloc->init_add_free(0x2000000, 0x8000);
+
+  // requests are served from the smallest class that fits,
+  // large extent stays intact
+  PExtentVector extents;
+  EXPECT_EQ(0x8000, alloc->allocate(0x8000, block_size, 0, 0, &extents));
+  ASSERT_EQ(1u, extents.size());
+  EXPECT_EQ(0x2000000u, extents[0].offset);
+  extents.clear();
+  EXPECT_EQ(0x10000, alloc->allocate(0x10000, block_size, 0, 0, &extents));
+  ASSERT_EQ(1u, extents.size());
+  EXPECT_EQ(0u, extents[0].offset);
+  extents.clear();
+  EXPECT_EQ(0x20000, alloc->allocate(0x20000, block_size, 0, 0, &extents));
+  ASSERT_EQ(1u, extents.size());
+  EXPECT_EQ(0x100000u, extents[0].offset);
+  alloc->release(extents);
+  EXPECT_EQ(0x1000000u, alloc->get_free());
+  init_close();
+
+  // above the defrag threshold smaller holes are consumed whole first
+  g_ceph_context->_conf.set_val(
+    "bluestore_segregated_alloc_defrag_threshold", "0.0001");
+  init_alloc(capacity, block_size);
+  alloc->init_add_free(0, 0x10000);
+  alloc->init_add_free(0x100000, 0x1000000);
+  alloc->init_add_free(0x2000000, 0x8000);
+  extents.clear();
+  EXPECT_EQ(0x20000, alloc->allocate(0x20000, block_size, 0, 0, &extents));
+  ASSERT_EQ(3u, extents.size());
+  EXPECT_EQ(0u, extents[0].offset);
+  EXPECT_EQ(0x10000u, extents[0].length);
+  EXPECT_EQ(0x2000000u, extents[1].offset);
+  EXPECT_EQ(0x8000u, extents[1].length);
+  EXPECT_EQ(0x100000u, extents[2].offset);
+  EXPECT_EQ(0x8000u, extents[2].length);
+  g_ceph_context->_conf.set_val(
+    "bluestore_segregated_alloc_defrag_threshold", "0");
+}
+
 INSTANTIATE_TEST_SUITE_P(
   Allocator,
   AllocTest,
-  ::testing::Values("stupid", "bitmap", "avl", "hybrid", "btree"));
+  ::testing::Values("stupid", "bitmap", "avl", "hybrid", "btree",
+                    "segregated"));
@@ -19,8 +19,12 @@
 
 using namespace std;
 
+// allocator type to use instead of the one recorded in the free dump,
+// allows to compare allocators against the same free space layout
+static string alloc_type_override;
+
 void usage(const string &name) {
-  cerr << "Usage: " << name << " <log_to_replay|free-dump> "
+  cerr << "Usage: " << name << " [--alloc-type <type>] <log_to_replay|free-dump> "
        << " raw_duplicates|"
           "duplicates|"
           "free_dump|"
@@ -37,6 +41,7 @@ void usage_replay_alloc(const string &name) {
   cerr << "The number of replays defaults to 1." << std::endl;
   cerr << "The \"alloc_list_file\" parameter should be a file with allocation requests, one per line." << std::endl;
   cerr << "Allocation request format (space separated, optional parameters are 0 if not given): want unit [max] [hint]" << std::endl;
+  cerr << "Use \"--alloc-type <type>\" to replay against a different allocator than the dumped one." << std::endl;
 }
 
 struct binary_alloc_map_t {
@@ -244,6 +249,9 @@ int replay_and_check_for_duplicate(char* fname)
 	std::cerr << "error: invalid init: " << s << std::endl;
       return -1;
       }
+      if (!alloc_type_override.empty()) {
+	alloc_type = alloc_type_override;
+      }
       alloc.reset(Allocator::create(g_ceph_context, alloc_type, total,
 				    alloc_unit));
       owned_by_app.insert(0, total);
@@ -314,6 +322,11 @@ int replay_free_dump_and_apply_raw(
   }
   std::cout << "parsing completed!" << std::endl;
 
+  if (!alloc_type_override.empty()) {
+    std::cout << "overriding allocator type " << alloc_type
+              << " with " << alloc_type_override << std::endl;
+    alloc_type = alloc_type_override;
+  }
   create(alloc_type, capacity, alloc_unit, alloc_name);
   int r = 0;
   if (fd < 0) {
@@ -536,6 +549,17 @@ int check_duplicates(char* fname)
 
 int main(int argc, char **argv)
 {
+  // strip "--alloc-type <type>" to keep positional arguments intact
+  for (int i = 1; i < argc - 1; ++i) {
+    if (strcmp(argv[i], "--alloc-type") == 0) {
+      alloc_type_override = argv[i + 1];
+      for (int j = i + 2; j <= argc; ++j) {
+        argv[j - 2] = argv[j];
+      }
+      argc -= 2;
+      break;
+    }
+  }
   auto args = argv_to_vec(argc, argv);
   auto cct = global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT,
 			 CODE_ENVIRONMENT_UTILITY,
@@ -677,6 +701,9 @@ int main(int argc, char **argv)
           if (argc == 5) {
             replay_count = atoi(argv[4]);
           }
+          uint64_t total_requests = 0;
+          uint64_t total_fragments = 0;
+          ceph::timespan total_duration = ceph::timespan::zero();
 
           for (auto i = 0; i < replay_count; ++i) {
             while (fgets(s, sizeof(s), f_alloc_list) != nullptr) {
@@ -716,8 +743,13 @@ int main(int argc, char **argv)
                 return -1;
               }
 
+              auto duration = ceph::mono_clock::now() - t0;
+              ++total_requests;
+              total_fragments += extents.size();
+              total_duration += duration;
+
               /* Outputs the allocation's duration in nanoseconds and the allocation request parameters */
-              std::cout << "Duration (ns): " << (ceph::mono_clock::now() - t0).count()
+              std::cout << "Duration (ns): " << duration.count()
                         << " want/unit/max/hint (hex): " << std::hex
                         << want << "/" << unit << "/" << max << "/" << hint
                         << std::dec << " res fragments " << extents.size()
@@ -730,6 +762,11 @@ int main(int argc, char **argv)
             fseek(f_alloc_list, 0, SEEK_SET);
           }
           fclose(f_alloc_list);
+          std::cout << "Allocator: " << a->get_type()
+                    << " requests: " << total_requests
+                    << " total duration (ns): " << total_duration.count()
+                    << " res fragments: " << total_fragments
+                    << std::endl;
           std::cout << "Fragmentation:" << a->get_fragmentation()
                     << std::endl;
           std::cout << "Fragmentation score:" << a->get_fragmentation_score()
@@ -2,6 +2,7 @@
 // vim: ts=8 sw=2 smarttab
 
 #include <iostream>
+#include <random>
 #include <gtest/gtest.h>
 
 #include "os/bluestore/fastbmap_allocator_impl.h"
@@ -1143,3 +1144,65 @@ TEST(TestAllocatorLevel01, test_claim_free_l2)
   ASSERT_EQ(0x15000,
     al2.debug_get_free());
 }
+
+TEST(TestAllocatorLevel01, test_find_slot_not_equal)
+{
+  std::mt19937_64 rng(0);
+  slot_t slots[67];
+  for (size_t i = 0; i < 10000; ++i) {
+    slot_t val = (i % 2) ? all_slot_set : all_slot_clear;
+    for (auto& s : slots) {
+      s = (rng() % 16) ? val : rng();
+    }
+    size_t pos = rng() % 68;
+    size_t end = pos + rng() % (68 - pos);
+    size_t expected = pos;
+    while (expected < end && slots[expected] == val) {
+      ++expected;
+    }
+    ASSERT_EQ(expected, find_slot_not_equal(slots, pos, end, val));
+  }
+}
+
+TEST(TestAllocatorLevel01, test_l2_fragmented)
+{
+  TestAllocatorLevel02 al2;
+  uint64_t num_l2_entries = 1;
+  uint64_t capacity = num_l2_entries * 256 * 512 * 4096;
+  al2.init(capacity, 0x1000);
+
+  // every other 4K unit is free within the first 16M
+  uint64_t frag_size = 16 * _1m;
+  al2.mark_allocated(frag_size, capacity - frag_size);
+  for (uint64_t o = 0x1000; o < frag_size; o += 0x2000) {
+    al2.mark_allocated(o, 0x1000);
+  }
+  // and a single 64K hole right after
+  al2.mark_free(frag_size + _1m, 0x10000);
+  ASSERT_EQ(frag_size / 2 + 0x10000, al2.debug_get_free());
+
+  uint64_t allocated = 0;
+  interval_vector_t a;
+  al2.allocate_l2(0x10000, 0x10000, &allocated, &a);
+  ASSERT_EQ(0x10000u, allocated);
+  ASSERT_EQ(1u, a.size());
+  ASSERT_EQ(frag_size + _1m, a[0].offset);
+  ASSERT_EQ(0x10000u, a[0].length);
+
+  allocated = 0;
+  a.clear();
+  al2.allocate_l2(0x2000, 0x2000, &allocated, &a);
+  ASSERT_EQ(0u, allocated);
+
+  allocated = 0;
+  a.clear();
+  al2.allocate_l2(0x40000, 0x1000, &allocated, &a);
+  ASSERT_EQ(0x40000u, allocated);
+  ASSERT_EQ(0x40u, a.size());
+  for (size_t i = 0; i < a.size(); ++i) {
+    ASSERT_EQ(i * 0x2000, a[i].offset);
+    ASSERT_EQ(0x1000u, a[i].length);
+  }
+  al2.free_l2(a);
+  ASSERT_EQ(frag_size / 2, al2.debug_get_free());
+}
@@ -1599,6 +1599,156 @@ TEST_P(StoreTestSpecificAUSize, ReproBug41901Test) {
 }
 
 
+TEST_P(StoreTestSpecificAUSize, ParallelSampledCompressionTest) {
+  if(string(GetParam()) != "bluestore")
+    return;
+
+  SetVal(g_conf(), "bluestore_compression_mode", "force");
+  SetVal(g_conf(), "bluestore_compression_algorithm", "snappy");
+  SetVal(g_conf(), "bluestore_max_blob_size", "65536");
+  SetVal(g_conf(), "bluestore_compression_max_blob_size", "65536");
+  SetVal(g_conf(), "bluestore_compression_threads", "2");
+  SetVal(g_conf(), "bluestore_compression_sample_size", "8192");
+  g_conf().apply_changes(nullptr);
+  StartDeferred(4096);
+
+  int r;
+  coll_t cid;
+  ghobject_t hoid(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  ghobject_t hoid2(hobject_t(sobject_t("Object 2", CEPH_NOSNAP)));
+  const PerfCounters* logger = store->get_perf_counters();
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  // 16 blobs of well compressible data
+  bufferlist good;
+  for (unsigned i = 0; i < 16 * 65536 / 16; ++i) {
+    good.append("0123456789abcdef");
+  }
+  // 16 blobs of random data, the sample must be enough to give up
+  bufferlist bad;
+  {
+    gen_type rng(0);
+    bufferptr p(16 * 65536);
+    for (unsigned i = 0; i < p.length(); ++i) {
+      p.c_str()[i] = rng();
+    }
+    bad.append(p);
+  }
+  {
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, 0, good.length(), good);
+    t.write(cid, hoid2, 0, bad.length(), bad);
+    cerr << "write" << std::endl;
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_EQ(logger->get(l_bluestore_compress_success_count), 16u);
+  ASSERT_EQ(logger->get(l_bluestore_compress_skipped_count), 16u);
+  ASSERT_EQ(logger->get(l_bluestore_compress_parallel_count), 30u);
+  {
+    bufferlist in;
+    r = store->read(ch, hoid, 0, good.length(), in);
+    ASSERT_EQ((int)good.length(), r);
+    ASSERT_TRUE(bl_eq(good, in));
+    in.clear();
+    r = store->read(ch, hoid2, 0, bad.length(), in);
+    ASSERT_EQ((int)bad.length(), r);
+    ASSERT_TRUE(bl_eq(bad, in));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove(cid, hoid2);
+    t.remove_collection(cid);
+    cerr << "Cleaning" << std::endl;
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, DefragTest) {
+  if(string(GetParam()) != "bluestore")
+    return;
+
+  SetVal(g_conf(), "bluestore_defrag_min_extents", "8");
+  SetVal(g_conf(), "bluestore_defrag_extent_ratio", "4");
+  SetVal(g_conf(), "bluestore_defrag_max_bytes_per_sec", "0");
+  g_conf().apply_changes(nullptr);
+  StartDeferred(4096);
+
+  int r;
+  coll_t cid;
+  ghobject_t hoid(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  ghobject_t hoid2(hobject_t(sobject_t("Object 2", CEPH_NOSNAP)));
+  BlueStore* bstore = dynamic_cast<BlueStore*> (store.get());
+  const PerfCounters* logger = store->get_perf_counters();
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  // interleaved appends leave both objects in 16 separate extents
+  bufferlist expected, expected2;
+  for (unsigned i = 0; i < 16; ++i) {
+    bufferlist bl, bl2;
+    bl.append(string(4096, 'a' + i));
+    bl2.append(string(4096, 'A' + i));
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, i * 4096, bl.length(), bl);
+    t.write(cid, hoid2, i * 4096, bl2.length(), bl2);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+    expected.append(bl);
+    expected2.append(bl2);
+  }
+  // objects with writes in flight are skipped
+  ch->flush();
+  // not enough free space left for the rewrite
+  SetVal(g_conf(), "bluestore_defrag_min_free_ratio", "1");
+  g_conf().apply_changes(nullptr);
+  bstore->debug_defrag_pass();
+  ASSERT_EQ(logger->get(l_bluestore_defrag_scanned_objects), 2u);
+  ASSERT_EQ(logger->get(l_bluestore_defrag_objects), 0u);
+  SetVal(g_conf(), "bluestore_defrag_min_free_ratio", "0.1");
+  g_conf().apply_changes(nullptr);
+
+  bstore->debug_defrag_pass();
+  ASSERT_EQ(logger->get(l_bluestore_defrag_scanned_objects), 4u);
+  ASSERT_EQ(logger->get(l_bluestore_defrag_objects), 2u);
+  ASSERT_EQ(logger->get(l_bluestore_defrag_bytes), 2u * 16 * 4096);
+  ASSERT_GT(logger->get(l_bluestore_defrag_removed_extents), 0u);
+  {
+    bufferlist in;
+    r = store->read(ch, hoid, 0, expected.length(), in);
+    ASSERT_EQ((int)expected.length(), r);
+    ASSERT_TRUE(bl_eq(expected, in));
+    in.clear();
+    r = store->read(ch, hoid2, 0, expected2.length(), in);
+    ASSERT_EQ((int)expected2.length(), r);
+    ASSERT_TRUE(bl_eq(expected2, in));
+  }
+  // nothing left to do
+  ch->flush();
+  bstore->debug_defrag_pass();
+  ASSERT_EQ(logger->get(l_bluestore_defrag_objects), 2u);
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove(cid, hoid2);
+    t.remove_collection(cid);
+    cerr << "Cleaning" << std::endl;
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
 TEST_P(StoreTestSpecificAUSize, BluestoreStatFSTest) {
   if(string(GetParam()) != "bluestore")
     return;
@@ -5502,6 +5652,388 @@ TEST_P(StoreTestSpecificAUSize, SyntheticMatrixPreferDeferred) {
   };
   do_matrix(m, &StoreTestSpecificAUSize::SyntheticTest);
 }
+
+TEST_P(StoreTestSpecificAUSize, KVSyncShards) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  SetVal(g_conf(), "bluestore_kv_sync_shards", "3");
+  // tiny windows make the extra shards wait for new {nid,blobid}_max
+  SetVal(g_conf(), "bluestore_nid_prealloc", "8");
+  SetVal(g_conf(), "bluestore_blobid_prealloc", "8");
+  g_conf().apply_changes(nullptr);
+  StartDeferred(4096);
+
+  const int num_colls = 6;
+  const int num_writes = 64;
+  int poolid = 4374;
+  vector<coll_t> cids;
+  vector<ObjectStore::CollectionHandle> chs;
+  for (int i = 0; i < num_colls; ++i) {
+    coll_t cid(spg_t(pg_t(i, poolid), shard_id_t::NO_SHARD));
+    auto ch = store->create_new_collection(cid);
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+    cids.push_back(cid);
+    chs.push_back(ch);
+  }
+  auto make_oid = [&](int c, int n) {
+    ghobject_t hoid(hobject_t(sobject_t(
+      "Object " + stringify(c) + "." + stringify(n), CEPH_NOSNAP)));
+    hoid.hobj.pool = poolid;
+    return hoid;
+  };
+  auto make_data = [](int c, int n) {
+    bufferlist bl;
+    bl.append(string(4096, 'a' + (c * num_writes + n) % 26));
+    return bl;
+  };
+
+  // interleave sequencers so all kv sync shards are busy at once
+  {
+    vector<std::unique_ptr<C_SaferCond>> waiters;
+    for (int n = 0; n < num_writes; ++n) {
+      for (int c = 0; c < num_colls; ++c) {
+	ObjectStore::Transaction t;
+	auto bl = make_data(c, n);
+	t.write(cids[c], make_oid(c, n), 0, bl.length(), bl);
+	// overwrite a shared object too; per sequencer order must hold
+	t.write(cids[c], make_oid(c, -1), 0, bl.length(), bl);
+	waiters.emplace_back(std::make_unique<C_SaferCond>());
+	t.register_on_commit(waiters.back().get());
+	store->queue_transaction(chs[c], std::move(t));
+      }
+    }
+    for (auto& w : waiters) {
+      ASSERT_EQ(0, w->wait());
+    }
+  }
+
+  auto verify = [&]() {
+    for (int c = 0; c < num_colls; ++c) {
+      for (int n = 0; n < num_writes; ++n) {
+	bufferlist exp = make_data(c, n), in;
+	ASSERT_EQ(4096, store->read(chs[c], make_oid(c, n), 0, 4096, in));
+	ASSERT_TRUE(bl_eq(exp, in));
+      }
+      bufferlist exp = make_data(c, num_writes - 1), in;
+      ASSERT_EQ(4096, store->read(chs[c], make_oid(c, -1), 0, 4096, in));
+      ASSERT_TRUE(bl_eq(exp, in));
+    }
+  };
+  verify();
+
+  chs.clear();
+  ASSERT_EQ(0, store->umount());
+  ASSERT_EQ(0, store->fsck(false));
+  ASSERT_EQ(0, store->mount());
+  for (auto& cid : cids) {
+    chs.push_back(store->open_collection(cid));
+  }
+  verify();
+
+  for (int c = 0; c < num_colls; ++c) {
+    ObjectStore::Transaction t;
+    for (int n = -1; n < num_writes; ++n) {
+      t.remove(cids[c], make_oid(c, n));
+    }
+    t.remove_collection(cids[c]);
+    int r = queue_transaction(store, chs[c], std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, DeferredAdaptive) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  SetVal(g_conf(), "bluestore_prefer_deferred_size", "65536");
+  SetVal(g_conf(), "bluestore_deferred_batch_ops", "1024");
+  // a small deferred throttle keeps the backlog high
+  SetVal(g_conf(), "bluestore_throttle_deferred_bytes", "262144");
+  SetVal(g_conf(), "bluestore_deferred_adaptive", "true");
+  SetVal(g_conf(), "bluestore_deferred_adaptive_interval", "0.1");
+  g_conf().apply_changes(nullptr);
+  StartDeferred(4096);
+
+  int poolid = 4375;
+  coll_t cid(spg_t(pg_t(0, poolid), shard_id_t::NO_SHARD));
+  const PerfCounters* logger = store->get_perf_counters();
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_EQ(logger->get(l_bluestore_deferred_adaptive_size), 65536u);
+  ASSERT_EQ(logger->get(l_bluestore_deferred_adaptive_batch_ops), 1024u);
+
+  const int min_rounds = 8;
+  const int max_rounds = 32;
+  const int num_objs = 16;
+  auto make_oid = [&](int n) {
+    ghobject_t hoid(hobject_t(sobject_t("Object " + stringify(n), CEPH_NOSNAP)));
+    hoid.hobj.pool = poolid;
+    return hoid;
+  };
+  auto make_data = [](int round, int n) {
+    bufferlist bl;
+    bl.append(string(32768, 'a' + (round * num_objs + n) % 26));
+    return bl;
+  };
+  // the backlog keeps voting for smaller deferred writes, so the policy
+  // must move off the configured values
+  bool adapted = false;
+  int round = 0;
+  for (; round < max_rounds && !(adapted && round >= min_rounds); ++round) {
+    for (int n = 0; n < num_objs; ++n) {
+      ObjectStore::Transaction t;
+      auto bl = make_data(round, n);
+      t.write(cid, make_oid(n), 0, bl.length(), bl);
+      int r = queue_transaction(store, ch, std::move(t));
+      ASSERT_EQ(r, 0);
+    }
+    // the effective values never leave [0, configured] / [.., 4 * configured]
+    auto size = logger->get(l_bluestore_deferred_adaptive_size);
+    auto batch = logger->get(l_bluestore_deferred_adaptive_batch_ops);
+    ASSERT_LE(size, 65536u);
+    ASSERT_LE(batch, 4096u);
+    adapted |= size != 65536u || batch != 1024u;
+    usleep(150000);
+  }
+  ASSERT_TRUE(adapted);
+  for (int n = 0; n < num_objs; ++n) {
+    bufferlist exp = make_data(round - 1, n), in;
+    ASSERT_EQ(32768, store->read(ch, make_oid(n), 0, 32768, in));
+    ASSERT_TRUE(bl_eq(exp, in));
+  }
+
+  // turning the policy off restores the configured values
+  SetVal(g_conf(), "bluestore_deferred_adaptive", "false");
+  g_conf().apply_changes(nullptr);
+  ASSERT_EQ(logger->get(l_bluestore_deferred_adaptive_size), 65536u);
+  ASSERT_EQ(logger->get(l_bluestore_deferred_adaptive_batch_ops), 1024u);
+
+  {
+    ObjectStore::Transaction t;
+    for (int n = 0; n < num_objs; ++n) {
+      t.remove(cid, make_oid(n));
+    }
+    t.remove_collection(cid);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, AllocationCheckpoint) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  SetVal(g_conf(), "bluestore_debug_inject_allocation_from_file_failure", "0");
+  SetVal(g_conf(), "bluestore_allocation_checkpoint_interval", "0.2");
+  SetVal(g_conf(), "bluestore_allocation_checkpoint_min_deltas", "1");
+  SetVal(g_conf(), "bluestore_fsck_on_mount", "false");
+  SetVal(g_conf(), "bluestore_fsck_on_umount", "false");
+  g_conf().apply_changes(nullptr);
+  StartDeferred(0x10000);
+  if (!store->has_null_manager()) {
+    return;
+  }
+  BlueStore* bstore = dynamic_cast<BlueStore*> (store.get());
+  // the file written by mkfs enables the delta log on the next mount
+  bstore->umount();
+  ASSERT_EQ(bstore->mount(), 0);
+
+  int poolid = 4376;
+  coll_t cid(spg_t(pg_t(0, poolid), shard_id_t::NO_SHARD));
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  const int num_objs = 256;
+  auto make_oid = [&](int n) {
+    ghobject_t hoid(hobject_t(sobject_t("Object " + stringify(n), CEPH_NOSNAP)));
+    hoid.hobj.pool = poolid;
+    return hoid;
+  };
+  auto write_objs = [&](int from, int to, char c) {
+    bufferlist bl;
+    bl.append(string(0x20000, c));
+    for (int n = from; n < to; ++n) {
+      ObjectStore::Transaction t;
+      t.write(cid, make_oid(n), 0, bl.length(), bl);
+      int r = queue_transaction(store, ch, std::move(t));
+      ASSERT_EQ(r, 0);
+    }
+  };
+  write_objs(0, num_objs, 'a');
+
+  // wait for the deltas to be folded into the file
+  const PerfCounters* logger = store->get_perf_counters();
+  for (int i = 0; i < 50 &&
+	 logger->get_tavg_ns(l_bluestore_alloc_checkpoint_lat).first == 0; ++i) {
+    usleep(100000);
+  }
+  ASSERT_GT(logger->get_tavg_ns(l_bluestore_alloc_checkpoint_lat).first, 0u);
+  ASSERT_GT(logger->get(l_bluestore_alloc_deltas), 0u);
+
+  // changes past the checkpoint are only in the delta log
+  SetVal(g_conf(), "bluestore_allocation_checkpoint_interval", "0");
+  g_conf().apply_changes(nullptr);
+  {
+    ObjectStore::Transaction t;
+    for (int n = 0; n < num_objs; n += 2) {
+      t.remove(cid, make_oid(n));
+    }
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  write_objs(num_objs, num_objs * 3 / 2, 'b');
+  store_statfs_t statfs0;
+  ASSERT_EQ(store->statfs(&statfs0), 0);
+  ch.reset();
+
+  // mount after a crash, first from the delta log, then with full recovery
+  SetVal(g_conf(), "bluestore_allocation_checkpoint_interval", "0.2");
+  g_conf().apply_changes(nullptr);
+  bstore->inject_skip_allocation_destage();
+  bstore->umount();
+  ASSERT_EQ(bstore->fsck(false), 0);
+  ASSERT_EQ(bstore->mount(), 0);
+
+  SetVal(g_conf(), "bluestore_debug_inject_allocation_from_file_failure", "1");
+  g_conf().apply_changes(nullptr);
+  bstore->inject_skip_allocation_destage();
+  bstore->umount();
+  ASSERT_EQ(bstore->mount(), 0);
+  SetVal(g_conf(), "bluestore_debug_inject_allocation_from_file_failure", "0");
+  g_conf().apply_changes(nullptr);
+
+  store_statfs_t statfs;
+  ASSERT_EQ(store->statfs(&statfs), 0);
+  ASSERT_EQ(statfs0.allocated, statfs.allocated);
+  ASSERT_EQ(statfs0.data_stored, statfs.data_stored);
+  ch = store->open_collection(cid);
+  for (int n = 1; n < num_objs * 3 / 2; n += 2) {
+    bufferlist in;
+    int r = store->read(ch, make_oid(n), 0, 0x20000, in);
+    ASSERT_EQ(0x20000, r);
+    ASSERT_EQ(n < num_objs ? 'a' : 'b', in[0]);
+  }
+  bstore->umount();
+  ASSERT_EQ(bstore->fsck(false), 0);
+  ASSERT_EQ(bstore->mount(), 0);
+}
+
+// disabled by default b/c it populates a few GB and takes minutes, run with
+// --gtest_also_run_disabled_tests to compare mount times after a crash
+TEST_P(StoreTestSpecificAUSize, DISABLED_AllocationCheckpointMountBench) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  SetVal(g_conf(), "bluestore_debug_inject_allocation_from_file_failure", "0");
+  SetVal(g_conf(), "bluestore_allocation_checkpoint_interval", "1");
+  SetVal(g_conf(), "bluestore_allocation_checkpoint_min_deltas", "1");
+  SetVal(g_conf(), "bluestore_fsck_on_mount", "false");
+  SetVal(g_conf(), "bluestore_fsck_on_umount", "false");
+  SetVal(g_conf(), "bluestore_block_size", stringify(16ull << 30).c_str());
+  g_conf().apply_changes(nullptr);
+  StartDeferred(0x1000);
+  if (!store->has_null_manager()) {
+    return;
+  }
+  BlueStore* bstore = dynamic_cast<BlueStore*> (store.get());
+  bstore->umount();
+  ASSERT_EQ(bstore->mount(), 0);
+
+  int poolid = 4377;
+  coll_t cid(spg_t(pg_t(0, poolid), shard_id_t::NO_SHARD));
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  const int num_objs = 65536;
+  const int num_chunks = 16;
+  const int batch = 256;
+  auto make_oid = [&](int n) {
+    ghobject_t hoid(hobject_t(sobject_t("Object " + stringify(n), CEPH_NOSNAP)));
+    hoid.hobj.pool = poolid;
+    return hoid;
+  };
+  bufferlist bl;
+  bl.append(string(0x1000, 'a'));
+  // write the objects a chunk at a time so that their allocations are
+  // interleaved, then remove every other one to leave 4K holes behind
+  cout << "populating " << num_objs << " objects" << std::endl;
+  for (int chunk = 0; chunk < num_chunks; ++chunk) {
+    for (int n = 0; n < num_objs; n += batch) {
+      ObjectStore::Transaction t;
+      for (int i = n; i < n + batch; ++i) {
+	t.write(cid, make_oid(i), chunk * bl.length(), bl.length(), bl);
+      }
+      int r = queue_transaction(store, ch, std::move(t));
+      ASSERT_EQ(r, 0);
+    }
+  }
+  for (int n = 0; n < num_objs; n += batch) {
+    ObjectStore::Transaction t;
+    for (int i = n; i < n + batch; i += 2) {
+      t.remove(cid, make_oid(i));
+    }
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  // let the checkpoint catch up, then leave some deltas to replay
+  const PerfCounters* logger = store->get_perf_counters();
+  sleep(5);
+  ASSERT_GT(logger->get_tavg_ns(l_bluestore_alloc_checkpoint_lat).first, 0u);
+  SetVal(g_conf(), "bluestore_allocation_checkpoint_interval", "0");
+  g_conf().apply_changes(nullptr);
+  for (int n = 1; n < num_objs; n += batch * 2) {
+    ObjectStore::Transaction t;
+    for (int i = n; i < n + batch * 2; i += 2) {
+      t.write(cid, make_oid(i), num_chunks * bl.length(), bl.length(), bl);
+    }
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  store_statfs_t statfs0;
+  ASSERT_EQ(store->statfs(&statfs0), 0);
+  ch.reset();
+
+  auto crash_and_mount = [&](const char* how) {
+    bstore->inject_skip_allocation_destage();
+    bstore->umount();
+    auto start = ceph::mono_clock::now();
+    ASSERT_EQ(bstore->mount(), 0);
+    auto elapsed = ceph::mono_clock::now() - start;
+    store_statfs_t statfs;
+    ASSERT_EQ(store->statfs(&statfs), 0);
+    ASSERT_EQ(statfs0.allocated, statfs.allocated);
+    cout << "mount after crash with " << how << ": "
+	 << ceph::to_seconds<double>(elapsed) << "s" << std::endl;
+  };
+  const int rounds = 3;
+  for (int i = 0; i < rounds; ++i) {
+    crash_and_mount("delta log replay");
+  }
+  SetVal(g_conf(), "bluestore_debug_inject_allocation_from_file_failure", "1");
+  g_conf().apply_changes(nullptr);
+  for (int i = 0; i < rounds; ++i) {
+    crash_and_mount("full allocation recovery");
+  }
+  SetVal(g_conf(), "bluestore_debug_inject_allocation_from_file_failure", "0");
+  g_conf().apply_changes(nullptr);
+}
 #endif // WITH_BLUESTORE
 
 TEST_P(StoreTest, AttrSynthetic) {
@@ -6115,6 +6647,82 @@ TEST_P(StoreTest, OMapIterator) {
   }
 }
 
+TEST_P(StoreTest, OMapIterate) {
+  coll_t cid;
+  ghobject_t hoid(hobject_t("tesomap", "", CEPH_NOSNAP, 0, 0, ""));
+  auto ch = store->create_new_collection(cid);
+  int r;
+  map<string, bufferlist> attrs;
+  for (int i = 0; i < 100; i++) {
+    bufferlist bl;
+    bl.append("value-" + stringify(i));
+    attrs["key-" + stringify(i)] = bl;
+  }
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    t.touch(cid, hoid);
+    bufferlist header;
+    header.append("header");
+    t.omap_setheader(cid, hoid, header);
+    t.omap_setkeys(cid, hoid, attrs);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  auto collect = [&](ObjectStore::omap_iter_seek_t start_from, size_t max,
+                     map<string, string> *out) {
+    return store->omap_iterate(
+      ch, hoid, start_from,
+      [&](std::string_view key, std::string_view value) {
+        if (out->size() >= max) {
+          return ObjectStore::omap_iter_ret_t::STOP;
+        }
+        out->emplace(key, value);
+        return ObjectStore::omap_iter_ret_t::NEXT;
+      });
+  };
+  {
+    map<string, string> out;
+    r = collect(ObjectStore::omap_iter_seek_t::min_lower_bound(), 1000, &out);
+    ASSERT_EQ(r, 0);
+    ASSERT_EQ(attrs.size(), out.size());
+    for (auto& [k, v] : attrs) {
+      ASSERT_EQ(out[k], v.to_str());
+    }
+  }
+  {
+    map<string, string> out;
+    r = collect({"key-50", ObjectStore::omap_iter_seek_t::LOWER_BOUND}, 3,
+                &out);
+    ASSERT_EQ(r, 1);
+    ASSERT_EQ(3u, out.size());
+    ASSERT_EQ("key-50", out.begin()->first);
+  }
+  {
+    map<string, string> out;
+    r = collect({"key-50", ObjectStore::omap_iter_seek_t::UPPER_BOUND}, 1,
+                &out);
+    ASSERT_EQ(r, 1);
+    ASSERT_EQ("key-51", out.begin()->first);
+  }
+  {
+    ghobject_t missing(hobject_t("missing", "", CEPH_NOSNAP, 0, 0, ""));
+    r = store->omap_iterate(
+      ch, missing, ObjectStore::omap_iter_seek_t::min_lower_bound(),
+      [](std::string_view, std::string_view) {
+        return ObjectStore::omap_iter_ret_t::NEXT;
+      });
+    ASSERT_EQ(r, -ENOENT);
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
 TEST_P(StoreTest, XattrTest) {
   coll_t cid;
   ghobject_t hoid(hobject_t("tesomap", "", CEPH_NOSNAP, 0, 0, ""));
@@ -10221,6 +10829,241 @@ TEST_P(StoreTest, SpuriousReadErrorTest) {
   }
 }
 
+TEST_P(StoreTest, DeepFsckThreads) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  int r;
+  auto logger = store->get_perf_counters();
+  coll_t cid(spg_t(pg_t(0, 333), shard_id_t::NO_SHARD));
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  const uint64_t num_objs = 100;
+  bufferlist data;
+  data.append(std::string(0x3000, 'a'));
+  for (uint64_t i = 0; i < num_objs; ++i) {
+    ObjectStore::Transaction t;
+    ghobject_t hoid(hobject_t(sobject_t("Object " + stringify(i), CEPH_NOSNAP),
+                              "", i, 333, ""));
+    t.write(cid, hoid, 0, data.length(), data);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ch.reset();
+  ASSERT_EQ(store->umount(), 0);
+
+  SetVal(g_conf(), "bluestore_fsck_deep_threads", "4");
+  SetVal(g_conf(), "bluestore_fsck_deep_checkpoint_interval", "0.001");
+  g_conf().apply_changes(nullptr);
+
+  auto objects0 = logger->get(l_bluestore_fsck_deep_objects);
+  auto bytes0 = logger->get(l_bluestore_fsck_deep_bytes);
+  ASSERT_EQ(store->fsck(true), 0);
+  ASSERT_EQ(logger->get(l_bluestore_fsck_deep_objects) - objects0, num_objs);
+  ASSERT_EQ(logger->get(l_bluestore_fsck_deep_bytes) - bytes0,
+            num_objs * data.length());
+
+  // a completed pass doesn't leave a position behind, everything is read again
+  objects0 = logger->get(l_bluestore_fsck_deep_objects);
+  ASSERT_EQ(store->fsck(true), 0);
+  ASSERT_EQ(logger->get(l_bluestore_fsck_deep_objects) - objects0, num_objs);
+
+  // read errors are reported by the reader threads
+  SetVal(g_conf(), "bluestore_retry_disk_reads", "0");
+  SetVal(g_conf(), "bluestore_debug_inject_csum_err_probability", "1");
+  g_conf().apply_changes(nullptr);
+  ASSERT_GE(store->fsck(true), (int)num_objs);
+
+  SetVal(g_conf(), "bluestore_debug_inject_csum_err_probability", "0");
+  g_conf().apply_changes(nullptr);
+
+  // a position left behind by an interrupted pass is dropped by a
+  // read-write mount, the objects may be rewritten after it
+  ASSERT_EQ(store->mount(), 0);
+  {
+    BlueStore* bstore = dynamic_cast<BlueStore*> (store.get());
+    auto* kv = bstore->get_kv();
+
+    // to be inline with BlueStore.cc
+    const string PREFIX_SUPER = "S";
+
+    KeyValueDB::Transaction t = kv->get_transaction();
+    bufferlist bl;
+    encode(std::string(64, '\xff'), bl); // past all the objects
+    t->set(PREFIX_SUPER, "fsck_deep_done", bl);
+    kv->submit_transaction_sync(t);
+  }
+  ASSERT_EQ(store->umount(), 0);
+  ASSERT_EQ(store->mount(), 0);
+  ASSERT_EQ(store->umount(), 0);
+  objects0 = logger->get(l_bluestore_fsck_deep_objects);
+  ASSERT_EQ(store->fsck(true), 0);
+  ASSERT_EQ(logger->get(l_bluestore_fsck_deep_objects) - objects0, num_objs);
+
+  SetVal(g_conf(), "bluestore_fsck_deep_threads", "0");
+  SetVal(g_conf(), "bluestore_fsck_deep_checkpoint_interval", "0");
+  g_conf().apply_changes(nullptr);
+  ASSERT_EQ(store->fsck(true), 0);
+  ASSERT_EQ(store->mount(), 0);
+}
+
+TEST_P(StoreTest, SequentialReadahead) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  SetVal(g_conf(), "bluestore_readahead_max_bytes", "1048576");
+  SetVal(g_conf(), "bluestore_readahead_min_bytes", "131072");
+  SetVal(g_conf(), "bluestore_readahead_trigger_requests", "2");
+  g_conf().apply_changes(nullptr);
+
+  int r;
+  auto logger = store->get_perf_counters();
+  coll_t cid(spg_t(pg_t(0, 555), shard_id_t::NO_SHARD));
+  ghobject_t hoid(hobject_t(sobject_t("Object", CEPH_NOSNAP),
+                            "", 1, 555, ""));
+  auto ch = store->create_new_collection(cid);
+  const uint64_t obj_size = 4 << 20;
+  const uint64_t chunk = 64 << 10;
+  bufferlist data;
+  for (uint64_t i = 0; i < obj_size / chunk; ++i) {
+    data.append(std::string(chunk, 'a' + i % 26));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    t.write(cid, hoid, 0, data.length(), data,
+            CEPH_OSD_OP_FLAG_FADVISE_DONTNEED);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  auto count0 = logger->get(l_bluestore_readahead_count);
+  auto hit0 = logger->get(l_bluestore_readahead_hit_bytes);
+  for (uint64_t off = 0; off < obj_size; off += chunk) {
+    bufferlist bl, expected;
+    r = store->read(ch, hoid, off, chunk, bl);
+    ASSERT_EQ(r, (int)chunk);
+    expected.substr_of(data, off, chunk);
+    ASSERT_TRUE(bl_eq(expected, bl));
+    // give read-ahead a chance to complete before the next read
+    usleep(10000);
+  }
+  ASSERT_GT(logger->get(l_bluestore_readahead_count), count0);
+  ASSERT_GT(logger->get(l_bluestore_readahead_hit_bytes), hit0);
+
+  // data cached by read-ahead doesn't hide later writes
+  {
+    bufferlist bl;
+    bl.append(std::string(chunk, 'z'));
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, obj_size - chunk, bl.length(), bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+    bufferlist rbl;
+    r = store->read(ch, hoid, obj_size - chunk, chunk, rbl);
+    ASSERT_EQ(r, (int)chunk);
+    ASSERT_TRUE(bl_eq(bl, rbl));
+  }
+
+  // writes to other objects in the collection don't invalidate it
+  ghobject_t hoid2(hobject_t(sobject_t("Object2", CEPH_NOSNAP),
+                             "", 2, 555, ""));
+  {
+    ObjectStore::Transaction t;
+    t.write(cid, hoid2, 0, data.length(), data,
+            CEPH_OSD_OP_FLAG_FADVISE_DONTNEED);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  auto hit1 = logger->get(l_bluestore_readahead_hit_bytes);
+  for (uint64_t off = 0; off < obj_size; off += chunk) {
+    bufferlist wbl;
+    wbl.append(std::string(chunk, 'y'));
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, off, wbl.length(), wbl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+    bufferlist bl, expected;
+    r = store->read(ch, hoid2, off, chunk, bl);
+    ASSERT_EQ(r, (int)chunk);
+    expected.substr_of(data, off, chunk);
+    ASSERT_TRUE(bl_eq(expected, bl));
+    usleep(10000);
+  }
+  ASSERT_GT(logger->get(l_bluestore_readahead_hit_bytes), hit1);
+  ch.reset();
+}
+
+TEST_P(StoreTest, BatchedOnodeLookup) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  SetVal(g_conf(), "bluestore_onode_batch_min_objects", "3");
+  g_conf().apply_changes(nullptr);
+
+  int r;
+  coll_t cid(spg_t(pg_t(0, 556), shard_id_t::NO_SHARD));
+  auto ch = store->create_new_collection(cid);
+  const unsigned num_objects = 8;
+  vector<ghobject_t> oids;
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    for (unsigned i = 0; i < num_objects; ++i) {
+      ghobject_t hoid(hobject_t(sobject_t("Object " + stringify(i),
+                                          CEPH_NOSNAP),
+                                "", i, 556, ""));
+      bufferlist bl;
+      bl.append("abcde");
+      t.write(cid, hoid, 0, bl.length(), bl);
+      oids.push_back(hoid);
+    }
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  // start with a cold onode cache
+  ch.reset();
+  EXPECT_EQ(store->umount(), 0);
+  EXPECT_EQ(store->mount(), 0);
+  ch = store->open_collection(cid);
+  auto logger = store->get_perf_counters();
+
+  const unsigned half = num_objects / 2;
+  vector<ghobject_t> first(oids.begin(), oids.begin() + half);
+  auto batched0 = logger->get(l_bluestore_onode_batch_reads);
+  store->prefetch_objects(ch, first);
+  ASSERT_EQ(logger->get(l_bluestore_onode_batch_reads), batched0 + half);
+  // cached onodes are not looked up again
+  store->prefetch_objects(ch, first);
+  ASSERT_EQ(logger->get(l_bluestore_onode_batch_reads), batched0 + half);
+
+  // a transaction touching several cold objects reads them in one batch
+  {
+    ObjectStore::Transaction t;
+    for (unsigned i = half; i < num_objects; ++i) {
+      bufferlist bl;
+      bl.append("value");
+      t.setattr(cid, oids[i], "attr", bl);
+    }
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_EQ(logger->get(l_bluestore_onode_batch_reads),
+            batched0 + num_objects);
+  for (auto& hoid : oids) {
+    bufferlist bl;
+    r = store->read(ch, hoid, 0, 5, bl);
+    ASSERT_EQ(r, 5);
+    ASSERT_EQ(string(bl.c_str(), bl.length()), "abcde");
+  }
+  ch.reset();
+}
+
 TEST_P(StoreTest, mergeRegionTest) {
   if (string(GetParam()) != "bluestore")
     return;
@@ -412,6 +412,87 @@ void join_all(std::vector<std::thread>& v)
 #define NUM_SINGLE_FILE_WRITERS 1
 #define NUM_MULTIPLE_FILE_WRITERS 2
 
+TEST(BlueFS, read_random_batch) {
+  uint64_t size = 1048576 * 128;
+  TempBdev bdev{size};
+  ConfSaver conf(g_ceph_context->_conf);
+  // the batch is only issued as parallel aio with direct io
+  conf.SetVal("bluefs_buffered_io", "false");
+  conf.ApplyChanges();
+
+  BlueFS fs(g_ceph_context);
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_DB, bdev.path, false));
+  uuid_d fsid;
+  ASSERT_EQ(0, fs.mkfs(fsid, { BlueFS::BDEV_DB, false, false }));
+  ASSERT_EQ(0, fs.mount());
+  const uint64_t file_size = 4 * 1048576;
+  const uint64_t chunk = 65536;
+  auto data = gen_buffer(file_size);
+  auto other = gen_buffer(file_size);
+  {
+    // growing two files in turns leaves each in several extents
+    BlueFS::FileWriter *h, *o;
+    ASSERT_EQ(0, fs.mkdir("dir"));
+    ASSERT_EQ(0, fs.open_for_write("dir", "file", &h, false));
+    ASSERT_EQ(0, fs.open_for_write("dir", "other", &o, false));
+    for (uint64_t off = 0; off < file_size; off += chunk) {
+      h->append(data.get() + off, chunk);
+      fs.fsync(h);
+      o->append(other.get() + off, chunk);
+      fs.fsync(o);
+    }
+    fs.close_writer(h);
+    fs.close_writer(o);
+  }
+  BlueFS::FileReader *h, *ref;
+  ASSERT_EQ(0, fs.open_for_read("dir", "file", &h));
+  ASSERT_EQ(0, fs.open_for_read("dir", "file", &ref, true));
+  ASSERT_GT(h->file->fnode.extents.size(), 1u);
+  {
+    // fill the prefetch buffer
+    bufferlist bl;
+    ASSERT_EQ(4096, fs.read(h, 0, 4096, &bl, NULL));
+  }
+  ASSERT_GT(h->buf.bl.length(), 0u);
+  const uint64_t buf_end = h->buf.get_buf_end();
+  const uint64_t ext_end = h->file->fnode.extents.begin()->length;
+  const vector<pair<uint64_t, uint64_t>> ranges = {
+    {100, 5000},                  // prefetch buffer
+    {buf_end - 100, 8192},        // out of the prefetch buffer
+    {ext_end - 1000, 3000},       // across two extents
+    {ext_end + 4095, 2},          // across a block boundary
+    {12345, 3 * 1048576},         // across several extents
+    {2 * 1048576 + 1, 4096},      // unaligned, a full block long
+    {file_size - 777, 777},       // up to eof
+    {file_size - 10, 100},        // past eof
+  };
+  vector<std::unique_ptr<char[]>> outs;
+  vector<BlueFS::ReadRequest> reqs;
+  for (auto& [off, len] : ranges) {
+    outs.push_back(std::make_unique<char[]>(len));
+    reqs.push_back(BlueFS::ReadRequest{off, len, outs.back().get()});
+  }
+  auto logger = fs.get_perf_counters();
+  auto batches = logger->get(l_bluefs_read_random_batch_count);
+  auto buffered = logger->get(l_bluefs_read_random_buffer_count);
+  fs.read_random_batch(h, reqs);
+  ASSERT_EQ(batches + 1, logger->get(l_bluefs_read_random_batch_count));
+  ASSERT_GT(logger->get(l_bluefs_read_random_buffer_count), buffered);
+
+  for (unsigned i = 0; i < ranges.size(); ++i) {
+    auto [off, len] = ranges[i];
+    int64_t expected = std::min(len, file_size - off);
+    ASSERT_EQ(expected, reqs[i].result) << "range " << i;
+    auto refbuf = std::make_unique<char[]>(len);
+    ASSERT_EQ(expected, fs.read_random(ref, off, len, refbuf.get()));
+    ASSERT_EQ(0, memcmp(refbuf.get(), outs[i].get(), expected)) << "range " << i;
+    ASSERT_EQ(0, memcmp(data.get() + off, outs[i].get(), expected)) << "range " << i;
+  }
+  delete h;
+  delete ref;
+  fs.umount();
+}
+
 TEST(BlueFS, test_flush_1) {
   uint64_t size = 1048576 * 128;
   TempBdev bdev{size};
@@ -1183,6 +1264,90 @@ TEST(BlueFS, test_shared_alloc) {
   fs.umount();
 }
 
+TEST(BlueFS, test_hot_migrate) {
+  uint64_t size = 1048576 * 128;
+  TempBdev bdev_slow{size};
+  uint64_t size_db = 1048576 * 8;
+  TempBdev bdev_db{size_db};
+
+  ConfSaver conf(g_ceph_context->_conf);
+  conf.SetVal("bluefs_shared_alloc_size", "1048576");
+  conf.SetVal("bluefs_hot_migrate_min_reads", "10");
+  conf.ApplyChanges();
+
+  bluefs_shared_alloc_context_t shared_alloc;
+  uint64_t shared_alloc_unit = 4096;
+  shared_alloc.set(
+    Allocator::create(g_ceph_context, g_ceph_context->_conf->bluefs_allocator,
+                      size, shared_alloc_unit, "test shared allocator"),
+    shared_alloc_unit);
+  shared_alloc.a->init_add_free(0, size);
+
+  BlueFS fs(g_ceph_context);
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_DB, bdev_db.path, false));
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_SLOW, bdev_slow.path, false,
+                                   &shared_alloc));
+  uuid_d fsid;
+  ASSERT_EQ(0, fs.mkfs(fsid, { BlueFS::BDEV_DB, false, false }));
+  ASSERT_EQ(0, fs.mount());
+  ASSERT_EQ(0, fs.mkdir("dir"));
+
+  auto write_file = [&fs](const string& name, bufferlist& bl) {
+    BlueFS::FileWriter *h;
+    ASSERT_EQ(0, fs.open_for_write("dir", name, &h, false));
+    h->append(bl.c_str(), bl.length());
+    fs.fsync(h);
+    fs.close_writer(h);
+  };
+  auto check_file = [&fs](const string& name, const bufferlist& expected) {
+    BlueFS::FileReader *h;
+    ASSERT_EQ(0, fs.open_for_read("dir", name, &h));
+    bufferlist bl;
+    ASSERT_EQ((int64_t)expected.length(),
+              fs.read(h, 0, expected.length(), &bl, NULL));
+    ASSERT_TRUE(bl.contents_equal(expected));
+    delete h;
+  };
+
+  // fill up DB so that the next file spills over to slow
+  bufferlist fill;
+  fill.append(string(1048576, 'f'));
+  for (int i = 0; i < 9; i++) {
+    write_file("fill." + to_string(i), fill);
+  }
+  bufferlist data;
+  {
+    std::unique_ptr<char[]> buf = gen_buffer(1048576);
+    data.append(buf.get(), 1048576);
+  }
+  write_file("hot", data);
+
+  // make room on DB and read the spilled file a lot
+  for (int i = 0; i < 9; i++) {
+    fs.unlink("dir", "fill." + to_string(i));
+  }
+  fs.sync_metadata(false);
+  for (int i = 0; i < 20; i++) {
+    check_file("hot", data);
+  }
+
+  auto *logger = fs.get_perf_counters();
+  ASSERT_EQ(data.length(), fs.debug_hot_migrate_pass());
+  ASSERT_EQ(1u, logger->get(l_bluefs_spilled_files));
+  ASSERT_EQ(1u, logger->get(l_bluefs_hot_migrated_files));
+  ASSERT_EQ(data.length(), logger->get(l_bluefs_hot_migrated_bytes));
+  check_file("hot", data);
+
+  // nothing left to move
+  ASSERT_EQ(0u, fs.debug_hot_migrate_pass());
+  ASSERT_EQ(0u, logger->get(l_bluefs_spilled_files));
+
+  fs.umount();
+  ASSERT_EQ(0, fs.mount());
+  check_file("hot", data);
+  fs.umount();
+}
+
 TEST(BlueFS, test_shared_alloc_sparse) {
   uint64_t size = 1048576 * 128 * 2;
   uint64_t main_unit = 4096;
@@ -1583,6 +1748,46 @@ TEST(BlueFS, test_log_runway_advance_seq) {
   fs.compact_log();
 }
 
+TEST(BlueFS, test_compaction_background) {
+  uint64_t size = 1048576 * 128;
+  TempBdev bdev{size};
+  ConfSaver conf(g_ceph_context->_conf);
+  conf.SetVal("bluefs_alloc_size", "65536");
+  conf.SetVal("bluefs_compact_log_sync", "false");
+  conf.SetVal("bluefs_compact_log_background", "true");
+  // make sure fsync always requests log compaction
+  conf.SetVal("bluefs_log_compact_min_ratio", "0");
+  conf.SetVal("bluefs_log_compact_min_size", "0");
+  conf.ApplyChanges();
+
+  BlueFS fs(g_ceph_context);
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_DB, bdev.path, false));
+  uuid_d fsid;
+  ASSERT_EQ(0, fs.mkfs(fsid, { BlueFS::BDEV_DB, false, false }));
+  ASSERT_EQ(0, fs.mount());
+  ASSERT_EQ(0, fs.maybe_verify_layout({ BlueFS::BDEV_DB, false, false }));
+  ASSERT_EQ(0, fs.mkdir("dir"));
+  for (int i = 0; i < 100; ++i) {
+    BlueFS::FileWriter *h;
+    ASSERT_EQ(0, fs.open_for_write("dir", "file" + to_string(i), &h, false));
+    h->append("foo", 3);
+    fs.fsync(h);
+    fs.close_writer(h);
+  }
+  auto *logger = fs.get_perf_counters();
+  for (int i = 0; i < 100 && logger->get(l_bluefs_compaction_bg) == 0; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  ASSERT_NE(0u, logger->get(l_bluefs_compaction_bg));
+  fs.umount(true);
+
+  ASSERT_EQ(0, fs.mount());
+  std::vector<std::string> ls;
+  ASSERT_EQ(0, fs.readdir("dir", &ls));
+  ASSERT_EQ(100u + 2, ls.size()); // plus "." and ".."
+  fs.umount();
+}
+
 int main(int argc, char **argv) {
   auto args = argv_to_vec(argc, argv);
   map<string,string> defaults = {
@@ -423,6 +423,56 @@ TEST(bluestore_blob_t, csum_bench)
   }
 }
 
+TEST(bluestore_blob_t, csum_batch_bench)
+{
+  // the same 4K csum blocks, once in a single buffer (batched path) and once
+  // split so that every csum block crosses a buffer boundary (per-block path)
+  const unsigned csum_order = 12;
+  const unsigned block_size = 1u << csum_order;
+  bufferptr bp(10485760);
+  for (char *a = bp.c_str(); a < bp.c_str() + bp.length(); ++a)
+    *a = (unsigned long)a & 0xff;
+  bufferlist contiguous;
+  contiguous.append(bp);
+  bufferlist fragmented;
+  unsigned pos = 0;
+  for (unsigned l = block_size / 2; pos < bp.length();
+       pos += l, l = block_size) {
+    fragmented.append(bufferptr(bp, pos, std::min(l, bp.length() - pos)));
+  }
+  ASSERT_EQ(contiguous.length(), fragmented.length());
+
+  auto run = [&](bluestore_blob_t& b, const bufferlist& bl, int count) {
+    ceph::mono_clock::time_point start = ceph::mono_clock::now();
+    for (int i = 0; i < count; ++i) {
+      b.calc_csum(0, bl);
+      int bad_off;
+      uint64_t bad_csum;
+      EXPECT_EQ(0, b.verify_csum(0, bl, &bad_off, &bad_csum));
+    }
+    auto dur = std::chrono::duration_cast<ceph::timespan>(
+      ceph::mono_clock::now() - start);
+    return (double)count * (double)bl.length() / 1000000.0 /
+      (double)dur.count() * 1000000000.0;
+  };
+  int count = 64;
+  for (unsigned csum_type = Checksummer::CSUM_NONE + 1;
+       csum_type < Checksummer::CSUM_MAX;
+       ++csum_type) {
+    bluestore_blob_t b1, b2;
+    b1.init_csum(csum_type, csum_order, contiguous.length());
+    b2.init_csum(csum_type, csum_order, contiguous.length());
+    double batched = run(b1, contiguous, count);
+    double per_block = run(b2, fragmented, count);
+    ASSERT_EQ(b1.csum_data.length(), b2.csum_data.length());
+    ASSERT_EQ(0, memcmp(b1.csum_data.c_str(), b2.csum_data.c_str(),
+			b1.csum_data.length()));
+    cout << "csum_type " << Checksummer::get_csum_type_string(csum_type)
+	 << ", batched " << batched << " MB/sec"
+	 << ", per-block " << per_block << " MB/sec" << std::endl;
+  }
+}
+
 TEST(Blob, put_ref)
 {
   {
@@ -1148,6 +1198,50 @@ TEST(ExtentMap, seek_lextent)
   ASSERT_EQ(em.extent_map.end(), em.seek_lextent(500));
 }
 
+TEST(ExtentMap, unload_clean_shards)
+{
+  BlueStore store(g_ceph_context, "", 4096);
+  BlueStore::OnodeCacheShard *oc = BlueStore::OnodeCacheShard::create(
+    g_ceph_context, "lru", NULL);
+  BlueStore::BufferCacheShard *bc = BlueStore::BufferCacheShard::create(
+    g_ceph_context, "lru", NULL);
+
+  auto coll = ceph::make_ref<BlueStore::Collection>(&store, oc, bc, coll_t());
+  BlueStore::OnodeRef onode(new BlueStore::Onode(coll.get(), ghobject_t(), ""));
+  BlueStore::ExtentMap& em = onode->extent_map;
+  onode->onode.extent_map_shards.resize(3);
+  onode->onode.extent_map_shards[0].offset = 0;
+  onode->onode.extent_map_shards[1].offset = 0x1000;
+  onode->onode.extent_map_shards[2].offset = 0x2000;
+  em.init_shards(true, false);
+  em.shards[1].dirty = true;
+
+  BlueStore::BlobRef spanning(coll->new_blob());
+  spanning->id = 0;
+  em.spanning_blob_map[0] = spanning;
+  for (uint32_t off = 0; off < 0x3000; off += 0x1000) {
+    BlueStore::BlobRef b(coll->new_blob());
+    em.extent_map.insert(*new BlueStore::Extent(off, 0, 0x100, b));
+    em.extent_map.insert(*new BlueStore::Extent(off + 0x800, 0, 0x100,
+                                                spanning));
+  }
+  ASSERT_EQ(6u, em.extent_map.size());
+  ASSERT_EQ(6u, bc->num_extents);
+
+  // the dirty shard stays, the clean ones go
+  ASSERT_EQ(2u, em.unload_clean_shards());
+  ASSERT_EQ(2u, em.extent_map.size());
+  ASSERT_EQ(2u, bc->num_extents);
+  ASSERT_FALSE(em.shards[0].loaded);
+  ASSERT_TRUE(em.shards[1].loaded);
+  ASSERT_FALSE(em.shards[2].loaded);
+  ASSERT_EQ(0x1000u, em.extent_map.begin()->logical_offset);
+  ASSERT_EQ(1u, em.spanning_blob_map.size());
+
+  // nothing left to unload
+  ASSERT_EQ(0u, em.unload_clean_shards());
+}
+
 TEST(ExtentMap, has_any_lextents)
 {
   BlueStore store(g_ceph_context, "", 4096);
@@ -1812,6 +1906,97 @@ void clear_and_dispose(BlueStore::old_extent_map_t& old_em)
   }
 }
 
+TEST(ClockCacheShard, onode)
+{
+  BlueStore store(g_ceph_context, "", 4096);
+  BlueStore::OnodeCacheShard *oc = BlueStore::OnodeCacheShard::create(
+    g_ceph_context, "clock", NULL);
+  BlueStore::BufferCacheShard *bc = BlueStore::BufferCacheShard::create(
+    g_ceph_context, "clock", NULL);
+  auto coll = ceph::make_ref<BlueStore::Collection>(&store, oc, bc, coll_t());
+  oc->set_max(4);
+
+  auto make_oid = [](int i) {
+    return ghobject_t(hobject_t(sobject_t("obj" + stringify(i), CEPH_NOSNAP)));
+  };
+  auto add = [&](int i) {
+    ghobject_t oid = make_oid(i);
+    BlueStore::OnodeRef o(new BlueStore::Onode(coll.get(), oid, ""));
+    o->exists = true;
+    return coll->onode_space.add_onode(oid, o);
+  };
+  // pin and unpin, like a lookup hit does
+  auto touch = [&](int i) {
+    ghobject_t oid = make_oid(i);
+    return coll->onode_space.map_any([&](BlueStore::Onode* o) {
+      if (o->oid != oid) {
+        return false;
+      }
+      BlueStore::OnodeRef r(o);
+      return true;
+    });
+  };
+  auto cached = [&](int i) {
+    ghobject_t oid = make_oid(i);
+    return coll->onode_space.map_any([&](BlueStore::Onode* o) {
+      return o->oid == oid;
+    });
+  };
+
+  BlueStore::OnodeRef pinned = add(0);
+  for (int i = 1; i < 4; ++i) {
+    add(i);
+  }
+  ASSERT_EQ(4u, oc->_get_num());
+
+  // everything was unpinned once, so the hand takes a full turn clearing
+  // reference bits and then evicts the oldest unpinned onode
+  add(4);
+  ASSERT_EQ(4u, oc->_get_num());
+  ASSERT_TRUE(cached(0));
+  ASSERT_FALSE(cached(1));
+
+  // 3 gets a second chance, 2 does not
+  ASSERT_TRUE(touch(3));
+  add(5);
+  ASSERT_EQ(4u, oc->_get_num());
+  ASSERT_TRUE(cached(0));
+  ASSERT_FALSE(cached(2));
+  ASSERT_TRUE(cached(3));
+  ASSERT_TRUE(cached(4));
+  ASSERT_TRUE(cached(5));
+}
+
+TEST(ClockCacheShard, buffer)
+{
+  BlueStore::BufferCacheShard *bc = BlueStore::BufferCacheShard::create(
+    g_ceph_context, "clock", NULL);
+  BlueStore::BufferSpace bs;
+  std::lock_guard l(bc->lock);
+
+  for (uint32_t off = 0; off < 4 * 4096; off += 4096) {
+    bufferlist bl;
+    bl.append(string(4096, 'a'));
+    bs._add_buffer(bc, &bs,
+      BlueStore::Buffer(&bs, BlueStore::Buffer::STATE_CLEAN, 0, off, bl),
+      0, 1, nullptr);
+  }
+  ASSERT_EQ(4u, bc->_get_num());
+  ASSERT_EQ(4u * 4096, bc->_get_bytes());
+
+  bc->_touch(&bs.buffer_map.find(4096)->second);
+  bc->_trim_to(3 * 4096);
+  ASSERT_EQ(0u, bs.buffer_map.count(0));
+  bc->_trim_to(2 * 4096);
+  ASSERT_EQ(1u, bs.buffer_map.count(4096));
+  ASSERT_EQ(0u, bs.buffer_map.count(2 * 4096));
+  ASSERT_EQ(1u, bs.buffer_map.count(3 * 4096));
+  ASSERT_EQ(2u, bc->_get_num());
+
+  bs._clear(bc);
+  ASSERT_EQ(0u, bc->_get_bytes());
+}
+
 TEST(GarbageCollector, BasicTest)
 {
   BlueStore::OnodeCacheShard *oc = BlueStore::OnodeCacheShard::create(
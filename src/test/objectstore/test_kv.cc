@@ -129,6 +129,66 @@ TEST_P(KVTest, OpenWriteRead) {
   fini();
 }
 
+TEST_P(KVTest, GetMany) {
+  ASSERT_EQ(0, db->create_and_open(cout, "cf1"));
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    for (int i = 0; i < 100; i += 2) {
+      bufferlist value;
+      value.append("value" + stringify(i));
+      t->set("prefix", "key" + stringify(i), value);
+      t->set("cf1", "key" + stringify(i), value);
+    }
+    ASSERT_EQ(0, db->submit_transaction_sync(t));
+  }
+  vector<string> keys;
+  for (int i = 0; i < 100; ++i) {
+    keys.push_back("key" + stringify(i));
+  }
+  for (auto prefix : {"prefix", "cf1"}) {
+    vector<bufferlist> values;
+    vector<int> rs;
+    ASSERT_EQ(0, db->get_many(prefix, keys, &values, &rs));
+    ASSERT_EQ(keys.size(), values.size());
+    ASSERT_EQ(keys.size(), rs.size());
+    for (int i = 0; i < 100; ++i) {
+      if (i % 2) {
+	ASSERT_EQ(-ENOENT, rs[i]);
+	ASSERT_EQ(0u, values[i].length());
+      } else {
+	ASSERT_EQ(0, rs[i]);
+	ASSERT_EQ("value" + stringify(i), _bl_to_str(values[i]));
+      }
+    }
+
+    vector<bufferlist> async_values;
+    vector<int> async_rs;
+    C_SaferCond cond;
+    db->async_get(prefix, keys, &async_values, &async_rs, &cond);
+    ASSERT_EQ(0, cond.wait());
+    ASSERT_EQ(rs, async_rs);
+    for (size_t i = 0; i < keys.size(); ++i) {
+      ASSERT_TRUE(values[i].contents_equal(async_values[i]));
+    }
+  }
+  if (string(GetParam()) == "rocksdb") {
+    // no reads once closed, until the store is opened again
+    db->close();
+    vector<bufferlist> async_values;
+    vector<int> async_rs;
+    C_SaferCond closed;
+    db->async_get("prefix", keys, &async_values, &async_rs, &closed);
+    ASSERT_EQ(-ESHUTDOWN, closed.wait());
+    ASSERT_EQ(0, db->open(cout));
+    C_SaferCond reopened;
+    db->async_get("prefix", keys, &async_values, &async_rs, &reopened);
+    ASSERT_EQ(0, reopened.wait());
+    ASSERT_EQ(0, async_rs[0]);
+    ASSERT_EQ(-ENOENT, async_rs[1]);
+  }
+  fini();
+}
+
 TEST_P(KVTest, PutReopen) {
   ASSERT_EQ(0, db->create_and_open(cout));
   {
@@ -11,6 +11,7 @@
  * Foundation. See file COPYING.
  *
  */
+#include <dirent.h>
 #include <boost/intrusive_ptr.hpp>
 #include "global/global_init.h"
 #include "common/ceph_argparse.h"
@@ -18,6 +19,7 @@
 #include <gtest/gtest.h>
 #include "include/ceph_assert.h"
 #include "common/errno.h"
+#include "include/stringify.h"
 #include "store_test_fixture.h"
 
 #define dout_context g_ceph_context
@@ -182,6 +184,94 @@ TEST_F(MemStoreClone, CloneRangeHoleEnd)
   ASSERT_EQ(expected, result);
 }
 
+class MemStoreSpill : public MemStoreClone {
+public:
+  void SetUp() override {
+    g_conf().set_val_or_die("memstore_page_set", "true");
+    g_conf().set_val_or_die("memstore_memory_limit", "65536");
+    g_conf().apply_changes(nullptr);
+    MemStoreClone::SetUp();
+  }
+  void TearDown() override {
+    MemStoreClone::TearDown();
+    g_conf().rm_val("memstore_page_set");
+    g_conf().rm_val("memstore_memory_limit");
+    g_conf().apply_changes(nullptr);
+  }
+};
+
+static unsigned count_spill_files()
+{
+  unsigned n = 0;
+  if (DIR *dir = ::opendir("memstore.test_temp_dir/spill"); dir) {
+    while (struct dirent *de = ::readdir(dir)) {
+      if (de->d_name[0] != '.') {
+	++n;
+      }
+    }
+    ::closedir(dir);
+  }
+  return n;
+}
+
+TEST_F(MemStoreSpill, SpillAndReload)
+{
+  ASSERT_TRUE(store);
+
+  const unsigned num = 16;
+  const unsigned len = 4096;
+  for (unsigned i = 0; i < num; i++) {
+    bufferlist bl;
+    bl.append(string(len, 'a' + i));
+    ObjectStore::Transaction t;
+    t.write(cid, make_ghobject(("obj" + stringify(i)).c_str()), 0, len, bl);
+    ASSERT_EQ(0, store->queue_transaction(ch, std::move(t)));
+  }
+  // the early objects went to files
+  ASSERT_GT(count_spill_files(), 0u);
+
+  for (unsigned i = 0; i < num; i++) {
+    bufferlist bl;
+    ASSERT_EQ((int)len, store->read(ch, make_ghobject(("obj" + stringify(i)).c_str()),
+				    0, len, bl));
+    ASSERT_EQ(string(len, 'a' + i), bl.to_str());
+  }
+
+  // overwrite and clone data that might be spilled
+  {
+    bufferlist bl;
+    bl.append("zz");
+    ObjectStore::Transaction t;
+    t.write(cid, make_ghobject("obj0"), 1, 2, bl);
+    t.clone(cid, make_ghobject("obj0"), make_ghobject("clone0"));
+    ASSERT_EQ(0, store->queue_transaction(ch, std::move(t)));
+  }
+  string expected = string(len, 'a');
+  expected.replace(1, 2, "zz");
+  for (auto& o : { "obj0", "clone0" }) {
+    bufferlist bl;
+    ASSERT_EQ((int)len, store->read(ch, make_ghobject(o), 0, len, bl));
+    ASSERT_EQ(expected, bl.to_str());
+  }
+
+  // umount saves spilled objects straight from their files
+  ASSERT_GT(count_spill_files(), 0u);
+  CloseAndReopen();
+  ch = store->open_collection(cid);
+  ASSERT_TRUE(ch);
+  for (unsigned i = 1; i < num; i++) {
+    bufferlist bl;
+    ASSERT_EQ((int)len, store->read(ch, make_ghobject(("obj" + stringify(i)).c_str()),
+				    0, len, bl));
+    ASSERT_EQ(string(len, 'a' + i), bl.to_str());
+  }
+  for (auto& o : { "obj0", "clone0" }) {
+    bufferlist bl;
+    ASSERT_EQ((int)len, store->read(ch, make_ghobject(o), 0, len, bl));
+    ASSERT_EQ(expected, bl.to_str());
+  }
+}
+
 int main(int argc, char** argv)
 {
   // default to memstore
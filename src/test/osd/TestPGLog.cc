@@ -2912,6 +2912,44 @@ TEST_F(PGLogTrimTest, TestGetRequest) {
   EXPECT_FALSE(result);
 }
 
+TEST_F(PGLogTrimTest, TestObjectIndexAfterTrim) {
+  SetUp(20);
+  const uint64_t entries = PGLog::IndexedLog::get_num_entries();
+  const uint64_t dups = PGLog::IndexedLog::get_num_dups();
+  {
+    PGLog::IndexedLog log;
+    log.head = mk_evt(20, 0);
+    log.skip_can_rollback_to_to_head();
+    log.head = mk_evt(9, 0);
+    log.index();
+
+    const hobject_t obj1 = mk_obj(1);
+    log.add(mk_ple_mod(obj1, mk_evt(10, 100), mk_evt(8, 70)));
+    log.add(mk_ple_mod(mk_obj(2), mk_evt(15, 150), mk_evt(10, 100)));
+    log.add(mk_ple_mod(obj1, mk_evt(19, 160), mk_evt(10, 100)));
+    EXPECT_EQ(entries + 3, PGLog::IndexedLog::get_num_entries());
+
+    // the object index must have moved on to the surviving entry of obj1
+    log.trim(cct, mk_evt(15, 150), nullptr, nullptr, nullptr);
+    EXPECT_EQ(1u, log.log.size());
+    EXPECT_EQ(entries + 1, PGLog::IndexedLog::get_num_entries());
+    // only the entry at 150 is recent enough to become a dup
+    EXPECT_EQ(1u, log.dups.size());
+    EXPECT_EQ(dups + 1, PGLog::IndexedLog::get_num_dups());
+    ASSERT_EQ(1u, log.objects.size());
+    auto p = log.objects.find(obj1);
+    ASSERT_NE(log.objects.end(), p);
+    EXPECT_EQ(&log.log.back(), p->second);
+    EXPECT_EQ(&log.log.back().soid, &p->first.get());
+
+    PGLog::IndexedLog copy(log);
+    EXPECT_EQ(entries + 2, PGLog::IndexedLog::get_num_entries());
+    EXPECT_EQ(dups + 2, PGLog::IndexedLog::get_num_dups());
+  }
+  EXPECT_EQ(entries, PGLog::IndexedLog::get_num_entries());
+  EXPECT_EQ(dups, PGLog::IndexedLog::get_num_dups());
+}
+
 TEST_F(PGLogTest, _merge_object_divergent_entries) {
   {
     // Test for issue 20843
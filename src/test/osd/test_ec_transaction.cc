@@ -13,8 +13,11 @@
  */
 
 #include <gtest/gtest.h>
+#include "erasure-code/ErasureCode.h"
+#include "os/ObjectStore.h"
 #include "osd/PGTransaction.h"
 #include "osd/ECTransaction.h"
+#include "osd/ECCommon.h"
 
 #include "test/unit.cc"
 
@@ -122,3 +125,634 @@ TEST(ectransaction, many_writes)
   ASSERT_EQ(0u, plan.to_read.size());
   ASSERT_EQ(1u, plan.will_write.size());
 }
+
+// A linear k=4, m=2 code over GF(2): the coding chunks are d0^d1^d2^d3
+// and d0^d2. Good enough to compare parity deltas with re-encoding.
+class XorErasureCode final : public ceph::ErasureCode {
+public:
+  static constexpr unsigned K = 4;
+  static constexpr unsigned M = 2;
+
+  unsigned int get_chunk_count() const override {
+    return K + M;
+  }
+  unsigned int get_data_chunk_count() const override {
+    return K;
+  }
+  unsigned int get_chunk_size(unsigned int object_size) const override {
+    return (object_size + K - 1) / K;
+  }
+  int encode_chunks(const std::set<int> &want_to_encode,
+		    std::map<int, bufferlist> *encoded) override {
+    unsigned size = (*encoded)[0].length();
+    char *d[K];
+    for (unsigned i = 0; i < K; ++i) {
+      d[i] = (*encoded)[i].c_str();
+    }
+    char *all = (*encoded)[K].c_str();
+    char *even = (*encoded)[K + 1].c_str();
+    for (unsigned j = 0; j < size; ++j) {
+      all[j] = d[0][j] ^ d[1][j] ^ d[2][j] ^ d[3][j];
+      even[j] = d[0][j] ^ d[2][j];
+    }
+    return 0;
+  }
+  int decode_chunks(const std::set<int> &want_to_read,
+		    const std::map<int, bufferlist> &chunks,
+		    std::map<int, bufferlist> *decoded) override {
+    // only encoding is exercised here
+    return -EOPNOTSUPP;
+  }
+};
+
+static ECUtil::HashInfoRef make_hinfo(
+  const ECUtil::stripe_info_t &sinfo,
+  uint64_t size)
+{
+  ECUtil::HashInfoRef ref(
+    new ECUtil::HashInfo(XorErasureCode::K + XorErasureCode::M));
+  ref->set_total_chunk_size_clear_hash(
+    sinfo.aligned_logical_offset_to_chunk_offset(size));
+  ref->set_projected_total_logical_size(sinfo, size);
+  return ref;
+}
+
+static ECTransaction::WritePlan plan_with_parity_delta(
+  const ECUtil::stripe_info_t &sinfo,
+  const ceph::ErasureCodeInterfaceRef &ec,
+  PGTransaction &t,
+  uint64_t size)
+{
+  auto plan = ECTransaction::get_write_plan(
+    sinfo,
+    t,
+    [&](const hobject_t &i) {
+      return make_hinfo(sinfo, size);
+    },
+    &dpp);
+  ECTransaction::plan_parity_delta(sinfo, ec, t, plan, &dpp);
+  return plan;
+}
+
+TEST(ectransaction, parity_delta_plan)
+{
+  ceph::ErasureCodeInterfaceRef ec(new XorErasureCode);
+  const uint64_t chunk_size = 4096;
+  ECUtil::stripe_info_t sinfo(XorErasureCode::K,
+			      XorErasureCode::K * chunk_size);
+  const uint64_t stripe_width = sinfo.get_stripe_width();
+  const uint64_t size = 4 * stripe_width;
+  hobject_t h(object_t("foo"), "", CEPH_NOSNAP, 0, 1, "");
+  bufferlist small, large;
+  small.append(std::string(100, 'a'));
+  large.append(std::string(chunk_size + 100, 'b'));
+
+  {
+    // within a single chunk of the second stripe
+    PGTransaction t;
+    t.write(h, stripe_width + chunk_size + 50, small.length(), small);
+    auto plan = plan_with_parity_delta(sinfo, ec, t, size);
+    ASSERT_EQ(1u, plan.parity_delta.count(h));
+    auto &pd = plan.parity_delta.at(h);
+    ASSERT_EQ(stripe_width, pd.stripe_off);
+    ASSERT_EQ(std::set<int>{1}, pd.data_chunks);
+    extent_set expected;
+    expected.insert(stripe_width + chunk_size, chunk_size);
+    ASSERT_EQ(expected, pd.get_will_write(sinfo));
+  }
+  {
+    // touched + m == k reads no more than the whole stripe
+    PGTransaction t;
+    t.write(h, chunk_size - 50, small.length(), small);
+    auto plan = plan_with_parity_delta(sinfo, ec, t, size);
+    ASSERT_EQ(1u, plan.parity_delta.count(h));
+    ASSERT_EQ((std::set<int>{0, 1}), plan.parity_delta.at(h).data_chunks);
+  }
+  {
+    // touched + m > k
+    PGTransaction t;
+    t.write(h, chunk_size - 50, large.length(), large);
+    auto plan = plan_with_parity_delta(sinfo, ec, t, size);
+    ASSERT_EQ(1u, plan.to_read.size());
+    ASSERT_TRUE(plan.parity_delta.empty());
+  }
+  {
+    // two separate chunks of one stripe are fine
+    PGTransaction t;
+    t.write(h, 50, small.length(), small);
+    t.write(h, 3 * chunk_size + 50, small.length(), small);
+    auto plan = plan_with_parity_delta(sinfo, ec, t, size);
+    ASSERT_EQ(1u, plan.parity_delta.count(h));
+    ASSERT_EQ((std::set<int>{0, 3}), plan.parity_delta.at(h).data_chunks);
+  }
+  {
+    // spans two stripes
+    PGTransaction t;
+    t.write(h, stripe_width - 50, small.length(), small);
+    auto plan = plan_with_parity_delta(sinfo, ec, t, size);
+    ASSERT_EQ(2 * stripe_width, plan.to_read.at(h).size());
+    ASSERT_TRUE(plan.parity_delta.empty());
+  }
+  {
+    // partial stripe writes to two stripes
+    PGTransaction t;
+    t.write(h, 50, small.length(), small);
+    t.write(h, 2 * stripe_width + 50, small.length(), small);
+    auto plan = plan_with_parity_delta(sinfo, ec, t, size);
+    ASSERT_TRUE(plan.parity_delta.empty());
+  }
+  {
+    // full stripe overwrite doesn't read at all
+    bufferlist stripe;
+    stripe.append(std::string(stripe_width, 'd'));
+    PGTransaction t;
+    t.write(h, stripe_width, stripe.length(), stripe);
+    auto plan = plan_with_parity_delta(sinfo, ec, t, size);
+    ASSERT_TRUE(plan.to_read.empty());
+    ASSERT_TRUE(plan.parity_delta.empty());
+  }
+  {
+    // extends the object
+    PGTransaction t;
+    t.write(h, size - 50, small.length(), small);
+    auto plan = plan_with_parity_delta(sinfo, ec, t, size);
+    ASSERT_TRUE(plan.parity_delta.empty());
+  }
+  {
+    PGTransaction t;
+    t.truncate(h, size - stripe_width - 50);
+    t.write(h, 50, small.length(), small);
+    auto plan = plan_with_parity_delta(sinfo, ec, t, size);
+    ASSERT_TRUE(plan.parity_delta.empty());
+  }
+  {
+    PGTransaction t;
+    t.create(h);
+    t.write(h, 50, small.length(), small);
+    auto plan = plan_with_parity_delta(sinfo, ec, t, size);
+    ASSERT_TRUE(plan.parity_delta.empty());
+  }
+  {
+    hobject_t temp = h.make_temp_hobject("temp");
+    PGTransaction t;
+    t.write(temp, 50, small.length(), small);
+    auto plan = plan_with_parity_delta(sinfo, ec, t, size);
+    ASSERT_EQ(1u, plan.to_read.size());
+    ASSERT_TRUE(plan.parity_delta.empty());
+  }
+  {
+    auto mapped = std::make_shared<XorErasureCode>();
+    mapped->chunk_mapping = {4, 5, 0, 1, 2, 3};
+    ceph::ErasureCodeInterfaceRef ec_mapped(mapped);
+    PGTransaction t;
+    t.write(h, 50, small.length(), small);
+    auto plan = plan_with_parity_delta(sinfo, ec_mapped, t, size);
+    ASSERT_EQ(1u, plan.to_read.size());
+    ASSERT_TRUE(plan.parity_delta.empty());
+  }
+}
+
+struct ShardWrites {
+  std::map<shard_id_t, bufferlist> data;  ///< shard contents
+  std::set<shard_id_t> written;           ///< shards with data writes
+  std::map<shard_id_t, extent_set> stashed; ///< clone_range for rollback
+};
+
+// Apply the data writes and rollback clones of the per-shard
+// transactions to in-memory shard contents.
+static void apply_shard_transactions(
+  std::map<shard_id_t, ObjectStore::Transaction> &transactions,
+  ShardWrites *shards)
+{
+  for (auto &&[shard, t] : transactions) {
+    auto i = t.begin();
+    while (i.have_op()) {
+      auto op = i.decode_op();
+      switch (op->op) {
+      case ObjectStore::Transaction::OP_WRITE:
+	{
+	  ghobject_t oid = i.get_oid(op->oid);
+	  bufferlist bl;
+	  i.decode_bl(bl);
+	  ASSERT_EQ(ghobject_t::NO_GEN, oid.generation);
+	  bufferlist &data = shards->data[shard];
+	  ASSERT_LE(op->off + op->len, data.length());
+	  bufferlist out;
+	  data.begin().copy(op->off, out);
+	  out.append(bl);
+	  bufferlist tail;
+	  data.begin(op->off + op->len).copy(
+	    data.length() - op->off - op->len, tail);
+	  out.append(tail);
+	  data.swap(out);
+	  shards->written.insert(shard);
+	}
+	break;
+      case ObjectStore::Transaction::OP_CLONERANGE2:
+	ASSERT_EQ(op->off, op->dest_off);
+	shards->stashed[shard].union_insert(op->off, op->len);
+	break;
+      case ObjectStore::Transaction::OP_SETATTR:
+	{
+	  i.decode_string();
+	  bufferlist bl;
+	  i.decode_bl(bl);
+	}
+	break;
+      case ObjectStore::Transaction::OP_SETATTRS:
+	{
+	  std::map<std::string, bufferptr> aset;
+	  i.decode_attrset(aset);
+	}
+	break;
+      case ObjectStore::Transaction::OP_TOUCH:
+	break;
+      default:
+	FAIL() << "unexpected op " << op->op;
+      }
+    }
+  }
+}
+
+// Run one overwrite of an existing object through generate_transactions,
+// reading what the rmw pipeline would read for the chosen path from
+// 'shards' and applying the result to it.
+static void overwrite_object(
+  ceph::ErasureCodeInterfaceRef &ec,
+  const ECUtil::stripe_info_t &sinfo,
+  const hobject_t &h,
+  uint64_t size,
+  uint64_t off,
+  bufferlist data,
+  bool parity_delta,
+  ShardWrites *shards,
+  extent_map *written)
+{
+  const uint64_t chunk_size = sinfo.get_chunk_size();
+  PGTransaction t;
+  ObjectContextRef obc = std::make_shared<ObjectContext>();
+  obc->obs.oi.soid = h;
+  obc->obs.exists = true;
+  t.add_obc(obc);
+  t.write(h, off, data.length(), data);
+
+  auto plan = ECTransaction::get_write_plan(
+    sinfo,
+    t,
+    [&](const hobject_t &i) {
+      return make_hinfo(sinfo, size);
+    },
+    &dpp);
+  ASSERT_EQ(1u, plan.to_read.size());
+  std::map<hobject_t, extent_map> partial_extents;
+  if (parity_delta) {
+    ECTransaction::plan_parity_delta(sinfo, ec, t, plan, &dpp);
+    ASSERT_EQ(1u, plan.parity_delta.count(h));
+    auto &pd = plan.parity_delta.at(h);
+    uint64_t chunk_off = sinfo.aligned_logical_offset_to_chunk_offset(
+      pd.stripe_off);
+    std::set<int> want = pd.data_chunks;
+    for (unsigned i = XorErasureCode::K; i < ec->get_chunk_count(); ++i) {
+      want.insert(i);
+    }
+    for (int i : want) {
+      shards->data[shard_id_t(i)].begin(chunk_off).copy(
+	chunk_size, pd.old_chunks[i]);
+    }
+    plan.will_write[h] = pd.get_will_write(sinfo);
+  } else {
+    for (auto &&[start, len] : plan.to_read.at(h)) {
+      bufferlist stripes;
+      for (uint64_t s = start; s < start + len; s += sinfo.get_stripe_width()) {
+	uint64_t chunk_off = sinfo.aligned_logical_offset_to_chunk_offset(s);
+	for (unsigned i = 0; i < XorErasureCode::K; ++i) {
+	  shards->data[shard_id_t(i)].begin(chunk_off).copy(
+	    chunk_size, stripes);
+	}
+      }
+      partial_extents[h].insert(start, len, stripes);
+    }
+  }
+
+  std::vector<pg_log_entry_t> entries(1);
+  entries[0].op = pg_log_entry_t::MODIFY;
+  entries[0].soid = h;
+  entries[0].version = eversion_t(1, 2);
+  std::map<hobject_t, extent_map> written_map;
+  std::map<shard_id_t, ObjectStore::Transaction> transactions;
+  for (unsigned i = 0; i < ec->get_chunk_count(); ++i) {
+    transactions[shard_id_t(i)];
+  }
+  std::set<hobject_t> temp_added, temp_removed;
+  ECTransaction::generate_transactions(
+    &t,
+    plan,
+    ec,
+    pg_t(0, 1),
+    sinfo,
+    partial_extents,
+    entries,
+    &written_map,
+    &transactions,
+    &temp_added,
+    &temp_removed,
+    &dpp,
+    ceph_release_t::quincy);
+  // try_reads_to_commit() asserts this
+  ASSERT_EQ(plan.will_write.at(h), written_map[h].get_interval_set());
+  *written = written_map[h];
+  apply_shard_transactions(transactions, shards);
+}
+
+TEST(ectransaction, parity_delta_matches_full_stripe)
+{
+  ceph::ErasureCodeInterfaceRef ec(new XorErasureCode);
+  const uint64_t chunk_size = 4096;
+  ECUtil::stripe_info_t sinfo(XorErasureCode::K,
+			      XorErasureCode::K * chunk_size);
+  const uint64_t stripe_width = sinfo.get_stripe_width();
+  const uint64_t size = 3 * stripe_width;
+  hobject_t h(object_t("foo"), "", CEPH_NOSNAP, 0, 1, "");
+
+  bufferlist orig;
+  for (uint64_t i = 0; i < size; ++i) {
+    orig.append((char)(i * 7 + i / 13));
+  }
+  std::set<int> all;
+  for (unsigned i = 0; i < ec->get_chunk_count(); ++i) {
+    all.insert(i);
+  }
+  std::map<int, bufferlist> encoded;
+  ASSERT_EQ(0, ECUtil::encode(sinfo, ec, orig, all, &encoded));
+  ShardWrites initial;
+  for (auto &&[i, bl] : encoded) {
+    initial.data[shard_id_t(i)] = bl;
+  }
+
+  // (offset, length) of overwrites within the middle stripe
+  const std::vector<std::pair<uint64_t, uint64_t>> cases = {
+    {stripe_width + 50, 100},                  // head of chunk 0
+    {stripe_width + chunk_size - 50, 100},     // crosses chunks 0 and 1
+    {stripe_width + 3 * chunk_size, chunk_size}, // all of chunk 3
+    {2 * stripe_width - 10, 10},               // end of the stripe
+  };
+  for (auto &&[off, len] : cases) {
+    SCOPED_TRACE(off);
+    bufferlist data;
+    data.append(std::string(len, 'z'));
+
+    ShardWrites full = initial, delta = initial;
+    extent_map full_written, delta_written;
+    overwrite_object(ec, sinfo, h, size, off, data, false,
+		     &full, &full_written);
+    overwrite_object(ec, sinfo, h, size, off, data, true,
+		     &delta, &delta_written);
+
+    // identical shard contents
+    for (auto &&[shard, bl] : full.data) {
+      ASSERT_TRUE(bl.contents_equal(delta.data[shard])) << shard;
+    }
+    // the delta only writes the touched data shards and the coding shards
+    std::set<shard_id_t> expected_written;
+    for (uint64_t i = (off - stripe_width) / chunk_size;
+	 i <= (off + len - 1 - stripe_width) / chunk_size;
+	 ++i) {
+      expected_written.insert(shard_id_t(i));
+    }
+    for (unsigned i = XorErasureCode::K; i < ec->get_chunk_count(); ++i) {
+      expected_written.insert(shard_id_t(i));
+    }
+    ASSERT_EQ(ec->get_chunk_count(), full.written.size());
+    ASSERT_EQ(expected_written, delta.written);
+    // all shards stash the same range for rollback
+    ASSERT_EQ(full.stashed, delta.stashed);
+    ASSERT_EQ(ec->get_chunk_count(), delta.stashed.size());
+    // and what was written agrees with the full stripe
+    ASSERT_EQ(1u, full_written.ext_count());
+    auto stripe = full_written.begin();
+    for (auto &&extent : delta_written) {
+      bufferlist expected;
+      stripe.get_val().begin(extent.get_off() - stripe.get_off()).copy(
+	extent.get_len(), expected);
+      ASSERT_TRUE(expected.contents_equal(extent.get_val()));
+    }
+  }
+}
+
+// Just enough of a PG for RMWPipeline to queue writes and issue reads.
+struct StubECListener : public ECListener {
+  pg_pool_t pool;
+  OSDMapRef osdmap;
+  pg_info_t info;
+  std::set<pg_shard_t> shards;
+  std::map<hobject_t, std::set<pg_shard_t>> missing_loc;
+  std::map<pg_shard_t, pg_missing_t> shard_missing;
+  std::map<pg_shard_t, pg_info_t> shard_info;
+
+  StubECListener() {
+    pool.type = pg_pool_t::TYPE_ERASURE;
+    pool.set_flag(pg_pool_t::FLAG_EC_OVERWRITES);
+  }
+
+  const OSDMapRef& pgb_get_osdmap() const override { return osdmap; }
+  epoch_t pgb_get_osdmap_epoch() const override { return 1; }
+  const pg_info_t &get_info() const override { return info; }
+  void cancel_pull(const hobject_t &soid) override { ceph_abort(); }
+  pg_shard_t primary_shard() const override { return pg_shard_t(); }
+  bool pgb_is_primary() const override { return true; }
+  void on_failed_pull(const std::set<pg_shard_t> &from,
+		      const hobject_t &soid,
+		      const eversion_t &v) override { ceph_abort(); }
+  void on_local_recover(const hobject_t &oid,
+			const ObjectRecoveryInfo &recovery_info,
+			ObjectContextRef obc,
+			bool is_delete,
+			ceph::os::Transaction *t) override { ceph_abort(); }
+  void on_global_recover(const hobject_t &oid,
+			 const object_stat_sum_t &stat_diff,
+			 bool is_delete) override { ceph_abort(); }
+  void on_peer_recover(pg_shard_t peer,
+		       const hobject_t &oid,
+		       const ObjectRecoveryInfo &recovery_info) override {
+    ceph_abort();
+  }
+  void begin_peer_recover(pg_shard_t peer,
+			  const hobject_t oid) override { ceph_abort(); }
+  bool pg_is_repair() const override { return false; }
+  ObjectContextRef get_obc(
+    const hobject_t &hoid,
+    const std::map<std::string, ceph::buffer::list, std::less<>> &attrs)
+    override { ceph_abort(); }
+  bool check_failsafe_full() override { return false; }
+  hobject_t get_temp_recovery_object(const hobject_t& target,
+				     eversion_t version) override {
+    ceph_abort();
+  }
+  bool pg_is_remote_backfilling() override { return false; }
+  void pg_add_local_num_bytes(int64_t num_bytes) override {}
+  void pg_add_num_bytes(int64_t num_bytes) override {}
+  void inc_osd_stat_repaired() override {}
+  void add_temp_obj(const hobject_t &oid) override {}
+  void clear_temp_obj(const hobject_t &oid) override {}
+  epoch_t get_last_peering_reset_epoch() const override { return 1; }
+  GenContext<ThreadPool::TPHandle&> *bless_unlocked_gencontext(
+    GenContext<ThreadPool::TPHandle&> *c) override { ceph_abort(); }
+  void schedule_recovery_work(GenContext<ThreadPool::TPHandle&> *c,
+			      uint64_t cost) override { ceph_abort(); }
+  epoch_t get_interval_start_epoch() const override { return 1; }
+  const std::set<pg_shard_t> &get_acting_shards() const override {
+    return shards;
+  }
+  const std::set<pg_shard_t> &get_backfill_shards() const override {
+    return shards;
+  }
+  const std::map<hobject_t, std::set<pg_shard_t>> &get_missing_loc_shards()
+    const override { return missing_loc; }
+  const std::map<pg_shard_t, pg_missing_t> &get_shard_missing()
+    const override { return shard_missing; }
+  const pg_missing_const_i &get_shard_missing(pg_shard_t peer)
+    const override { ceph_abort(); }
+  const pg_missing_const_i *maybe_get_shard_missing(pg_shard_t peer)
+    const override { return nullptr; }
+  const pg_info_t &get_shard_info(pg_shard_t peer) const override {
+    return info;
+  }
+  ceph_tid_t get_tid() override { ceph_abort(); }
+  pg_shard_t whoami_shard() const override { return pg_shard_t(); }
+  void send_message_osd_cluster(
+    std::vector<std::pair<int, Message*>>& messages,
+    epoch_t from_epoch) override { ceph_abort(); }
+  std::ostream& gen_dbg_prefix(std::ostream& out) const override {
+    return out << "stub ";
+  }
+  const pg_pool_t &get_pool() const override { return pool; }
+  const std::set<pg_shard_t> &get_acting_recovery_backfill_shards()
+    const override { return shards; }
+  bool should_send_op(pg_shard_t peer, const hobject_t &hoid) override {
+    return true;
+  }
+  const std::map<pg_shard_t, pg_info_t> &get_shard_info() const override {
+    return shard_info;
+  }
+  spg_t primary_spg_t() const override { return spg_t(); }
+  const PGLog &get_log() const override { ceph_abort(); }
+  DoutPrefixProvider *get_dpp() override { return &dpp; }
+  void apply_stats(const hobject_t &soid,
+		   const object_stat_sum_t &delta_stats) override {}
+  bool is_missing_object(const hobject_t& oid) const override {
+    return false;
+  }
+  void add_local_next_event(const pg_log_entry_t& e) override {}
+  void log_operation(
+    std::vector<pg_log_entry_t>&& logv,
+    const std::optional<pg_hit_set_history_t> &hset_history,
+    const eversion_t &trim_to,
+    const eversion_t &roll_forward_to,
+    const eversion_t &min_last_complete_ondisk,
+    bool transaction_applied,
+    ceph::os::Transaction &t,
+    bool async) override { ceph_abort(); }
+  void op_applied(const eversion_t &applied_version) override {}
+};
+
+// Holds on to the reads RMWPipeline issues so a test can complete them.
+struct StubECBackend : public ECCommon {
+  GenContextURef<std::pair<int, std::map<int, bufferlist>> &&> shard_read;
+  std::map<hobject_t, std::list<boost::tuple<uint64_t, uint64_t, uint32_t>>>
+    stripe_read;
+
+  void handle_sub_write(pg_shard_t from,
+			OpRequestRef msg,
+			ECSubWrite &op,
+			const ZTracer::Trace &trace,
+			ECListener& eclistener) override { ceph_abort(); }
+  void objects_read_and_reconstruct(
+    const std::map<hobject_t,
+		   std::list<boost::tuple<uint64_t, uint64_t, uint32_t>>> &reads,
+    bool fast_read,
+    GenContextURef<std::map<hobject_t, std::pair<int, extent_map>> &&>
+      &&func) override {
+    // never completed, the op stays in waiting_reads
+    stripe_read = reads;
+  }
+  bool objects_read_shards(
+    const hobject_t &hoid,
+    const std::set<int> &want,
+    uint64_t off,
+    uint64_t len,
+    GenContextURef<std::pair<int, std::map<int, bufferlist>> &&> &&func)
+    override {
+    shard_read = std::move(func);
+    return true;
+  }
+};
+
+struct StubRMWOp : public ECCommon::RMWPipeline::Op {
+  void generate_transactions(
+    ceph::ErasureCodeInterfaceRef &ecimpl,
+    pg_t pgid,
+    const ECUtil::stripe_info_t &sinfo,
+    std::map<hobject_t,extent_map> *written,
+    std::map<shard_id_t, ceph::os::Transaction> *transactions,
+    DoutPrefixProvider *dpp,
+    const ceph_release_t require_osd_release) override { ceph_abort(); }
+};
+
+TEST(ectransaction, parity_delta_read_failure_blocks_later_rmw)
+{
+  ceph::ErasureCodeInterfaceRef ec(new XorErasureCode);
+  const uint64_t chunk_size = 4096;
+  ECUtil::stripe_info_t sinfo(XorErasureCode::K,
+			      XorErasureCode::K * chunk_size);
+  const uint64_t stripe_width = sinfo.get_stripe_width();
+  const uint64_t size = 4 * stripe_width;
+  hobject_t h(object_t("foo"), "", CEPH_NOSNAP, 0, 1, "");
+  bufferlist small;
+  small.append(std::string(100, 'a'));
+
+  StubECListener parent;
+  StubECBackend backend;
+  ECCommon::RMWPipeline pipeline(g_ceph_context, ec, sinfo, &parent, backend);
+
+  auto make_op = [&](ceph_tid_t tid, uint64_t off) {
+    auto op = std::make_unique<StubRMWOp>();
+    op->hoid = h;
+    op->tid = tid;
+    PGTransaction t;
+    t.write(h, off, small.length(), small);
+    op->plan = plan_with_parity_delta(sinfo, ec, t, size);
+    return op;
+  };
+  auto op1 = make_op(1, stripe_width + chunk_size + 50);
+  auto op2 = make_op(2, stripe_width + 2 * chunk_size + 50);
+  ASSERT_EQ(1u, op1->plan.parity_delta.size());
+  ASSERT_EQ(1u, op2->plan.parity_delta.size());
+  auto *first = op1.get();
+  auto *second = op2.get();
+
+  pipeline.start_rmw(std::move(op1));
+  ASSERT_EQ(1u, pipeline.waiting_reads.size());
+  ASSERT_EQ(first, &pipeline.waiting_reads.front());
+  ASSERT_TRUE(first->parity_delta_read);
+  ASSERT_TRUE(backend.shard_read);
+
+  // held back by the parity delta of the first write
+  pipeline.start_rmw(std::move(op2));
+  ASSERT_EQ(1u, pipeline.waiting_state.size());
+  ASSERT_EQ(second, &pipeline.waiting_state.front());
+
+  // the first write falls back to reading the whole stripe without the
+  // cache, so the second one must not start its own read before the
+  // first write is committed
+  backend.shard_read.release()->complete(
+    std::make_pair(-EIO, std::map<int, bufferlist>{}));
+  ASSERT_TRUE(first->plan.parity_delta.empty());
+  ASSERT_EQ(1u, backend.stripe_read.count(h));
+  ASSERT_TRUE(pipeline.pipeline_state.cache_invalid());
+  ASSERT_EQ(1u, pipeline.waiting_reads.size());
+  ASSERT_EQ(first, &pipeline.waiting_reads.front());
+  ASSERT_EQ(1u, pipeline.waiting_state.size());
+  ASSERT_EQ(second, &pipeline.waiting_state.front());
+
+  pipeline.on_change();
+}